@@ -125,12 +125,15 @@ AST_NODES
 #undef NODE
 
 typedef struct Package Package;
+typedef struct PolyInstanceCache PolyInstanceCache;
 
 typedef struct Scope {
     u64 id;
     struct Scope *parent;
     OnyxFilePos created_at;
     char* name;
+
+    // Keyed by atom (see lex.h), so use the hm* functions, not sh*.
     Table(AstNode *) symbols;
 } Scope;
 
@@ -1036,7 +1039,7 @@ struct AstPolyStructType {
 
     Scope *scope;
     bh_arr(AstPolyStructParam) poly_params;
-    Table(AstStructType *) concrete_structs;
+    PolyInstanceCache *concrete_structs;
 
     AstStructType* base_struct;
 };
@@ -1090,7 +1093,7 @@ struct AstPolyUnionType {
 
     Scope *scope;
     bh_arr(AstPolyStructParam) poly_params;
-    Table(AstUnionType *) concrete_unions;
+    PolyInstanceCache *concrete_unions;
 
     AstUnionType* base_union;
 };
@@ -1186,15 +1189,32 @@ struct OverloadOption {
     AstTyped* option;
 };
 
+// Remembers the complete set of options reachable from a list of overloads,
+// and which option matched each list of argument types. Adding an option to
+// any overload list throws away every cache built before, because the list
+// might itself be an option of other lists.
+typedef struct OverloadCache OverloadCache;
+struct OverloadCache {
+    // Every reachable option, in the order they are tried.
+    bh_arr(AstTyped *) options;
+
+    // Whether an option before this index matches only depends on the types
+    // of the arguments. Only matches of those options are remembered, and
+    // misses only when this covers every option.
+    i32 type_only_count;
+
+    // Argument types (see overload_cache_key) -> the matched option, or NULL
+    // if none of the options matched.
+    Table(AstTyped *) matches;
+
+    u32 generation;
+};
+
 struct AstOverloadedFunction {
     AstTyped_base;
 
     bh_arr(OverloadOption) overloads;
-
-    // CLEANUP: This is unused right now, but should be used to cache
-    // the complete set of overloads that can be used by an overloaded
-    // function.
-    bh_imap            all_overloads;
+    OverloadCache cache;
 
     AstType *expected_return_node;
     Type    *expected_return_type;
@@ -1371,6 +1391,35 @@ struct AstSolidifiedFunction {
     struct Entity *func_header_entity;
 };
 
+// Instances of a polymorphic procedure, structure or union, found by the solutions
+// to their polymorphic variables. A key is a list of words built from the names of
+// the variables, the types they were solved to and the values they were given (see
+// build_poly_instance_key). Keys that hash the same are chained together.
+typedef struct PolyInstance PolyInstance;
+struct PolyInstance {
+    PolyInstance *next;
+
+    u64 *key;
+    u32  key_length;
+
+    union {
+        AstSolidifiedFunction func;
+        AstStructType        *struct_type;
+        AstUnionType         *union_type;
+    };
+};
+
+// Lookups and stores take the lock, and copy the instance in or out under it,
+// so the cache can be shared between threads.
+struct PolyInstanceCache {
+    // Hash of the key -> PolyInstance*
+    bh_imap instances;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    pthread_mutex_t lock;
+#endif
+};
+
 struct AstFunction {
     AstTyped_base;
 
@@ -1416,7 +1465,7 @@ struct AstFunction {
 
     bh_arr(AstPolySolution) known_slns;
 
-    Table(AstSolidifiedFunction) concrete_funcs;
+    PolyInstanceCache *concrete_funcs;
     bh_imap active_queries;
 
     bh_arr(AstNode *) nodes_that_need_entities_after_clone;
@@ -1726,6 +1775,9 @@ void entity_heap_add_job(EntityHeap *entities, enum TypeMatch (*func)(void *), v
 // If target_arr is null, the entities will be placed directly in the heap.
 void add_entities_for_node(bh_arr(Entity *)* target_arr, AstNode* node, Scope* scope, Package* package);
 
+// Starts reading and lexing the file named by a #load in the background, if it can.
+void prefetch_source_file(AstInclude *include);
+
 void symres_entity(Entity* ent);
 void check_entity(Entity* ent);
 void emit_entity(Entity* ent);
@@ -1807,6 +1859,9 @@ typedef struct CheckerData {
 
 typedef struct ContextCaches {
     bh_imap implicit_cast_to_bool_cache;
+
+    // Bumped whenever an overload option is added, to invalidate every OverloadCache.
+    u32 overload_generation;
 } ContextCaches;
 
 typedef struct DefinedVariable {
@@ -1829,6 +1884,7 @@ struct CompileOptions {
 
     b32 use_post_mvp_features : 1;
     b32 use_multi_threading   : 1;
+    b32 use_tail_calls        : 1;
     b32 generate_foreign_info : 1;
     b32 generate_type_info    : 1;
     b32 no_core               : 1;
@@ -1850,9 +1906,15 @@ struct CompileOptions {
     bh_arr(DefinedVariable) defined_variables;
 
     b32 debug_session;
+    char *profile_path;
+    char *counts_path;
     b32 debug_info_enabled;
     b32 stack_trace_enabled;
 
+    // How many threads read and lex source files ahead of the parser.
+    // -1 picks based on the number of cores.
+    i32 lex_threads;
+
     i32    passthrough_argument_count;
     char** passthrough_argument_data;
 };
@@ -1986,6 +2048,8 @@ extern IntrinsicTable intrinsic_table;
 
 extern bh_arr(OverloadOption) operator_overloads[Binary_Op_Count];
 extern bh_arr(OverloadOption) unary_operator_overloads[Unary_Op_Count];
+extern OverloadCache operator_overload_caches[Binary_Op_Count];
+extern OverloadCache unary_operator_overload_caches[Unary_Op_Count];
 
 void prepare_builtins();
 void initialize_builtins(bh_allocator a);
@@ -2083,9 +2147,10 @@ typedef struct OverloadReturnTypeCheck {
 } OverloadReturnTypeCheck;
 
 void add_overload_option(bh_arr(OverloadOption)* poverloads, u64 order, AstTyped* overload);
-AstTyped* find_matching_overload_by_arguments(bh_arr(OverloadOption) overloads, Arguments* args);
-AstTyped* find_matching_overload_by_type(bh_arr(OverloadOption) overloads, Type* type);
-void report_unable_to_match_overload(AstCall* call, bh_arr(OverloadOption) overloads);
+bh_arr(AstTyped *) overload_cache_options(OverloadCache* cache, bh_arr(OverloadOption) overloads);
+AstTyped* find_matching_overload_by_arguments(bh_arr(OverloadOption) overloads, OverloadCache* cache, Arguments* args);
+AstTyped* find_matching_overload_by_type(bh_arr(OverloadOption) overloads, OverloadCache* cache, Type* type);
+void report_unable_to_match_overload(AstCall* call, bh_arr(OverloadOption) overloads, OverloadCache* cache);
 void report_incorrect_overload_expected_type(Type *given, Type *expected, OnyxToken *overload, OnyxToken *group);
 void ensure_overload_returns_correct_type(AstTyped *overload, AstOverloadedFunction *group);
 
@@ -43,5 +43,7 @@ void onyx_report_warning(OnyxFilePos pos, char* format, ...);
 void onyx_errors_print();
 b32  onyx_has_errors();
 void onyx_clear_errors();
+void onyx_errors_hold_back(b32 hold_back);
+b32  onyx_errors_held_back_any();
 
 #endif
@@ -99,6 +99,10 @@ typedef struct OnyxToken {
     i32 length;
     char* text;
     OnyxFilePos pos;
+
+    // For symbols, the atom for the text. NULL until the symbol is interned;
+    // use token_atom to get it. Tokens made by hand must come from token_create.
+    char* atom;
 } OnyxToken;
 
 typedef struct OnyxTokenizer {
@@ -110,8 +114,18 @@ typedef struct OnyxTokenizer {
     u64 line_number;
 
     bh_arr(OnyxToken) tokens;
+
+    // Set when lexing away from the main thread. Errors are not reported, only
+    // remembered in found_error, and symbols are not interned; they get their
+    // atoms from token_atom when they are first looked up.
+    b32 background : 1;
+    b32 found_error : 1;
 } OnyxTokenizer;
 
+// Tokens that are not read from a file have to be made here, so that every
+// field not given, including the atom, starts out zeroed.
+OnyxToken* token_create(bh_allocator allocator, TokenType type, char* text, i32 length, OnyxFilePos pos);
+
 const char *token_type_name(TokenType tkn_type);
 const char* token_name(OnyxToken *tkn);
 void token_toggle_end(OnyxToken* tkn);
@@ -124,4 +138,18 @@ b32 token_equals(OnyxToken* tkn1, OnyxToken* tkn2);
 b32 token_text_equals(OnyxToken* tkn, char* text);
 b32 token_same_file(OnyxToken *tkn1, OnyxToken *tkn2);
 
+//
+// Atoms
+//
+// An atom is the single, NUL-terminated copy of an identifier that every
+// occurrence of it shares, so two identifiers are equal exactly when their
+// atoms are the same pointer. Scopes and struct members are keyed by atom,
+// which makes a lookup hash a pointer instead of a string. Interning only
+// reads the text it is given, so a token's source is never written. Atoms are
+// never freed, and the table is only used from the main thread.
+char* atom_intern(char* text, i32 length);
+char* atom_intern_cstr(char* text);
+char* atom_find(char* text);
+char* token_atom(OnyxToken* tkn);
+
 #endif
@@ -12,6 +12,36 @@ typedef struct PolymorphicContext {
     bh_arr(AstPolyParam)* poly_params;
 } PolymorphicContext;
 
+typedef struct ParserSubmission {
+    bh_arr(Entity *) *target;
+    AstNode *node;
+    Scope *scope;
+} ParserSubmission;
+
+//
+// A file that is parsed on a prefetch thread cannot touch anything shared,
+// and its package is not known until the main thread gets to it. Everything
+// the parser would have done to the shared state is kept here instead, and
+// onyx_parse_replay does it on the main thread, in the same order.
+typedef struct ParserRecord {
+    // Stand in for the package of the file and its scopes.
+    Package package;
+    Scope package_scope;
+    Scope package_private_scope;
+
+    // The first token of the file that is not a comment.
+    OnyxToken *start;
+
+    // Scopes are numbered when they are replayed.
+    bh_arr(Scope *) scopes;
+    bh_arr(ParserSubmission) submissions;
+
+    // Nodes whose type is set from state that can change before the replay.
+    bh_arr(AstNode *) typed_late;
+
+    b32 allow_stale_code : 1;
+} ParserRecord;
+
 typedef struct OnyxParser {
     bh_allocator allocator;
 
@@ -60,6 +90,9 @@ typedef struct OnyxParser {
 
     // Currently, package expressions are only allowed in certain places.
     b32 allow_package_expressions : 1;
+
+    // Non-NULL when parsing away from the main thread.
+    ParserRecord *record;
 } OnyxParser;
 
 const char* onyx_ast_node_kind_string(AstKind kind);
@@ -67,5 +100,6 @@ void* onyx_ast_node_new(bh_allocator alloc, i32 size, AstKind kind);
 OnyxParser onyx_parser_create(bh_allocator alloc, OnyxTokenizer *tokenizer);
 void onyx_parser_free(OnyxParser* parser);
 void onyx_parse(OnyxParser *parser);
+void onyx_parse_replay(OnyxParser *parser);
 
 #endif // #ifndef ONYXPARSER_H
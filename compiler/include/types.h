@@ -76,6 +76,8 @@ typedef struct StructMember {
     // store a hash table of struct members. There realistically will not
     // be many struct members, and iterating through an array would be
     // easier and less costly.                  - brendanfh 2020/09/17
+    //
+    // The name is an atom (see lex.h), and Struct.members is keyed by it.
     char *name;
     struct OnyxToken* token;
 
@@ -236,6 +238,7 @@ Type* type_build_from_ast(bh_allocator alloc, struct AstType* type_node);
 Type* type_build_implicit_type_of_struct_literal(bh_allocator alloc, struct AstStructLiteral* lit);
 
 Type* type_build_function_type(bh_allocator alloc, struct AstFunction* func);
+Type* type_intern_resolved_function(Type* func_type);
 Type* type_build_compound_type(bh_allocator alloc, struct AstCompound* compound);
 
 Type* type_make_pointer(bh_allocator alloc, Type* to);
@@ -256,6 +259,7 @@ Type* type_get_contained_type(Type* type);
 
 b32 type_is_ready_for_lookup(Type* type);
 b32 type_lookup_member(Type* type, char* member, StructMember* smem);
+b32 type_lookup_member_atom(Type* type, char* atom, StructMember* smem);
 b32 type_lookup_member_by_idx(Type* type, i32 idx, StructMember* smem);
 
 i32 type_linear_member_count(Type* type);
@@ -20,13 +20,16 @@ Scope* scope_create(bh_allocator a, Scope* parent, OnyxFilePos created_at);
 void scope_include(Scope* target, Scope* source, OnyxFilePos pos);
 b32 symbol_introduce(Scope* scope, OnyxToken* tkn, AstNode* symbol);
 b32 symbol_raw_introduce(Scope* scope, char* tkn, OnyxFilePos pos, AstNode* symbol);
+b32 symbol_atom_introduce(Scope* scope, char* atom, OnyxFilePos pos, AstNode* symbol);
 void symbol_builtin_introduce(Scope* scope, char* sym, AstNode *node);
 void symbol_subpackage_introduce(Package *parent, char* sym, AstPackage *node);
 AstNode* symbol_raw_resolve(Scope* start_scope, char* sym);
+AstNode* symbol_atom_resolve(Scope* start_scope, char* atom);
 AstNode* symbol_resolve(Scope* start_scope, OnyxToken* tkn);
 AstNode* try_symbol_raw_resolve_from_node(AstNode* node, char* symbol);
+AstNode* try_symbol_atom_resolve_from_node(AstNode* node, char* atom);
 AstNode* try_symbol_resolve_from_node(AstNode* node, OnyxToken* token);
-AstNode* try_symbol_raw_resolve_from_type(Type *type, char* symbol);
+AstNode* try_symbol_atom_resolve_from_type(Type *type, char* atom);
 Scope *get_scope_from_node(AstNode *node);
 Scope *get_scope_from_node_or_create(AstNode *node);
 
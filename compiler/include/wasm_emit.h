@@ -38,6 +38,8 @@ typedef enum WasmInstructionType {
     WI_RETURN                        = 0x0F,
     WI_CALL                          = 0x10,
     WI_CALL_INDIRECT                 = 0x11,
+    WI_RETURN_CALL                   = 0x12,
+    WI_RETURN_CALL_INDIRECT          = 0x13,
 
     // NOTE: Parametric instructions
     WI_DROP                          = 0x1A,
@@ -702,6 +704,7 @@ typedef struct OnyxWasmModule {
     bh_arr(AllocatedSpace) local_allocations;
 
     bh_arr(PatchInfo) stack_leave_patches;
+    bh_arr(PatchInfo) tail_call_patches;
     bh_arr(DatumPatchInfo) data_patches;
 
     bh_arr(ForRemoveInfo) for_remove_info;
@@ -754,6 +757,9 @@ typedef struct OnyxWasmModule {
     CallingConvention curr_cc;
     i32 null_proc_func_idx;
 
+    // NOTE: The call being returned from the current function, if it could become a tail call.
+    AstCall *tail_call;
+
     b32 has_stack_locals : 1;
     b32 doing_linking : 1;
 
@@ -793,7 +799,7 @@ void onyx_wasm_module_write_to_buffer(OnyxWasmModule* module, bh_buffer* buffer)
 void onyx_wasm_module_write_to_file(OnyxWasmModule* module, bh_file file);
 
 #ifdef ONYX_RUNTIME_LIBRARY
-void onyx_run_initialize(b32 debug_enabled);
+void onyx_run_initialize(b32 debug_enabled, char *profile_path, char *counts_path);
 b32 onyx_run_wasm(bh_buffer code_buffer, int argc, char *argv[]);
 #endif
 
@@ -705,7 +705,7 @@ TypeMatch unify_node_and_type_(AstTyped** pnode, Type* type, b32 permanent) {
     }
 
     if (node->kind == Ast_Kind_Overloaded_Function) {
-        AstTyped* func = find_matching_overload_by_type(((AstOverloadedFunction *) node)->overloads, type);
+        AstTyped* func = find_matching_overload_by_type(((AstOverloadedFunction *) node)->overloads, &((AstOverloadedFunction *) node)->cache, type);
         if (func == NULL) return TYPE_MATCH_FAILED;
         if (func == (AstTyped *) &node_that_signals_a_yield) return TYPE_MATCH_YIELD;
 
@@ -1509,7 +1509,7 @@ TypeMatch implicit_cast_to_bool(AstTyped **pnode) {
     }
 
     Arguments *args = (Arguments *) bh_imap_get(&context.caches.implicit_cast_to_bool_cache, (u64) node);
-    AstFunction *overload = (AstFunction *) find_matching_overload_by_arguments(builtin_implicit_bool_cast->overloads, args);
+    AstFunction *overload = (AstFunction *) find_matching_overload_by_arguments(builtin_implicit_bool_cast->overloads, &builtin_implicit_bool_cast->cache, args);
 
     if (overload == NULL)                                       return TYPE_MATCH_FAILED;
     if (overload == (AstFunction *) &node_that_signals_a_yield) return TYPE_MATCH_YIELD;
@@ -1618,7 +1618,7 @@ AstArgument* make_argument(bh_allocator a, AstTyped* value) {
 AstFieldAccess* make_field_access(bh_allocator a, AstTyped* node, char* field) {
     AstFieldAccess* fa = onyx_ast_node_new(a, sizeof(AstFieldAccess), Ast_Kind_Field_Access);
     if (node->token) fa->token = node->token;
-    fa->field = field;
+    fa->field = field ? atom_intern_cstr(field) : NULL;
     fa->expr = node;
 
     return fa;
@@ -382,6 +382,8 @@ static IntrinsicMap builtin_intrinsics[] = {
 
 bh_arr(OverloadOption) operator_overloads[Binary_Op_Count] = { 0 };
 bh_arr(OverloadOption) unary_operator_overloads[Unary_Op_Count] = { 0 };
+OverloadCache operator_overload_caches[Binary_Op_Count] = { 0 };
+OverloadCache unary_operator_overload_caches[Unary_Op_Count] = { 0 };
 
 void prepare_builtins() {
     builtin_string_type = NULL;
@@ -553,11 +555,13 @@ void initialize_builtins(bh_allocator a) {
     fori (i, 0, Binary_Op_Count) {
         operator_overloads[i] = NULL;
         bh_arr_new(global_heap_allocator, operator_overloads[i], 4);
+        memset(&operator_overload_caches[i], 0, sizeof(OverloadCache));
     }
 
     fori (i, 0, Unary_Op_Count) {
         unary_operator_overloads[i] = NULL;
         bh_arr_new(global_heap_allocator, unary_operator_overloads[i], 4);
+        memset(&unary_operator_overload_caches[i], 0, sizeof(OverloadCache));
     }
 
     IntrinsicMap* intrinsic = &builtin_intrinsics[0];
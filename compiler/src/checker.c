@@ -717,6 +717,7 @@ static CheckStatus check_resolve_callee(AstCall* call, AstTyped** effective_call
     if (callee->kind == Ast_Kind_Overloaded_Function) {
         AstTyped* new_callee = find_matching_overload_by_arguments(
             ((AstOverloadedFunction *) callee)->overloads,
+            &((AstOverloadedFunction *) callee)->cache,
             &call->args);
 
         if (new_callee == NULL) {
@@ -724,7 +725,7 @@ static CheckStatus check_resolve_callee(AstCall* call, AstTyped** effective_call
                 YIELD(call->token->pos, "Waiting to know all options for overloaded function");
             }
 
-            report_unable_to_match_overload(call, ((AstOverloadedFunction *) callee)->overloads);
+            report_unable_to_match_overload(call, ((AstOverloadedFunction *) callee)->overloads, &((AstOverloadedFunction *) callee)->cache);
             return Check_Error;
         }
 
@@ -848,11 +849,9 @@ CheckStatus check_call(AstCall** pcall) {
             callsite->callsite_token = call->token;
 
             // HACK CLEANUP
-            OnyxToken* str_token = bh_alloc(context.ast_alloc, sizeof(OnyxToken));
-            str_token->text  = bh_strdup(global_heap_allocator, (char *) call->token->pos.filename);
-            str_token->length = strlen(call->token->pos.filename);
-            str_token->pos = call->token->pos;
-            str_token->type = Token_Type_Literal_String;
+            OnyxToken* str_token = token_create(context.ast_alloc, Token_Type_Literal_String,
+                bh_strdup(global_heap_allocator, (char *) call->token->pos.filename),
+                strlen(call->token->pos.filename), call->token->pos);
 
             AstStrLit* filename = bh_alloc_item(context.ast_alloc, AstStrLit);
             memset(filename, 0, sizeof(AstStrLit));
@@ -974,7 +973,7 @@ static AstCall* binaryop_try_operator_overload(AstBinaryOp* binop, AstTyped* thi
         if (third_argument != NULL) binop->overload_args->values[2] = (AstTyped *) make_argument(context.ast_alloc, third_argument);
     }
 
-    AstTyped* overload = find_matching_overload_by_arguments(operator_overloads[binop->operation], binop->overload_args);
+    AstTyped* overload = find_matching_overload_by_arguments(operator_overloads[binop->operation], &operator_overload_caches[binop->operation], binop->overload_args);
     if (overload == NULL || overload == (AstTyped *) &node_that_signals_a_yield) return (AstCall *) overload;
 
     AstCall* implicit_call = onyx_ast_node_new(context.ast_alloc, sizeof(AstCall), Ast_Kind_Call);
@@ -999,7 +998,7 @@ static AstCall* unaryop_try_operator_overload(AstUnaryOp* unop) {
         unop->overload_args->values[0] = (AstTyped *) make_argument(context.ast_alloc, unop->expr);
     }
 
-    AstTyped* overload = find_matching_overload_by_arguments(unary_operator_overloads[unop->operation], unop->overload_args);
+    AstTyped* overload = find_matching_overload_by_arguments(unary_operator_overloads[unop->operation], &unary_operator_overload_caches[unop->operation], unop->overload_args);
     if (overload == NULL || overload == (AstTyped *) &node_that_signals_a_yield) return (AstCall *) overload;
 
     AstCall* implicit_call = onyx_ast_node_new(context.ast_alloc, sizeof(AstCall), Ast_Kind_Call);
@@ -2072,9 +2071,7 @@ CheckStatus check_field_access(AstFieldAccess** pfield) {
     }
 
     if (field->token != NULL && field->field == NULL) {
-        token_toggle_end(field->token);
-        field->field = bh_strdup(context.ast_alloc, field->token->text);
-        token_toggle_end(field->token);
+        field->field = token_atom(field->token);
     }
 
     if (!type_is_structlike(field->expr->type)) {
@@ -2086,7 +2083,7 @@ CheckStatus check_field_access(AstFieldAccess** pfield) {
     }
 
     StructMember smem;
-    if (!type_lookup_member(field->expr->type, field->field, &smem)) {
+    if (!type_lookup_member_atom(field->expr->type, field->field, &smem)) {
         if (field->expr->type->kind == Type_Kind_Array) {
             u32 field_count = field->expr->type->Array.count;
 
@@ -2193,11 +2190,11 @@ CheckStatus check_field_access(AstFieldAccess** pfield) {
     AstNode *n;
     AstType *type_node;
   try_resolve_from_type:
-    n = try_symbol_raw_resolve_from_type(field->expr->type, field->field);
+    n = try_symbol_atom_resolve_from_type(field->expr->type, field->field);
 
     type_node = field->expr->type->ast_type;
-    if (!n) n = try_symbol_raw_resolve_from_node((AstNode *) field->expr, field->field);
-    if (!n) n = try_symbol_raw_resolve_from_node((AstNode *) type_node, field->field);
+    if (!n) n = try_symbol_atom_resolve_from_node((AstNode *) field->expr, field->field);
+    if (!n) n = try_symbol_atom_resolve_from_node((AstNode *) type_node, field->field);
 
     if (n) {
         track_resolution_for_symbol_info((AstNode *) *pfield, n);
@@ -2691,11 +2688,7 @@ CheckStatus check_directive_export_name(AstDirectiveExportName *ename) {
         random_name[15] = 0;
         fori (i, 0, 15) random_name[i] = (rand() % 26) + 'a';
 
-        OnyxToken *name_token = bh_alloc_item(context.ast_alloc, OnyxToken);
-        memset(name_token, 0, sizeof(*name_token));
-        name_token->type = Token_Type_Literal_String;
-        name_token->length = 15;
-        name_token->text = random_name;
+        OnyxToken *name_token = token_create(context.ast_alloc, Token_Type_Literal_String, random_name, 15, (OnyxFilePos) { 0 });
 
         AstStrLit* name = bh_alloc_item(context.ast_alloc, AstStrLit);
         memset(name, 0, sizeof(AstStrLit));
@@ -2897,6 +2890,11 @@ CheckStatus check_function(AstFunction* func) {
         *bh_arr_last(context.checker.expected_return_type_stack) = &basic_types[Basic_Kind_Void];
     }
 
+    // The return type is known now, so the type can be interned like every other function type.
+    if (func->return_type == (AstType *) &basic_type_auto_return) {
+        func->type = type_intern_resolved_function(func->type);
+    }
+
     func->flags |= Ast_Flag_Has_Been_Checked;
     return Check_Success;
 }
@@ -2904,12 +2902,10 @@ CheckStatus check_function(AstFunction* func) {
 CheckStatus check_overloaded_function(AstOverloadedFunction* ofunc) {
     b32 done = 1;
 
-    bh_imap all_overloads;
-    bh_imap_init(&all_overloads, global_heap_allocator, 4);
-    build_all_overload_options(ofunc->overloads, &all_overloads);
+    bh_arr(AstTyped *) all_overloads = overload_cache_options(&ofunc->cache, ofunc->overloads);
 
-    bh_arr_each(bh__imap_entry, entry, all_overloads.entries) {
-        AstTyped* node = (AstTyped *) strip_aliases((AstNode *) entry->key);
+    bh_arr_each(AstTyped *, option, all_overloads) {
+        AstTyped* node = (AstTyped *) strip_aliases((AstNode *) *option);
         if (node->kind == Ast_Kind_Overloaded_Function) continue;
 
         if (   node->kind != Ast_Kind_Function
@@ -2918,7 +2914,6 @@ CheckStatus check_overloaded_function(AstOverloadedFunction* ofunc) {
             onyx_report_error(node->token->pos, Error_Critical, "Overload option not procedure or macro. Got '%s'",
                 onyx_ast_node_kind_string(node->kind));
 
-            bh_imap_free(&all_overloads);
             return Check_Error;
         }
 
@@ -2934,7 +2929,6 @@ CheckStatus check_overloaded_function(AstOverloadedFunction* ofunc) {
     }
 
     if (!done) {
-        bh_imap_free(&all_overloads);
         YIELD(ofunc->token->pos, "Waiting for all options to pass type-checking.");
     }
 
@@ -2957,7 +2951,6 @@ CheckStatus check_overloaded_function(AstOverloadedFunction* ofunc) {
 
                 // Return early here because the following code does not work with a
                 // polymorphic expected return type.
-                bh_imap_free(&all_overloads);
                 return Check_Success;
             }
         }
@@ -2965,8 +2958,8 @@ CheckStatus check_overloaded_function(AstOverloadedFunction* ofunc) {
         ofunc->expected_return_type = type_build_from_ast(context.ast_alloc, expected_return_node);
         if (!ofunc->expected_return_type) YIELD(ofunc->token->pos, "Waiting to construct expected return type.");
 
-        bh_arr_each(bh__imap_entry, entry, all_overloads.entries) {
-            AstTyped* node = (AstTyped *) entry->key;
+        bh_arr_each(AstTyped *, option, all_overloads) {
+            AstTyped* node = *option;
 
             if (node->kind == Ast_Kind_Function) {
                 AstFunction *func = (AstFunction *) node;
@@ -2979,15 +2972,12 @@ CheckStatus check_overloaded_function(AstOverloadedFunction* ofunc) {
 
                 if (!types_are_compatible(return_type, ofunc->expected_return_type)) {
                     report_incorrect_overload_expected_type(return_type, ofunc->expected_return_type, func->token, ofunc->token);
-                    bh_imap_free(&all_overloads);
                     return Check_Error;
                 }
             }
         }
     }
 
-
-    bh_imap_free(&all_overloads);
     return Check_Success;
 }
 
@@ -2998,7 +2988,7 @@ static void mark_all_functions_used_in_scope(Scope *scope) {
     // use-case of procedures in structures is dynamically linking them
     // using the type info data.
     if (scope) {
-        fori (i, 0, shlen(scope->symbols)) {
+        fori (i, 0, hmlen(scope->symbols)) {
             AstNode* node = scope->symbols[i].value;
             if (node->kind == Ast_Kind_Function) {
                 node->flags |= Ast_Flag_Function_Used;
@@ -3415,7 +3405,16 @@ CheckStatus check_type(AstType** ptype) {
                 YIELD(type_of->token->pos, "Trying to check type for type-of expression.");
             }
 
-            type_of->resolved_type = type_of->expr->type;
+            Type *resolved_type = type_of->expr->type;
+            if (resolved_type->kind == Type_Kind_Function) {
+                if (resolved_type->Function.return_type == &type_auto_return) {
+                    YIELD(type_of->token->pos, "Waiting for the return type of the procedure to be known.");
+                }
+
+                resolved_type = type_intern_resolved_function(resolved_type);
+            }
+
+            type_of->resolved_type = resolved_type;
             break;
         }
 
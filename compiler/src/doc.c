@@ -517,7 +517,7 @@ static void write_doc_methods(bh_buffer *buffer, Scope *method_scope) {
     }
 
     u32 method_count = 0;
-    fori (i, 0, shlen(method_scope->symbols)) {
+    fori (i, 0, hmlen(method_scope->symbols)) {
         AstFunction* node = (AstFunction *) strip_aliases(method_scope->symbols[i].value);
         if (node->kind != Ast_Kind_Function
             && node->kind != Ast_Kind_Polymorphic_Proc
@@ -536,10 +536,11 @@ static void write_doc_methods(bh_buffer *buffer, Scope *method_scope) {
             case Ast_Kind_Overloaded_Function: binding = ((AstOverloadedFunction *) node)->original_binding_to_node; break;
         }
 
-        OnyxToken tmp_name_token;
+        OnyxToken tmp_name_token = { 0 };
         tmp_name_token.pos = binding->token->pos;
         tmp_name_token.text = method_scope->symbols[i].key;
         tmp_name_token.length = strlen(tmp_name_token.text);
+        tmp_name_token.atom = method_scope->symbols[i].key;
 
         OnyxToken *old_token = binding->token;
         binding->token = &tmp_name_token;
@@ -587,9 +588,7 @@ static b32 write_doc_function(bh_buffer *buffer, AstBinding *binding, AstNode *p
 static b32 write_doc_overloaded_function(bh_buffer *buffer, AstBinding *binding, AstNode *proc) {
     AstOverloadedFunction *ofunc = (void *) proc;
 
-    bh_imap all_overloads;
-    bh_imap_init(&all_overloads, global_heap_allocator, bh_arr_length(ofunc->overloads) * 2);
-    build_all_overload_options(ofunc->overloads, &all_overloads);
+    bh_arr(AstTyped *) all_overloads = overload_cache_options(&ofunc->cache, ofunc->overloads);
 
     write_entity_header(buffer, binding, ofunc->token->pos);
 
@@ -604,8 +603,8 @@ static b32 write_doc_overloaded_function(bh_buffer *buffer, AstBinding *binding,
     bh_buffer_write_u32(buffer, 0);
 
     u32 proc_count = 0;
-    bh_arr_each(bh__imap_entry, entry, all_overloads.entries) {
-        AstNode* node = strip_aliases((AstNode *) entry->key);
+    bh_arr_each(AstTyped *, option, all_overloads) {
+        AstNode* node = strip_aliases((AstNode *) *option);
 
         if (write_doc_procedure(buffer, NULL, node)) {
             proc_count += 1;
@@ -617,7 +616,6 @@ static b32 write_doc_overloaded_function(bh_buffer *buffer, AstBinding *binding,
     // Constraints
     bh_buffer_write_u32(buffer, 0);
 
-    bh_imap_free(&all_overloads);
     return 1;
 }
 
@@ -208,6 +208,10 @@ void add_entities_for_node(bh_arr(Entity *) *target_arr, AstNode* node, Scope* s
             ent.type = Entity_Type_Load_File;
             ent.include = (AstInclude *) node;
             ENTITY_INSERT(ent);
+
+            if (node->kind == Ast_Kind_Load_File) {
+                prefetch_source_file(ent.include);
+            }
             break;
         }
 
@@ -1,6 +1,22 @@
 #include "errors.h"
 #include "utils.h"
 
+//
+// Set on threads that parse files ahead of the main thread. Errors found
+// there are not reported; the file is parsed again on the main thread, so
+// they are reported in the same order and with the same state as before.
+static __thread b32 errors_held_back = 0;
+static __thread b32 held_back_error_seen = 0;
+
+void onyx_errors_hold_back(b32 hold_back) {
+    errors_held_back = hold_back;
+    held_back_error_seen = 0;
+}
+
+b32 onyx_errors_held_back_any() {
+    return held_back_error_seen;
+}
+
 void onyx_errors_init(bh_arr(bh_file_contents)* files) {
     context.errors.file_contents = files;
 
@@ -100,6 +116,8 @@ b32 onyx_errors_are_enabled() {
 }
 
 b32 onyx_has_errors() {
+    if (errors_held_back) return held_back_error_seen;
+
     bh_arr_each(OnyxError, err, context.errors.errors) {
         if (err->rank >= Error_Waiting_On) return 1;
     }
@@ -114,12 +132,22 @@ void onyx_clear_errors() {
 }
 
 void onyx_submit_error(OnyxError error) {
+    if (errors_held_back) {
+        held_back_error_seen = 1;
+        return;
+    }
+
     if (!context.errors_enabled) return;
 
     bh_arr_push(context.errors.errors, error);
 }
 
 void onyx_report_error(OnyxFilePos pos, OnyxErrorRank rank, char * format, ...) {
+    if (errors_held_back) {
+        held_back_error_seen = 1;
+        return;
+    }
+
     if (!context.errors_enabled) return;
 
     va_list vargs;
@@ -137,6 +165,11 @@ void onyx_report_error(OnyxFilePos pos, OnyxErrorRank rank, char * format, ...)
 }
 
 void onyx_submit_warning(OnyxError error) {
+    if (errors_held_back) {
+        held_back_error_seen = 1;
+        return;
+    }
+
     if (!context.errors_enabled) return;
 
     bh_file_contents file_contents = { 0 };
@@ -152,6 +185,11 @@ void onyx_submit_warning(OnyxError error) {
 
 // This definitely doesn't do what I thought it did?
 void onyx_report_warning(OnyxFilePos pos, char* format, ...) {
+    if (errors_held_back) {
+        held_back_error_seen = 1;
+        return;
+    }
+
     if (!context.errors_enabled) return;
 
     va_list vargs;
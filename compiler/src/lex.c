@@ -138,13 +138,32 @@ const char* token_name(OnyxToken * tkn) {
 }
 
 void token_toggle_end(OnyxToken* tkn) {
-    static char backup = 0;
+    // Per thread, because files are parsed on the prefetch threads too.
+    static __thread char backup = 0;
     char tmp = tkn->text[tkn->length];
     assert(backup == '\0' || tmp == '\0'); // Sanity check
     tkn->text[tkn->length] = backup;
     backup = tmp;
 }
 
+static void lexer_report_error(OnyxTokenizer* tokenizer, OnyxFilePos pos, char *msg) {
+    tokenizer->found_error = 1;
+    if (tokenizer->background) return;
+
+    onyx_report_error(pos, Error_Critical, "%s", msg);
+}
+
+OnyxToken* token_create(bh_allocator allocator, TokenType type, char* text, i32 length, OnyxFilePos pos) {
+    OnyxToken* tkn = bh_alloc_item(allocator, OnyxToken);
+    memset(tkn, 0, sizeof(*tkn));
+
+    tkn->type = type;
+    tkn->text = text;
+    tkn->length = length;
+    tkn->pos = pos;
+    return tkn;
+}
+
 OnyxToken* onyx_get_token(OnyxTokenizer* tokenizer) {
     OnyxToken tk;
 
@@ -169,6 +188,7 @@ whitespace_skipped:
     tk.type = Token_Type_Unknown;
     tk.text = tokenizer->curr;
     tk.length = 1;
+    tk.atom = NULL;
     tk.pos.line_start = tokenizer->line_start;
     tk.pos.filename = tokenizer->filename;
     tk.pos.line = tokenizer->line_number;
@@ -267,7 +287,7 @@ whitespace_skipped:
 
             if (*tokenizer->curr == '\n' && ch == '\'') {
                 tk.pos.length = (u16) len;
-                onyx_report_error(tk.pos, Error_Critical, "Character literal not terminated by end of line.");
+                lexer_report_error(tokenizer, tk.pos, "Character literal not terminated by end of line.");
                 break;
             }
 
@@ -280,7 +300,7 @@ whitespace_skipped:
 
             INCREMENT_CURR_TOKEN(tokenizer);
             if (tokenizer->curr == tokenizer->end) {
-                onyx_report_error(tk.pos, Error_Critical, "String literal not closed. String literal starts here.");
+                lexer_report_error(tokenizer, tk.pos, "String literal not closed. String literal starts here.");
                 break;
             }
         }
@@ -487,6 +507,7 @@ whitespace_skipped:
 
         tk.length = len;
         tk.type = Token_Type_Symbol;
+        if (!tokenizer->background) tk.atom = atom_intern(tk.text, len);
         goto token_parsed;
     }
 
@@ -527,9 +548,6 @@ void onyx_lex_tokens(OnyxTokenizer* tokenizer) {
     do {
         tk = onyx_get_token(tokenizer);
     } while (tk->type != Token_Type_End_Stream);
-
-    context.lexer_lines_processed += tokenizer->line_number - 1;
-    context.lexer_tokens_processed += bh_arr_length(tokenizer->tokens);
 }
 
 b32 token_equals(OnyxToken* tkn1, OnyxToken* tkn2) {
@@ -557,3 +575,64 @@ b32 token_same_file(OnyxToken *tkn1, OnyxToken *tkn2) {
     // :Security?
     return strcmp(tkn1->pos.filename, tkn2->pos.filename) == 0;
 }
+
+
+
+//
+// Atoms
+//
+
+// Hash of the text -> atom. Texts are hashed and compared by (pointer, length), so
+// the source they come from is only ever read. If two texts hash the same, the
+// later atom is stored at the next hash. Atoms outlive a compilation, so they
+// come from the plain heap rather than global_heap_allocator.
+static bh_imap atoms;
+
+static u64 atom_hash(char* text, i32 length) {
+    u64 hash = 0xcbf29ce484222325ull;
+    fori (i, 0, length) hash = (hash ^ (u8) text[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+static char* atom_lookup(char* text, i32 length, u64 *hash) {
+    if (atoms.hashes == NULL) bh_imap_init(&atoms, bh_heap_allocator(), 1021);
+
+    *hash = atom_hash(text, length);
+
+    char* atom;
+    while ((atom = (char *) bh_imap_get(&atoms, *hash))) {
+        if (!strncmp(atom, text, length) && atom[length] == '\0') return atom;
+        *hash += 1;
+    }
+
+    return NULL;
+}
+
+char* atom_intern(char* text, i32 length) {
+    u64 hash;
+    char* atom = atom_lookup(text, length, &hash);
+    if (atom) return atom;
+
+    atom = bh_alloc_array(bh_heap_allocator(), char, length + 1);
+    memcpy(atom, text, length);
+    atom[length] = '\0';
+
+    bh_imap_put(&atoms, hash, (u64) atom);
+    return atom;
+}
+
+char* atom_intern_cstr(char* text) {
+    return atom_intern(text, strlen(text));
+}
+
+// Returns NULL if the text has never been interned, in which case nothing
+// can be declared with it.
+char* atom_find(char* text) {
+    u64 hash;
+    return atom_lookup(text, strlen(text), &hash);
+}
+
+char* token_atom(OnyxToken* tkn) {
+    if (tkn->atom == NULL) tkn->atom = atom_intern(tkn->text, tkn->length);
+    return tkn->atom;
+}
@@ -82,11 +82,14 @@ static const char *build_docstring = DOCSTRING_HEADER
     "\t           -VVV         Very very verbose output (to be used by compiler developers).\n"
     "\t--multi-threaded        Enables multi-threading for this compilation.\n"
     "\t                        Automatically enabled for \"onyx\" runtime.\n"
+    "\t--tail-calls            Compiles calls being returned to tail calls, so they do not grow the stack.\n"
     "\t--doc <doc_file>        Generates an O-DOC file, a.k.a an Onyx documentation file. Used by onyx-doc-gen.\n"
     "\t--tag                   Generates a C-Tag file.\n"
     "\t--syminfo <target_file> (DEPRECATED) Generates a symbol resolution information file. Used by onyx-lsp.\n"
     "\t--lspinfo <target_file> Generates an LSP information file. Used by onyx-lsp.\n"
     "\t--stack-trace           Enable dynamic stack trace.\n"
+    "\t--profile=<file>        When running, samples the program and writes collapsed stacks to <file>.\n"
+    "\t--counts=<file>         When running, counts executed instructions and writes a report to <file>.\n"
     "\t--no-core               Disable automatically including \"core/module\".\n"
     "\t--no-stale-code         Disables use of `#allow_stale_code` directive\n"
     "\t--no-type-info          Disables generating type information\n"
@@ -97,6 +100,8 @@ static const char *build_docstring = DOCSTRING_HEADER
     "\t--no-colors               Disables colors in the error message.\n"
     "\t--no-file-contents        Disables '#file_contents' for security.\n"
     "\t--show-all-errors         Print all errors (can result in many consequencial errors from a single error)\n"
+    "\t--lex-threads <n>         Number of threads that read, lex and parse files ahead of the main thread. 0 disables them.\n"
+    "\t                          (default: one less than the number of cores, at most 8)\n"
     "\t--print-function-mappings Prints a mapping from WASM function index to source location.\n"
     "\t--print-static-if-results Prints the conditional result of each #if statement. Useful for debugging.\n"
     "\n";
@@ -114,11 +119,13 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
 
         .use_post_mvp_features   = 1,
         .use_multi_threading     = 0,
+        .use_tail_calls          = 0,
         .generate_foreign_info   = 0,
         .generate_type_info      = 1,
         .no_core                 = 0,
         .no_stale_code           = 0,
         .show_all_errors         = 0,
+        .lex_threads             = -1,
 
         .runtime = Runtime_Onyx,
 
@@ -132,6 +139,8 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
         .defined_variables = NULL,
 
         .debug_info_enabled = 0,
+        .profile_path = NULL,
+        .counts_path = NULL,
 
         .passthrough_argument_count = 0,
         .passthrough_argument_data  = NULL,
@@ -259,6 +268,9 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
             else if (!strcmp(argv[i], "--multi-threaded")) {
                 options.use_multi_threading = 1;
             }
+            else if (!strcmp(argv[i], "--tail-calls")) {
+                options.use_tail_calls = 1;
+            }
             else if (!strcmp(argv[i], "--generate-foreign-info")) {
                 options.generate_foreign_info = 1;
             }
@@ -274,6 +286,9 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
             else if (!strcmp(argv[i], "--show-all-errors")) {
                 options.show_all_errors = 1;
             }
+            else if (!strcmp(argv[i], "--lex-threads")) {
+                options.lex_threads = atoi(argv[++i]);
+            }
             else if (!strcmp(argv[i], "-I")) {
                 bh_arr_push(options.included_folders, argv[++i]);
             }
@@ -320,6 +335,14 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
                 options.debug_info_enabled = 1;
                 options.stack_trace_enabled = 1;
             }
+            else if (!strncmp(argv[i], "--profile=", 10)) {
+                options.profile_path = argv[i] + 10;
+                options.debug_info_enabled = 1;
+            }
+            else if (!strncmp(argv[i], "--counts=", 9)) {
+                options.counts_path = argv[i] + 9;
+                options.debug_info_enabled = 1;
+            }
             else if (!strcmp(argv[i], "--debug-info")) {
                 options.debug_info_enabled = 1;
                 options.stack_trace_enabled = 1;
@@ -409,13 +432,8 @@ static AstInclude* create_load(bh_allocator alloc, char* filename) {
 }
 
 static void create_and_add_defined_variable(char *name, char *value) {
-    OnyxToken *value_token = bh_alloc_item(context.ast_alloc, OnyxToken);
-    value_token->text = value;
-    value_token->length = strlen(value);
-
-    OnyxToken *name_token = bh_alloc_item(context.ast_alloc, OnyxToken);
-    name_token->text = name;
-    name_token->length = strlen(name);
+    OnyxToken *value_token = token_create(context.ast_alloc, Token_Type_Unknown, value, strlen(value), (OnyxFilePos) { 0 });
+    OnyxToken *name_token  = token_create(context.ast_alloc, Token_Type_Unknown, name,  strlen(name),  (OnyxFilePos) { 0 });
 
     Package *p = package_lookup("runtime.vars");
     assert(p);
@@ -583,21 +601,394 @@ static void context_init(CompileOptions* opts) {
     }
 }
 
+static void source_prefetcher_stop();
+
 static void context_free() {
+    source_prefetcher_stop();
+
     bh_arena_free(&context.ast_arena);
     bh_arr_free(context.loaded_files);
 }
 
+static char* resolve_load_filename(AstInclude *include, char *name) {
+    // :RelativeFiles
+    const char* parent_file = include->token->pos.filename;
+    if (parent_file == NULL) parent_file = ".";
+
+    char* parent_folder = bh_path_get_parent(parent_file, global_scratch_allocator);
+
+    char* filename = bh_lookup_file(name, parent_folder, ".onyx", 1, context.options->included_folders, 1);
+    return bh_strdup(global_heap_allocator, filename);
+}
+
+//
+// Source file prefetching
+//
+// Reading, lexing and parsing a file does not depend on the files before it,
+// so as soon as a #load is seen, the file it names is handed to a pool of
+// worker threads. By the time the load entity comes up, the file has usually
+// been parsed, and the main thread only has to replay what the parser would
+// have done to the shared state: look up the package, number the scopes and
+// submit the entities (see onyx_parse_replay). This happens in the same order
+// as before, which keeps compilation deterministic.
+//
+// Files are only lexed, and not parsed, until the builtins are initialized,
+// because the parser refers to some of them.
+//
+// Loads are prefetched when they are submitted, which is before it is known
+// whether an #if around them is true, or whether a later #load_path changes
+// where they resolve to. Either way, the prefetched file is simply never used.
+//
+// The global heap allocator is not thread-safe, so the workers allocate from
+// the plain heap, and each parsed file gets its own arena for its AST. What
+// they allocate is freed when the prefetcher is stopped.
+//
+
+typedef enum PrefetchState {
+    Prefetch_Queued,
+    Prefetch_Working,
+    Prefetch_Done,
+
+    // The main thread needed the file before a worker got to it.
+    Prefetch_Skipped,
+} PrefetchState;
+
+typedef struct PrefetchedFile {
+    char *filename;
+    PrefetchState state;
+
+    // If the file could not be opened, or lexing it found an error, it is
+    // processed again on the main thread, so the errors are reported there.
+    b32 failed;
+
+    bh_file_contents contents;
+    OnyxTokenizer tokenizer;
+
+    // Set if the file was also parsed. The parser is replayed when the file
+    // is used.
+    b32 parsed;
+    bh_arena arena;
+    OnyxParser parser;
+    ParserRecord *record;
+} PrefetchedFile;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+
+typedef struct SourcePrefetcher {
+    b32 started, stopping;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  work_available;
+    pthread_cond_t  work_done;
+
+    bh_arr(pthread_t) workers;
+
+    // Jobs are taken from the front of the queue, at queue_head.
+    bh_arr(PrefetchedFile *) queue;
+    i32 queue_head;
+
+    Table(PrefetchedFile *) files;
+
+    // Set once the builtins the parser refers to are initialized.
+    b32 parse_ready;
+
+    // How many files were used from the workers, and how many of those
+    // were parsed there.
+    u32 used_count;
+    u32 parsed_count;
+} SourcePrefetcher;
+
+static SourcePrefetcher prefetcher;
+
+static __thread b32 on_prefetch_thread = 0;
+
+//
+// Allocations made on the workers come from the plain heap. The managed heap
+// allocator passes memory it did not allocate on to the plain heap, so the
+// main thread can still resize and free it.
+static BH_ALLOCATOR_PROC(global_heap_allocator_proc) {
+    if (on_prefetch_thread) {
+        return bh_heap_allocator_proc(NULL, action, size, alignment, prev_memory, flags);
+    }
+
+    return bh_managed_heap_allocator_proc(data, action, size, alignment, prev_memory, flags);
+}
+
+//
+// Same for the scratch allocator. The workers only use it to format error
+// messages, which are dropped.
+static BH_ALLOCATOR_PROC(global_scratch_allocator_proc) {
+    if (on_prefetch_thread) {
+        return bh_heap_allocator_proc(NULL, action, size, alignment, prev_memory, flags);
+    }
+
+    return bh_scratch_allocator_proc(data, action, size, alignment, prev_memory, flags);
+}
+
+static void prefetch_lex_file(PrefetchedFile *pf) {
+    bh_allocator alloc = bh_heap_allocator();
+
+    bh_file file;
+    if (bh_file_open(&file, pf->filename) != BH_FILE_ERROR_NONE) {
+        pf->failed = 1;
+        return;
+    }
+
+    pf->contents = bh_file_read_contents(alloc, &file);
+    bh_file_close(&file);
+
+    pf->tokenizer = onyx_tokenizer_create(alloc, &pf->contents);
+    pf->tokenizer.background = 1;
+    onyx_lex_tokens(&pf->tokenizer);
+
+    pf->failed = pf->tokenizer.found_error;
+}
+
+static void prefetch_parse_file(PrefetchedFile *pf) {
+    bh_arena_init(&pf->arena, bh_heap_allocator(), 256 * 1024);
+
+    pf->record = bh_alloc_item(bh_heap_allocator(), ParserRecord);
+    memset(pf->record, 0, sizeof(*pf->record));
+
+    pf->parser = onyx_parser_create(bh_arena_allocator(&pf->arena), &pf->tokenizer);
+    pf->parser.record = pf->record;
+
+    //
+    // A file with errors is parsed again on the main thread, which reports them.
+    onyx_errors_hold_back(1);
+    onyx_parse(&pf->parser);
+    pf->parsed = !onyx_errors_held_back_any();
+}
+
+static void prefetched_file_free(PrefetchedFile *pf) {
+    onyx_tokenizer_free(&pf->tokenizer);
+    if (pf->contents.data) bh_file_contents_free(&pf->contents);
+
+    if (pf->record) {
+        onyx_parser_free(&pf->parser);
+        bh_arr_free(pf->record->scopes);
+        bh_arr_free(pf->record->submissions);
+        bh_arr_free(pf->record->typed_late);
+        bh_arr_free(pf->record->package.doc_strings);
+        bh_free(bh_heap_allocator(), pf->record);
+        bh_arena_free(&pf->arena);
+    }
+}
+
+static void *prefetch_worker(void *data) {
+    on_prefetch_thread = 1;
+
+    pthread_mutex_lock(&prefetcher.mutex);
+
+    while (1) {
+        while (prefetcher.queue_head == bh_arr_length(prefetcher.queue) && !prefetcher.stopping) {
+            pthread_cond_wait(&prefetcher.work_available, &prefetcher.mutex);
+        }
+
+        if (prefetcher.stopping) break;
+
+        PrefetchedFile *pf = prefetcher.queue[prefetcher.queue_head++];
+        if (pf->state != Prefetch_Queued) continue;
+
+        pf->state = Prefetch_Working;
+        b32 parse = prefetcher.parse_ready;
+        pthread_mutex_unlock(&prefetcher.mutex);
+
+        prefetch_lex_file(pf);
+        if (parse && !pf->failed) prefetch_parse_file(pf);
+
+        pthread_mutex_lock(&prefetcher.mutex);
+        pf->state = Prefetch_Done;
+        pthread_cond_broadcast(&prefetcher.work_done);
+    }
+
+    pthread_mutex_unlock(&prefetcher.mutex);
+    return NULL;
+}
+
+static b32 source_prefetcher_start() {
+    if (prefetcher.started) return bh_arr_length(prefetcher.workers) > 0;
+    prefetcher.started = 1;
+
+    i32 thread_count = context.options->lex_threads;
+    if (thread_count < 0) {
+        thread_count = bh_min(sysconf(_SC_NPROCESSORS_ONLN) - 1, 8);
+    }
+
+    if (thread_count <= 0) return 0;
+
+    pthread_mutex_init(&prefetcher.mutex, NULL);
+    pthread_cond_init(&prefetcher.work_available, NULL);
+    pthread_cond_init(&prefetcher.work_done, NULL);
+
+    bh_arr_new(global_heap_allocator, prefetcher.queue, 64);
+    bh_arr_new(global_heap_allocator, prefetcher.workers, thread_count);
+    sh_new_arena(prefetcher.files);
+
+    fori (i, 0, thread_count) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, prefetch_worker, NULL) == 0) {
+            bh_arr_push(prefetcher.workers, thread);
+        }
+    }
+
+    return bh_arr_length(prefetcher.workers) > 0;
+}
+
+static void source_prefetcher_stop() {
+    if (!prefetcher.started) return;
+
+    if (bh_arr_length(prefetcher.workers) > 0) {
+        pthread_mutex_lock(&prefetcher.mutex);
+        prefetcher.stopping = 1;
+        pthread_cond_broadcast(&prefetcher.work_available);
+        pthread_mutex_unlock(&prefetcher.mutex);
+
+        bh_arr_each(pthread_t, thread, prefetcher.workers) {
+            pthread_join(*thread, NULL);
+        }
+
+        bh_arr_each(PrefetchedFile *, ppf, prefetcher.queue) {
+            PrefetchedFile *pf = *ppf;
+            if (pf->state == Prefetch_Done) {
+                prefetched_file_free(pf);
+            }
+        }
+
+        pthread_mutex_destroy(&prefetcher.mutex);
+        pthread_cond_destroy(&prefetcher.work_available);
+        pthread_cond_destroy(&prefetcher.work_done);
+
+        shfree(prefetcher.files);
+    }
+
+    bh_arr_free(prefetcher.queue);
+    bh_arr_free(prefetcher.workers);
+    memset(&prefetcher, 0, sizeof(prefetcher));
+}
+
+void prefetch_source_file(AstInclude *include) {
+    if (!source_prefetcher_start()) return;
+
+    //
+    // The name of the file is not known until symbol resolution, unless it
+    // is written as a string literal, which is nearly always the case.
+    char *name = include->name;
+    if (name == NULL) {
+        AstTyped *name_node = include->name_node;
+        if (!name_node || name_node->kind != Ast_Kind_StrLit || !name_node->token) return;
+
+        OnyxToken *str_token = name_node->token;
+        name = bh_alloc_array(global_scratch_allocator, char, str_token->length + 1);
+        i32 length = string_process_escape_seqs(name, str_token->text, str_token->length);
+        name[length] = '\0';
+    }
+
+    char *filename = resolve_load_filename(include, name);
+
+    pthread_mutex_lock(&prefetcher.mutex);
+
+    if (shgeti(prefetcher.files, filename) == -1) {
+        PrefetchedFile *pf = bh_alloc_item(global_heap_allocator, PrefetchedFile);
+        memset(pf, 0, sizeof(*pf));
+        pf->filename = filename;
+        pf->state = Prefetch_Queued;
+
+        shput(prefetcher.files, filename, pf);
+        bh_arr_push(prefetcher.queue, pf);
+        pthread_cond_signal(&prefetcher.work_available);
+    }
+
+    pthread_mutex_unlock(&prefetcher.mutex);
+}
+
+//
+// Returns the prefetched file, waiting for a worker to finish it if needed, or
+// NULL if the file has to be read and lexed on the main thread.
+static PrefetchedFile *take_prefetched_file(char *filename) {
+    if (!prefetcher.started || bh_arr_length(prefetcher.workers) == 0) return NULL;
+
+    pthread_mutex_lock(&prefetcher.mutex);
+
+    PrefetchedFile *pf = shget(prefetcher.files, filename);
+    if (pf && pf->state == Prefetch_Queued) {
+        pf->state = Prefetch_Skipped;
+        pf = NULL;
+    }
+
+    while (pf && pf->state == Prefetch_Working) {
+        pthread_cond_wait(&prefetcher.work_done, &prefetcher.mutex);
+    }
+
+    pthread_mutex_unlock(&prefetcher.mutex);
+
+    if (pf && pf->failed) return NULL;
+    if (pf) prefetcher.used_count += 1;
+    return pf;
+}
+
+//
+// Called once the builtins are initialized.
+static void source_prefetcher_allow_parsing() {
+    if (!prefetcher.started || bh_arr_length(prefetcher.workers) == 0) {
+        prefetcher.parse_ready = 1;
+        return;
+    }
+
+    pthread_mutex_lock(&prefetcher.mutex);
+    prefetcher.parse_ready = 1;
+    pthread_mutex_unlock(&prefetcher.mutex);
+}
+
+static void replay_prefetched_parse(PrefetchedFile *pf) {
+    onyx_parse_replay(&pf->parser);
+    prefetcher.parsed_count += 1;
+}
+
+static u32 prefetched_file_count() {
+    return prefetcher.used_count;
+}
+
+static u32 prefetched_parsed_file_count() {
+    return prefetcher.parsed_count;
+}
+
+#else
+
+#define global_heap_allocator_proc    bh_managed_heap_allocator_proc
+#define global_scratch_allocator_proc bh_scratch_allocator_proc
+
+void prefetch_source_file(AstInclude *include) {}
+static void source_prefetcher_stop() {}
+static void source_prefetcher_allow_parsing() {}
+static PrefetchedFile *take_prefetched_file(char *filename) { return NULL; }
+static void replay_prefetched_parse(PrefetchedFile *pf) {}
+static u32 prefetched_file_count() { return 0; }
+static u32 prefetched_parsed_file_count() { return 0; }
+
+#endif
+
+static void count_lexed_file(bh_file_contents* file_contents, OnyxTokenizer *tokenizer) {
+    file_contents->line_count = tokenizer->line_number;
+
+    context.lexer_lines_processed += tokenizer->line_number - 1;
+    context.lexer_tokens_processed += bh_arr_length(tokenizer->tokens);
+}
+
+static void parse_tokens(bh_file_contents* file_contents, OnyxTokenizer *tokenizer) {
+    count_lexed_file(file_contents, tokenizer);
+
+    OnyxParser parser = onyx_parser_create(context.ast_alloc, tokenizer);
+    onyx_parse(&parser);
+    onyx_parser_free(&parser);
+}
+
 static void parse_source_file(bh_file_contents* file_contents) {
     // :Remove passing the allocators as parameters
     OnyxTokenizer tokenizer = onyx_tokenizer_create(context.token_alloc, file_contents);
     onyx_lex_tokens(&tokenizer);
 
-    file_contents->line_count = tokenizer.line_number;
-
-    OnyxParser parser = onyx_parser_create(context.ast_alloc, &tokenizer);
-    onyx_parse(&parser);
-    onyx_parser_free(&parser);
+    parse_tokens(file_contents, &tokenizer);
 }
 
 static b32 process_source_file(char* filename, OnyxFilePos error_pos) {
@@ -607,6 +998,26 @@ static b32 process_source_file(char* filename, OnyxFilePos error_pos) {
         if (!strcmp(fc->filename, filename)) return 1;
     }
 
+    PrefetchedFile *pf = take_prefetched_file(filename);
+    if (pf) {
+        bh_arr_push(context.loaded_files, pf->contents);
+
+        if (context.options->verbose_output == 2)
+            bh_printf("Processing source file:    %s (%d bytes)\n", filename, pf->contents.length);
+
+        //
+        // Parsing stops at the first error, so if there already is one, the
+        // parse on the worker, which did not see it, is not used.
+        if (pf->parsed && !onyx_has_errors()) {
+            count_lexed_file(&bh_arr_last(context.loaded_files), &pf->tokenizer);
+            replay_prefetched_parse(pf);
+        } else {
+            parse_tokens(&bh_arr_last(context.loaded_files), &pf->tokenizer);
+        }
+
+        return 1;
+    }
+
     bh_file file;
     bh_file_error err = bh_file_open(&file, filename);
     if (err != BH_FILE_ERROR_NONE) {
@@ -633,15 +1044,7 @@ static b32 process_load_entity(Entity* ent) {
     AstInclude* include = ent->include;
 
     if (include->kind == Ast_Kind_Load_File) {
-        // :RelativeFiles
-        const char* parent_file = include->token->pos.filename;
-        if (parent_file == NULL) parent_file = ".";
-
-        char* parent_folder = bh_path_get_parent(parent_file, global_scratch_allocator);
-
-        char* filename = bh_lookup_file(include->name, parent_folder, ".onyx", 1, context.options->included_folders, 1);
-        char* formatted_name = bh_strdup(global_heap_allocator, filename);
-
+        char* formatted_name = resolve_load_filename(include, include->name);
         return process_source_file(formatted_name, include->token->pos);
 
     } else if (include->kind == Ast_Kind_Load_All) {
@@ -763,6 +1166,7 @@ static b32 process_entity(Entity* ent) {
                 initialize_builtins(context.ast_alloc);
                 introduce_build_options(context.ast_alloc);
                 introduce_defined_variables();
+                source_prefetcher_allow_parsing();
             }
 
             // GROSS
@@ -973,6 +1377,7 @@ static i32 onyx_compile() {
         printf("    Time taken: %lf ms\n", (double) duration);
         printf("    Processed %ld lines (%f lines/second).\n", context.lexer_lines_processed, ((f32) 1000 * context.lexer_lines_processed) / (duration));
         printf("    Processed %ld tokens (%f tokens/second).\n", context.lexer_tokens_processed, ((f32) 1000 * context.lexer_tokens_processed) / (duration));
+        printf("    Lexed %d and parsed %d of %d files ahead of the main thread.\n", prefetched_file_count(), prefetched_parsed_file_count(), bh_arr_length(context.loaded_files));
         printf("\n");
     }
 
@@ -1054,7 +1459,7 @@ static CompilerProgress onyx_flush_module() {
 
 #ifdef ONYX_RUNTIME_LIBRARY
 static b32 onyx_run_module(bh_buffer code_buffer) {
-    onyx_run_initialize(context.options->debug_session);
+    onyx_run_initialize(context.options->debug_session, context.options->profile_path, context.options->counts_path);
 
     if (context.options->verbose_output > 0)
         bh_printf("Running program:\n");
@@ -1087,10 +1492,16 @@ static bh_managed_heap mh;
 
 CompilerProgress do_compilation(CompileOptions *compile_opts) {
     bh_scratch_init(&global_scratch, bh_heap_allocator(), 256 * 1024); // NOTE: 256 KiB
-    global_scratch_allocator = bh_scratch_allocator(&global_scratch);
+    global_scratch_allocator = (bh_allocator) {
+        .proc = global_scratch_allocator_proc,
+        .data = &global_scratch,
+    };
 
     bh_managed_heap_init(&mh);
-    global_heap_allocator = bh_managed_heap_allocator(&mh);
+    global_heap_allocator = (bh_allocator) {
+        .proc = global_heap_allocator_proc,
+        .data = &mh,
+    };
     // global_heap_allocator = bh_heap_allocator();
     context_init(compile_opts);
 
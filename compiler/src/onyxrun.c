@@ -13,17 +13,29 @@ int main(int argc, char *argv[]) {
     }
 
     b32 debug = 0;
-    if (!strcmp(argv[1], "--debug")) {
-        debug = 1;
-        wasm_file_idx = 2;
+    char *profile_path = NULL;
+    char *counts_path = NULL;
+
+    while (wasm_file_idx < argc) {
+        if (!strcmp(argv[wasm_file_idx], "--debug")) {
+            debug = 1;
+        } else if (!strncmp(argv[wasm_file_idx], "--profile=", 10)) {
+            profile_path = argv[wasm_file_idx] + 10;
+        } else if (!strncmp(argv[wasm_file_idx], "--counts=", 9)) {
+            counts_path = argv[wasm_file_idx] + 9;
+        } else {
+            break;
+        }
+
+        wasm_file_idx++;
     }
 
-    if (debug && argc < 3) {
+    if (wasm_file_idx >= argc) {
         fprintf(stderr, "Expected a WASM file to run.\n");
         return 1;
     }
 
-    onyx_run_initialize(debug);
+    onyx_run_initialize(debug, profile_path, counts_path);
 
     bh_file wasm_file;
     bh_file_error err = bh_file_open(&wasm_file, argv[wasm_file_idx]);
@@ -38,5 +50,5 @@ int main(int argc, char *argv[]) {
     bh_buffer data;
     data.data = wasm_data.data;
     data.length = wasm_data.length;
-    return onyx_run_wasm(data, argc - 1 - debug, argv + 1 + debug);
+    return onyx_run_wasm(data, argc - wasm_file_idx, argv + wasm_file_idx);
 }
@@ -20,6 +20,20 @@ static AstNode error_node = { Ast_Kind_Error, 0, NULL, NULL };
 #define ENTITY_SUBMIT_IN_SCOPE(node, scope) (submit_entity_in_scope(parser, (AstNode *) (node), scope, parser->package))
 
 void submit_entity_in_scope(OnyxParser* parser, AstNode* node, Scope* scope, Package* package) {
+    if (parser->record) {
+        ParserSubmission submission;
+        submission.target = NULL;
+        submission.node   = node;
+        submission.scope  = scope;
+
+        if (bh_arr_length(parser->alternate_entity_placement_stack) > 0) {
+            submission.target = bh_arr_last(parser->alternate_entity_placement_stack);
+        }
+
+        bh_arr_push(parser->record->submissions, submission);
+        return;
+    }
+
     if (bh_arr_length(parser->alternate_entity_placement_stack) == 0) {
         add_entities_for_node(NULL, node, scope, package);
 
@@ -29,6 +43,22 @@ void submit_entity_in_scope(OnyxParser* parser, AstNode* node, Scope* scope, Pac
     }
 }
 
+static Scope* parser_scope_create(OnyxParser* parser, Scope* parent, OnyxFilePos created_at) {
+    if (!parser->record) {
+        return scope_create(parser->allocator, parent, created_at);
+    }
+
+    // Scope ids are handed out in order, so they are given when the
+    // record is replayed.
+    Scope* scope = bh_alloc_item(parser->allocator, Scope);
+    memset(scope, 0, sizeof(*scope));
+    scope->parent = parent;
+    scope->created_at = created_at;
+
+    bh_arr_push(parser->record->scopes, scope);
+    return scope;
+}
+
 // Parsing Utilities
 static void consume_token(OnyxParser* parser);
 static OnyxToken* expect_token(OnyxParser* parser, TokenType token_type);
@@ -623,7 +653,7 @@ static AstTyped* parse_factor(OnyxParser* parser) {
                 AstBlock *tmp_block = make_node(AstBlock, Ast_Kind_Block);
                 tmp_block->token = do_token;
 
-                tmp_block->binding_scope = scope_create(parser->allocator, parser->current_scope, parser->curr->pos);
+                tmp_block->binding_scope = parser_scope_create(parser, parser->current_scope, parser->curr->pos);
                 tmp_block->binding_scope->name = "<anonymous do block>";
 
                 parser->current_scope = tmp_block->binding_scope;
@@ -719,7 +749,11 @@ static AstTyped* parse_factor(OnyxParser* parser) {
                 AstFileContents* fc = make_node(AstFileContents, Ast_Kind_File_Contents);
                 fc->token = parser->prev - 1;
                 fc->filename_expr = parse_expression(parser, 0);
-                fc->type = type_make_slice(parser->allocator, &basic_types[Basic_Kind_U8]);
+                if (parser->record) {
+                    bh_arr_push(parser->record->typed_late, (AstNode *) fc);
+                } else {
+                    fc->type = type_make_slice(parser->allocator, &basic_types[Basic_Kind_U8]);
+                }
 
                 if (parser->current_function_stack && bh_arr_length(parser->current_function_stack) > 0) {
                     bh_arr_push(bh_arr_last(parser->current_function_stack)->nodes_that_need_entities_after_clone, (AstNode *) fc);
@@ -734,11 +768,9 @@ static AstTyped* parse_factor(OnyxParser* parser) {
             else if (parse_possible_directive(parser, "file")) {
                 OnyxToken* dir_token = parser->curr - 2;
 
-                OnyxToken* str_token = bh_alloc(parser->allocator, sizeof(OnyxToken));
-                str_token->text  = bh_strdup(global_heap_allocator, (char *) dir_token->pos.filename);
-                str_token->length = strlen(dir_token->pos.filename);
-                str_token->pos = dir_token->pos;
-                str_token->type = Token_Type_Literal_String;
+                OnyxToken* str_token = token_create(parser->allocator, Token_Type_Literal_String,
+                    bh_strdup(global_heap_allocator, (char *) dir_token->pos.filename),
+                    strlen(dir_token->pos.filename), dir_token->pos);
 
                 AstStrLit* filename = make_node(AstStrLit, Ast_Kind_StrLit);
                 filename->token = str_token;
@@ -981,7 +1013,7 @@ static AstTyped* parse_factor(OnyxParser* parser) {
                 method_call->left = retval;
 
                 OnyxToken *method_name = expect_token(parser, Token_Type_Symbol);
-                AstNode *method = make_symbol(context.ast_alloc, method_name);
+                AstNode *method = make_symbol(parser->allocator, method_name);
 
                 if (parser->curr->type != '(') {
                     // CLEANUP: This error message is horrendous.
@@ -1654,7 +1686,7 @@ static AstNode* parse_statement(OnyxParser* parser) {
                         }
                     }
 
-                    bh_arr_push(dest->args.values, (AstTyped *) make_argument(context.ast_alloc, (AstTyped *) code_block));
+                    bh_arr_push(dest->args.values, (AstTyped *) make_argument(parser->allocator, (AstTyped *) code_block));
                     needs_semicolon = 0;
                 }
             }
@@ -1722,11 +1754,8 @@ static AstNode* parse_statement(OnyxParser* parser) {
                 // :LinearTokenDependent
                 OnyxToken* directive_token = parser->curr - 2;
 
-                OnyxToken* sym_token = bh_alloc_item(parser->allocator, OnyxToken);
-                sym_token->type = Token_Type_Symbol;
-                sym_token->length = 15;
-                sym_token->text = bh_strdup(parser->allocator, "__saved_context ");
-                sym_token->pos = ((OnyxFilePos) {0});
+                OnyxToken* sym_token = token_create(parser->allocator, Token_Type_Symbol,
+                    bh_strdup(parser->allocator, "__saved_context "), 15, (OnyxFilePos) { 0 });
 
                 AstNode *sym_node = make_symbol(parser->allocator, sym_token);
 
@@ -1817,7 +1846,7 @@ static AstBlock* parse_block(OnyxParser* parser, b32 make_a_new_scope, char* blo
     }
 
     if (make_a_new_scope) {
-        block->binding_scope = scope_create(parser->allocator, parser->current_scope, parser->curr->pos);
+        block->binding_scope = parser_scope_create(parser, parser->current_scope, parser->curr->pos);
         block->binding_scope->name = block_name;
         parser->current_scope = block->binding_scope;
     }
@@ -1927,12 +1956,14 @@ static AstType* parse_compound_type(OnyxParser* parser) {
 
 static AstType* parse_function_type(OnyxParser* parser, OnyxToken* proc_token) {
     bh_arr(AstType *) params = NULL;
-    bh_arr_new(global_scratch_allocator, params, 4);
-    bh_arr_set_length(params, 0);
+    bh_arr_new(global_heap_allocator, params, 4);
 
     expect_token(parser, '(');
     while (!consume_token_if_next(parser, ')')) {
-        if (parser->hit_unexpected_token) return NULL;
+        if (parser->hit_unexpected_token) {
+            bh_arr_free(params);
+            return NULL;
+        }
 
         // NOTE: Allows for names to be put in the function types, just for readability.
         if (next_tokens_are(parser, 2, Token_Type_Symbol, ':')) consume_tokens(parser, 2);
@@ -1959,6 +1990,7 @@ static AstType* parse_function_type(OnyxParser* parser, OnyxToken* proc_token) {
     if (param_count > 0)
         fori (i, 0, param_count) new->params[i] = params[i];
 
+    bh_arr_free(params);
     return (AstType *) new;
 }
 
@@ -2175,7 +2207,7 @@ static AstTypeOf* parse_typeof(OnyxParser* parser) {
 
 static void type_create_scope(OnyxParser *parser, Scope ** scope, OnyxToken* token) {
     if (scope && !*scope) {
-        *scope = scope_create(context.ast_alloc, parser->current_scope, token->pos);
+        *scope = parser_scope_create(parser, parser->current_scope, token->pos);
 
         if (bh_arr_length(parser->current_symbol_stack) == 0) {
             (*scope)->name = "<anonymous>";
@@ -3080,11 +3112,8 @@ static b32 parse_possible_quick_function_definition(OnyxParser* parser, AstTyped
         strncat(text, param->token->text, 511);
         token_toggle_end(param->token);
 
-        OnyxToken* new_token = bh_alloc(parser->allocator, sizeof(OnyxToken));
-        new_token->type = Token_Type_Symbol;
-        new_token->length = 7 + param->token->length;
-        new_token->text = bh_strdup(parser->allocator, text);
-        new_token->pos = param->token->pos;
+        OnyxToken* new_token = token_create(parser->allocator, Token_Type_Symbol,
+            bh_strdup(parser->allocator, text), 7 + param->token->length, param->token->pos);
 
         AstNode* type_node = make_symbol(parser->allocator, new_token);
         type_node->flags |= Ast_Flag_Symbol_Is_PolyVar;
@@ -3358,7 +3387,11 @@ static AstForeignBlock* parse_foreign_block(OnyxParser* parser, OnyxToken *token
     //
     // This has a fun implication that there cannot be foreign blocks in the builtin
     // or type_info packages, as those are loaded before foreign_block_type has a value.
-    fb->type_node = foreign_block_type;
+    if (parser->record) {
+        bh_arr_push(parser->record->typed_late, (AstNode *) fb);
+    } else {
+        fb->type_node = foreign_block_type;
+    }
 
     bh_arr_new(global_heap_allocator, fb->captured_entities, 4);
     bh_arr_push(parser->alternate_entity_placement_stack, &fb->captured_entities);
@@ -3904,7 +3937,7 @@ static b32 parse_package_name(OnyxParser *parser, AstPackage *package) {
         total_package_name_length += (*token)->length + 1;
     }
 
-    char* package_name = bh_alloc_array(context.ast_alloc, char, total_package_name_length);
+    char* package_name = bh_alloc_array(parser->allocator, char, total_package_name_length);
     *package_name = '\0';
 
     bh_arr_each(OnyxToken *, token, package->path) {
@@ -4080,6 +4113,7 @@ OnyxParser onyx_parser_create(bh_allocator alloc, OnyxTokenizer *tokenizer) {
     parser.injection_point = NULL;
     parser.last_documentation_token = NULL;
     parser.allow_package_expressions = 0;
+    parser.record = NULL;
 
     parser.polymorph_context = (PolymorphicContext) {
         .root_node = NULL,
@@ -4107,15 +4141,35 @@ void onyx_parse(OnyxParser *parser) {
     // NOTE: Skip comments at the beginning of the file
     while (consume_token_if_next(parser, Token_Type_Comment));
 
-    parser->package = parse_file_package(parser);
-    parser->file_scope = scope_create(parser->allocator, parser->package->private_scope, parser->tokenizer->tokens[0].pos);
+    if (parser->record) {
+        //
+        // The package is looked up again by onyx_parse_replay. Until then,
+        // the record's stand in package is used.
+        ParserRecord *record = parser->record;
+        record->start = parser->curr;
+        if (parser->curr->type == Token_Type_Keyword_Package) {
+            parse_package_expression(parser);
+        }
+
+        record->package.scope = &record->package_scope;
+        record->package.private_scope = &record->package_private_scope;
+        parser->package = &record->package;
+
+    } else {
+        parser->package = parse_file_package(parser);
+    }
+
+    parser->file_scope = parser_scope_create(parser, parser->package->private_scope, parser->tokenizer->tokens[0].pos);
     parser->current_scope = parser->file_scope;
 
-    if (parse_possible_directive(parser, "allow_stale_code")
-        && !parser->package->is_included_somewhere
-        && !context.options->no_stale_code) {
-        bh_arr_new(global_heap_allocator, parser->package->buffered_entities, 32);
-        bh_arr_push(parser->alternate_entity_placement_stack, &parser->package->buffered_entities);
+    if (parse_possible_directive(parser, "allow_stale_code")) {
+        if (parser->record) {
+            parser->record->allow_stale_code = 1;
+
+        } else if (!parser->package->is_included_somewhere && !context.options->no_stale_code) {
+            bh_arr_new(global_heap_allocator, parser->package->buffered_entities, 32);
+            bh_arr_push(parser->alternate_entity_placement_stack, &parser->package->buffered_entities);
+        }
     }
 
     while (parse_possible_directive(parser, "package_doc")) {
@@ -4128,3 +4182,60 @@ void onyx_parse(OnyxParser *parser) {
 
     parser->current_scope = parser->current_scope->parent;
 }
+
+//
+// Does what a parse with a record left out, on the main thread. This has to
+// happen at the point the file would have been parsed, so packages, scopes
+// and entities are numbered as if it had been.
+void onyx_parse_replay(OnyxParser *parser) {
+    ParserRecord *record = parser->record;
+    assert(record);
+
+    parser->allocator = context.ast_alloc;
+    parser->record = NULL;
+    parser->prev = NULL;
+    parser->curr = record->start;
+
+    Package *package = parse_file_package(parser);
+    parser->package = package;
+
+    bh_arr_each(Scope *, scope, record->scopes) {
+        (*scope)->id = ++context.next_scope_id;
+    }
+
+    parser->file_scope->parent = package->private_scope;
+    parser->current_scope = package->private_scope;
+
+    bh_arr(Entity *) *top_level = NULL;
+    if (record->allow_stale_code && !package->is_included_somewhere && !context.options->no_stale_code) {
+        bh_arr_new(global_heap_allocator, package->buffered_entities, 32);
+        top_level = &package->buffered_entities;
+    }
+
+    bh_arr_each(OnyxToken *, doc_string, record->package.doc_strings) {
+        bh_arr_push(package->doc_strings, *doc_string);
+    }
+
+    bh_arr_each(ParserSubmission, submission, record->submissions) {
+        Scope *scope = submission->scope;
+        if (scope == &record->package_scope)         scope = package->scope;
+        if (scope == &record->package_private_scope) scope = package->private_scope;
+
+        bh_arr(Entity *) *target = submission->target ? submission->target : top_level;
+        add_entities_for_node(target, submission->node, scope, package);
+    }
+
+    bh_arr_each(AstNode *, node, record->typed_late) {
+        switch ((*node)->kind) {
+            case Ast_Kind_File_Contents:
+                ((AstFileContents *) *node)->type = type_make_slice(context.ast_alloc, &basic_types[Basic_Kind_U8]);
+                break;
+
+            case Ast_Kind_Foreign_Block:
+                ((AstForeignBlock *) *node)->type_node = foreign_block_type;
+                break;
+
+            default: assert(0);
+        }
+    }
+}
@@ -20,11 +20,6 @@ static b32 doing_nested_polymorph_lookup = 0;
 AstTyped node_that_signals_a_yield = { Ast_Kind_Function, 0 };
 AstTyped node_that_signals_failure = { Ast_Kind_Error, 0 };
 
-static void ensure_polyproc_cache_is_created(AstFunction* pp) {
-    if (pp->concrete_funcs == NULL)        sh_new_arena(pp->concrete_funcs);
-    if (pp->active_queries.hashes == NULL) bh_imap_init(&pp->active_queries, global_heap_allocator, 31);
-}
-
 void insert_poly_sln_into_scope(Scope* scope, AstPolySolution *sln) {
     AstNode *node = NULL;
 
@@ -58,50 +53,203 @@ static void insert_poly_slns_into_scope(Scope* scope, bh_arr(AstPolySolution) sl
     }
 }
 
-// NOTE: This might return a volatile string. Do not store it without copying it.
-static char* build_poly_solution_key(AstPolySolution* sln) {
-    if (sln->kind == PSK_Type) {
-        return (char *) type_get_unique_name(sln->type);
+//
+// Polymorphic instances are cached by a key made of words, instead of by name, so
+// looking up an instance never formats any strings. Each solution adds the atom of
+// the variable's name, a tag, and then either the type or the value it was solved to.
+// Nominal types (structures, enums, etc.) are their id. Other types are written out
+// from their parts: most of them are interned, but functions with an automatic return
+// type are not, and two equal ones have different ids.
+//
+// The key lives in storage owned by the caller, so building one is reentrant.
+//
+typedef struct PolyInstanceKey {
+    u64  hash;
+    u64 *words;
+    u32  length;
+    u32  capacity;
+
+    u64  inline_words[32];
+} PolyInstanceKey;
+
+#define POLY_KEY_TAG_TYPE   1
+#define POLY_KEY_TAG_NUMLIT 2
+#define POLY_KEY_TAG_VALUE  3
+
+static void poly_key_push(PolyInstanceKey *key, u64 word) {
+    if (key->length == key->capacity) {
+        u32 new_capacity = key->capacity * 2;
+        u64 *new_words = bh_alloc_array(global_heap_allocator, u64, new_capacity);
+        memcpy(new_words, key->words, key->length * sizeof(u64));
+
+        if (key->words != key->inline_words) bh_free(global_heap_allocator, key->words);
+        key->words = new_words;
+        key->capacity = new_capacity;
+    }
 
-    } else if (sln->kind == PSK_Value) {
-        static char buffer[256];
+    key->words[key->length++] = word;
+    key->hash = (key->hash ^ word) * 0x100000001b3ull;
+    key->hash ^= key->hash >> 29;
+}
+
+static void poly_key_push_type(PolyInstanceKey *key, Type *type) {
+    if (type == NULL) {
+        poly_key_push(key, 0);
+        return;
+    }
 
-        fori (i, 0, 256) buffer[i] = 0;
+    u64 kind = ((u64) type->kind) << 56;
 
-        if (sln->value->kind == Ast_Kind_NumLit) {
-            strncat(buffer, "NUMLIT:", 127);
-            strncat(buffer, bh_bprintf("%l", ((AstNumLit *) sln->value)->value.l), 127);
+    switch (type->kind) {
+        case Type_Kind_Pointer:      poly_key_push(key, kind); poly_key_push_type(key, type->Pointer.elem);      break;
+        case Type_Kind_MultiPointer: poly_key_push(key, kind); poly_key_push_type(key, type->MultiPointer.elem); break;
+        case Type_Kind_Array:        poly_key_push(key, kind | type->Array.count); poly_key_push_type(key, type->Array.elem); break;
+        case Type_Kind_Slice:        poly_key_push(key, kind); poly_key_push_type(key, type->Slice.elem);        break;
+        case Type_Kind_VarArgs:      poly_key_push(key, kind); poly_key_push_type(key, type->VarArgs.elem);      break;
+        case Type_Kind_DynArray:     poly_key_push(key, kind); poly_key_push_type(key, type->DynArray.elem);     break;
+
+        case Type_Kind_Function:
+            poly_key_push(key, kind | ((u64) (u16) type->Function.vararg_arg_pos << 32) | ((u64) type->Function.param_count << 16) | type->Function.needed_param_count);
+            fori (i, 0, type->Function.param_count) poly_key_push_type(key, type->Function.params[i]);
+            poly_key_push_type(key, type->Function.return_type);
+            break;
+
+        case Type_Kind_Compound:
+            poly_key_push(key, kind | type->Compound.count);
+            fori (i, 0, type->Compound.count) poly_key_push_type(key, type->Compound.types[i]);
+            break;
+
+        default:
+            poly_key_push(key, kind | type->id);
+            break;
+    }
+}
+
+static void build_poly_instance_key(PolyInstanceKey *key, bh_arr(AstPolySolution) slns) {
+    key->hash = 0xcbf29ce484222325ull;
+    key->words = key->inline_words;
+    key->length = 0;
+    key->capacity = sizeof(key->inline_words) / sizeof(u64);
+
+    bh_arr_each(AstPolySolution, sln, slns) {
+        poly_key_push(key, (u64) token_atom(sln->poly_sym->token));
+
+        if (sln->kind == PSK_Type) {
+            poly_key_push(key, POLY_KEY_TAG_TYPE);
+            poly_key_push_type(key, sln->type);
+
+        } else if (sln->value->kind == Ast_Kind_NumLit) {
+            poly_key_push(key, POLY_KEY_TAG_NUMLIT);
+            poly_key_push(key, ((AstNumLit *) sln->value)->value.l);
 
         } else {
             // HACK: For now, the value pointer is just used. This means that
             // sometimes, even through the solution is the same, it won't be
             // stored the same.
-            bh_snprintf(buffer, 128, "%p", sln->value);
+            poly_key_push(key, POLY_KEY_TAG_VALUE);
+            poly_key_push(key, (u64) sln->value);
         }
+    }
+}
 
-        return buffer;
+static void poly_instance_key_free(PolyInstanceKey *key) {
+    if (key->words != key->inline_words) bh_free(global_heap_allocator, key->words);
+    key->words = NULL;
+}
+
+// Creates the cache in *slot if there is none yet. Two threads can race to create
+// it, and the one that loses frees its copy.
+static PolyInstanceCache *poly_instance_cache_ensure(PolyInstanceCache **slot) {
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    PolyInstanceCache *cache = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+    PolyInstanceCache *cache = *slot;
+#endif
+
+    if (cache) return cache;
+
+    PolyInstanceCache *created = bh_alloc_item(global_heap_allocator, PolyInstanceCache);
+    bh_imap_init(&created->instances, global_heap_allocator, 31);
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    pthread_mutex_init(&created->lock, NULL);
+
+    if (!__atomic_compare_exchange_n(slot, &cache, created, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_destroy(&created->lock);
+        bh_imap_free(&created->instances);
+        bh_free(global_heap_allocator, created);
+        return cache;
+    }
+#else
+    *slot = created;
+#endif
+
+    return created;
+}
+
+static inline void poly_instance_cache_lock(PolyInstanceCache *cache) {
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    pthread_mutex_lock(&cache->lock);
+#endif
+}
+
+static inline void poly_instance_cache_unlock(PolyInstanceCache *cache) {
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+// Must be called with the lock held.
+static PolyInstance *poly_instance_find(PolyInstanceCache *cache, PolyInstanceKey *key) {
+    PolyInstance *inst = (PolyInstance *) bh_imap_get(&cache->instances, key->hash);
+    while (inst) {
+        if (inst->key_length == key->length && !memcmp(inst->key, key->words, key->length * sizeof(u64))) {
+            return inst;
+        }
+
+        inst = inst->next;
     }
 
     return NULL;
 }
 
-// NOTE: This returns a volatile string. Do not store it without copying it.
-static char* build_poly_slns_unique_key(bh_arr(AstPolySolution) slns) {
-    static char key_buf[1024];
-    fori (i, 0, 1024) key_buf[i] = 0;
+// Copies the instance for this key into out, if there is one.
+static b32 poly_instance_lookup(PolyInstanceCache *cache, PolyInstanceKey *key, PolyInstance *out) {
+    poly_instance_cache_lock(cache);
 
-    bh_arr_each(AstPolySolution, sln, slns) {
-        token_toggle_end(sln->poly_sym->token);
+    PolyInstance *inst = poly_instance_find(cache, key);
+    if (inst) *out = *inst;
+
+    poly_instance_cache_unlock(cache);
+    return inst != NULL;
+}
 
-        strncat(key_buf, sln->poly_sym->token->text, 1023);
-        strncat(key_buf, "=", 1023);
-        strncat(key_buf, build_poly_solution_key(sln), 1023);
-        strncat(key_buf, ";", 1023);
+// Adds the instance for this key, or replaces the one that is there. Only the
+// value's func, struct_type or union_type is used.
+static void poly_instance_store(PolyInstanceCache *cache, PolyInstanceKey *key, PolyInstance value) {
+    poly_instance_cache_lock(cache);
 
-        token_toggle_end(sln->poly_sym->token);
+    PolyInstance *inst = poly_instance_find(cache, key);
+    if (!inst) {
+        inst = bh_alloc_item(context.ast_alloc, PolyInstance);
+        memset(inst, 0, sizeof(*inst));
+
+        inst->key = bh_alloc_array(context.ast_alloc, u64, key->length);
+        inst->key_length = key->length;
+        memcpy(inst->key, key->words, key->length * sizeof(u64));
+
+        inst->next = (PolyInstance *) bh_imap_get(&cache->instances, key->hash);
+        bh_imap_put(&cache->instances, key->hash, (u64) inst);
     }
 
-    return key_buf;
+    inst->func = value.func;
+
+    poly_instance_cache_unlock(cache);
+}
+
+static void ensure_polyproc_cache_is_created(AstFunction* pp) {
+    poly_instance_cache_ensure(&pp->concrete_funcs);
+    if (pp->active_queries.hashes == NULL) bh_imap_init(&pp->active_queries, global_heap_allocator, 31);
 }
 
 // NOTE: This function adds a solidified function to the entity heap for it to be processed
@@ -815,10 +963,12 @@ AstFunction* polymorphic_proc_solidify(AstFunction* pp, bh_arr(AstPolySolution)
     ensure_polyproc_cache_is_created(pp);
 
     // NOTE: Check if a version of this polyproc has already been created.
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(pp->concrete_funcs, unique_key);
-    if (index != -1) {
-        AstSolidifiedFunction solidified_func = pp->concrete_funcs[index].value;
+    PolyInstanceKey key;
+    build_poly_instance_key(&key, slns);
+    PolyInstance inst;
+    if (poly_instance_lookup(pp->concrete_funcs, &key, &inst)) {
+        poly_instance_key_free(&key);
+        AstSolidifiedFunction solidified_func = inst.func;
 
         // NOTE: If this solution was originally created from a "build_only_header" call, then the body
         // will not have been or type checked, or anything. This ensures that the body is copied, the
@@ -838,7 +988,8 @@ AstFunction* polymorphic_proc_solidify(AstFunction* pp, bh_arr(AstPolySolution)
     add_solidified_function_entities(&solidified_func);
 
     // NOTE: Cache the function for later use, reducing duplicate functions.
-    shput(pp->concrete_funcs, unique_key, solidified_func);
+    poly_instance_store(pp->concrete_funcs, &key, (PolyInstance) { .func = solidified_func });
+    poly_instance_key_free(&key);
 
     return (AstFunction *) &node_that_signals_a_yield;
 }
@@ -915,10 +1066,11 @@ AstFunction* polymorphic_proc_build_only_header(AstFunction* pp, PolyProcLookupM
 AstFunction* polymorphic_proc_build_only_header_with_slns(AstFunction* pp, bh_arr(AstPolySolution) slns, b32 error_if_failed) {
     AstSolidifiedFunction solidified_func;
 
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(pp->concrete_funcs, unique_key);
-    if (index != -1) {
-        solidified_func = pp->concrete_funcs[index].value;
+    PolyInstanceKey key;
+    build_poly_instance_key(&key, slns);
+    PolyInstance inst;
+    if (poly_instance_lookup(pp->concrete_funcs, &key, &inst)) {
+        solidified_func = inst.func;
 
     } else {
         // NOTE: This function is only going to have the header of it correctly created.
@@ -928,6 +1080,8 @@ AstFunction* polymorphic_proc_build_only_header_with_slns(AstFunction* pp, bh_ar
     }
 
     if (solidified_func.func_header_entity) {
+        poly_instance_key_free(&key);
+
         if (solidified_func.func_header_entity->state == Entity_State_Finalized) return solidified_func.func;
         if (solidified_func.func_header_entity->state == Entity_State_Failed)    return NULL;
 
@@ -948,7 +1102,8 @@ AstFunction* polymorphic_proc_build_only_header_with_slns(AstFunction* pp, bh_ar
     solidified_func.func_header_entity = func_header_entity_ptr;
 
     // NOTE: Cache the function for later use.
-    shput(pp->concrete_funcs, unique_key, solidified_func);
+    poly_instance_store(pp->concrete_funcs, &key, (PolyInstance) { .func = solidified_func });
+    poly_instance_key_free(&key);
 
     return (AstFunction *) &node_that_signals_a_yield;
 }
@@ -1040,11 +1195,8 @@ b32 potentially_convert_function_to_polyproc(AstFunction *func) {
         *apv->replace = (AstType *) pcall;
 
         fori (i, 0, apv->variable_count) {
-            OnyxToken* name_token = bh_alloc_item(context.ast_alloc, OnyxToken);
-            name_token->text = bh_aprintf(context.ast_alloc, "__autopoly_var_%d\0", param_idx);
-            name_token->length = strlen(name_token->text);
-            name_token->type = Token_Type_Symbol;
-            name_token->pos  = pcall->token->pos;
+            char* name = bh_aprintf(context.ast_alloc, "__autopoly_var_%d\0", param_idx);
+            OnyxToken* name_token = token_create(context.ast_alloc, Token_Type_Symbol, name, strlen(name), pcall->token->pos);
 
             pp.poly_sym = make_symbol(context.ast_alloc, name_token);
             pp.poly_sym->flags |= Ast_Flag_Symbol_Is_PolyVar;
@@ -1142,9 +1294,7 @@ Type* polymorphic_struct_lookup(AstPolyStructType* ps_type, bh_arr(AstPolySoluti
 
     assert(!ps_type->base_struct->scope);
 
-    if (ps_type->concrete_structs == NULL) {
-        sh_new_arena(ps_type->concrete_structs);
-    }
+    poly_instance_cache_ensure(&ps_type->concrete_structs);
 
     if (bh_arr_length(slns) != bh_arr_length(ps_type->poly_params)) {
         onyx_report_error(pos, Error_Critical, "Wrong number of arguments for '%s'. Expected %d, got %d.",
@@ -1161,10 +1311,12 @@ Type* polymorphic_struct_lookup(AstPolyStructType* ps_type, bh_arr(AstPolySoluti
         i++;
     }
 
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(ps_type->concrete_structs, unique_key);
-    if (index != -1) {
-        AstStructType* concrete_struct = ps_type->concrete_structs[index].value;
+    PolyInstanceKey key;
+    build_poly_instance_key(&key, slns);
+    PolyInstance inst;
+    if (poly_instance_lookup(ps_type->concrete_structs, &key, &inst)) {
+        poly_instance_key_free(&key);
+        AstStructType* concrete_struct = inst.struct_type;
 
         if (concrete_struct->entity_type->state < Entity_State_Check_Types) {
             return NULL;
@@ -1203,7 +1355,8 @@ Type* polymorphic_struct_lookup(AstPolyStructType* ps_type, bh_arr(AstPolySoluti
         concrete_struct->polymorphic_argument_types[i] = (AstType *) ast_clone(context.ast_alloc, ps_type->poly_params[i].type_node);
     }
 
-    shput(ps_type->concrete_structs, unique_key, concrete_struct);
+    poly_instance_store(ps_type->concrete_structs, &key, (PolyInstance) { .struct_type = concrete_struct });
+    poly_instance_key_free(&key);
     add_entities_for_node(NULL, (AstNode *) concrete_struct, sln_scope, NULL);
     return NULL;
 }
@@ -1215,9 +1368,7 @@ Type* polymorphic_union_lookup(AstPolyUnionType* pu_type, bh_arr(AstPolySolution
 
     assert(!pu_type->base_union->scope);
 
-    if (pu_type->concrete_unions == NULL) {
-        sh_new_arena(pu_type->concrete_unions);
-    }
+    poly_instance_cache_ensure(&pu_type->concrete_unions);
 
     if (bh_arr_length(slns) != bh_arr_length(pu_type->poly_params)) {
         onyx_report_error(pos, Error_Critical, "Wrong number of arguments for '%s'. Expected %d, got %d.",
@@ -1234,10 +1385,12 @@ Type* polymorphic_union_lookup(AstPolyUnionType* pu_type, bh_arr(AstPolySolution
         i++;
     }
 
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(pu_type->concrete_unions, unique_key);
-    if (index != -1) {
-        AstUnionType* concrete_union = pu_type->concrete_unions[index].value;
+    PolyInstanceKey key;
+    build_poly_instance_key(&key, slns);
+    PolyInstance inst;
+    if (poly_instance_lookup(pu_type->concrete_unions, &key, &inst)) {
+        poly_instance_key_free(&key);
+        AstUnionType* concrete_union = inst.union_type;
 
         if (concrete_union->entity->state < Entity_State_Check_Types) {
             return NULL;
@@ -1276,7 +1429,8 @@ Type* polymorphic_union_lookup(AstPolyUnionType* pu_type, bh_arr(AstPolySolution
         concrete_union->polymorphic_argument_types[i] = (AstType *) ast_clone(context.ast_alloc, pu_type->poly_params[i].type_node);
     }
 
-    shput(pu_type->concrete_unions, unique_key, concrete_union);
+    poly_instance_store(pu_type->concrete_unions, &key, (PolyInstance) { .union_type = concrete_union });
+    poly_instance_key_free(&key);
     add_entities_for_node(NULL, (AstNode *) concrete_union, sln_scope, NULL);
     return NULL;
 }
@@ -1178,11 +1178,8 @@ SymresStatus symres_function_header(AstFunction* func) {
     SYMRES(type, &func->return_type);
 
     if (context.options->stack_trace_enabled) {
-        OnyxToken *stack_trace_token = bh_alloc_item(context.ast_alloc, OnyxToken);
-        stack_trace_token->type = Token_Type_Symbol;
-        stack_trace_token->length = 13;
-        stack_trace_token->text = bh_strdup(context.ast_alloc, "__stack_trace ");
-        stack_trace_token->pos = func->token->pos;
+        OnyxToken *stack_trace_token = token_create(context.ast_alloc, Token_Type_Symbol,
+            bh_strdup(context.ast_alloc, "__stack_trace "), 13, func->token->pos);
 
         if (!func->stack_trace_local) {
             assert(builtin_stack_trace_type);
@@ -1243,10 +1240,10 @@ SymresStatus symres_function(AstFunction* func) {
 
                     if (st->Struct.status != SPS_Uses_Done) return Symres_Yield_Macro;
 
-                    fori (i, 0, shlen(st->Struct.members)) {
+                    fori (i, 0, hmlen(st->Struct.members)) {
                         StructMember* value = st->Struct.members[i].value;
                         AstFieldAccess* fa = make_field_access(context.ast_alloc, (AstTyped *) param->local, value->name);
-                        symbol_raw_introduce(current_scope, value->name, param->local->token->pos, (AstNode *) fa);
+                        symbol_atom_introduce(current_scope, value->name, param->local->token->pos, (AstNode *) fa);
                     }
 
                     param->use_processed = 1;
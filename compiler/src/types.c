@@ -39,15 +39,96 @@ Type basic_types[] = {
     { Type_Kind_Basic, 0, 0, (AstType *) &basic_type_type_expr, { Basic_Kind_Type_Index, Basic_Flag_Type_Index,          4,  4, "type_expr" } },
 };
 
-// TODO: Document this!!
+// Type id -> Type*
        bh_imap type_map;
-static bh_imap type_pointer_map;
-static bh_imap type_multi_pointer_map;
-static bh_imap type_array_map;
-static bh_imap type_slice_map;
-static bh_imap type_dynarr_map;
-static bh_imap type_vararg_map;
-static Table(u64) type_func_map;
+
+//
+// Types built out of other types (pointers, arrays, slices, functions, compounds, etc.)
+// are hash-consed. A TypeShape describes the type being built, and type_intern_map maps
+// the hash of a shape to the one Type with that shape, so building the same type twice
+// gives back the same Type*. Two of these types are equal exactly when they are the
+// same pointer. If two shapes hash the same, the later one is stored at the next hash.
+//
+// Functions with an automatic return type are interned by type_intern_resolved_function
+// once the checker has filled in their return type, and typeof waits for that. Until
+// then they are distinct types, and a node that took one of them while the function was
+// being checked can keep it; types_are_compatible still finds it equal structurally.
+//
+static bh_imap type_intern_map;
+
+typedef struct TypeShape {
+    TypeKind kind;
+
+    // Pointer, slice, etc.: the element type. Function: the return type.
+    Type *elem;
+
+    // Array: the number of elements. Function and Compound: the number of parts.
+    u32 count;
+
+    u16 needed_param_count;
+    i16 vararg_arg_pos;
+
+    // Function: the parameter types. Compound: the types of the elements.
+    Type **parts;
+} TypeShape;
+
+static u64 type_shape_hash(TypeShape *shape) {
+    u64 hash = 0xcbf29ce484222325ull;
+
+#define MIX(x) (hash = (hash ^ (u64) (x)) * 0x100000001b3ull)
+    MIX(shape->kind);
+    MIX(shape->elem ? shape->elem->id : 0);
+    MIX(shape->count);
+    MIX(shape->needed_param_count);
+    MIX((u16) shape->vararg_arg_pos);
+
+    if (shape->parts) {
+        fori (i, 0, shape->count) MIX(shape->parts[i] ? shape->parts[i]->id : 0);
+    }
+#undef MIX
+
+    return hash;
+}
+
+static b32 type_has_shape(Type *type, TypeShape *shape) {
+    if (type->kind != shape->kind) return 0;
+
+    switch (type->kind) {
+        case Type_Kind_Pointer:      return type->Pointer.elem == shape->elem;
+        case Type_Kind_MultiPointer: return type->MultiPointer.elem == shape->elem;
+        case Type_Kind_Slice:        return type->Slice.elem == shape->elem;
+        case Type_Kind_DynArray:     return type->DynArray.elem == shape->elem;
+        case Type_Kind_VarArgs:      return type->VarArgs.elem == shape->elem;
+        case Type_Kind_Array:        return type->Array.elem == shape->elem && type->Array.count == shape->count;
+
+        case Type_Kind_Function:
+            if (type->Function.return_type != shape->elem
+                || type->Function.param_count != shape->count
+                || type->Function.needed_param_count != shape->needed_param_count
+                || type->Function.vararg_arg_pos != shape->vararg_arg_pos) return 0;
+
+            return !memcmp(type->Function.params, shape->parts, shape->count * sizeof(Type *));
+
+        case Type_Kind_Compound:
+            if (type->Compound.count != shape->count) return 0;
+            return !memcmp(type->Compound.types, shape->parts, shape->count * sizeof(Type *));
+
+        default: return 0;
+    }
+}
+
+// Returns the type with this shape, or NULL and the hash to intern a new type at.
+static Type* type_intern_lookup(TypeShape *shape, u64 *hash) {
+    *hash = type_shape_hash(shape);
+
+    Type *type;
+    while ((type = (Type *) bh_imap_get(&type_intern_map, *hash))) {
+        if (type_has_shape(type, shape)) return type;
+        *hash += 1;
+    }
+
+    return NULL;
+}
 
 static Type* type_create(TypeKind kind, bh_allocator a, u32 extra_type_pointer_count) {
     Type* type = bh_alloc(a, sizeof(Type) + sizeof(Type *) * extra_type_pointer_count);
@@ -65,21 +146,53 @@ static void type_register(Type* type) {
     bh_imap_put(&type_map, type->id, (u64) type);
 }
 
+static void type_intern(Type* type, u64 hash) {
+    type_register(type);
+    bh_imap_put(&type_intern_map, hash, (u64) type);
+}
+
+static StructMember slice_members[] = {
+    { 0,            0, NULL,                         "data",   NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE, 1, &basic_types[Basic_Kind_U32], "count",  NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE, 1, &basic_types[Basic_Kind_U32], "size",   NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE, 1, &basic_types[Basic_Kind_U32], "length", NULL, NULL, -1, 0, 0 },
+};
+
+static StructMember array_members[] = {
+    { 0,                0, NULL,                         "data",      NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE,     1, &basic_types[Basic_Kind_U32], "count",     NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE + 4, 2, &basic_types[Basic_Kind_U32], "capacity",  NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE + 8, 3, NULL,                         "allocator", NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE,     1, &basic_types[Basic_Kind_U32], "size",      NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE,     1, &basic_types[Basic_Kind_U32], "length",    NULL, NULL, -1, 0, 0 },
+};
+
+static StructMember func_members[] = {
+    { 0,                0, &basic_types[Basic_Kind_U32],    "__funcidx",    NULL, NULL, -1, 0, 0 },
+    { POINTER_SIZE,     1, &basic_types[Basic_Kind_Rawptr], "closure",      NULL, NULL, -1, 0, 0 },
+    { 2 * POINTER_SIZE, 2, &basic_types[Basic_Kind_U32],    "closure_size", NULL, NULL, -1, 0, 0 },
+};
+
+static StructMember union_members[] = {
+    { 0, 0, NULL, "tag", NULL, NULL, -1, 0, 0 },
+};
+
 void types_init() {
 #define MAKE_MAP(x) (memset(&x, 0, sizeof(x)), bh_imap_init(&x, global_heap_allocator, 255))
     MAKE_MAP(type_map);
-    MAKE_MAP(type_pointer_map);
-    MAKE_MAP(type_multi_pointer_map);
-    MAKE_MAP(type_array_map);
-    MAKE_MAP(type_slice_map);
-    MAKE_MAP(type_dynarr_map);
-    MAKE_MAP(type_vararg_map);
-
-    type_func_map = NULL;
-    sh_new_arena(type_func_map);
+    MAKE_MAP(type_intern_map);
 
     fori (i, 0, Basic_Kind_Count) type_register(&basic_types[i]);
 #undef MAKE_MAP
+
+    // Members are looked up by atom, so the names of the built-in members
+    // have to be atoms too. Interning an atom again gives back the same atom.
+#define INTERN_NAMES(arr) fori (i, 0, (i64) (sizeof(arr) / sizeof(StructMember))) arr[i].name = atom_intern_cstr(arr[i].name)
+    INTERN_NAMES(slice_members);
+    INTERN_NAMES(array_members);
+    INTERN_NAMES(func_members);
+    INTERN_NAMES(union_members);
+#undef INTERN_NAMES
 }
 
 void types_dump_type_info() {
@@ -294,6 +407,73 @@ u32 type_alignment_of(Type* type) {
     }
 }
 
+static Type* type_make_function(bh_allocator alloc, TypeShape *shape, AstType *ast_type) {
+    u64 hash = 0;
+    b32 interned = shape->elem != &type_auto_return;
+
+    if (interned) {
+        Type* existing = type_intern_lookup(shape, &hash);
+        if (existing) return existing;
+    }
+
+    Type* func_type = type_create(Type_Kind_Function, alloc, shape->count);
+    func_type->ast_type = ast_type;
+    func_type->Function.param_count = shape->count;
+    func_type->Function.needed_param_count = shape->needed_param_count;
+    func_type->Function.vararg_arg_pos = shape->vararg_arg_pos;
+    func_type->Function.return_type = shape->elem;
+    fori (i, 0, shape->count) func_type->Function.params[i] = shape->parts[i];
+
+    if (interned) type_intern(func_type, hash);
+    else          type_register(func_type);
+
+    return func_type;
+}
+
+Type* type_intern_resolved_function(Type* func_type) {
+    assert(func_type->kind == Type_Kind_Function);
+    assert(func_type->Function.return_type != &type_auto_return);
+
+    TypeShape shape = {
+        Type_Kind_Function, func_type->Function.return_type, func_type->Function.param_count,
+        func_type->Function.needed_param_count, func_type->Function.vararg_arg_pos, func_type->Function.params
+    };
+
+    u64 hash;
+    Type* existing = type_intern_lookup(&shape, &hash);
+    if (existing) return existing;
+
+    // Already registered when it was built.
+    bh_imap_put(&type_intern_map, hash, (u64) func_type);
+    return func_type;
+}
+
+static Type* type_make_compound(bh_allocator alloc, Type **types, u32 count) {
+    TypeShape shape = { Type_Kind_Compound, NULL, count, 0, 0, types };
+
+    u64 hash;
+    Type* existing = type_intern_lookup(&shape, &hash);
+    if (existing) return existing;
+
+    Type* comp_type = type_create(Type_Kind_Compound, alloc, count);
+    comp_type->Compound.size = 0;
+    comp_type->Compound.count = count;
+
+    fori (i, 0, count) {
+        comp_type->Compound.types[i] = types[i];
+        comp_type->Compound.size += bh_max(type_size_of(types[i]), 4);
+    }
+
+    bh_align(comp_type->Compound.size, 4);
+
+    comp_type->Compound.linear_members = NULL;
+    bh_arr_new(global_heap_allocator, comp_type->Compound.linear_members, comp_type->Compound.count);
+    build_linear_types_with_offset(comp_type, &comp_type->Compound.linear_members, 0);
+
+    type_intern(comp_type, hash);
+    return comp_type;
+}
+
 static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b32 accept_partial_types) {
     if (type_node == NULL) return NULL;
 
@@ -319,37 +499,23 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
             Type* return_type = type_build_from_ast_inner(alloc, ftype_node->return_type, 1);
             if (return_type == NULL) return NULL;
 
-            Type* func_type = type_create(Type_Kind_Function, alloc, param_count);
-            func_type->ast_type = type_node;
-            func_type->Function.param_count = param_count;
-            func_type->Function.needed_param_count = param_count;
-            func_type->Function.vararg_arg_pos = -1;
-            func_type->Function.return_type = return_type;
+            bh_arr(Type *) params = NULL;
+            bh_arr_new(global_heap_allocator, params, param_count);
 
-            if (param_count > 0) {
-                fori (i, 0, (i64) param_count) {
-                    func_type->Function.params[i] = type_build_from_ast_inner(alloc, ftype_node->params[i], 1);
-
-                    // LEAK LEAK LEAK
-                    if (func_type->Function.params[i] == NULL) return NULL;
+            fori (i, 0, (i64) param_count) {
+                Type *param_type = type_build_from_ast_inner(alloc, ftype_node->params[i], 1);
+                if (param_type == NULL) {
+                    bh_arr_free(params);
+                    return NULL;
                 }
-            }
 
-            char* name = (char *) type_get_unique_name(func_type);
-            if (func_type->Function.return_type != &type_auto_return) {
-                i32 index = shgeti(type_func_map, name);
-                if (index != -1) {
-                    u64 id = type_func_map[index].value;
-                    Type* existing_type = (Type *) bh_imap_get(&type_map, id);
-
-                    // LEAK LEAK LEAK the func_type that is created
-                    return existing_type;
-                }
+                bh_arr_push(params, param_type);
             }
 
-            type_register(func_type);
-            shput(type_func_map, name, func_type->id);
+            TypeShape shape = { Type_Kind_Function, return_type, param_count, param_count, -1, params };
+            Type* func_type = type_make_function(alloc, &shape, type_node);
 
+            bh_arr_free(params);
             return func_type;
         }
 
@@ -425,7 +591,7 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
                 type_register(s_type);
 
                 s_type->Struct.memarr = NULL;
-                sh_new_arena(s_type->Struct.members);
+                s_type->Struct.members = NULL;
                 bh_arr_new(global_heap_allocator, s_type->Struct.memarr, s_type->Struct.mem_count);
 
             } else {
@@ -433,8 +599,7 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
             }
 
             bh_arr_clear(s_type->Struct.memarr);
-            shfree(s_type->Struct.members);
-            sh_new_arena(s_type->Struct.members);
+            hmfree(s_type->Struct.members);
 
             s_node->pending_type_is_valid = 1;
 
@@ -473,10 +638,9 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
                     bh_align(offset, mem_alignment);
                 }
 
-                token_toggle_end((*member)->token);
-                if (shgeti(s_type->Struct.members, (*member)->token->text) != -1) {
-                    onyx_report_error((*member)->token->pos, Error_Critical, "Duplicate struct member, '%s'.", (*member)->token->text);
-                    token_toggle_end((*member)->token);
+                char *member_name = token_atom((*member)->token);
+                if (hmgeti(s_type->Struct.members, member_name) != -1) {
+                    onyx_report_error((*member)->token->pos, Error_Critical, "Duplicate struct member, '%s'.", member_name);
                     return NULL;
                 }
 
@@ -484,7 +648,7 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
                 smem->offset = offset;
                 smem->type = (*member)->type;
                 smem->idx = idx;
-                smem->name = bh_strdup(alloc, (*member)->token->text);
+                smem->name = member_name;
                 smem->token = (*member)->token;
                 smem->initial_value = &(*member)->initial_value;
                 smem->meta_tags = (*member)->meta_tags;
@@ -493,9 +657,8 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
                 smem->included_through_use = 0;
                 smem->used = (*member)->is_used;
                 smem->use_through_pointer_index = -1;
-                shput(s_type->Struct.members, (*member)->token->text, smem);
+                hmput(s_type->Struct.members, member_name, smem);
                 bh_arr_push(s_type->Struct.memarr, smem);
-                token_toggle_end((*member)->token);
 
                 u32 type_size = type_size_of((*member)->type);
 
@@ -660,27 +823,23 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
 
             i64 type_count = bh_arr_length(ctype->types);
 
-            Type* comp_type = type_create(Type_Kind_Compound, alloc, type_count);
-            comp_type->Compound.size = 0;
-            comp_type->Compound.count = type_count;
+            bh_arr(Type *) types = NULL;
+            bh_arr_new(global_heap_allocator, types, type_count);
 
             fori (i, 0, type_count) {
                 assert(ctype->types[i] != NULL);
-                comp_type->Compound.types[i] = type_build_from_ast_inner(alloc, ctype->types[i], 1);
-
-                // LEAK LEAK LEAK
-                if (comp_type->Compound.types[i] == NULL) return NULL;
+                Type *elem_type = type_build_from_ast_inner(alloc, ctype->types[i], 1);
+                if (elem_type == NULL) {
+                    bh_arr_free(types);
+                    return NULL;
+                }
 
-                comp_type->Compound.size += bh_max(type_size_of(comp_type->Compound.types[i]), 4);
+                bh_arr_push(types, elem_type);
             }
 
-            bh_align(comp_type->Compound.size, 4);
-
-            comp_type->Compound.linear_members = NULL;
-            bh_arr_new(global_heap_allocator, comp_type->Compound.linear_members, comp_type->Compound.count);
-            build_linear_types_with_offset(comp_type, &comp_type->Compound.linear_members, 0);
+            Type* comp_type = type_make_compound(alloc, types, type_count);
 
-            type_register(comp_type);
+            bh_arr_free(types);
             return comp_type;
         }
 
@@ -843,48 +1002,33 @@ Type *type_build_from_ast(bh_allocator alloc, AstType* type_node) {
     return type_build_from_ast_inner(alloc, type_node, 0);
 }
 
-// CLEANUP: This needs to be merged with the very similar code from up above.
 Type* type_build_function_type(bh_allocator alloc, AstFunction* func) {
     u64 param_count = bh_arr_length(func->params);
 
     Type* return_type = type_build_from_ast(alloc, func->return_type);
     if (return_type == NULL) return NULL;
 
-    Type* func_type = type_create(Type_Kind_Function, alloc, param_count);
-    func_type->Function.param_count = param_count;
-    func_type->Function.needed_param_count = 0;
-    func_type->Function.vararg_arg_pos = -1;
-    func_type->Function.return_type = return_type;
-
-    if (param_count > 0) {
-        i32 i = 0;
-        bh_arr_each(AstParam, param, func->params) {
-            if (param->default_value == NULL && param->vararg_kind == VA_Kind_Not_VA)
-                func_type->Function.needed_param_count++;
+    bh_arr(Type *) params = NULL;
+    bh_arr_new(global_heap_allocator, params, param_count);
 
-            if (param->vararg_kind == VA_Kind_Untyped)
-                func_type->Function.vararg_arg_pos = i;
+    TypeShape shape = { Type_Kind_Function, return_type, param_count, 0, -1, NULL };
 
-            func_type->Function.params[i++] = param->local->type;
-        }
-    }
+    i32 i = 0;
+    bh_arr_each(AstParam, param, func->params) {
+        if (param->default_value == NULL && param->vararg_kind == VA_Kind_Not_VA)
+            shape.needed_param_count++;
 
-    // CopyPaste from above in type_build_from_ast
-    char* name = (char *) type_get_unique_name(func_type);
-    if (func_type->Function.return_type != &type_auto_return) {
-        i32 index = shgeti(type_func_map, name);
-        if (index != -1) {
-            u64 id = type_func_map[index].value;
-            Type* existing_type = (Type *) bh_imap_get(&type_map, id);
+        if (param->vararg_kind == VA_Kind_Untyped)
+            shape.vararg_arg_pos = i;
 
-            // LEAK LEAK LEAK the func_type that is created
-            return existing_type;
-        }
+        bh_arr_push(params, param->local->type);
+        i++;
     }
 
-    type_register(func_type);
-    shput(type_func_map, name, func_type->id);
+    shape.parts = params;
+    Type* func_type = type_make_function(alloc, &shape, NULL);
 
+    bh_arr_free(params);
     return func_type;
 }
 
@@ -899,23 +1043,13 @@ Type* type_build_compound_type(bh_allocator alloc, AstCompound* compound) {
         }
     }
 
-    Type* comp_type = type_create(Type_Kind_Compound, alloc, expr_count);
-    comp_type->Compound.size = 0;
-    comp_type->Compound.count = expr_count;
+    bh_arr(Type *) types = NULL;
+    bh_arr_new(global_heap_allocator, types, expr_count);
+    fori (i, 0, expr_count) bh_arr_push(types, compound->exprs[i]->type);
 
-    fori (i, 0, expr_count) {
-        assert(compound->exprs[i]->type != NULL);
-        comp_type->Compound.types[i] = compound->exprs[i]->type;
-        comp_type->Compound.size += bh_max(type_size_of(comp_type->Compound.types[i]), 4);
-    }
+    Type* comp_type = type_make_compound(alloc, types, expr_count);
 
-    bh_align(comp_type->Compound.size, 4);
-
-    comp_type->Compound.linear_members = NULL;
-    bh_arr_new(global_heap_allocator, comp_type->Compound.linear_members, comp_type->Compound.count);
-    build_linear_types_with_offset(comp_type, &comp_type->Compound.linear_members, 0);
-
-    type_register(comp_type);
+    bh_arr_free(types);
     return comp_type;
 }
 
@@ -935,7 +1069,7 @@ Type* type_build_implicit_type_of_struct_literal(bh_allocator alloc, AstStructLi
     type_register(type);
 
     type->Struct.memarr = NULL;
-    sh_new_arena(type->Struct.members);
+    type->Struct.members = NULL;
     bh_arr_new(global_heap_allocator, type->Struct.memarr, type->Struct.mem_count);
 
     u32 size = 0;
@@ -960,9 +1094,8 @@ Type* type_build_implicit_type_of_struct_literal(bh_allocator alloc, AstStructLi
         // Should these structs be packed or not?
         bh_align(offset, mem_alignment);
 
-        token_toggle_end(nv->token);
-        if (shgeti(type->Struct.members, nv->token->text) != -1) {
-            token_toggle_end(nv->token);
+        char *member_name = token_atom(nv->token);
+        if (hmgeti(type->Struct.members, member_name) != -1) {
             return NULL;
         }
 
@@ -970,7 +1103,7 @@ Type* type_build_implicit_type_of_struct_literal(bh_allocator alloc, AstStructLi
         smem->offset = offset;
         smem->type = member_type;
         smem->idx = idx;
-        smem->name = bh_strdup(alloc, nv->token->text);
+        smem->name = member_name;
         smem->token = nv->token;
         smem->meta_tags = NULL;
         smem->included_through_use = 0;
@@ -985,9 +1118,8 @@ Type* type_build_implicit_type_of_struct_literal(bh_allocator alloc, AstStructLi
         // smem->initial_value = &nv->value;
         smem->initial_value = NULL;
 
-        shput(type->Struct.members, nv->token->text, smem);
+        hmput(type->Struct.members, member_name, smem);
         bh_arr_push(type->Struct.memarr, smem);
-        token_toggle_end(nv->token);
 
         u32 type_size = type_size_of(member_type);
         offset += type_size;
@@ -1008,22 +1140,19 @@ Type* type_make_pointer(bh_allocator alloc, Type* to) {
     if (to == (Type *) &node_that_signals_failure) return to;
 
     assert(to->id > 0);
-    u64 ptr_id = bh_imap_get(&type_pointer_map, to->id);
-    if (ptr_id > 0) {
-        Type* ptr_type = (Type *) bh_imap_get(&type_map, ptr_id);
-        return ptr_type;
+    TypeShape shape = { Type_Kind_Pointer, to };
 
-    } else {
-        Type* ptr_type = type_create(Type_Kind_Pointer, alloc, 0);
-        ptr_type->Pointer.base.flags |= Basic_Flag_Pointer;
-        ptr_type->Pointer.base.size = POINTER_SIZE;
-        ptr_type->Pointer.elem = to;
+    u64 hash;
+    Type* ptr_type = type_intern_lookup(&shape, &hash);
+    if (ptr_type) return ptr_type;
 
-        type_register(ptr_type);
-        bh_imap_put(&type_pointer_map, to->id, ptr_type->id);
+    ptr_type = type_create(Type_Kind_Pointer, alloc, 0);
+    ptr_type->Pointer.base.flags |= Basic_Flag_Pointer;
+    ptr_type->Pointer.base.size = POINTER_SIZE;
+    ptr_type->Pointer.elem = to;
 
-        return ptr_type;
-    }
+    type_intern(ptr_type, hash);
+    return ptr_type;
 }
 
 Type* type_make_multi_pointer(bh_allocator alloc, Type* to) {
@@ -1031,23 +1160,20 @@ Type* type_make_multi_pointer(bh_allocator alloc, Type* to) {
     if (to == (Type *) &node_that_signals_failure) return to;
 
     assert(to->id > 0);
-    u64 ptr_id = bh_imap_get(&type_multi_pointer_map, to->id);
-    if (ptr_id > 0) {
-        Type* ptr_type = (Type *) bh_imap_get(&type_map, ptr_id);
-        return ptr_type;
+    TypeShape shape = { Type_Kind_MultiPointer, to };
 
-    } else {
-        Type* ptr_type = type_create(Type_Kind_MultiPointer, alloc, 0);
-        ptr_type->MultiPointer.base.flags |= Basic_Flag_Pointer;
-        ptr_type->MultiPointer.base.flags |= Basic_Flag_Multi_Pointer;
-        ptr_type->MultiPointer.base.size = POINTER_SIZE;
-        ptr_type->MultiPointer.elem = to;
+    u64 hash;
+    Type* ptr_type = type_intern_lookup(&shape, &hash);
+    if (ptr_type) return ptr_type;
 
-        type_register(ptr_type);
-        bh_imap_put(&type_multi_pointer_map, to->id, ptr_type->id);
+    ptr_type = type_create(Type_Kind_MultiPointer, alloc, 0);
+    ptr_type->MultiPointer.base.flags |= Basic_Flag_Pointer;
+    ptr_type->MultiPointer.base.flags |= Basic_Flag_Multi_Pointer;
+    ptr_type->MultiPointer.base.size = POINTER_SIZE;
+    ptr_type->MultiPointer.elem = to;
 
-        return ptr_type;
-    }
+    type_intern(ptr_type, hash);
+    return ptr_type;
 }
 
 Type* type_make_array(bh_allocator alloc, Type* to, u32 count) {
@@ -1055,23 +1181,19 @@ Type* type_make_array(bh_allocator alloc, Type* to, u32 count) {
     if (to == (Type *) &node_that_signals_failure) return to;
 
     assert(to->id > 0);
-    u64 key = ((((u64) to->id) << 32) | (u64) count);
-    u64 array_id = bh_imap_get(&type_array_map, key);
-    if (array_id > 0) {
-        Type* array_type = (Type *) bh_imap_get(&type_map, array_id);
-        return array_type;
+    TypeShape shape = { Type_Kind_Array, to, count };
 
-    } else {
-        Type* arr_type = type_create(Type_Kind_Array, alloc, 0);
-        arr_type->Array.count = count;
-        arr_type->Array.elem = to;
-        arr_type->Array.size = count * type_size_of(to);
+    u64 hash;
+    Type* arr_type = type_intern_lookup(&shape, &hash);
+    if (arr_type) return arr_type;
 
-        type_register(arr_type);
-        bh_imap_put(&type_array_map, key, arr_type->id);
+    arr_type = type_create(Type_Kind_Array, alloc, 0);
+    arr_type->Array.count = count;
+    arr_type->Array.elem = to;
+    arr_type->Array.size = count * type_size_of(to);
 
-        return arr_type;
-    }
+    type_intern(arr_type, hash);
+    return arr_type;
 }
 
 Type* type_make_slice(bh_allocator alloc, Type* of) {
@@ -1079,21 +1201,18 @@ Type* type_make_slice(bh_allocator alloc, Type* of) {
     if (of == (Type *) &node_that_signals_failure) return of;
 
     assert(of->id > 0);
-    u64 slice_id = bh_imap_get(&type_slice_map, of->id);
-    if (slice_id > 0) {
-        Type* slice_type = (Type *) bh_imap_get(&type_map, slice_id);
-        return slice_type;
+    TypeShape shape = { Type_Kind_Slice, of };
 
-    } else {
-        Type* slice_type = type_create(Type_Kind_Slice, alloc, 0);
-        type_register(slice_type);
-        bh_imap_put(&type_slice_map, of->id, slice_type->id);
+    u64 hash;
+    Type* slice_type = type_intern_lookup(&shape, &hash);
+    if (slice_type) return slice_type;
 
-        type_make_multi_pointer(alloc, of);
-        slice_type->Slice.elem = of;
+    slice_type = type_create(Type_Kind_Slice, alloc, 0);
+    slice_type->Slice.elem = of;
+    type_intern(slice_type, hash);
 
-        return slice_type;
-    }
+    type_make_multi_pointer(alloc, of);
+    return slice_type;
 }
 
 Type* type_make_dynarray(bh_allocator alloc, Type* of) {
@@ -1101,21 +1220,18 @@ Type* type_make_dynarray(bh_allocator alloc, Type* of) {
     if (of == (Type *) &node_that_signals_failure) return of;
 
     assert(of->id > 0);
-    u64 dynarr_id = bh_imap_get(&type_dynarr_map, of->id);
-    if (dynarr_id > 0) {
-        Type* dynarr = (Type *) bh_imap_get(&type_map, dynarr_id);
-        return dynarr;
+    TypeShape shape = { Type_Kind_DynArray, of };
 
-    } else {
-        Type* dynarr = type_create(Type_Kind_DynArray, alloc, 0);
-        type_register(dynarr);
-        bh_imap_put(&type_dynarr_map, of->id, dynarr->id);
+    u64 hash;
+    Type* dynarr = type_intern_lookup(&shape, &hash);
+    if (dynarr) return dynarr;
 
-        type_make_multi_pointer(alloc, of);
-        dynarr->DynArray.elem = of;
+    dynarr = type_create(Type_Kind_DynArray, alloc, 0);
+    dynarr->DynArray.elem = of;
+    type_intern(dynarr, hash);
 
-        return dynarr;
-    }
+    type_make_multi_pointer(alloc, of);
+    return dynarr;
 }
 
 Type* type_make_varargs(bh_allocator alloc, Type* of) {
@@ -1123,21 +1239,18 @@ Type* type_make_varargs(bh_allocator alloc, Type* of) {
     if (of == (Type *) &node_that_signals_failure) return of;
 
     assert(of->id > 0);
-    u64 vararg_id = bh_imap_get(&type_vararg_map, of->id);
-    if (vararg_id > 0) {
-        Type* va_type = (Type *) bh_imap_get(&type_map, vararg_id);
-        return va_type;
+    TypeShape shape = { Type_Kind_VarArgs, of };
 
-    } else {
-        Type* va_type = type_create(Type_Kind_VarArgs, alloc, 0);
-        type_register(va_type);
-        bh_imap_put(&type_vararg_map, of->id, va_type->id);
+    u64 hash;
+    Type* va_type = type_intern_lookup(&shape, &hash);
+    if (va_type) return va_type;
 
-        type_make_multi_pointer(alloc, of);
-        va_type->VarArgs.elem = of;
+    va_type = type_create(Type_Kind_VarArgs, alloc, 0);
+    va_type->VarArgs.elem = of;
+    type_intern(va_type, hash);
 
-        return va_type;
-    }
+    type_make_multi_pointer(alloc, of);
+    return va_type;
 }
 
 void build_linear_types_with_offset(Type* type, bh_arr(TypeWithOffset)* pdest, u32 offset) {
@@ -1184,7 +1297,7 @@ b32 type_struct_member_apply_use(bh_allocator alloc, Type *s_type, StructMember
 
     if (used_type->Struct.status < SPS_Uses_Done) return 0;
 
-    fori (i, 0, shlen(used_type->Struct.members)) {
+    fori (i, 0, hmlen(used_type->Struct.members)) {
         StructMember *nsmem = used_type->Struct.members[i].value;
 
         //
@@ -1194,7 +1307,7 @@ b32 type_struct_member_apply_use(bh_allocator alloc, Type *s_type, StructMember
             continue;
         }
 
-        if (shgeti(s_type->Struct.members, nsmem->name) != -1) {
+        if (hmgeti(s_type->Struct.members, nsmem->name) != -1) {
             onyx_report_error(smem->token->pos, Error_Critical, "Used name '%s' conflicts with existing struct member.", nsmem->name);
             return 0;
         }
@@ -1219,7 +1332,7 @@ b32 type_struct_member_apply_use(bh_allocator alloc, Type *s_type, StructMember
             new_smem->use_through_pointer_index = -1;
         }
 
-        shput(s_type->Struct.members, nsmem->name, new_smem);
+        hmput(s_type->Struct.members, nsmem->name, new_smem);
     }
 
     return 1;
@@ -1407,40 +1520,21 @@ b32 type_is_ready_for_lookup(Type* type) {
     return 1;
 }
 
-static const StructMember slice_members[] = {
-    { 0,            0, NULL,                         "data",   NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE, 1, &basic_types[Basic_Kind_U32], "count",  NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE, 1, &basic_types[Basic_Kind_U32], "size",   NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE, 1, &basic_types[Basic_Kind_U32], "length", NULL, NULL, -1, 0, 0 },
-};
-
-static const StructMember array_members[] = {
-    { 0,                0, NULL,                         "data",      NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE,     1, &basic_types[Basic_Kind_U32], "count",     NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE + 4, 2, &basic_types[Basic_Kind_U32], "capacity",  NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE + 8, 3, NULL,                         "allocator", NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE,     1, &basic_types[Basic_Kind_U32], "size",      NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE,     1, &basic_types[Basic_Kind_U32], "length",    NULL, NULL, -1, 0, 0 },
-};
-
-static const StructMember func_members[] = {
-    { 0,                0, &basic_types[Basic_Kind_U32],    "__funcidx",    NULL, NULL, -1, 0, 0 },
-    { POINTER_SIZE,     1, &basic_types[Basic_Kind_Rawptr], "closure",      NULL, NULL, -1, 0, 0 },
-    { 2 * POINTER_SIZE, 2, &basic_types[Basic_Kind_U32],    "closure_size", NULL, NULL, -1, 0, 0 },
-};
+b32 type_lookup_member(Type* type, char* member, StructMember* smem) {
+    char* atom = atom_find(member);
+    if (atom == NULL) return 0;
 
-static const StructMember union_members[] = {
-    { 0, 0, NULL, "tag", NULL, NULL, -1, 0, 0 },
-};
+    return type_lookup_member_atom(type, atom, smem);
+}
 
-b32 type_lookup_member(Type* type, char* member, StructMember* smem) {
+b32 type_lookup_member_atom(Type* type, char* atom, StructMember* smem) {
     if (type->kind == Type_Kind_Pointer) type = type->Pointer.elem;
 
     switch (type->kind) {
         case Type_Kind_Struct: {
             TypeStruct* stype = &type->Struct;
 
-            i32 index = shgeti(stype->members, member);
+            i32 index = hmgeti(stype->members, atom);
             if (index == -1) return 0;
             *smem = *stype->members[index].value;
             return 1;
@@ -1449,7 +1543,7 @@ b32 type_lookup_member(Type* type, char* member, StructMember* smem) {
         case Type_Kind_VarArgs:
         case Type_Kind_Slice: {
             fori (i, 0, (i64) (sizeof(slice_members) / sizeof(StructMember))) {
-                if (strcmp(slice_members[i].name, member) == 0) {
+                if (slice_members[i].name == atom) {
                     *smem = slice_members[i];
                     if (smem->idx == 0) smem->type = type_make_multi_pointer(context.ast_alloc, type->Slice.elem);
 
@@ -1461,7 +1555,7 @@ b32 type_lookup_member(Type* type, char* member, StructMember* smem) {
 
         case Type_Kind_DynArray: {
             fori (i, 0, (i64) (sizeof(array_members) / sizeof(StructMember))) {
-                if (strcmp(array_members[i].name, member) == 0) {
+                if (array_members[i].name == atom) {
                     *smem = array_members[i];
                     if (smem->idx == 0) smem->type = type_make_multi_pointer(context.ast_alloc, type->DynArray.elem);
                     if (smem->idx == 3) smem->type = type_build_from_ast(context.ast_alloc, builtin_allocator_type);
@@ -1474,7 +1568,7 @@ b32 type_lookup_member(Type* type, char* member, StructMember* smem) {
 
         case Type_Kind_Function: {
             fori (i, 0, (i64) (sizeof(func_members) / sizeof(StructMember))) {
-                if (strcmp(func_members[i].name, member) == 0) {
+                if (func_members[i].name == atom) {
                     *smem = func_members[i];
                     return 1;
                 }
@@ -1482,7 +1576,7 @@ b32 type_lookup_member(Type* type, char* member, StructMember* smem) {
         }
 
         case Type_Kind_Union: {
-            if (!strcmp(member, "tag")) {
+            if (union_members[0].name == atom) {
                 *smem = union_members[0];
                 smem->type = type->Union.tag_type;
                 return 1;
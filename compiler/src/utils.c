@@ -123,33 +123,31 @@ Scope* scope_create(bh_allocator a, Scope* parent, OnyxFilePos created_at) {
     scope->name = NULL;
 
     scope->symbols = NULL;
-    sh_new_arena(scope->symbols);
 
     return scope;
 }
 
 void scope_include(Scope* target, Scope* source, OnyxFilePos pos) {
-    fori (i, 0, shlen(source->symbols)) {
-        symbol_raw_introduce(target, source->symbols[i].key, pos, source->symbols[i].value);
+    fori (i, 0, hmlen(source->symbols)) {
+        symbol_atom_introduce(target, source->symbols[i].key, pos, source->symbols[i].value);
     }
 }
 
 b32 symbol_introduce(Scope* scope, OnyxToken* tkn, AstNode* symbol) {
-    token_toggle_end(tkn);
-
-    b32 ret = symbol_raw_introduce(scope, tkn->text, tkn->pos, symbol);
-
-    token_toggle_end(tkn);
-    return ret;
+    return symbol_atom_introduce(scope, token_atom(tkn), tkn->pos, symbol);
 }
 
 b32 symbol_raw_introduce(Scope* scope, char* name, OnyxFilePos pos, AstNode* symbol) {
-    if (strcmp(name, "_")) {
-        i32 index = shgeti(scope->symbols, name);
+    return symbol_atom_introduce(scope, atom_intern_cstr(name), pos, symbol);
+}
+
+b32 symbol_atom_introduce(Scope* scope, char* atom, OnyxFilePos pos, AstNode* symbol) {
+    if (strcmp(atom, "_")) {
+        i32 index = hmgeti(scope->symbols, atom);
         if (index != -1) {
             AstNode *node = scope->symbols[index].value;
             if (node != symbol) {
-                onyx_report_error(pos, Error_Critical, "Redeclaration of symbol '%s'.", name);
+                onyx_report_error(pos, Error_Critical, "Redeclaration of symbol '%s'.", atom);
 
                 if (node->token) {
                     onyx_report_error(node->token->pos, Error_Critical, "Previous declaration was here.");
@@ -161,19 +159,20 @@ b32 symbol_raw_introduce(Scope* scope, char* name, OnyxFilePos pos, AstNode* sym
         }
     }
 
-    shput(scope->symbols, name, symbol);
+    hmput(scope->symbols, atom, symbol);
     track_declaration_for_symbol_info(pos, symbol);
     return 1;
 }
 
 void symbol_builtin_introduce(Scope* scope, char* sym, AstNode *node) {
-    shput(scope->symbols, sym, node);
+    hmput(scope->symbols, atom_intern_cstr(sym), node);
 }
 
 void symbol_subpackage_introduce(Package* parent, char* sym, AstPackage* subpackage) {
     Scope *scope = parent->scope;
+    char *atom = atom_intern_cstr(sym);
 
-    i32 index = shgeti(scope->symbols, sym);
+    i32 index = hmgeti(scope->symbols, atom);
     if (index != -1) {
         AstNode* maybe_package = scope->symbols[index].value;
         
@@ -181,7 +180,7 @@ void symbol_subpackage_introduce(Package* parent, char* sym, AstPackage* subpack
         assert(maybe_package->kind == Ast_Kind_Package);
 
     } else {
-        shput(scope->symbols, sym, (AstNode *) subpackage);
+        hmput(scope->symbols, atom, (AstNode *) subpackage);
 
         // Parent: parent->id
         // Child:  subpackage->package->id
@@ -190,10 +189,17 @@ void symbol_subpackage_introduce(Package* parent, char* sym, AstPackage* subpack
 }
 
 AstNode* symbol_raw_resolve(Scope* start_scope, char* sym) {
+    char *atom = atom_find(sym);
+    if (atom == NULL) return NULL;
+
+    return symbol_atom_resolve(start_scope, atom);
+}
+
+AstNode* symbol_atom_resolve(Scope* start_scope, char* atom) {
     Scope* scope = start_scope;
 
     while (scope != NULL) {
-        i32 index = shgeti(scope->symbols, sym);
+        i32 index = hmgeti(scope->symbols, atom);
         if (index != -1) {
             AstNode* res = scope->symbols[index].value;
 
@@ -209,14 +215,17 @@ AstNode* symbol_raw_resolve(Scope* start_scope, char* sym) {
 }
 
 AstNode* symbol_resolve(Scope* start_scope, OnyxToken* tkn) {
-    token_toggle_end(tkn);
-    AstNode* res = symbol_raw_resolve(start_scope, tkn->text);
-    token_toggle_end(tkn);
-
-    return res;
+    return symbol_atom_resolve(start_scope, token_atom(tkn));
 }
 
 AstNode* try_symbol_raw_resolve_from_node(AstNode* node, char* symbol) {
+    char *atom = atom_find(symbol);
+    if (atom == NULL) return NULL;
+
+    return try_symbol_atom_resolve_from_node(node, atom);
+}
+
+AstNode* try_symbol_atom_resolve_from_node(AstNode* node, char* atom) {
     // CLEANUP: I think this has a lot of duplication from get_scope_from_node.
     // There are some additional cases handled here, but I think the majority
     // of this code could be rewritten in terms of get_scope_from_node.
@@ -258,7 +267,7 @@ all_types_peeled_off:
                 return NULL;
             }
 
-            return symbol_raw_resolve(package->package->scope, symbol);
+            return symbol_atom_resolve(package->package->scope, atom);
         } 
 
         case Ast_Kind_Foreign_Block: {
@@ -267,7 +276,7 @@ all_types_peeled_off:
             if (fb->scope == NULL)
                 return NULL;
 
-            return symbol_raw_resolve(fb->scope, symbol);
+            return symbol_atom_resolve(fb->scope, atom);
         }
 
         case Ast_Kind_Basic_Type: {
@@ -276,12 +285,12 @@ all_types_peeled_off:
             if (bt->scope == NULL)
                 return NULL;
 
-            return symbol_raw_resolve(bt->scope, symbol);
+            return symbol_atom_resolve(bt->scope, atom);
         }
 
         case Ast_Kind_Enum_Type: {
             AstEnumType* etype = (AstEnumType *) node;
-            return symbol_raw_resolve(etype->scope, symbol);
+            return symbol_atom_resolve(etype->scope, atom);
         }
 
         case Ast_Kind_Struct_Type: {
@@ -307,7 +316,7 @@ all_types_peeled_off:
                 tmp_parent_backup = *tmp_parent;
                 *tmp_parent = NULL;
 
-                result = symbol_raw_resolve(stype->scope, symbol);
+                result = symbol_atom_resolve(stype->scope, atom);
 
                 *tmp_parent = tmp_parent_backup;
             }
@@ -317,7 +326,7 @@ all_types_peeled_off:
                 assert(struct_type->kind == Type_Kind_Struct);
 
                 bh_arr_each(AstPolySolution, sln, struct_type->Struct.poly_sln) {
-                    if (token_text_equals(sln->poly_sym->token, symbol)) {
+                    if (token_atom(sln->poly_sym->token) == atom) {
                         if (sln->kind == PSK_Type) {
                             result = (AstNode *) sln->type->ast_type;
                         } else {
@@ -347,13 +356,13 @@ all_types_peeled_off:
                 tmp_parent_backup = *tmp_parent;
                 *tmp_parent = NULL;
 
-                result = symbol_raw_resolve(utype->scope, symbol);
+                result = symbol_atom_resolve(utype->scope, atom);
 
                 *tmp_parent = tmp_parent_backup;
             }
 
             if (result == NULL && utype->utcache != NULL) {
-                if (!strcmp(symbol, "tag_enum")) {
+                if (!strcmp(atom, "tag_enum")) {
                     result = (AstNode *) utype->utcache->Union.tag_type->ast_type;
                 }
             }
@@ -363,30 +372,30 @@ all_types_peeled_off:
 
         case Ast_Kind_Poly_Struct_Type: {
             AstPolyStructType* stype = ((AstPolyStructType *) node);
-            return symbol_raw_resolve(stype->scope, symbol);
+            return symbol_atom_resolve(stype->scope, atom);
         }
 
         case Ast_Kind_Poly_Union_Type: {
             AstPolyUnionType* utype = ((AstPolyUnionType *) node);
-            return symbol_raw_resolve(utype->scope, symbol);
+            return symbol_atom_resolve(utype->scope, atom);
         }
 
         case Ast_Kind_Poly_Call_Type: {
             AstPolyCallType* pctype = (AstPolyCallType *) node;
             if (pctype->resolved_type) {
-                return try_symbol_raw_resolve_from_node((AstNode*) pctype->resolved_type->ast_type, symbol);
+                return try_symbol_atom_resolve_from_node((AstNode*) pctype->resolved_type->ast_type, atom);
             }
             return NULL;
         }
 
         case Ast_Kind_Distinct_Type: {
             AstDistinctType* dtype = (AstDistinctType *) node;
-            return symbol_raw_resolve(dtype->scope, symbol);
+            return symbol_atom_resolve(dtype->scope, atom);
         }
 
         case Ast_Kind_Interface: {
             AstInterface* inter = (AstInterface *) node;
-            return symbol_raw_resolve(inter->scope, symbol);
+            return symbol_atom_resolve(inter->scope, atom);
         }
     }
 
@@ -394,14 +403,10 @@ all_types_peeled_off:
 }
 
 AstNode* try_symbol_resolve_from_node(AstNode* node, OnyxToken* token) {
-    token_toggle_end(token);
-    AstNode* result = try_symbol_raw_resolve_from_node(node, token->text);
-    token_toggle_end(token);
-
-    return result;
+    return try_symbol_atom_resolve_from_node(node, token_atom(token));
 }
 
-AstNode* try_symbol_raw_resolve_from_type(Type *type, char* symbol) {
+AstNode* try_symbol_atom_resolve_from_type(Type *type, char* atom) {
     while (type->kind == Type_Kind_Pointer) {
         type = type->Pointer.elem; 
     }
@@ -410,7 +415,7 @@ AstNode* try_symbol_raw_resolve_from_type(Type *type, char* symbol) {
         if (type->Struct.poly_sln == NULL) return NULL;
 
         bh_arr_each(AstPolySolution, sln, type->Struct.poly_sln) {
-            if (token_text_equals(sln->poly_sym->token, symbol)) {
+            if (token_atom(sln->poly_sym->token) == atom) {
                 if (sln->kind == PSK_Type) {
                     AstTypeRawAlias* alias = onyx_ast_node_new(context.ast_alloc, sizeof(AstTypeRawAlias), Ast_Kind_Type_Raw_Alias);
                     alias->type = &basic_types[Basic_Kind_Type_Index];
@@ -428,7 +433,7 @@ AstNode* try_symbol_raw_resolve_from_type(Type *type, char* symbol) {
 }
 
 void scope_clear(Scope* scope) {
-    sh_new_arena(scope->symbols);
+    hmfree(scope->symbols);
 }
 
 // Polymorphic procedures are in their own file to clean up this file.
@@ -461,6 +466,24 @@ void scope_clear(Scope* scope) {
 //  * Resolving an overload from a TypeFunction (so an overloaded procedure can be passed as a parameter)
 //
 
+// The prefetch threads only exist on Linux and MacOS, so elsewhere the
+// generation is a plain counter.
+static inline void bump_overload_generation() {
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    __atomic_fetch_add(&context.caches.overload_generation, 1, __ATOMIC_RELAXED);
+#else
+    context.caches.overload_generation++;
+#endif
+}
+
+static inline u32 current_overload_generation() {
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    return __atomic_load_n(&context.caches.overload_generation, __ATOMIC_RELAXED);
+#else
+    return context.caches.overload_generation;
+#endif
+}
+
 void add_overload_option(bh_arr(OverloadOption)* poverloads, u64 order, AstTyped* overload) {
     bh_arr(OverloadOption) overloads = *poverloads;
 
@@ -485,6 +508,9 @@ void add_overload_option(bh_arr(OverloadOption)* poverloads, u64 order, AstTyped
     }
 
     *poverloads = overloads;
+
+    // Files parsed on the prefetch threads add options too.
+    bump_overload_generation();
 }
 
 // NOTE: The job of this function is to take a set of overloads, and traverse it to add all possible
@@ -518,21 +544,171 @@ void build_all_overload_options(bh_arr(OverloadOption) overloads, bh_imap* all_o
     }
 }
 
-AstTyped* find_matching_overload_by_arguments(bh_arr(OverloadOption) overloads, Arguments* param_args) {
-    Arguments args;
-    arguments_clone(&args, param_args);
-    arguments_ensure_length(&args, bh_arr_length(args.values) + bh_arr_length(args.named_values));
+//
+// Overload caches
+//
+// Resolving an overloaded call used to flatten the overload list and try every
+// option against the arguments, every time. Both results are now kept in an
+// OverloadCache. The flattened list is valid until any option is added anywhere.
+// The matches are keyed by the types of the arguments, which is only sound when
+// nothing but those types decides whether an option matches. Options whose
+// header depends on the values of the arguments (baked parameters) or on the
+// rest of the program (where clauses) end the part of the list that can be
+// remembered, and arguments whose expressions can be converted in different
+// ways depending on their value are never used as keys.
+//
+
+static b32 overload_option_depends_on_more_than_types(AstTyped *option) {
+    AstNode *node = strip_aliases((AstNode *) option);
+    if (node->kind == Ast_Kind_Macro) node = strip_aliases((AstNode *) ((AstMacro *) node)->body);
+    if (node->kind != Ast_Kind_Polymorphic_Proc) return 0;
+
+    AstFunction *pp = (AstFunction *) node;
+    if (bh_arr_length(pp->constraints.constraints) > 0) return 1;
+
+    bh_arr_each(AstPolyParam, param, pp->poly_params) {
+        if (param->kind == PPK_Baked_Value) return 1;
+    }
+
+    return 0;
+}
+
+bh_arr(AstTyped *) overload_cache_options(OverloadCache* cache, bh_arr(OverloadOption) overloads) {
+    if (cache->options != NULL && cache->generation == current_overload_generation()) {
+        return cache->options;
+    }
 
-    // CLEANUP SPEED: This currently rebuilds the complete set of overloads every time one is looked up.
-    // This should be cached in the AstOverloadedFunction or somewhere like that.
     bh_imap all_overloads;
     bh_imap_init(&all_overloads, global_heap_allocator, bh_arr_length(overloads) * 2);
     build_all_overload_options(overloads, &all_overloads);
 
-    AstTyped *matched_overload = NULL;
+    if (cache->options == NULL) bh_arr_new(global_heap_allocator, cache->options, bh_arr_length(all_overloads.entries) + 1);
+    bh_arr_clear(cache->options);
 
+    cache->type_only_count = -1;
     bh_arr_each(bh__imap_entry, entry, all_overloads.entries) {
-        AstTyped* node = (AstTyped *) strip_aliases((AstNode *) entry->key);
+        AstTyped *option = (AstTyped *) entry->key;
+
+        if (cache->type_only_count < 0 && overload_option_depends_on_more_than_types(option)) {
+            cache->type_only_count = bh_arr_length(cache->options);
+        }
+
+        bh_arr_push(cache->options, option);
+    }
+
+    if (cache->type_only_count < 0) cache->type_only_count = bh_arr_length(cache->options);
+
+    shfree(cache->matches);
+    sh_new_arena(cache->matches);
+
+    cache->generation = current_overload_generation();
+
+    bh_imap_free(&all_overloads);
+    return cache->options;
+}
+
+// Returns the type that decides how the argument matches a parameter, or NULL
+// if how it matches also depends on the expression itself.
+static Type *overload_argument_key_type(AstTyped *value) {
+    if (value->kind == Ast_Kind_Argument) {
+        if (((AstArgument *) value)->is_baked) return NULL;
+        value = ((AstArgument *) value)->value;
+    }
+
+    Type *type = value->type;
+    if (type == NULL) return NULL;
+    if (value->flags & Ast_Flag_Proc_Is_Null) return NULL;
+    if (node_is_auto_cast((AstNode *) value)) return NULL;
+
+    // These are the nodes that unify_node_and_type handles specially.
+    switch (value->kind) {
+        case Ast_Kind_Struct_Literal:
+        case Ast_Kind_Array_Literal:
+        case Ast_Kind_Unary_Field_Access:
+        case Ast_Kind_Overloaded_Function:
+        case Ast_Kind_Polymorphic_Proc:
+        case Ast_Kind_Zero_Value:
+        case Ast_Kind_Switch:
+        case Ast_Kind_NumLit:
+        case Ast_Kind_Compound:
+        case Ast_Kind_If_Expression:
+        case Ast_Kind_Alias:
+            return NULL;
+
+        case Ast_Kind_Address_Of:
+            if (((AstAddressOf *) value)->can_be_removed) return NULL;
+            break;
+    }
+
+    if (type->kind == Type_Kind_Basic) {
+        switch (type->Basic.kind) {
+            case Basic_Kind_Int_Unsized:
+            case Basic_Kind_Float_Unsized:
+            case Basic_Kind_Type_Index:
+                return NULL;
+        }
+    }
+
+    if (type->kind == Type_Kind_Function && type->Function.return_type == &type_auto_return) return NULL;
+
+    return type;
+}
+
+// Writes a key for the argument types into buffer, and returns it, or NULL if
+// the arguments cannot be keyed.
+static char *overload_cache_key(Arguments *args, char *buffer, i32 buffer_size) {
+    char *end = buffer;
+    i32 remaining = buffer_size;
+
+    bh_arr_each(AstTyped *, value, args->values) {
+        Type *type = overload_argument_key_type(*value);
+        if (type == NULL || remaining < 16) return NULL;
+
+        // String literals can also become cstrs, which other strings cannot.
+        AstTyped *arg_value = (*value)->kind == Ast_Kind_Argument ? ((AstArgument *) *value)->value : *value;
+        b32 is_strlit = arg_value->kind == Ast_Kind_StrLit;
+
+        isize written = bh_snprintf(end, remaining, "%s%d,", is_strlit ? "s" : "", type->id) - 1;
+        end += written;
+        remaining -= written;
+    }
+
+    bh_arr_each(AstNamedValue *, named_value, args->named_values) {
+        AstTyped *value = (*named_value)->value;
+        Type *type = overload_argument_key_type(value);
+        if (type == NULL) return NULL;
+
+        char *name = token_atom((*named_value)->token);
+        if (remaining < (i32) strlen(name) + 16) return NULL;
+
+        isize written = bh_snprintf(end, remaining, "%s=%s%d,", name, value->kind == Ast_Kind_StrLit ? "s" : "", type->id) - 1;
+        end += written;
+        remaining -= written;
+    }
+
+    *end = '\0';
+    return buffer;
+}
+
+AstTyped* find_matching_overload_by_arguments(bh_arr(OverloadOption) overloads, OverloadCache* cache, Arguments* param_args) {
+    bh_arr(AstTyped *) all_overloads = overload_cache_options(cache, overloads);
+
+    char key_buffer[512];
+    char *key = overload_cache_key(param_args, key_buffer, sizeof(key_buffer));
+    if (key) {
+        i32 index = shgeti(cache->matches, key);
+        if (index != -1) return cache->matches[index].value;
+    }
+
+    Arguments args;
+    arguments_clone(&args, param_args);
+    arguments_ensure_length(&args, bh_arr_length(args.values) + bh_arr_length(args.named_values));
+
+    AstTyped *matched_overload = NULL;
+    i32 matched_index = bh_arr_length(all_overloads);
+
+    fori (i, 0, bh_arr_length(all_overloads)) {
+        AstTyped* node = (AstTyped *) strip_aliases((AstNode *) all_overloads[i]);
         arguments_copy(&args, param_args);
 
         AstFunction* overload = NULL;
@@ -554,7 +730,6 @@ AstTyped* find_matching_overload_by_arguments(bh_arr(OverloadOption) overloads,
 
             // return and not continue because if the overload that didn't have a type will
             // work in the future, then it has to take precedence over the other options available.
-            bh_imap_free(&all_overloads);
             bh_arr_free(args.values);
             return (AstTyped *) &node_that_signals_a_yield;
         }
@@ -570,32 +745,40 @@ AstTyped* find_matching_overload_by_arguments(bh_arr(OverloadOption) overloads,
         TypeMatch tm = check_arguments_against_type(&args, &overload->type->Function, &va_kind, NULL, NULL, NULL);
         if (tm == TYPE_MATCH_SUCCESS) {
             matched_overload = node;
+            matched_index = i;
             break;
         }
 
         if (tm == TYPE_MATCH_YIELD) {
-            bh_imap_free(&all_overloads);
             bh_arr_free(args.values);
             return (AstTyped *) &node_that_signals_a_yield;
         }
     }
 
-    bh_imap_free(&all_overloads);
+    // A miss is only remembered when every option was tried on the types alone.
+    // The caller yields on a miss, and adding an option invalidates the cache.
+    b32 decided_by_types = matched_index < cache->type_only_count
+        || cache->type_only_count == bh_arr_length(all_overloads);
+
+    // Trying the options can add options, which would make the key stale.
+    if (key && decided_by_types
+        && cache->generation == current_overload_generation()) {
+        shput(cache->matches, key, matched_overload);
+    }
+
     bh_arr_free(args.values);
     return matched_overload;
 }
 
-AstTyped* find_matching_overload_by_type(bh_arr(OverloadOption) overloads, Type* type) {
+AstTyped* find_matching_overload_by_type(bh_arr(OverloadOption) overloads, OverloadCache* cache, Type* type) {
     if (type->kind != Type_Kind_Function) return NULL;
 
-    bh_imap all_overloads;
-    bh_imap_init(&all_overloads, global_heap_allocator, bh_arr_length(overloads) * 2);
-    build_all_overload_options(overloads, &all_overloads);
+    bh_arr(AstTyped *) all_overloads = overload_cache_options(cache, overloads);
 
     AstTyped *matched_overload = NULL;
 
-    bh_arr_each(bh__imap_entry, entry, all_overloads.entries) {
-        AstTyped* node = (AstTyped *) entry->key;
+    fori (i, 0, bh_arr_length(all_overloads)) {
+        AstTyped* node = all_overloads[i];
         if (node->kind == Ast_Kind_Overloaded_Function) continue;
 
         TypeMatch tm = unify_node_and_type(&node, type);
@@ -609,11 +792,10 @@ AstTyped* find_matching_overload_by_type(bh_arr(OverloadOption) overloads, Type*
         }
     }
     
-    bh_imap_free(&all_overloads);
     return matched_overload;
 }
 
-void report_unable_to_match_overload(AstCall* call, bh_arr(OverloadOption) overloads) {
+void report_unable_to_match_overload(AstCall* call, bh_arr(OverloadOption) overloads, OverloadCache* cache) {
     char* arg_str = bh_alloc(global_scratch_allocator, 1024);
     arg_str[0] = '\0';
 
@@ -646,19 +828,13 @@ void report_unable_to_match_overload(AstCall* call, bh_arr(OverloadOption) overl
 
     bh_free(global_scratch_allocator, arg_str);
 
-    // CLEANUP SPEED: This currently rebuilds the complete set of overloads every time one is looked up.
-    // This should be cached in the AstOverloadedFunction or somewhere like that.
-    bh_imap all_overloads;
-    bh_imap_init(&all_overloads, global_heap_allocator, bh_arr_length(overloads) * 2);
-    build_all_overload_options(overloads, &all_overloads);
+    bh_arr(AstTyped *) all_overloads = overload_cache_options(cache, overloads);
 
     i32 i = 1;
-    bh_arr_each(bh__imap_entry, entry, all_overloads.entries) {
-        AstTyped* node = (AstTyped *) strip_aliases((AstNode *) entry->key);
-        onyx_report_error(node->token->pos, Error_Critical, "Here is one of the overloads. %d/%d", i++, bh_arr_length(all_overloads.entries));
+    bh_arr_each(AstTyped *, option, all_overloads) {
+        AstTyped* node = (AstTyped *) strip_aliases((AstNode *) *option);
+        onyx_report_error(node->token->pos, Error_Critical, "Here is one of the overloads. %d/%d", i++, bh_arr_length(all_overloads));
     }
-
-    bh_imap_free(&all_overloads);
 }
 
 void report_incorrect_overload_expected_type(Type *given, Type *expected, OnyxToken *overload, OnyxToken *group) {
@@ -1500,7 +1676,7 @@ char *find_closest_symbol_in_scope(Scope *scope, char *sym, u32 *out_distance) {
     if (scope == NULL) return NULL;
 
     char* closest = NULL;
-    fori (i, 0, shlen(scope->symbols)) {
+    fori (i, 0, hmlen(scope->symbols)) {
         if (scope->symbols[i].value->flags & Ast_Flag_Symbol_Invisible) continue;
 
         char *key = scope->symbols[i].key;
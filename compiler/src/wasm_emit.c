@@ -2291,6 +2291,12 @@ EMIT_FUNC(call, AstCall* call) {
         WID(NULL, WI_CALL_INDIRECT, ((WasmInstructionData) { type_idx, 0x00 }));
     }
 
+    // A call being returned can only become a tail call if nothing
+    // has to happen after it, like restoring the stack pointer.
+    if (call == mod->tail_call && reserve_size == 0 && cc == CC_Return_Wasm) {
+        SUBMIT_PATCH(mod->tail_call_patches, 1);
+    }
+
     if (reserve_size > 0) {
         WIL(call_token, WI_LOCAL_GET,  stack_top_store_local);
         WID(call_token, WI_GLOBAL_SET, stack_top_idx);
@@ -4087,6 +4093,23 @@ EMIT_FUNC(return, AstReturn* ret) {
         result_destination = mod->return_location_stack[len - ret->count - 1];
     }
 
+    //
+    // A call being returned from the function, with no deferred statements to run
+    // after it, might be a tail call. Whether it is depends on what the call and
+    // the rest of the function need, so this is decided in emit_call and emit_function.
+    //
+    if (context.options->use_tail_calls && context.options->use_post_mvp_features
+        && ret->expr && jump_label < 0 && mod->curr_cc == CC_Return_Wasm
+        && bh_arr_length(mod->deferred_stmts) == 0) {
+        if (ret->expr->kind == Ast_Kind_Call) {
+            mod->tail_call = (AstCall *) ret->expr;
+        }
+
+        if (ret->expr->kind == Ast_Kind_Method_Call) {
+            mod->tail_call = (AstCall *) ((AstBinaryOp *) ret->expr)->right;
+        }
+    }
+
     // If we have an expression to return, we see if it should be placed on the linear memory stack, or the WASM stack.
     if (ret->expr) {
         if (result_destination) {
@@ -4137,6 +4160,8 @@ EMIT_FUNC(return, AstReturn* ret) {
         }
     }
 
+    mod->tail_call = NULL;
+
     // Clear the normal deferred statements
     emit_deferred_stmts(mod, &code);
 
@@ -4457,6 +4482,7 @@ static void emit_function(OnyxWasmModule* mod, AstFunction* fd) {
         assert(mod->curr_cc != CC_Undefined);
 
         bh_arr_clear(mod->stack_leave_patches);
+        bh_arr_clear(mod->tail_call_patches);
 
         debug_emit_instruction(mod, fd->token);
         debug_emit_instruction(mod, fd->token);
@@ -4503,6 +4529,15 @@ static void emit_function(OnyxWasmModule* mod, AstFunction* fd) {
                 wasm_func.code[patch->instruction_index + 0] = (WasmInstruction) { WI_LOCAL_GET,  { .l = mod->stack_base_idx } };
                 wasm_func.code[patch->instruction_index + 1] = (WasmInstruction) { WI_GLOBAL_SET, { .l = stack_top_idx } };
             }
+
+        } else {
+            // Without a stack frame to leave, the calls being returned become tail
+            // calls. The rest of the return after them is never reached.
+            bh_arr_each(PatchInfo, patch, mod->tail_call_patches) {
+                WasmInstruction *call_instr = &wasm_func.code[patch->instruction_index];
+                if (call_instr->type == WI_CALL)          call_instr->type = WI_RETURN_CALL;
+                if (call_instr->type == WI_CALL_INDIRECT) call_instr->type = WI_RETURN_CALL_INDIRECT;
+            }
         }
     }
 
@@ -5076,6 +5111,8 @@ OnyxWasmModule onyx_wasm_module_create(bh_allocator alloc) {
         .return_location_stack = NULL,
         .local_allocations = NULL,
         .stack_leave_patches = NULL,
+        .tail_call_patches = NULL,
+        .tail_call = NULL,
         .deferred_stmts = NULL,
 
         .heap_start_ptr = NULL,
@@ -5129,6 +5166,7 @@ OnyxWasmModule onyx_wasm_module_create(bh_allocator alloc) {
     bh_arr_new(global_heap_allocator, module.deferred_stmts, 4);
     bh_arr_new(global_heap_allocator, module.local_allocations, 4);
     bh_arr_new(global_heap_allocator, module.stack_leave_patches, 4);
+    bh_arr_new(global_heap_allocator, module.tail_call_patches, 4);
     bh_arr_new(global_heap_allocator, module.foreign_blocks, 4);
     bh_arr_new(global_heap_allocator, module.procedures_with_tags, 4);
     bh_arr_new(global_heap_allocator, module.globals_with_tags, 4);
@@ -472,6 +472,7 @@ static void output_instruction(WasmFunc* func, WasmInstruction* instr, bh_buffer
         case WI_GLOBAL_GET:
         case WI_GLOBAL_SET:
         case WI_CALL:
+        case WI_RETURN_CALL:
         case WI_BLOCK_START:
         case WI_LOOP_START:
         case WI_JUMP:
@@ -511,6 +512,7 @@ static void output_instruction(WasmFunc* func, WasmInstruction* instr, bh_buffer
 
 
         case WI_CALL_INDIRECT:
+        case WI_RETURN_CALL_INDIRECT:
         case WI_I32_STORE: case WI_I32_STORE_8: case WI_I32_STORE_16:
         case WI_I64_STORE: case WI_I64_STORE_8: case WI_I64_STORE_16: case WI_I64_STORE_32:
         case WI_F32_STORE: case WI_F64_STORE:
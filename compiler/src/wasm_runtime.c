@@ -78,6 +78,14 @@ typedef struct LinkLibraryContext {
     bh_arr(char *) library_paths;
 } LinkLibraryContext;
 
+typedef struct LinkedLibrary {
+    WasmFuncDefinition **funcs;
+
+    // Set if the library was built with raw calls, in which case
+    // its definitions are OnyxRawFuncDefinitions.
+    b32 raw_calls;
+} LinkedLibrary;
+
 
 static void *locate_symbol_in_dynamic_library_raw(char *libname, char *sym) {
 #if defined(_BH_LINUX) || defined(_BH_DARWIN)
@@ -121,7 +129,7 @@ static void *locate_symbol_in_dynamic_library(LinkLibraryContext *ctx, char *lib
 
 typedef void *(*LinkLibraryer)(OnyxRuntime *runtime);
 
-static WasmFuncDefinition** onyx_load_library(LinkLibraryContext *ctx, char *name) {
+static LinkedLibrary onyx_load_library(LinkLibraryContext *ctx, char *name) {
     #if defined(_BH_LINUX) || defined(_BH_DARWIN)
         #define DIR_SEPARATOR '/'
     #endif
@@ -138,17 +146,36 @@ static WasmFuncDefinition** onyx_load_library(LinkLibraryContext *ctx, char *nam
     char *library_load_name = alloca(strlen(library_load_name_tmp) + 1);
     strcpy(library_load_name, library_load_name_tmp);
 
+    LinkedLibrary linked = { 0 };
+
     LinkLibraryer library_load = locate_symbol_in_dynamic_library(ctx, name, library_load_name);
     if (library_load == NULL) {
         printf("ERROR RESOLVING '%s'\n", library_load_name);
-        return NULL;
+        return linked;
+    }
+
+    char *raw_calls_name_tmp = bh_bprintf("onyx_library_raw_calls_%s", library);
+    char *raw_calls_name = alloca(strlen(raw_calls_name_tmp) + 1);
+    strcpy(raw_calls_name, raw_calls_name_tmp);
+
+    int *abi_version = locate_symbol_in_dynamic_library(ctx, name, raw_calls_name);
+    if (abi_version != NULL && *abi_version != ONYX_LIBRARY_ABI_VERSION) {
+        printf("ERROR LOADING '%s': built against library ABI version %d, but this runtime uses version %d\n",
+            library, *abi_version, ONYX_LIBRARY_ABI_VERSION);
+
+        // The program still runs, and fails if it calls into the library. Make
+        // sure this is seen before anything the program prints.
+        fflush(stdout);
+        return linked;
     }
 
-    return library_load(runtime);
+    linked.funcs = library_load(runtime);
+    linked.raw_calls = abi_version != NULL;
+    return linked;
 }
 
-static void lookup_and_load_custom_libraries(LinkLibraryContext *ctx, bh_arr(WasmFuncDefinition **)* p_out) {
-    bh_arr(WasmFuncDefinition **) out = *p_out;
+static void lookup_and_load_custom_libraries(LinkLibraryContext *ctx, bh_arr(LinkedLibrary)* p_out) {
+    bh_arr(LinkedLibrary) out = *p_out;
 
     char *onyx_path = getenv("ONYX_PATH");
     if (onyx_path) {
@@ -193,8 +220,8 @@ static void lookup_and_load_custom_libraries(LinkLibraryContext *ctx, bh_arr(Was
                     library_name[lib_name_length] = '\0';
                     cursor += lib_name_length;
 
-                    WasmFuncDefinition** lib = onyx_load_library(ctx, library_name);
-                    if (lib) {
+                    LinkedLibrary lib = onyx_load_library(ctx, library_name);
+                    if (lib.funcs) {
                         bh_arr_push(out, lib);
                     }
                 }
@@ -416,6 +443,14 @@ static void onyx_print_trap(wasm_trap_t* trap) {
         i32 func_idx   = wasm_frame_func_index(frames.data[i]);
         i32 mod_offset = wasm_frame_module_offset(frames.data[i]);
 
+        // Runs of the same frame, like from a stack overflow, are only printed once.
+        i32 repeats = 0;
+        while (i + repeats + 1 < (i32) frames.size
+            && (i32) wasm_frame_func_index(frames.data[i + repeats + 1]) == func_idx
+            && (i32) wasm_frame_module_offset(frames.data[i + repeats + 1]) == mod_offset) {
+            repeats++;
+        }
+
         if (func_name_section > 0) {
             i32 cursor = func_name_section + 4 * func_idx;
             i32 func_offset = *(i32 *) (wasm_raw_bytes.data + cursor);
@@ -425,6 +460,11 @@ static void onyx_print_trap(wasm_trap_t* trap) {
         } else {
             bh_printf("    func[%d]\n", func_idx);
         }
+
+        if (repeats > 0) {
+            bh_printf("    ... repeated %d more times\n", repeats);
+            i += repeats;
+        }
     }
 }
 
@@ -445,7 +485,7 @@ static wasm_trap_t *__error_on_call(void *env, const wasm_val_vec_t *args, wasm_
 // This could be cleaned up a bit, as this function directly modifies various global variables.
 // Those being wasm_memory and wasm_imports.
 static b32 link_wasm_imports(
-        bh_arr(WasmFuncDefinition **) linkable_functions,
+        bh_arr(LinkedLibrary) linkable_functions,
         LinkLibraryContext *lib_ctx,
         wasm_module_t *wasm_module)
 {
@@ -501,8 +541,8 @@ static b32 link_wasm_imports(
         }
 #endif
 
-        bh_arr_each(WasmFuncDefinition **, library_funcs, linkable_functions) {
-            WasmFuncDefinition **pcurrent_function = *library_funcs;
+        bh_arr_each(LinkedLibrary, library, linkable_functions) {
+            WasmFuncDefinition **pcurrent_function = library->funcs;
             while (*pcurrent_function != NULL) {
                 WasmFuncDefinition *cf = *pcurrent_function;
                 if (wasm_name_equals_string(module_name, cf->module_name) && wasm_name_equals_string(import_name, cf->import_name)) {
@@ -516,7 +556,16 @@ static b32 link_wasm_imports(
 
                     wasm_functype_t* wasm_functype = wasm_functype_new(&wasm_params, &wasm_results);
 
-                    wasm_func_t* wasm_func = wasm_func_new(wasm_store, wasm_functype, cf->func);
+                    wasm_func_t* wasm_func;
+
+#ifdef USE_OVM_DEBUGGER
+                    if (library->raw_calls) {
+                        wasm_func_t *wasm_func_new_with_raw_callback(wasm_store_t *, const wasm_functype_t *, wasm_func_callback_t, OnyxRawFuncCallback);
+                        wasm_func = wasm_func_new_with_raw_callback(wasm_store, wasm_functype, cf->func, ((OnyxRawFuncDefinition *) cf)->raw_func);
+                    } else
+#endif
+                    wasm_func = wasm_func_new(wasm_store, wasm_functype, cf->func);
+
                     import = wasm_func_as_extern(wasm_func);
                     goto import_found;
                 }
@@ -554,7 +603,7 @@ static b32 link_wasm_imports(
     return 1;
 }
 
-void onyx_run_initialize(b32 debug_enabled) {
+void onyx_run_initialize(b32 debug_enabled, char *profile_path, char *counts_path) {
     wasm_config = wasm_config_new();
     if (!wasm_config) {
         cleanup_wasm_objects();
@@ -564,6 +613,16 @@ void onyx_run_initialize(b32 debug_enabled) {
 #ifdef USE_OVM_DEBUGGER
     void wasm_config_enable_debug(wasm_config_t *config, int value);
     wasm_config_enable_debug(wasm_config, debug_enabled);
+
+    if (profile_path) {
+        void wasm_config_set_profile_path(wasm_config_t *config, char *profile_path);
+        wasm_config_set_profile_path(wasm_config, profile_path);
+    }
+
+    if (counts_path) {
+        void wasm_config_set_counts_path(wasm_config_t *config, char *counts_path);
+        wasm_config_set_counts_path(wasm_config, counts_path);
+    }
 #endif
 
 #ifndef USE_OVM_DEBUGGER
@@ -571,6 +630,14 @@ void onyx_run_initialize(b32 debug_enabled) {
         printf("Warning: --debug does nothing if libovmwasm.so is not being used!\n");
     }
 
+    if (profile_path) {
+        printf("Warning: --profile does nothing if libovmwasm.so is not being used!\n");
+    }
+
+    if (counts_path) {
+        printf("Warning: --counts does nothing if libovmwasm.so is not being used!\n");
+    }
+
     wasmer_features_t* features = wasmer_features_new();
     wasmer_features_simd(features, 1);
     wasmer_features_threads(features, 1);
@@ -592,6 +659,7 @@ void onyx_run_initialize(b32 debug_enabled) {
 
     // See comment in onyx_library.h about us being the linker.
     wasm_runtime.wasm_memory_data = &wasm_memory_data;
+    wasm_runtime.wasm_memory_data_size = &wasm_memory_data_size;
     wasm_runtime.wasm_extern_lookup_by_name = &wasm_extern_lookup_by_name;
     wasm_runtime.wasm_extern_as_func = &wasm_extern_as_func;
     wasm_runtime.wasm_func_call = &wasm_func_call;
@@ -606,7 +674,7 @@ b32 onyx_run_wasm(bh_buffer wasm_bytes, int argc, char *argv[]) {
     runtime = &wasm_runtime;
     wasm_raw_bytes = wasm_bytes;
 
-    bh_arr(WasmFuncDefinition **) linkable_functions = NULL;
+    bh_arr(LinkedLibrary) linkable_functions = NULL;
     bh_arr_new(bh_heap_allocator(), linkable_functions, 4);
 
     LinkLibraryContext lib_ctx;
@@ -652,6 +720,13 @@ b32 onyx_run_wasm(bh_buffer wasm_bytes, int argc, char *argv[]) {
 #ifdef USE_DYNCALL
     wasm_runtime.wasm_func_from_idx = wasm_func_from_idx;
 #endif
+
+#ifdef USE_OVM_DEBUGGER
+    if (wasm_memory) {
+        char **wasm_memory_data_ref(wasm_memory_t *memory);
+        wasm_runtime.wasm_memory_data_ref = wasm_memory_data_ref(wasm_memory);
+    }
+#endif
     
     wasm_runtime.argc = argc;
     wasm_runtime.argv = argv;
@@ -392,7 +392,7 @@ static u64 build_type_table(OnyxWasmModule* module) {
 
                     if (struct_scope == NULL) goto no_methods;
 
-                    fori (i, 0, shlen(struct_scope->symbols)) {
+                    fori (i, 0, hmlen(struct_scope->symbols)) {
                         AstFunction* node = (AstFunction *) strip_aliases(struct_scope->symbols[i].value);
                         if (node->kind != Ast_Kind_Function) continue;
                         assert(node->entity);
@@ -651,7 +651,7 @@ static u64 build_type_table(OnyxWasmModule* module) {
 
                     if (union_scope == NULL) goto no_union_methods;
 
-                    fori (i, 0, shlen(union_scope->symbols)) {
+                    fori (i, 0, hmlen(union_scope->symbols)) {
                         AstFunction* node = (AstFunction *) strip_aliases(union_scope->symbols[i].value);
                         if (node->kind != Ast_Kind_Function) continue;
                         assert(node->entity);
@@ -891,13 +891,13 @@ static u64 build_foreign_blocks(OnyxWasmModule* module) {
 
         u32 funcs_length = 0;
 
-        u32 *name_offsets = bh_alloc_array(global_scratch_allocator, u32, shlen(fb->scope->symbols));
-        u32 *name_lengths = bh_alloc_array(global_scratch_allocator, u32, shlen(fb->scope->symbols));
-        u32 *func_types   = bh_alloc_array(global_scratch_allocator, u32, shlen(fb->scope->symbols));
-        u32 *tag_offsets  = bh_alloc_array(global_scratch_allocator, u32, shlen(fb->scope->symbols));
-        u32 *tag_lengths  = bh_alloc_array(global_scratch_allocator, u32, shlen(fb->scope->symbols));
+        u32 *name_offsets = bh_alloc_array(global_scratch_allocator, u32, hmlen(fb->scope->symbols));
+        u32 *name_lengths = bh_alloc_array(global_scratch_allocator, u32, hmlen(fb->scope->symbols));
+        u32 *func_types   = bh_alloc_array(global_scratch_allocator, u32, hmlen(fb->scope->symbols));
+        u32 *tag_offsets  = bh_alloc_array(global_scratch_allocator, u32, hmlen(fb->scope->symbols));
+        u32 *tag_lengths  = bh_alloc_array(global_scratch_allocator, u32, hmlen(fb->scope->symbols));
 
-        fori (i, 0, shlen(fb->scope->symbols)) {
+        fori (i, 0, hmlen(fb->scope->symbols)) {
             AstFunction *func = (AstFunction *) fb->scope->symbols[i].value;
             if (func->kind != Ast_Kind_Function) continue;
 
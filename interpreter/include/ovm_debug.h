@@ -302,6 +302,15 @@ typedef struct debug_state_t {
     debug_info_t *info;
     struct ovm_engine_t *ovm_engine;
 
+    //
+    // The code of the program as it was loaded, before any breakpoints
+    // were written over it, and a bit per instruction that is set when
+    // the instruction starts a new line. Both are NULL until the program
+    // is known.
+    struct ovm_program_t *program;
+    struct ovm_instr_t *original_code;
+    u64 *line_starts;
+
     bh_arr(debug_thread_state_t *) threads;
     u32 next_thread_id;
 
@@ -322,6 +331,8 @@ typedef struct debug_state_t {
 void debug_host_init(debug_state_t *debug, struct ovm_engine_t *ovm_engine);
 void debug_host_start(debug_state_t *debug);
 void debug_host_stop(debug_state_t *debug);
+void debug_host_set_program(debug_state_t *debug, struct ovm_program_t *program);
+void debug_host_sync_breakpoint(debug_state_t *debug, u32 instr);
 u32  debug_host_register_thread(debug_state_t *debug, struct ovm_state_t *ovm_state);
 debug_thread_state_t *debug_host_lookup_thread(debug_state_t *debug, u32 id);
 
@@ -7,13 +7,29 @@
 
 // Core Utils
 
+// Once the program cache grows past this many bytes, the least recently
+// used programs are removed.
+#define OVM_CACHE_DEFAULT_MAX_SIZE (256ll << 20)
+
 struct wasm_config_t {
     bool debug_enabled;
     char *listen_path;
+    i32 jit_threshold;
+    char *cache_dir;
+    i64 cache_max_size;
+    char *profile_path;
+    char *counts_path;
+    char *frames_path;
 };
 
 void wasm_config_enable_debug(wasm_config_t *config, bool enabled);
 void wasm_config_set_listen_path(wasm_config_t *config, char *listen_path);
+void wasm_config_set_jit_threshold(wasm_config_t *config, i32 threshold);
+void wasm_config_set_cache_dir(wasm_config_t *config, char *cache_dir);
+void wasm_config_set_cache_max_size(wasm_config_t *config, i64 max_size);
+void wasm_config_set_profile_path(wasm_config_t *config, char *profile_path);
+void wasm_config_set_counts_path(wasm_config_t *config, char *counts_path);
+void wasm_config_set_frames_path(wasm_config_t *config, char *frames_path);
 
 struct wasm_engine_t {
     wasm_config_t *config;
@@ -30,6 +46,12 @@ struct wasm_store_t {
 
 // Types
 
+//
+// The wasm-c-api does not have a value kind for v128, because they cannot
+// cross the host boundary. OVM still needs to know about them to lay out
+// the value numbers of functions that use them.
+#define WASM_V128 ((wasm_valkind_t) 4)
+
 struct wasm_valtype_t {
     wasm_valkind_t kind;
 };
@@ -168,12 +190,38 @@ struct wasm_module_t {
     debug_info_t debug_info;
 };
 
+//
+// Raw callbacks take their parameters as untagged 8-byte values, which is how
+// the VM stores them, so they can be called without converting each parameter
+// to a wasm_val_t. These match OnyxRawValVec in onyx_library.h.
+typedef union wasm_raw_val_t {
+    i32 i32;
+    i64 i64;
+    f32 f32;
+    f64 f64;
+} wasm_raw_val_t;
+
+typedef struct wasm_raw_val_vec_t {
+    size_t size;
+    wasm_raw_val_t *data;
+} wasm_raw_val_vec_t;
+
+typedef wasm_trap_t *(*wasm_func_raw_callback_t)(const wasm_raw_val_vec_t *params, wasm_val_vec_t *results);
+
+wasm_func_t *wasm_func_new_with_raw_callback(wasm_store_t *store, const wasm_functype_t *type,
+    wasm_func_callback_t callback, wasm_func_raw_callback_t raw_callback);
+
+byte_t **wasm_memory_data_ref(wasm_memory_t *memory);
+
 struct wasm_func_inner_t {
     bool env_present;
     void *env;
     void (*func_ptr)();
     void (*finalizer)(void *);
 
+    // Used instead of func_ptr when the VM calls the function, if present.
+    wasm_func_raw_callback_t raw_func_ptr;
+
     const wasm_functype_t *type;
 };
 
@@ -23,6 +23,11 @@ typedef struct ovm_value_t ovm_value_t;
 typedef struct ovm_instr_t ovm_instr_t;
 typedef struct ovm_static_data_t ovm_static_data_t;
 typedef struct ovm_static_integer_array_t ovm_static_integer_array_t;
+typedef struct ovm_jit_t ovm_jit_t;
+typedef struct ovm_profiler_t ovm_profiler_t;
+typedef struct ovm_counters_t ovm_counters_t;
+
+typedef u64 (*ovm_native_func_t)(ovm_state_t *state, ovm_value_t *values, u8 *memory, void *resume_at);
 
 
 //
@@ -58,6 +63,22 @@ struct ovm_static_integer_array_t {
 #define OVM_TYPE_V128   0x07
 #define OVM_TYPE_ERR    0xff
 
+//
+// Values are untagged 8-byte slots. The type of every value is known
+// from the instruction that produced or consumes it, so the tag is only
+// kept when OVM_TAGGED_VALUES is defined, which OVM_DEBUG implies, to let
+// ovm_assert check operand types. The debugger does not use the tag; it
+// reads locals using the types the compiler records in the debug info.
+#if defined(OVM_DEBUG) && !defined(OVM_TAGGED_VALUES)
+    #define OVM_TAGGED_VALUES 1
+#endif
+
+#ifdef OVM_TAGGED_VALUES
+    #define OVM_SET_TYPE(v, t) ((v).type = (t))
+#else
+    #define OVM_SET_TYPE(v, t) ((void) 0)
+#endif
+
 struct ovm_value_t {
     union {
         i8  i8;
@@ -71,7 +92,9 @@ struct ovm_value_t {
         f32 f32;
         f64 f64;
     };
+#ifdef OVM_TAGGED_VALUES
     ovm_valtype_t type;
+#endif
 };
 
 
@@ -90,6 +113,11 @@ struct ovm_program_t {
 
     i32 register_count;
     ovm_store_t *store;
+
+    //
+    // Executable memory for functions compiled by the JIT.
+    // NULL when the JIT is not available.
+    ovm_jit_t *jit;
 };
 
 ovm_program_t *ovm_program_new(ovm_store_t *store);
@@ -110,22 +138,66 @@ void ovm_program_modify_static_int(ovm_program_t *program, int arr, int idx, int
 struct ovm_engine_t {
     ovm_store_t *store;
 
+    // Only used to implement wait/notify on platforms without futexes.
     pthread_mutex_t atomic_mutex;
+    pthread_cond_t  atomic_cond;
 
-    i64   memory_size; // This is probably going to always be 4GiB.
+    //
+    // Linear memory is reserved up front and never moves. Only the first
+    // memory_size bytes are usable; growing makes more of the reservation
+    // accessible, up to memory_reserved bytes. The reservation is followed
+    // by a guard region of the same size, so that an address plus an offset
+    // that lands outside the memory faults instead of reaching other data.
+    // Such a fault traps the state that caused it (see ovm_func_call).
+    i64   memory_size;
+    i64   memory_reserved;
     void *memory;
 
     debug_state_t *debug;
+
+    //
+    // Number of calls and backward branches after which a function is
+    // compiled to native code. Zero disables the JIT.
+    i32 jit_threshold;
+
+    //
+    // NULL unless the program is being profiled.
+    ovm_profiler_t *profiler;
+
+    //
+    // NULL unless execution counts are being collected.
+    ovm_counters_t *counters;
 };
 
+//
+// Wasm's 32-bit addresses can reach at most 4GiB.
+#define OVM_MEMORY_MAX_SIZE  (1ll << 32)
+
 ovm_engine_t *ovm_engine_new(ovm_store_t *store);
 void          ovm_engine_delete(ovm_engine_t *engine);
 void          ovm_engine_enable_debug(ovm_engine_t *engine, debug_state_t *debug);
 bool          ovm_engine_memory_ensure_capacity(ovm_engine_t *engine, i64 minimum_size);
 void          ovm_engine_memory_copy(ovm_engine_t *engine, i64 target, void *data, i64 size);
+i32           ovm_engine_atomic_wait(ovm_engine_t *engine, u32 addr, i64 expected, i64 timeout, bool wide);
+i32           ovm_engine_atomic_notify(ovm_engine_t *engine, u32 addr, i32 count);
 
 bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, char *filename);
 
+//
+// Program images
+//
+// An image is a built program, along with the debug information generated while
+// building it, in a form that can be loaded without building the program again.
+// Images are used as an on-disk cache, so they are only valid for the build of OVM
+// that wrote them. Bump OVM_PROGRAM_IMAGE_VERSION when the instruction encoding or
+// the layout of an image changes.
+//
+#define OVM_PROGRAM_IMAGE_VERSION 2
+
+void ovm_program_write_image(ovm_program_t *program, debug_info_t *debug, bh_buffer *out);
+bool ovm_program_read_image(ovm_program_t *program, debug_info_t *debug, u8 *data, u32 size);
+void ovm_program_read_image_files(debug_info_t *debug, u8 *data, u32 size);
+
 //
 // Represents ephemeral state / execution context.
 // If multiple threads are used, multiple states are needed.
@@ -133,6 +205,12 @@ bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, ch
 
 #define OVM_MAX_PARAM_COUNT 64
 
+//
+// Every state owns a value stack and a frame stack of a fixed size, each
+// followed by a guard page. A call that does not fit traps.
+#define OVM_VALUE_STACK_SIZE  (1 << 22)
+#define OVM_FRAME_STACK_SIZE  (1 << 18)
+
 struct ovm_state_t {
     ovm_store_t *store;
     ovm_engine_t *engine;
@@ -141,8 +219,17 @@ struct ovm_state_t {
     i32 pc;
     i32 value_number_offset;
 
-    bh_arr(ovm_value_t) numbered_values;
-    bh_arr(ovm_stack_frame_t) stack_frames;
+    //
+    // These never move, so calls only have to bump the counts.
+    ovm_value_t *numbered_values;
+    i32          numbered_value_count;
+
+    ovm_stack_frame_t *stack_frames;
+    i32                stack_frame_count;
+
+    void *stacks_mapping;
+    u64   stacks_mapping_size;
+
     bh_arr(ovm_value_t) registers;
 
     ovm_value_t *param_buf;
@@ -160,15 +247,33 @@ struct ovm_state_t {
     // Temporary value used in computations. Should not be used otherwise.
     ovm_value_t __tmp_value;
 
+    //
+    // Set when the running code traps. Cleared on entry to ovm_func_call.
+    // The message is only set for some traps.
+    bool trapped;
+    const char *trap_message;
+
     //
     // TODO Doc
     ovm_value_t *__frame_values;
 
     debug_thread_state_t *debug;
     i32                   call_depth;
+
+    //
+    // Number of native functions currently on the C stack. Past
+    // OVM_JIT_MAX_NATIVE_DEPTH, calls are interpreted so that deep
+    // recursion cannot overflow the C stack.
+    i32 native_depth;
+
+    //
+    // Set if the engine is counting instructions for this state's program.
+    // The counting dispatch table is used instead of the normal one.
+    ovm_counters_t *counters;
 };
 
 ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program);
+ovm_state_t *ovm_state_current();
 void         ovm_state_delete(ovm_state_t *state);
 void ovm_state_link_external_funcs(ovm_program_t *program, ovm_state_t *state, ovm_linkable_func_t *funcs);
 void ovm_state_register_external_func(ovm_state_t *state, i32 idx, void (*func)(void *, ovm_value_t *, ovm_value_t *), void *data);
@@ -209,6 +314,18 @@ struct ovm_func_t {
         i32 start_instr;
         i32 external_func_idx;
     };
+
+    //
+    // Used by the JIT. Calls and taken backward branches are counted until the
+    // function is compiled. native_offsets maps each instruction of the function
+    // to its offset in the native code, so execution can move into native code
+    // in the middle of a loop. The counters are only touched with relaxed atomics,
+    // and native is published with a release store once the code is executable.
+    u32 call_count;
+    u32 back_edge_count;
+    ovm_native_func_t native;
+    u32 *native_offsets;
+    bool jit_failed;
 };
 
 struct ovm_external_func_t {
@@ -230,6 +347,72 @@ ovm_value_t ovm_func_call(ovm_engine_t *engine, ovm_state_t *state, ovm_program_
         i32 param_count, ovm_value_t *params);
 ovm_value_t ovm_run_code(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program);
 
+//
+// Baseline JIT
+//
+// On x86-64, functions that get hot are translated to native code, one template per
+// instruction. Native code works directly on the value numbers of the frame, so the
+// interpreter and native code can hand a frame to each other at any instruction.
+// Debug sessions always use the interpreter. The instructions of a program must
+// not change once the program has started running, as native code refers to them.
+//
+#if defined(__x86_64__) && defined(_BH_LINUX) && !defined(OVM_TAGGED_VALUES)
+    #define OVM_JIT 1
+#endif
+
+#define OVM_JIT_DEFAULT_THRESHOLD 1000
+#define OVM_JIT_MAX_NATIVE_DEPTH  1024
+
+ovm_jit_t *ovm_jit_new(bh_allocator allocator);
+void       ovm_jit_delete(ovm_jit_t *jit);
+bool       ovm_jit_compile(ovm_program_t *program, ovm_func_t *func);
+
+// These are only called by native code.
+void  ovm__jit_call(ovm_state_t *state, i32 func_idx, i32 result_number);
+void *ovm__jit_instr_handler(u32 full_instr);
+extern ovm_instr_t ovm__jit_exit_instr;
+
+//
+// Sampling profiler
+//
+// A CPU-time timer interrupts whichever thread is running, and the signal handler
+// copies the call stack of that thread's state into a preallocated slot. A
+// background thread turns the slots into collapsed stacks ("main;f;g 12"), which
+// are written to the output file when the profiler is stopped, or at exit.
+//
+#define OVM_PROFILER_HZ 997
+
+ovm_profiler_t *ovm_profiler_new(char *output_path);
+void            ovm_profiler_set_debug_info(ovm_profiler_t *profiler, debug_info_t *info);
+bool            ovm_profiler_start(ovm_profiler_t *profiler);
+void            ovm_profiler_stop(ovm_profiler_t *profiler);
+void            ovm_profiler_delete(ovm_profiler_t *profiler);
+
+//
+// Execution counters
+//
+// When counting, the interpreter runs with a third dispatch table that bumps a
+// counter for every instruction it executes. Function, opcode, basic block and
+// instruction pair counts are all derived from these when the report is written,
+// so the only cost while running is one increment per instruction. Native code
+// does not go through the dispatch table, so the JIT is off while counting.
+//
+struct ovm_counters_t {
+    char *output_path;
+    debug_info_t *info;
+
+    ovm_program_t *program;
+    u64 *instr_counts;  // One for each instruction in the program
+    u64 *call_counts;   // One for each function in the program
+
+    bool report_written;
+};
+
+ovm_counters_t *ovm_counters_new(char *output_path);
+void            ovm_counters_set_program(ovm_counters_t *counters, ovm_program_t *program, debug_info_t *info);
+void            ovm_counters_write_report(ovm_counters_t *counters);
+void            ovm_counters_delete(ovm_counters_t *counters);
+
 //
 // Instruction encoding
 //
@@ -279,6 +462,8 @@ struct ovm_instr_t {
 #define OVMI_SHR               0x0C   // %r = %a >> %b
 #define OVMI_SAR               0x0D   // %r = %a >>> %b
 
+#define OVMI_NATIVE_EXIT       0x0E   // return to native code after a single instruction
+
 #define OVMI_IMM               0x10   // %r = i/l/f/d
 #define OVMI_MOV               0x11   // %r = %a
 #define OVMI_LOAD              0x12   // %r = mem[%a + %b]
@@ -354,18 +539,130 @@ struct ovm_instr_t {
 
 #define OVMI_CMPXCHG           0x4c   // %r = %r == %a ? %b : %r
 
+//
+// An untyped break traps, like Wasm's unreachable. The debugger sets a
+// breakpoint by writing OVM_BREAKPOINT_INSTR over the first instruction
+// of a line, and keeps the original to run once the thread resumes.
 #define OVMI_BREAK             0x4d
 
 #define OVMI_MEM_SIZE          0x4e   // %r = <size in bytes of memory>
 #define OVMI_MEM_GROW          0x4f   // %r = <grow memory, return new size in bytes>
 
+//
+// Vector instructions. A v128 value occupies two consecutive value numbers,
+// %n holding the low 64 bits and %n+1 the high 64 bits. The type of these
+// instructions is the lane shape (i8 is i8x16, ..., f64 is f64x2), and
+// v128 is used for operations that do not care about lanes. For conversions,
+// the type is the lane shape of the result.
+#define OVMI_VSPLAT            0x50   // %r = splat(%a)
+#define OVMI_VEXTRACT          0x51   // %r = %a[b]
+#define OVMI_VEXTRACT_S        0x52   // %r = %a[b] (sign extended)
+#define OVMI_VREPLACE          0x53   // %r[b] = %a
+#define OVMI_VSHUFFLE          0x54   // %r = shuffle(%a, %b, lanes in %r)
+#define OVMI_VSWIZZLE          0x55   // %r = swizzle(%a, %b)
+#define OVMI_VBITSELECT        0x56   // %r = (%a & %r) | (%b & ~%r)
+#define OVMI_VNOT              0x57   // %r = ~%a
+#define OVMI_VAND              0x58   // %r = %a & %b
+#define OVMI_VANDNOT           0x59   // %r = %a & ~%b
+#define OVMI_VOR               0x5a   // %r = %a | %b
+#define OVMI_VXOR              0x5b   // %r = %a ^ %b
+
+#define OVMI_VEQ               0x5c   // %r = %a == %b
+#define OVMI_VNE               0x5d   // %r = %a != %b
+#define OVMI_VLT               0x5e   // %r = %a < %b
+#define OVMI_VLT_S             0x5f   // %r = %a < %b
+#define OVMI_VLE               0x60   // %r = %a <= %b
+#define OVMI_VLE_S             0x61   // %r = %a <= %b
+#define OVMI_VGT               0x62   // %r = %a > %b
+#define OVMI_VGT_S             0x63   // %r = %a > %b
+#define OVMI_VGE               0x64   // %r = %a >= %b
+#define OVMI_VGE_S             0x65   // %r = %a >= %b
+
+#define OVMI_VABS              0x66   // %r = |%a|
+#define OVMI_VNEG              0x67   // %r = -%a
+#define OVMI_VANY_TRUE         0x68   // %r = any lane of %a != 0
+#define OVMI_VALL_TRUE         0x69   // %r = all lanes of %a != 0
+#define OVMI_VBITMASK          0x6a   // %r = top bit of each lane of %a
+#define OVMI_VNARROW           0x6b   // %r = saturate(%a ++ %b)
+#define OVMI_VNARROW_S         0x6c   // %r = saturate(%a ++ %b) (sign aware)
+#define OVMI_VWIDEN_LOW        0x6d   // %r = widen(low half of %a)
+#define OVMI_VWIDEN_LOW_S      0x6e   // %r = widen(low half of %a) (sign aware)
+#define OVMI_VWIDEN_HIGH       0x6f   // %r = widen(high half of %a)
+#define OVMI_VWIDEN_HIGH_S     0x70   // %r = widen(high half of %a) (sign aware)
+#define OVMI_VSHL              0x71   // %r = %a << %b
+#define OVMI_VSHR              0x72   // %r = %a >> %b
+#define OVMI_VSAR              0x73   // %r = %a >>> %b
+#define OVMI_VADD              0x74   // %r = %a + %b
+#define OVMI_VADD_SAT          0x75   // %r = %a + %b (saturating)
+#define OVMI_VADD_SAT_S        0x76   // %r = %a + %b (saturating, sign aware)
+#define OVMI_VSUB              0x77   // %r = %a - %b
+#define OVMI_VSUB_SAT          0x78   // %r = %a - %b (saturating)
+#define OVMI_VSUB_SAT_S        0x79   // %r = %a - %b (saturating, sign aware)
+#define OVMI_VMUL              0x7a   // %r = %a * %b
+#define OVMI_VDIV              0x7b   // %r = %a / %b
+#define OVMI_VMIN              0x7c   // %r = min(%a, %b)
+#define OVMI_VMIN_S            0x7d   // %r = min(%a, %b)
+#define OVMI_VMAX              0x7e   // %r = max(%a, %b)
+#define OVMI_VMAX_S            0x7f   // %r = max(%a, %b)
+#define OVMI_VAVGR             0x80   // %r = (%a + %b + 1) / 2
+#define OVMI_VSQRT             0x81   // %r = sqrt(%a)
+#define OVMI_VTRUNC_SAT        0x82   // %r = (t) %a (saturating)
+#define OVMI_VTRUNC_SAT_S      0x83   // %r = (t) %a (saturating, sign aware)
+#define OVMI_VCONVERT          0x84   // %r = (t) %a
+#define OVMI_VCONVERT_S        0x85   // %r = (t) %a (sign aware)
+
+//
+// Atomic read-modify-write instructions. %a is the address (offset already
+// applied), and the type is the width of the memory being modified. The value
+// previously in memory is zero-extended into %r.
+#define OVMI_ATOMIC_ADD        0x86   // %r = mem[%a], mem[%a] += %b
+#define OVMI_ATOMIC_SUB        0x87   // %r = mem[%a], mem[%a] -= %b
+#define OVMI_ATOMIC_AND        0x88   // %r = mem[%a], mem[%a] &= %b
+#define OVMI_ATOMIC_OR         0x89   // %r = mem[%a], mem[%a] |= %b
+#define OVMI_ATOMIC_XOR        0x8a   // %r = mem[%a], mem[%a] ^= %b
+#define OVMI_ATOMIC_XCHG       0x8b   // %r = mem[%a], mem[%a] = %b
+#define OVMI_ATOMIC_WAIT       0x8c   // %r = wait(mem[%r] == %a, timeout %b)
+#define OVMI_ATOMIC_NOTIFY     0x8d   // %r = notify(mem[%a], count %b)
+#define OVMI_ATOMIC_FENCE      0x8e
+
+//
+// Superinstructions. These are never in the WebAssembly, they are formed by
+// the code builder when it sees the sequences they replace.
+#define OVMI_ADDI              0x8f   // %r = %a + b (b is a sign-extended immediate)
+#define OVMI_BR_LT             0x90   // br pc + a if %r < %b
+#define OVMI_BR_LT_S           0x91   // br pc + a if %r < %b
+#define OVMI_BR_LE             0x92   // br pc + a if %r <= %b
+#define OVMI_BR_LE_S           0x93   // br pc + a if %r <= %b
+#define OVMI_BR_EQ             0x94   // br pc + a if %r == %b
+#define OVMI_BR_GE             0x95   // br pc + a if %r >= %b
+#define OVMI_BR_GE_S           0x96   // br pc + a if %r >= %b
+#define OVMI_BR_GT             0x97   // br pc + a if %r > %b
+#define OVMI_BR_GT_S           0x98   // br pc + a if %r > %b
+#define OVMI_BR_NE             0x99   // br pc + a if %r != %b
+
+//
+// Tail calls reuse the frame of the caller, so the callee returns to the
+// caller's caller. %r is only used when native code runs them as a call
+// followed by a return.
+#define OVMI_RETURN_CALL       0x9a   // return a(...)
+#define OVMI_RETURN_CALLI      0x9b   // return %a(...)
+
+//
+// Atomic loads and stores. Unlike LOAD and STORE, these trap if the address
+// is out of bounds or not aligned to the width of the memory.
+#define OVMI_ATOMIC_LOAD       0x9c   // %r = mem[%a + %b]
+#define OVMI_ATOMIC_STORE      0x9d   // mem[%r + %b] = %a
+
 //
 // OVM_TYPED_INSTR(OVMI_ADD, OVM_TYPE_I32) == instruction for adding i32s
 //
 #define OVM_TYPED_INSTR(instr, type)  (((instr) << 3) | (type))
 
+#define OVM_BREAKPOINT_INSTR  OVM_TYPED_INSTR(OVMI_BREAK, OVM_TYPE_I32)
+
 
 void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_text);
+void ovm_disassemble_opcode(u32 full_instr, bh_buffer *instr_text);
 
 #endif
 
@@ -15,11 +15,24 @@ typedef enum label_kind_t label_kind_t;
 struct ovm_code_builder_t {
     bh_arr(i32) execution_stack;
 
+    // Parallel to execution_stack; see PUSH_VALUE.
+    bh_arr(i32) value_stack_tops;
+
     i32 next_label_idx;
     bh_arr(label_target_t) label_stack;
     bh_arr(branch_patch_t) branch_patches;
 
-    i32 param_count, result_count, local_count;
+    i32 result_count;
+
+    // Counted in value numbers, not WebAssembly locals; a v128
+    // parameter or local takes up two value numbers.
+    i32 param_count, local_count;
+
+    // Maps a WebAssembly local index to its value number.
+    bh_arr(i32) local_map;
+
+    // Indexed by value number; true for the first value number of a v128.
+    bh_arr(bool) v128_values;
 
     ovm_program_t *program;
     i32 start_instr;
@@ -28,6 +41,15 @@ struct ovm_code_builder_t {
     i32 highest_value_number;
 
     debug_info_builder_t *debug_builder;
+
+    // The first line info entry made while building this function. Lines
+    // from here on may point into this function's instructions.
+    i32 first_line_info;
+
+    // If set, the index of every instruction that refers to static data
+    // registered by this builder is pushed here, so the function can be
+    // built into a separate program and relocated when it is merged.
+    bh_arr(i32) *static_data_relocs;
 };
 
 enum label_kind_t {
@@ -59,12 +81,13 @@ struct branch_patch_t {
     bool targets_else;
 };
 
-ovm_code_builder_t ovm_code_builder_new(ovm_program_t *program, debug_info_builder_t *debug, i32 param_count, i32 result_count, i32 local_count);
+ovm_code_builder_t ovm_code_builder_new(ovm_program_t *program, debug_info_builder_t *debug, i32 param_count, i32 result_count, i32 local_count, ovm_valtype_t *local_types);
 label_target_t     ovm_code_builder_wasm_target_idx(ovm_code_builder_t *builder, i32 idx);
 i32                ovm_code_builder_push_label_target(ovm_code_builder_t *builder, label_kind_t kind);
 void               ovm_code_builder_pop_label_target(ovm_code_builder_t *builder);
 void               ovm_code_builder_patch_else(ovm_code_builder_t *builder, label_target_t if_target);
 void               ovm_code_builder_free(ovm_code_builder_t *builder);
+void               ovm_code_builder_form_superinstructions(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_nop(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_break(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_binop(ovm_code_builder_t *builder, u32 instr);
@@ -74,8 +97,10 @@ void               ovm_code_builder_add_branch(ovm_code_builder_t *builder, i32
 void               ovm_code_builder_add_cond_branch(ovm_code_builder_t *builder, i32 label_idx, bool branch_if_true, bool targets_else);
 void               ovm_code_builder_add_branch_table(ovm_code_builder_t *builder, i32 count, i32 *label_indicies, i32 default_label_idx);
 void               ovm_code_builder_add_return(ovm_code_builder_t *builder);
-void               ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, bool has_return_value);
-void               ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_count, bool has_return_value);
+void               ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, u32 return_type);
+void               ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_count, u32 return_type);
+void               ovm_code_builder_add_tail_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, u32 return_type);
+void               ovm_code_builder_add_indirect_tail_call(ovm_code_builder_t *builder, i32 param_count, u32 return_type);
 void               ovm_code_builder_drop_value(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_local_get(ovm_code_builder_t *builder, i32 local_idx);
 void               ovm_code_builder_add_local_set(ovm_code_builder_t *builder, i32 local_idx);
@@ -87,9 +112,19 @@ void               ovm_code_builder_add_store(ovm_code_builder_t *builder, u32 o
 void               ovm_code_builder_add_atomic_load(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
 void               ovm_code_builder_add_atomic_store(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
 void               ovm_code_builder_add_cmpxchg(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
+void               ovm_code_builder_add_atomic_rmw(ovm_code_builder_t *builder, u32 instr, u32 ovm_type, i32 offset);
+void               ovm_code_builder_add_atomic_wait(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
+void               ovm_code_builder_add_atomic_fence(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_copy(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_fill(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_size(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_grow(ovm_code_builder_t *builder);
+void               ovm_code_builder_add_v128_imm(ovm_code_builder_t *builder, u8 *bytes);
+void               ovm_code_builder_add_v128_binop(ovm_code_builder_t *builder, u32 instr);
+void               ovm_code_builder_add_v128_unop(ovm_code_builder_t *builder, u32 instr);
+void               ovm_code_builder_add_v128_extract_lane(ovm_code_builder_t *builder, u32 instr, i32 lane);
+void               ovm_code_builder_add_v128_replace_lane(ovm_code_builder_t *builder, u32 instr, i32 lane);
+void               ovm_code_builder_add_v128_shuffle(ovm_code_builder_t *builder, u8 *lanes);
+void               ovm_code_builder_add_v128_bitselect(ovm_code_builder_t *builder);
 
 #endif
@@ -35,6 +35,54 @@ void debug_host_stop(debug_state_t *debug) {
     pthread_join(debug->debug_thread, NULL);
 }
 
+void debug_host_set_program(debug_state_t *debug, ovm_program_t *program) {
+    i32 code_count = bh_arr_length(program->code);
+
+    debug->original_code = bh_alloc_array(debug->alloc, ovm_instr_t, code_count);
+    memcpy(debug->original_code, program->code, code_count * sizeof(ovm_instr_t));
+
+    debug->line_starts = bh_alloc_array(debug->alloc, u64, (code_count + 63) / 64);
+    memset(debug->line_starts, 0, ((code_count + 63) / 64) * sizeof(u64));
+
+    //
+    // Instructions without a location belong to the line before them.
+    debug_loc_info_t last_loc = {0}, loc;
+    fori (i, 0, code_count) {
+        if (!debug_info_lookup_location(debug->info, i, &loc)) continue;
+
+        if (loc.file_id != last_loc.file_id || loc.line != last_loc.line) {
+            debug->line_starts[i >> 6] |= 1ull << (i & 63);
+        }
+
+        last_loc = loc;
+    }
+
+    debug->program = program;
+
+    // Breakpoints set before the program was loaded are written now.
+    bh_arr_each(debug_breakpoint_t, bp, debug->breakpoints) {
+        debug_host_sync_breakpoint(debug, bp->instr);
+    }
+}
+
+//
+// Writes a breakpoint over the instruction if any breakpoint is set on it,
+// and otherwise puts the original instruction back. Only the opcode changes,
+// so a thread running the instruction at the same time sees either one.
+void debug_host_sync_breakpoint(debug_state_t *debug, u32 instr) {
+    if (!debug->program) return;
+
+    u32 full_instr = debug->original_code[instr].full_instr;
+    bh_arr_each(debug_breakpoint_t, bp, debug->breakpoints) {
+        if (bp->instr == instr) {
+            full_instr = OVM_BREAKPOINT_INSTR;
+            break;
+        }
+    }
+
+    __atomic_store_n(&debug->program->code[instr].full_instr, full_instr, __ATOMIC_RELEASE);
+}
+
 u32 debug_host_register_thread(debug_state_t *debug, ovm_state_t *ovm_state) {
     debug_thread_state_t *new_thread = bh_alloc(debug->alloc, sizeof(*new_thread));
     memset(new_thread, 0, sizeof(*new_thread));
@@ -133,6 +133,8 @@ void debug_info_builder_step(debug_info_builder_t *builder) {
 }
 
 void debug_info_builder_emit_location(debug_info_builder_t *builder) {
+    if (builder->data == NULL) return;
+
     bh_arr_push(builder->info->instruction_reducer, bh_arr_length(builder->info->line_info) - 1);
 }
 
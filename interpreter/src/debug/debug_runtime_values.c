@@ -20,7 +20,7 @@ static char write_buf[4096];
 static bool lookup_register_in_frame(ovm_state_t *state, ovm_stack_frame_t *frame, u32 reg, ovm_value_t *out) {
 
     u32 val_num_base;
-    if (frame == &bh_arr_last(state->stack_frames)) {
+    if (frame == &state->stack_frames[state->stack_frame_count - 1]) {
         val_num_base = state->value_number_offset;
     } else {
         val_num_base = frame->value_number_base;
@@ -4,48 +4,113 @@
 
 // #define BUILDER_DEBUG
 
+#define IS_TEMPORARY_VALUE(b, r) (r >= (b->param_count + b->local_count))
+
+#define IS_V128_VALUE(b, r) ((r) < bh_arr_length((b)->v128_values) && (b)->v128_values[r])
+
+#define VALUE_END(b, r) ((r) + (IS_V128_VALUE(b, r) ? 2 : 1))
+
+//
+// value_stack_tops is kept in lock-step with the execution stack. Each entry
+// is one past the highest value number used by the values up to and
+// including that slot, so the next free value number is always at the top.
+static inline void PUSH_VALUE(ovm_code_builder_t *b, i32 r) {
+    i32 top = VALUE_END(b, r);
+    if (bh_arr_length(b->value_stack_tops) > 0) top = bh_max(top, bh_arr_last(b->value_stack_tops));
+
+    bh_arr_push(b->value_stack_tops, top);
+    bh_arr_push(b->execution_stack, r);
+}
+
+static inline i32 POP_VALUE(ovm_code_builder_t *b) {
 #if defined(BUILDER_DEBUG)
-    #define POP_VALUE(b)     (bh_arr_length((b)->execution_stack) == 0 ? (assert(("invalid value pop", 0)), 0) : bh_arr_pop((b)->execution_stack))
-#else
-    #define POP_VALUE(b) bh_arr_pop((b)->execution_stack)
+    assert(("invalid value pop", bh_arr_length(b->execution_stack) > 0));
 #endif
 
-#define PUSH_VALUE(b, r) (bh_arr_push((b)->execution_stack, r))
+    bh_arr_fastdeleten(b->value_stack_tops, 1);
+    return bh_arr_pop(b->execution_stack);
+}
 
 #define LAST_VALUE(b) bh_arr_last((b)->execution_stack)
 
-#define IS_TEMPORARY_VALUE(b, r) (r >= (b->param_count + b->local_count))
+//
+// Recomputes value_stack_tops after values on the stack have been replaced.
+static void recompute_value_stack_tops(ovm_code_builder_t *b) {
+    i32 top = 0;
+    fori (i, 0, bh_arr_length(b->execution_stack)) {
+        top = bh_max(top, VALUE_END(b, b->execution_stack[i]));
+        b->value_stack_tops[i] = top;
+    }
+}
 
-static inline int NEXT_VALUE(ovm_code_builder_t *b) {
+static inline int NEXT_VALUE_OF_WIDTH(ovm_code_builder_t *b, bool is_v128) {
 #if defined(BUILDER_DEBUG)
-    b->highest_value_number += 1;
-    return b->highest_value_number - 1;
+    i32 value = b->highest_value_number;
+    b->highest_value_number += is_v128 ? 2 : 1;
 
 #else
-    if (bh_arr_length(b->execution_stack) == 0) {
-        return b->param_count + b->local_count;
-    }
+    i32 value = b->param_count + b->local_count;
 
-    i32 max = b->param_count + b->local_count;
-    bh_arr_each(i32, reg, b->execution_stack) {
-        max = bh_max(*reg, max);
+    if (bh_arr_length(b->value_stack_tops) > 0) {
+        value = bh_max(value, bh_arr_last(b->value_stack_tops));
     }
 
-    b->highest_value_number = bh_max(b->highest_value_number, max + 1);
-    return max + 1;
+    b->highest_value_number = bh_max(b->highest_value_number, value + (is_v128 ? 1 : 0));
 #endif
+
+    while (bh_arr_length(b->v128_values) <= value) bh_arr_push(b->v128_values, false);
+    b->v128_values[value] = is_v128;
+    return value;
+}
+
+#define NEXT_VALUE(b)      NEXT_VALUE_OF_WIDTH(b, false)
+#define NEXT_V128_VALUE(b) NEXT_VALUE_OF_WIDTH(b, true)
+
+static void add_static_data_reloc(ovm_code_builder_t *b, i32 instr) {
+    if (!b->static_data_relocs) return;
+
+    bh_arr(i32) relocs = *b->static_data_relocs;
+    bh_arr_push(relocs, instr);
+    *b->static_data_relocs = relocs;
 }
 
-ovm_code_builder_t ovm_code_builder_new(ovm_program_t *program, debug_info_builder_t *debug, i32 param_count, i32 result_count, i32 local_count) {
+ovm_code_builder_t ovm_code_builder_new(ovm_program_t *program, debug_info_builder_t *debug, i32 param_count, i32 result_count, i32 local_count, ovm_valtype_t *local_types) {
     ovm_code_builder_t builder;
-    builder.param_count = param_count;
     builder.result_count = result_count;
-    builder.local_count = local_count;
     builder.start_instr = bh_arr_length(program->code);
+
+    //
+    // Parameters and locals are laid out in order at the bottom of the value
+    // numbers. v128s take two value numbers, so if there are any, the local
+    // indicies no longer line up with the value numbers and have to be mapped.
+    builder.local_map = NULL;
+    builder.v128_values = NULL;
+    bh_arr_new(bh_heap_allocator(), builder.local_map, param_count + local_count);
+    bh_arr_new(bh_heap_allocator(), builder.v128_values, param_count + local_count);
+
+    i32 value_number = 0;
+    fori (i, 0, param_count + local_count) {
+        if (i == param_count) builder.param_count = value_number;
+
+        bool is_v128 = local_types && local_types[i] == OVM_TYPE_V128;
+        bh_arr_push(builder.local_map, value_number);
+        bh_arr_push(builder.v128_values, is_v128);
+        value_number += 1;
+
+        if (is_v128) {
+            bh_arr_push(builder.v128_values, false);
+            value_number += 1;
+        }
+    }
+
+    if (local_count == 0) builder.param_count = value_number;
+    builder.local_count = value_number - builder.param_count;
     builder.program = program;
 
     builder.execution_stack = NULL;
+    builder.value_stack_tops = NULL;
     bh_arr_new(bh_heap_allocator(), builder.execution_stack, 32);
+    bh_arr_new(bh_heap_allocator(), builder.value_stack_tops, 32);
 
     builder.next_label_idx = 0;
     builder.label_stack = NULL;
@@ -53,17 +118,276 @@ ovm_code_builder_t ovm_code_builder_new(ovm_program_t *program, debug_info_build
     bh_arr_new(bh_heap_allocator(), builder.label_stack, 32);
     bh_arr_new(bh_heap_allocator(), builder.branch_patches, 32);
 
-    builder.highest_value_number = param_count + local_count;
+    builder.highest_value_number = builder.param_count + builder.local_count;
 
     builder.debug_builder = debug;
+    builder.first_line_info = debug->data ? bh_arr_length(debug->info->line_info) : 0;
+    builder.static_data_relocs = NULL;
 
     return builder;
 }
 
 void ovm_code_builder_free(ovm_code_builder_t *builder) {
     bh_arr_free(builder->execution_stack);
+    bh_arr_free(builder->value_stack_tops);
     bh_arr_free(builder->label_stack);
     bh_arr_free(builder->branch_patches);
+    bh_arr_free(builder->local_map);
+    bh_arr_free(builder->v128_values);
+}
+
+//
+// Superinstructions
+//
+// Once a function is built, common instruction pairs are fused into a single
+// instruction. The pass runs over the finished function, so every branch
+// target is known, and a pair is never fused if something can branch to its
+// second instruction. Fused pairs only ever involve a temporary that the
+// second instruction consumes, so the temporary is dead afterwards.
+//
+
+static bool is_direct_branch(ovm_instr_t *instr) {
+    switch (OVM_INSTR_INSTR(*instr)) {
+        case OVMI_BR:
+        case OVMI_BR_Z:
+        case OVMI_BR_NZ:
+        case OVMI_BR_LT ... OVMI_BR_NE:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static i32 *branch_table_entries(ovm_program_t *program, ovm_instr_t *bri, i32 *count) {
+    // A branch table is always an idxarr that loads the offset, then the bri.
+    ovm_instr_t *idx_arr = bri - 1;
+    assert(OVM_INSTR_INSTR(*idx_arr) == OVMI_IDX_ARR);
+
+    ovm_static_integer_array_t table = program->static_data[idx_arr->a];
+    *count = table.len;
+    return &program->static_integers[table.start_idx];
+}
+
+//
+// imm + add/sub becomes ADDI, for i32, and for i64 with a 32-bit constant.
+// Together with :PrimitiveOptimization, `x += k` is a single `addi %x, %x, k`.
+static bool fuse_add_immediate(ovm_code_builder_t *builder, ovm_instr_t *imm, ovm_instr_t *next) {
+    u32 op   = OVM_INSTR_INSTR(*next);
+    u32 type = OVM_INSTR_TYPE(*next);
+    if (op != OVMI_ADD && op != OVMI_SUB) return false;
+    if (type != OVM_TYPE_I32 && type != OVM_TYPE_I64) return false;
+    if (next->full_instr != OVM_TYPED_INSTR(op, type)) return false;
+
+    if (imm->full_instr != OVM_TYPED_INSTR(OVMI_IMM, type)) return false;
+    if (!IS_TEMPORARY_VALUE(builder, imm->r)) return false;
+
+    i32 other;
+    if (imm->r == next->b && next->b != next->a) other = next->a;
+    else if (op == OVMI_ADD && imm->r == next->a && next->a != next->b) other = next->b;
+    else return false;
+
+    i64 value = type == OVM_TYPE_I32 ? (i64) imm->i : imm->l;
+    if (op == OVMI_SUB) value = type == OVM_TYPE_I32 ? (i64) (i32) (0u - (u32) value) : -value;
+    if (value != (i64) (i32) value) return false;
+
+    imm->full_instr = OVM_TYPED_INSTR(OVMI_ADDI, type);
+    imm->r = next->r;
+    imm->a = other;
+    imm->b = (i32) value;
+    return true;
+}
+
+//
+// A comparison whose only use is the following br_z/br_nz becomes BR_<cmp>.
+// Branching when the comparison is false needs the inverse comparison, which
+// only exists for floats when it is == or !=.
+static bool fuse_compare_branch(ovm_code_builder_t *builder, ovm_instr_t *cmp, ovm_instr_t *next) {
+    bool branch_if_true;
+    if      (next->full_instr == OVM_TYPED_INSTR(OVMI_BR_NZ, OVM_TYPE_NONE)) branch_if_true = true;
+    else if (next->full_instr == OVM_TYPED_INSTR(OVMI_BR_Z,  OVM_TYPE_NONE)) branch_if_true = false;
+    else return false;
+
+    u32 op   = OVM_INSTR_INSTR(*cmp);
+    u32 type = OVM_INSTR_TYPE(*cmp);
+    if (op < OVMI_LT || op > OVMI_NE || cmp->full_instr != OVM_TYPED_INSTR(op, type)) return false;
+    if (cmp->r != next->b || !IS_TEMPORARY_VALUE(builder, cmp->r)) return false;
+
+    if (!branch_if_true) {
+        bool is_float = type == OVM_TYPE_F32 || type == OVM_TYPE_F64;
+
+        switch (op) {
+            case OVMI_EQ:   op = OVMI_NE;   break;
+            case OVMI_NE:   op = OVMI_EQ;   break;
+            case OVMI_LT:   op = OVMI_GE;   break;
+            case OVMI_LT_S: op = OVMI_GE_S; break;
+            case OVMI_LE:   op = OVMI_GT;   break;
+            case OVMI_LE_S: op = OVMI_GT_S; break;
+            case OVMI_GT:   op = OVMI_LE;   break;
+            case OVMI_GT_S: op = OVMI_LE_S; break;
+            case OVMI_GE:   op = OVMI_LT;   break;
+            case OVMI_GE_S: op = OVMI_LT_S; break;
+        }
+
+        if (is_float && op != OVMI_EQ && op != OVMI_NE) return false;
+    }
+
+    // The left operand moves to %r, because %a holds the branch offset.
+    cmp->full_instr = OVM_TYPED_INSTR(op - OVMI_LT + OVMI_BR_LT, type);
+    cmp->r = cmp->a;
+    cmp->a = next->a;
+    return true;
+}
+
+//
+// An ADDI that computes the address of the following load or store is moved
+// into its offset. Addresses are computed modulo 2^32 either way, so this
+// does not change the result.
+static bool fuse_address(ovm_code_builder_t *builder, ovm_instr_t *addi, ovm_instr_t *next) {
+    if (addi->full_instr != OVM_TYPED_INSTR(OVMI_ADDI, OVM_TYPE_I32)) return false;
+    if (!IS_TEMPORARY_VALUE(builder, addi->r)) return false;
+
+    ovm_instr_t fused = *next;
+    u32 op = OVM_INSTR_INSTR(*next);
+    if (next->full_instr != OVM_TYPED_INSTR(op, OVM_INSTR_TYPE(*next))) return false;
+
+    if (op == OVMI_LOAD && next->a == addi->r) {
+        fused.a = addi->a;
+
+    } else if (op == OVMI_STORE && next->r == addi->r && next->a != addi->r) {
+        fused.r = addi->a;
+
+    } else {
+        return false;
+    }
+
+    fused.b = (i32) ((u32) next->b + (u32) addi->b);
+    *addi = fused;
+    return true;
+}
+
+static int compare_line_indices(const void *a, const void *b) {
+    return *(const i32 *) a - *(const i32 *) b;
+}
+
+void ovm_code_builder_form_superinstructions(ovm_code_builder_t *builder) {
+    assert(bh_arr_length(builder->branch_patches) == 0);
+
+    ovm_program_t *program = builder->program;
+    i32 start = builder->start_instr;
+    i32 count = bh_arr_length(program->code) - start;
+    ovm_instr_t *code = &program->code[start];
+    if (count <= 1) return;
+
+    bool *is_target = bh_alloc_array(bh_heap_allocator(), bool, count + 1);
+    i32  *new_index = bh_alloc_array(bh_heap_allocator(), i32, count + 1);
+    i32  *old_index = bh_alloc_array(bh_heap_allocator(), i32, count);
+    memset(is_target, 0, sizeof(bool) * (count + 1));
+
+    fori (pc, 0, count) {
+        if (is_direct_branch(&code[pc])) {
+            is_target[pc + 1 + code[pc].a] = true;
+        }
+
+        if (OVM_INSTR_INSTR(code[pc]) == OVMI_BRI) {
+            i32 entry_count;
+            i32 *entries = branch_table_entries(program, &code[pc], &entry_count);
+            fori (i, 0, entry_count) is_target[pc + 1 + entries[i]] = true;
+        }
+    }
+
+    //
+    // Fused instructions take the place of the first instruction of the pair,
+    // and keep the position of the second for relocating its branch offset.
+    i32 out = 0;
+    fori (pc, 0, count) {
+        if (out > 0 && !is_target[pc]) {
+            ovm_instr_t *last = &code[out - 1];
+
+            if (fuse_add_immediate(builder, last, &code[pc])
+                || fuse_compare_branch(builder, last, &code[pc])
+                || fuse_address(builder, last, &code[pc])) {
+                new_index[pc] = out - 1;
+                old_index[out - 1] = pc;
+                continue;
+            }
+        }
+
+        new_index[pc] = out;
+        old_index[out] = pc;
+        code[out++] = code[pc];
+    }
+    new_index[count] = out;
+
+    if (out == count) goto done;
+
+    fori (i, 0, out) {
+        if (is_direct_branch(&code[i])) {
+            i32 target = old_index[i] + 1 + code[i].a;
+            code[i].a = new_index[target] - i - 1;
+        }
+
+        if (OVM_INSTR_INSTR(code[i]) == OVMI_BRI) {
+            i32 entry_count;
+            i32 *entries = branch_table_entries(program, &code[i], &entry_count);
+            fori (j, 0, entry_count) {
+                i32 target = old_index[i] + 1 + entries[j];
+                entries[j] = new_index[target] - i - 1;
+            }
+        }
+    }
+
+    bh_arr_set_length(program->code, start + out);
+
+    if (builder->static_data_relocs) {
+        bh_arr_each(i32, reloc, *builder->static_data_relocs) {
+            if (*reloc >= start) *reloc = start + new_index[*reloc - start];
+        }
+    }
+
+    //
+    // Debug info has one location per instruction. A fused instruction keeps
+    // the location of the first instruction, and lines that started at a
+    // removed instruction now start at the instruction it was fused into.
+    debug_info_builder_t *debug = builder->debug_builder;
+    if (debug->data) {
+        debug_info_t *info = debug->info;
+        assert(bh_arr_length(info->instruction_reducer) == start + count);
+
+        fori (pc, 0, count) {
+            bool removed = pc > 0 && new_index[pc] == new_index[pc - 1];
+            if (!removed) {
+                info->instruction_reducer[start + new_index[pc]] = info->instruction_reducer[start + pc];
+            }
+        }
+        bh_arr_set_length(info->instruction_reducer, start + out);
+
+        bh_arr(i32) lines = NULL;
+        bh_arr_new(bh_heap_allocator(), lines, 16);
+        fori (i, builder->first_line_info, bh_arr_length(info->line_info)) {
+            debug_loc_info_t *loc = &info->line_info[i];
+            bh_arr_push(lines, info->files[loc->file_id].line_buffer_offset + loc->line);
+        }
+
+        qsort(lines, bh_arr_length(lines), sizeof(i32), compare_line_indices);
+
+        fori (i, 0, bh_arr_length(lines)) {
+            if (i > 0 && lines[i] == lines[i - 1]) continue;
+            if (lines[i] >= bh_arr_length(info->line_to_instruction)) continue;
+
+            u32 *instr = &info->line_to_instruction[lines[i]];
+            if (*instr >= (u32) start && *instr <= (u32) (start + count)) {
+                *instr = start + new_index[*instr - start];
+            }
+        }
+
+        bh_arr_free(lines);
+    }
+
+  done:
+    bh_free(bh_heap_allocator(), is_target);
+    bh_free(bh_heap_allocator(), new_index);
+    bh_free(bh_heap_allocator(), old_index);
 }
 
 label_target_t ovm_code_builder_wasm_target_idx(ovm_code_builder_t *builder, i32 idx) {
@@ -288,6 +612,7 @@ void ovm_code_builder_add_branch_table(ovm_code_builder_t *builder, i32 count, i
     instrs[4].a = tmp_register;
     
     POP_VALUE(builder);
+    add_static_data_reloc(builder, bh_arr_length(builder->program->code) + 3);
     
     fori (i, 0, count) {
         branch_patch_t patch;
@@ -322,6 +647,10 @@ void ovm_code_builder_add_return(ovm_code_builder_t *builder) {
     i32 values_on_stack = bh_arr_length(builder->execution_stack);
     if (values_on_stack > 0 && builder->result_count > 0) {
         instr.a = POP_VALUE(builder);
+
+        if (IS_V128_VALUE(builder, instr.a)) {
+            instr.full_instr = OVM_TYPED_INSTR(OVMI_RETURN, OVM_TYPE_V128);
+        }
     }
 
     debug_info_builder_emit_location(builder->debug_builder);
@@ -342,10 +671,18 @@ static void ovm_code_builder_add_params(ovm_code_builder_t *builder, i32 param_c
 
         debug_info_builder_emit_location(builder->debug_builder);
         ovm_program_add_instructions(builder->program, 1, &param_instr);
+
+        // v128s are passed as their two halves.
+        if (IS_V128_VALUE(builder, param_instr.a)) {
+            param_instr.a += 1;
+
+            debug_info_builder_emit_location(builder->debug_builder);
+            ovm_program_add_instructions(builder->program, 1, &param_instr);
+        }
     }
 }
 
-void ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, bool has_return_value) {
+void ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, u32 return_type) {
     ovm_code_builder_add_params(builder, param_count);
 
     ovm_instr_t call_instr = {0};
@@ -353,8 +690,9 @@ void ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 pa
     call_instr.a = func_idx;
     call_instr.r = -1;
 
+    bool has_return_value = return_type != OVM_TYPE_NONE;
     if (has_return_value) {
-        call_instr.r = NEXT_VALUE(builder);
+        call_instr.r = NEXT_VALUE_OF_WIDTH(builder, return_type == OVM_TYPE_V128);
     }
 
     debug_info_builder_emit_location(builder->debug_builder);
@@ -365,7 +703,7 @@ void ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 pa
     }
 }
 
-void ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_count, bool has_return_value) {
+void ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_count, u32 return_type) {
     ovm_instr_t call_instrs[2] = {0};
 
     // idxarr %k, table, %j
@@ -380,8 +718,9 @@ void ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_c
 
     ovm_code_builder_add_params(builder, param_count);
 
+    bool has_return_value = return_type != OVM_TYPE_NONE;
     if (has_return_value) {
-        call_instrs[1].r = NEXT_VALUE(builder);
+        call_instrs[1].r = NEXT_VALUE_OF_WIDTH(builder, return_type == OVM_TYPE_V128);
     }
 
     debug_info_builder_emit_location(builder->debug_builder);
@@ -393,12 +732,60 @@ void ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_c
     }
 }
 
+//
+// Nothing is pushed for the result of a tail call, as the result goes to the
+// caller of this function. A value number is still set aside for it, so native
+// code can run the tail call as a call followed by a return.
+void ovm_code_builder_add_tail_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, u32 return_type) {
+    ovm_code_builder_add_params(builder, param_count);
+
+    bool returns_v128 = return_type == OVM_TYPE_V128;
+
+    ovm_instr_t call_instr = {0};
+    call_instr.full_instr = OVM_TYPED_INSTR(OVMI_RETURN_CALL, returns_v128 ? OVM_TYPE_V128 : OVM_TYPE_NONE);
+    call_instr.a = func_idx;
+    call_instr.r = -1;
+
+    if (return_type != OVM_TYPE_NONE) {
+        call_instr.r = NEXT_VALUE_OF_WIDTH(builder, returns_v128);
+    }
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &call_instr);
+}
+
+void ovm_code_builder_add_indirect_tail_call(ovm_code_builder_t *builder, i32 param_count, u32 return_type) {
+    ovm_instr_t call_instrs[2] = {0};
+
+    bool returns_v128 = return_type == OVM_TYPE_V128;
+
+    // idxarr %k, table, %j
+    call_instrs[0].full_instr = OVM_TYPED_INSTR(OVMI_IDX_ARR, OVM_TYPE_NONE);
+    call_instrs[0].r = NEXT_VALUE(builder);
+    call_instrs[0].a = builder->func_table_arr_idx;
+    call_instrs[0].b = POP_VALUE(builder);
+
+    call_instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_RETURN_CALLI, returns_v128 ? OVM_TYPE_V128 : OVM_TYPE_NONE);
+    call_instrs[1].a = call_instrs[0].r;
+    call_instrs[1].r = -1;
+
+    ovm_code_builder_add_params(builder, param_count);
+
+    if (return_type != OVM_TYPE_NONE) {
+        call_instrs[1].r = NEXT_VALUE_OF_WIDTH(builder, returns_v128);
+    }
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 2, call_instrs);
+}
+
 void ovm_code_builder_drop_value(ovm_code_builder_t *builder) {
     POP_VALUE(builder);
 }
 
 void ovm_code_builder_add_local_get(ovm_code_builder_t *builder, i32 local_idx) {
-    PUSH_VALUE(builder, local_idx);
+    PUSH_VALUE(builder, builder->local_map[local_idx]);
 }
 
 static void maybe_copy_register_if_going_to_be_replaced(ovm_code_builder_t *builder, i32 local_idx) {
@@ -411,10 +798,11 @@ static void maybe_copy_register_if_going_to_be_replaced(ovm_code_builder_t *buil
     }
 
     if (need_to_copy) {
-        i32 new_register = NEXT_VALUE(builder);
+        bool is_v128 = IS_V128_VALUE(builder, local_idx);
+        i32 new_register = NEXT_VALUE_OF_WIDTH(builder, is_v128);
         assert(IS_TEMPORARY_VALUE(builder, new_register));
         ovm_instr_t instr = {0};
-        instr.full_instr = OVM_TYPED_INSTR(OVMI_MOV, OVM_TYPE_NONE);
+        instr.full_instr = OVM_TYPED_INSTR(OVMI_MOV, is_v128 ? OVM_TYPE_V128 : OVM_TYPE_NONE);
         instr.r = new_register;
         instr.a = local_idx;
 
@@ -426,22 +814,49 @@ static void maybe_copy_register_if_going_to_be_replaced(ovm_code_builder_t *buil
                 *reg = new_register;
             }
         }
+
+        recompute_value_stack_tops(builder);
+    }
+}
+
+//
+// Some instructions use %r as an input as well as the output. Their result
+// cannot be retargeted to a local, because the input would come from the local.
+static bool instr_reads_result(ovm_instr_t *instr) {
+    switch (OVM_INSTR_INSTR(*instr)) {
+        case OVMI_CMPXCHG:
+        case OVMI_ATOMIC_WAIT:
+        case OVMI_VREPLACE:
+        case OVMI_VSHUFFLE:
+        case OVMI_VBITSELECT:
+            return true;
+
+        default:
+            return false;
     }
 }
 
 void ovm_code_builder_add_local_set(ovm_code_builder_t *builder, i32 local_idx) {
+    local_idx = builder->local_map[local_idx];
+
+    // Setting a local to itself does nothing.
+    if (LAST_VALUE(builder) == local_idx) {
+        POP_VALUE(builder);
+        return;
+    }
+
     maybe_copy_register_if_going_to_be_replaced(builder, local_idx);
 
     // :PrimitiveOptimization
     ovm_instr_t *last_instr = &bh_arr_last(builder->program->code);
-    if (IS_TEMPORARY_VALUE(builder, last_instr->r) && last_instr->r == LAST_VALUE(builder)) {
+    if (IS_TEMPORARY_VALUE(builder, last_instr->r) && last_instr->r == LAST_VALUE(builder) && !instr_reads_result(last_instr)) {
         last_instr->r = local_idx;
         POP_VALUE(builder);
         return;
     }
 
     ovm_instr_t instr = {0};
-    instr.full_instr = OVM_TYPED_INSTR(OVMI_MOV, OVM_TYPE_NONE);
+    instr.full_instr = OVM_TYPED_INSTR(OVMI_MOV, IS_V128_VALUE(builder, local_idx) ? OVM_TYPE_V128 : OVM_TYPE_NONE);
     instr.r = local_idx; // This makes the assumption that the params will be in
                          // the lower "address space" of the value numbers. This
                          // will be true for web assembly, because that's how it
@@ -455,7 +870,7 @@ void ovm_code_builder_add_local_set(ovm_code_builder_t *builder, i32 local_idx)
 
 void ovm_code_builder_add_local_tee(ovm_code_builder_t *builder, i32 local_idx) {
     ovm_code_builder_add_local_set(builder, local_idx);
-    PUSH_VALUE(builder, local_idx);
+    PUSH_VALUE(builder, builder->local_map[local_idx]);
 }
 
 void ovm_code_builder_add_register_get(ovm_code_builder_t *builder, i32 reg_idx) {
@@ -500,7 +915,7 @@ void ovm_code_builder_add_load(ovm_code_builder_t *builder, u32 ovm_type, i32 of
     load_instr.full_instr = OVM_TYPED_INSTR(OVMI_LOAD, ovm_type);
     load_instr.b = offset;
     load_instr.a = POP_VALUE(builder);
-    load_instr.r = NEXT_VALUE(builder);
+    load_instr.r = NEXT_VALUE_OF_WIDTH(builder, ovm_type == OVM_TYPE_V128);
 
     debug_info_builder_emit_location(builder->debug_builder);
     ovm_program_add_instructions(builder->program, 1, &load_instr);
@@ -618,7 +1033,7 @@ void ovm_code_builder_add_memory_fill(ovm_code_builder_t *builder) {
 // CopyNPaste from _add_load
 void ovm_code_builder_add_atomic_load(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
     ovm_instr_t load_instr = {0};
-    load_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_LOAD, ovm_type);
+    load_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_ATOMIC_LOAD, ovm_type);
     load_instr.b = offset;
     load_instr.a = POP_VALUE(builder);
     load_instr.r = NEXT_VALUE(builder);
@@ -633,7 +1048,7 @@ void ovm_code_builder_add_atomic_load(ovm_code_builder_t *builder, u32 ovm_type,
 // CopyNPaste from _add_store
 void ovm_code_builder_add_atomic_store(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
     ovm_instr_t store_instr = {0};
-    store_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_STORE, ovm_type);
+    store_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_ATOMIC_STORE, ovm_type);
     store_instr.b = offset;
     store_instr.a = POP_VALUE(builder);
     store_instr.r = POP_VALUE(builder);
@@ -641,3 +1056,217 @@ void ovm_code_builder_add_atomic_store(ovm_code_builder_t *builder, u32 ovm_type
     debug_info_builder_emit_location(builder->debug_builder);
     ovm_program_add_instructions(builder->program, 1, &store_instr);
 }
+
+//
+// Used for the read-modify-write instructions and notify, which take an
+// address in %a and an operand in %b. The offset is folded into the address
+// ahead of time, because there is no room for it in the instruction.
+void ovm_code_builder_add_atomic_rmw(ovm_code_builder_t *builder, u32 instr, u32 ovm_type, i32 offset) {
+    ovm_instr_t instrs[3] = {0};
+    i32 instr_count = 0;
+
+    i32 result_reg = NEXT_VALUE(builder);
+    i32 value_reg = POP_VALUE(builder);
+    i32 addr_reg = POP_VALUE(builder);
+
+    if (offset != 0) {
+        // imm.i32 %n, offset
+        instrs[0].full_instr = OVM_TYPED_INSTR(OVMI_IMM, OVM_TYPE_I32);
+        instrs[0].i = offset;
+        instrs[0].r = result_reg;
+
+        // add.i32 %n, %a, %n
+        instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_ADD, OVM_TYPE_I32);
+        instrs[1].r = result_reg;
+        instrs[1].a = addr_reg;
+        instrs[1].b = result_reg;
+
+        addr_reg = result_reg;
+        instr_count = 2;
+    }
+
+    // rmw.x %n, %a, %v
+    instrs[instr_count].full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(instr, ovm_type);
+    instrs[instr_count].r = result_reg;
+    instrs[instr_count].a = addr_reg;
+    instrs[instr_count].b = value_reg;
+    instr_count += 1;
+
+    fori (i, 0, instr_count) debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, instr_count, instrs);
+
+    PUSH_VALUE(builder, result_reg);
+}
+
+//
+// Same layout as cmpxchg: the address is computed into the result value,
+// which the wait instruction then overwrites with its return code.
+void ovm_code_builder_add_atomic_wait(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
+    ovm_instr_t instrs[3] = {0};
+    // imm.i32 %n, offset
+    instrs[0].full_instr = OVM_TYPED_INSTR(OVMI_IMM, OVM_TYPE_I32);
+    instrs[0].i = offset;
+    instrs[0].r = NEXT_VALUE(builder);
+
+    int timeout_reg = POP_VALUE(builder);
+    int expected_reg = POP_VALUE(builder);
+    int addr_reg = POP_VALUE(builder);
+
+    // add.i32 %n, %n, %i
+    instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_ADD, OVM_TYPE_I32);
+    instrs[1].r = instrs[0].r;
+    instrs[1].a = addr_reg;
+    instrs[1].b = instrs[0].r;
+
+    // atomic_wait.x %n, %e, %t
+    instrs[2].full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_ATOMIC_WAIT, ovm_type);
+    instrs[2].r = instrs[1].r;
+    instrs[2].a = expected_reg;
+    instrs[2].b = timeout_reg;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    debug_info_builder_emit_location(builder->debug_builder);
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 3, instrs);
+
+    PUSH_VALUE(builder, instrs[2].r);
+}
+
+void ovm_code_builder_add_atomic_fence(ovm_code_builder_t *builder) {
+    ovm_instr_t instr = {0};
+    instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_ATOMIC_FENCE, OVM_TYPE_NONE);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &instr);
+}
+
+void ovm_code_builder_add_v128_imm(ovm_code_builder_t *builder, u8 *bytes) {
+    //
+    // A v128 constant does not fit in an instruction, so it is stored
+    // as four integers in the static data of the program.
+    i32 ints[4];
+    memcpy(ints, bytes, sizeof(ints));
+    i32 data_idx = ovm_program_register_static_ints(builder->program, 4, ints);
+
+    ovm_instr_t imm_instr = {0};
+    imm_instr.full_instr = OVM_TYPED_INSTR(OVMI_IMM, OVM_TYPE_V128);
+    imm_instr.r = NEXT_V128_VALUE(builder);
+    imm_instr.a = data_idx;
+    add_static_data_reloc(builder, bh_arr_length(builder->program->code));
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &imm_instr);
+    PUSH_VALUE(builder, imm_instr.r);
+}
+
+void ovm_code_builder_add_v128_binop(ovm_code_builder_t *builder, u32 instr) {
+    i32 right  = POP_VALUE(builder);
+    i32 left   = POP_VALUE(builder);
+    i32 result = NEXT_V128_VALUE(builder);
+
+    ovm_instr_t binop = {0};
+    binop.full_instr = instr;
+    binop.r = result;
+    binop.a = left;
+    binop.b = right;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &binop);
+    PUSH_VALUE(builder, result);
+}
+
+void ovm_code_builder_add_v128_unop(ovm_code_builder_t *builder, u32 instr) {
+    i32 operand = POP_VALUE(builder);
+
+    ovm_instr_t unop = {0};
+    unop.full_instr = instr;
+    unop.r = NEXT_V128_VALUE(builder);
+    unop.a = operand;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &unop);
+    PUSH_VALUE(builder, unop.r);
+}
+
+void ovm_code_builder_add_v128_extract_lane(ovm_code_builder_t *builder, u32 instr, i32 lane) {
+    ovm_instr_t extract = {0};
+    extract.full_instr = instr;
+    extract.a = POP_VALUE(builder);
+    extract.b = lane;
+    extract.r = NEXT_VALUE(builder);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &extract);
+    PUSH_VALUE(builder, extract.r);
+}
+
+void ovm_code_builder_add_v128_replace_lane(ovm_code_builder_t *builder, u32 instr, i32 lane) {
+    //
+    // The result is allocated before the operands are popped so it cannot
+    // overlap with them, since the vector is copied into it first.
+    i32 result = NEXT_V128_VALUE(builder);
+    i32 value  = POP_VALUE(builder);
+    i32 vector = POP_VALUE(builder);
+
+    ovm_instr_t instrs[2] = {0};
+    // mov.v128 %r, %v
+    instrs[0].full_instr = OVM_TYPED_INSTR(OVMI_MOV, OVM_TYPE_V128);
+    instrs[0].r = result;
+    instrs[0].a = vector;
+
+    // replace_lane %r[lane], %x
+    instrs[1].full_instr = instr;
+    instrs[1].r = result;
+    instrs[1].a = value;
+    instrs[1].b = lane;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 2, instrs);
+    PUSH_VALUE(builder, result);
+}
+
+void ovm_code_builder_add_v128_shuffle(ovm_code_builder_t *builder, u8 *lanes) {
+    //
+    // The lane indicies are loaded as a constant into the result,
+    // which the shuffle then reads and overwrites.
+    ovm_code_builder_add_v128_imm(builder, lanes);
+
+    i32 result = POP_VALUE(builder);
+    i32 right  = POP_VALUE(builder);
+    i32 left   = POP_VALUE(builder);
+
+    ovm_instr_t shuffle = {0};
+    shuffle.full_instr = OVM_TYPED_INSTR(OVMI_VSHUFFLE, OVM_TYPE_V128);
+    shuffle.r = result;
+    shuffle.a = left;
+    shuffle.b = right;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &shuffle);
+    PUSH_VALUE(builder, result);
+}
+
+void ovm_code_builder_add_v128_bitselect(ovm_code_builder_t *builder) {
+    i32 result = NEXT_V128_VALUE(builder);
+    i32 mask   = POP_VALUE(builder);
+    i32 right  = POP_VALUE(builder);
+    i32 left   = POP_VALUE(builder);
+
+    ovm_instr_t instrs[2] = {0};
+    // mov.v128 %r, %mask
+    instrs[0].full_instr = OVM_TYPED_INSTR(OVMI_MOV, OVM_TYPE_V128);
+    instrs[0].r = result;
+    instrs[0].a = mask;
+
+    // bitselect %r, %a, %b
+    instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_VBITSELECT, OVM_TYPE_V128);
+    instrs[1].r = result;
+    instrs[1].a = left;
+    instrs[1].b = right;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 2, instrs);
+    PUSH_VALUE(builder, result);
+}
@@ -0,0 +1,358 @@
+#include "vm.h"
+#include "stb_ds.h"
+
+#define COUNTERS_TOP_FUNCS   25
+#define COUNTERS_TOP_OPCODES 40
+#define COUNTERS_TOP_BLOCKS  25
+#define COUNTERS_TOP_PAIRS   40
+
+typedef struct counters_entry_t {
+    u64 count;
+    u64 extra;
+    u32 key;
+} counters_entry_t;
+
+static int counters_entry_compare(const void *a, const void *b) {
+    const counters_entry_t *ea = a, *eb = b;
+    if (ea->count != eb->count) return ea->count < eb->count ? 1 : -1;
+    return ea->key < eb->key ? -1 : ea->key > eb->key;
+}
+
+static int counters_func_start_compare(const void *a, const void *b) {
+    const ovm_func_t *fa = *(ovm_func_t * const *) a;
+    const ovm_func_t *fb = *(ovm_func_t * const *) b;
+    return (fa->start_instr > fb->start_instr) - (fa->start_instr < fb->start_instr);
+}
+
+static double counters_percent(u64 count, u64 total) {
+    return total ? 100.0 * (double) count / (double) total : 0.0;
+}
+
+static bool counters_is_branch(u32 opcode) {
+    switch (opcode) {
+        case OVMI_BR:   case OVMI_BR_Z:  case OVMI_BR_NZ:
+        case OVMI_BRI:  case OVMI_BRI_Z: case OVMI_BRI_NZ:
+            return true;
+    }
+
+    return opcode >= OVMI_BR_LT && opcode <= OVMI_BR_NE;
+}
+
+static bool counters_ends_block(u32 opcode) {
+    return counters_is_branch(opcode) || opcode == OVMI_RETURN || opcode == OVMI_BREAK;
+}
+
+static void counters_write_func_name(ovm_counters_t *counters, FILE *out, i32 func_id) {
+    debug_func_info_t func_info;
+    if (counters->info && debug_info_lookup_func(counters->info, func_id, &func_info) && func_info.name) {
+        fprintf(out, "%s", func_info.name);
+    } else {
+        fprintf(out, "%s", counters->program->funcs[func_id].name);
+    }
+}
+
+static void counters_write_location(ovm_counters_t *counters, FILE *out, i32 instr) {
+    if (!counters->info || !counters->info->has_debug_info) return;
+
+    //
+    // Not every instruction has a location, so look a little further
+    // ahead, like the debugger does.
+    debug_loc_info_t loc;
+    bool found = false;
+    fori (i, 0, 8) {
+        if (debug_info_lookup_location(counters->info, instr + i, &loc)) {
+            found = true;
+            break;
+        }
+    }
+
+    debug_file_info_t file_info;
+    if (!found || !debug_info_lookup_file(counters->info, loc.file_id, &file_info)) return;
+
+    char *file_name = strrchr(file_info.name, '/');
+    file_name = file_name ? file_name + 1 : file_info.name;
+    fprintf(out, " (%s:%d)", file_name, loc.line);
+}
+
+static void counters_write_opcode(FILE *out, bh_buffer *text, u32 full_instr) {
+    bh_buffer_clear(text);
+    ovm_disassemble_opcode(full_instr, text);
+    fprintf(out, "%.*s", text->length, text->data);
+}
+
+//
+// Only one set of counters reports at exit.
+static ovm_counters_t *active_counters = NULL;
+
+static void counters_write_report_at_exit() {
+    if (active_counters) ovm_counters_write_report(active_counters);
+}
+
+ovm_counters_t *ovm_counters_new(char *output_path) {
+    ovm_counters_t *counters = bh_alloc_item(bh_heap_allocator(), ovm_counters_t);
+    memset(counters, 0, sizeof(*counters));
+
+    counters->output_path = output_path;
+    return counters;
+}
+
+//
+// Counting only covers one program, the first that is set.
+void ovm_counters_set_program(ovm_counters_t *counters, ovm_program_t *program, debug_info_t *info) {
+    if (counters->program) return;
+
+    counters->program = program;
+    counters->info    = info;
+
+    i32 instr_count = bh_arr_length(program->code);
+    i32 func_count  = bh_arr_length(program->funcs);
+    counters->instr_counts = bh_alloc_array(bh_heap_allocator(), u64, bh_max(instr_count, 1));
+    counters->call_counts  = bh_alloc_array(bh_heap_allocator(), u64, bh_max(func_count, 1));
+    memset(counters->instr_counts, 0, sizeof(u64) * instr_count);
+    memset(counters->call_counts,  0, sizeof(u64) * func_count);
+
+    //
+    // Programs often end by calling exit directly, which never deletes
+    // the engine, so the report is also written at exit.
+    if (!active_counters) {
+        active_counters = counters;
+
+        static bool registered_at_exit = false;
+        if (!registered_at_exit) {
+            atexit(counters_write_report_at_exit);
+            registered_at_exit = true;
+        }
+    }
+}
+
+static void counters_write_report_to(ovm_counters_t *counters, FILE *out) {
+    ovm_program_t *program = counters->program;
+    ovm_instr_t *code = program->code;
+    u64 *counts = counters->instr_counts;
+    i32 instr_count = bh_arr_length(program->code);
+    i32 func_count  = bh_arr_length(program->funcs);
+
+    //
+    // Basic blocks start at the beginning of functions, at the targets of
+    // direct branches, and after any instruction that ends a block.
+    // Indirect branches only go to the table of branches following them,
+    // which already start their own blocks.
+    bool *leaders = bh_alloc_array(bh_heap_allocator(), bool, bh_max(instr_count, 1));
+    memset(leaders, 0, sizeof(bool) * instr_count);
+
+    bh_arr_each(ovm_func_t, func, program->funcs) {
+        if (func->kind == OVM_FUNC_INTERNAL && func->start_instr < instr_count) {
+            leaders[func->start_instr] = true;
+        }
+    }
+
+    fori (pc, 0, instr_count) {
+        u32 opcode = OVM_INSTR_INSTR(code[pc]);
+        if (!counters_ends_block(opcode)) continue;
+
+        if (pc + 1 < instr_count) leaders[pc + 1] = true;
+
+        bool direct = opcode == OVMI_BR || opcode == OVMI_BR_Z || opcode == OVMI_BR_NZ
+                   || (opcode >= OVMI_BR_LT && opcode <= OVMI_BR_NE);
+        i32 target = pc + 1 + code[pc].a;
+        if (direct && target >= 0 && target < instr_count) leaders[target] = true;
+    }
+
+    //
+    // Instructions are attributed to the function whose code they are in.
+    ovm_func_t **funcs_by_start = NULL;
+    bh_arr_new(bh_heap_allocator(), funcs_by_start, func_count);
+    bh_arr_each(ovm_func_t, func, program->funcs) {
+        if (func->kind == OVM_FUNC_INTERNAL) bh_arr_push(funcs_by_start, func);
+    }
+    qsort(funcs_by_start, bh_arr_length(funcs_by_start), sizeof(ovm_func_t *), counters_func_start_compare);
+
+    counters_entry_t *func_entries = bh_alloc_array(bh_heap_allocator(), counters_entry_t, bh_max(func_count, 1));
+    fori (i, 0, func_count) {
+        func_entries[i] = (counters_entry_t) { 0, counters->call_counts[i], i };
+    }
+
+    u64 opcode_counts[OVM_INSTR_MASK + 1] = { 0 };
+    u64 total_instrs = 0, total_blocks = 0, total_calls = 0;
+
+    bh_arr(counters_entry_t) block_entries = NULL;
+    bh_arr_new(bh_heap_allocator(), block_entries, 64);
+    struct { u64 key; u64 value; } *pairs = NULL;
+
+    bh_buffer text;
+    bh_buffer_init(&text, bh_heap_allocator(), 64);
+
+    i32 next_func = 0;
+    ovm_func_t *current_func = NULL;
+
+    fori (pc, 0, instr_count) {
+        while (next_func < bh_arr_length(funcs_by_start) && funcs_by_start[next_func]->start_instr <= pc) {
+            current_func = funcs_by_start[next_func++];
+        }
+
+        u64 count = counts[pc];
+        if (count == 0) continue;
+
+        u32 full_instr = code[pc].full_instr & OVM_INSTR_MASK;
+        opcode_counts[full_instr] += count;
+        total_instrs += count;
+
+        if (current_func) func_entries[current_func->id].count += count;
+
+        if (leaders[pc]) {
+            total_blocks += count;
+
+            i32 length = 1;
+            while (pc + length < instr_count && !leaders[pc + length]) length++;
+
+            counters_entry_t entry = { count, length, pc };
+            bh_arr_push(block_entries, entry);
+        }
+
+        //
+        // A pair only counts if the second instruction always follows the
+        // first, so it could be fused into a single instruction.
+        if (pc + 1 < instr_count && !leaders[pc + 1] && counts[pc + 1] > 0
+            && !counters_ends_block(OVM_INSTR_INSTR(code[pc]))) {
+            u64 key = ((u64) full_instr << 16) | (code[pc + 1].full_instr & OVM_INSTR_MASK);
+            i64 pair_idx = hmgeti(pairs, key);
+            if (pair_idx < 0) hmput(pairs, key, counts[pc + 1]);
+            else              pairs[pair_idx].value += counts[pc + 1];
+        }
+    }
+
+    fori (i, 0, func_count) total_calls += counters->call_counts[i];
+
+    fprintf(out, "OVM execution counts\n\n");
+    fprintf(out, "  instructions retired  %llu\n", (unsigned long long) total_instrs);
+    fprintf(out, "  basic blocks entered  %llu\n", (unsigned long long) total_blocks);
+    fprintf(out, "  function calls        %llu\n", (unsigned long long) total_calls);
+    if (total_blocks > 0) {
+        fprintf(out, "  instructions / block  %.2f\n", (double) total_instrs / (double) total_blocks);
+    }
+
+    //
+    // Functions
+    qsort(func_entries, func_count, sizeof(counters_entry_t), counters_entry_compare);
+
+    fprintf(out, "\nTop functions by instructions retired\n");
+    fprintf(out, "  %14s %7s %12s  %s\n", "instructions", "%", "calls", "function");
+    fori (i, 0, bh_min(func_count, COUNTERS_TOP_FUNCS)) {
+        counters_entry_t *entry = &func_entries[i];
+        if (entry->count == 0 && entry->extra == 0) break;
+
+        fprintf(out, "  %14llu %6.2f%% %12llu  ",
+            (unsigned long long) entry->count, counters_percent(entry->count, total_instrs),
+            (unsigned long long) entry->extra);
+        counters_write_func_name(counters, out, entry->key);
+        fprintf(out, "\n");
+    }
+
+    //
+    // Opcodes
+    counters_entry_t opcode_entries[OVM_INSTR_MASK + 1];
+    i32 opcode_entry_count = 0;
+    fori (i, 0, OVM_INSTR_MASK + 1) {
+        if (opcode_counts[i] == 0) continue;
+        opcode_entries[opcode_entry_count++] = (counters_entry_t) { opcode_counts[i], 0, i };
+    }
+    qsort(opcode_entries, opcode_entry_count, sizeof(counters_entry_t), counters_entry_compare);
+
+    fprintf(out, "\nTop opcodes\n");
+    fprintf(out, "  %14s %7s  %s\n", "count", "%", "opcode");
+    fori (i, 0, bh_min(opcode_entry_count, COUNTERS_TOP_OPCODES)) {
+        fprintf(out, "  %14llu %6.2f%%  ",
+            (unsigned long long) opcode_entries[i].count, counters_percent(opcode_entries[i].count, total_instrs));
+        counters_write_opcode(out, &text, opcode_entries[i].key);
+        fprintf(out, "\n");
+    }
+
+    //
+    // Basic blocks
+    i32 block_count = bh_arr_length(block_entries);
+    if (block_count > 0) {
+        qsort(block_entries, block_count, sizeof(counters_entry_t), counters_entry_compare);
+    }
+
+    fprintf(out, "\nHottest basic blocks\n");
+    fprintf(out, "  %14s %7s %7s  %s\n", "entries", "%", "length", "location");
+    fori (i, 0, bh_min(block_count, COUNTERS_TOP_BLOCKS)) {
+        counters_entry_t *entry = &block_entries[i];
+        u64 retired = entry->count * entry->extra;
+
+        fprintf(out, "  %14llu %6.2f%% %7llu  ",
+            (unsigned long long) entry->count, counters_percent(retired, total_instrs),
+            (unsigned long long) entry->extra);
+
+        //
+        // The block is in the last function that starts before it.
+        ovm_func_t *func = NULL;
+        bh_arr_each(ovm_func_t *, f, funcs_by_start) {
+            if ((*f)->start_instr > (i32) entry->key) break;
+            func = *f;
+        }
+
+        if (func) {
+            counters_write_func_name(counters, out, func->id);
+            fprintf(out, "+%d", entry->key - func->start_instr);
+        } else {
+            fprintf(out, "%d", entry->key);
+        }
+
+        counters_write_location(counters, out, entry->key);
+        fprintf(out, "\n");
+    }
+
+    //
+    // Pairs of instructions
+    i32 pair_count = hmlen(pairs);
+    counters_entry_t *pair_entries = bh_alloc_array(bh_heap_allocator(), counters_entry_t, bh_max(pair_count, 1));
+    fori (i, 0, pair_count) {
+        pair_entries[i] = (counters_entry_t) { pairs[i].value, pairs[i].key, i };
+    }
+    qsort(pair_entries, pair_count, sizeof(counters_entry_t), counters_entry_compare);
+
+    fprintf(out, "\nFused-op candidates (instruction pairs within a basic block)\n");
+    fprintf(out, "  %14s %7s  %s\n", "count", "%", "pair");
+    fori (i, 0, bh_min(pair_count, COUNTERS_TOP_PAIRS)) {
+        counters_entry_t *entry = &pair_entries[i];
+
+        fprintf(out, "  %14llu %6.2f%%  ",
+            (unsigned long long) entry->count, counters_percent(entry->count, total_instrs));
+        counters_write_opcode(out, &text, (u32) (entry->extra >> 16));
+        fprintf(out, " -> ");
+        counters_write_opcode(out, &text, (u32) (entry->extra & 0xffff));
+        fprintf(out, "\n");
+    }
+
+    bh_buffer_free(&text);
+    bh_free(bh_heap_allocator(), pair_entries);
+    hmfree(pairs);
+    bh_arr_free(block_entries);
+    bh_free(bh_heap_allocator(), func_entries);
+    bh_arr_free(funcs_by_start);
+    bh_free(bh_heap_allocator(), leaders);
+}
+
+void ovm_counters_write_report(ovm_counters_t *counters) {
+    if (!counters->program || counters->report_written) return;
+    counters->report_written = true;
+
+    FILE *out = fopen(counters->output_path, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open '%s' to write the execution counts.\n", counters->output_path);
+        return;
+    }
+
+    counters_write_report_to(counters, out);
+    fclose(out);
+}
+
+void ovm_counters_delete(ovm_counters_t *counters) {
+    ovm_counters_write_report(counters);
+    if (active_counters == counters) active_counters = NULL;
+
+    if (counters->instr_counts) bh_free(bh_heap_allocator(), counters->instr_counts);
+    if (counters->call_counts)  bh_free(bh_heap_allocator(), counters->call_counts);
+    bh_free(bh_heap_allocator(), counters);
+}
@@ -10,6 +10,7 @@ enum instr_format_kind_t {
     instr_format_rab,
     instr_format_ra,
     instr_format_a,
+    instr_format_rai,
 
     instr_format_imm,
 
@@ -18,10 +19,13 @@ enum instr_format_kind_t {
 
     instr_format_idx_arr,
 
+    instr_format_lane,
+
     instr_format_br,
     instr_format_br_cond,
     instr_format_bri,
     instr_format_bri_cond,
+    instr_format_cmp_br,
 
     instr_format_call,
     instr_format_calli,
@@ -127,14 +131,109 @@ static instr_format_t instr_formats[] = {
     { "break", instr_format_none },
 
     { "memory_size", instr_format_none },
-    { "memory_grow", instr_format_ra }
-};
+    { "memory_grow", instr_format_ra },
+
+    { "splat", instr_format_ra },
+    { "extract_lane", instr_format_lane },
+    { "extract_lane_s", instr_format_lane },
+    { "replace_lane", instr_format_lane },
+    { "shuffle", instr_format_rab },
+    { "swizzle", instr_format_rab },
+    { "bitselect", instr_format_rab },
+    { "not", instr_format_ra },
+    { "and", instr_format_rab },
+    { "andnot", instr_format_rab },
+    { "or", instr_format_rab },
+    { "xor", instr_format_rab },
 
-void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_text) {
-    static char buf[256];
+    { "eq", instr_format_rab },
+    { "ne", instr_format_rab },
+    { "lt", instr_format_rab },
+    { "lt_s", instr_format_rab },
+    { "le", instr_format_rab },
+    { "le_s", instr_format_rab },
+    { "gt", instr_format_rab },
+    { "gt_s", instr_format_rab },
+    { "ge", instr_format_rab },
+    { "ge_s", instr_format_rab },
 
-    ovm_instr_t *instr = &program->code[instr_addr];
-    switch (OVM_INSTR_TYPE(*instr)) {
+    { "abs", instr_format_ra },
+    { "neg", instr_format_ra },
+    { "any_true", instr_format_ra },
+    { "all_true", instr_format_ra },
+    { "bitmask", instr_format_ra },
+    { "narrow", instr_format_rab },
+    { "narrow_s", instr_format_rab },
+    { "widen_low", instr_format_ra },
+    { "widen_low_s", instr_format_ra },
+    { "widen_high", instr_format_ra },
+    { "widen_high_s", instr_format_ra },
+    { "shl", instr_format_rab },
+    { "shr", instr_format_rab },
+    { "sar", instr_format_rab },
+    { "add", instr_format_rab },
+    { "add_sat", instr_format_rab },
+    { "add_sat_s", instr_format_rab },
+    { "sub", instr_format_rab },
+    { "sub_sat", instr_format_rab },
+    { "sub_sat_s", instr_format_rab },
+    { "mul", instr_format_rab },
+    { "div", instr_format_rab },
+    { "min", instr_format_rab },
+    { "min_s", instr_format_rab },
+    { "max", instr_format_rab },
+    { "max_s", instr_format_rab },
+    { "avgr", instr_format_rab },
+    { "sqrt", instr_format_ra },
+    { "trunc_sat", instr_format_ra },
+    { "trunc_sat_s", instr_format_ra },
+    { "convert", instr_format_ra },
+    { "convert_s", instr_format_ra },
+
+    { "atomic_add", instr_format_rab },
+    { "atomic_sub", instr_format_rab },
+    { "atomic_and", instr_format_rab },
+    { "atomic_or", instr_format_rab },
+    { "atomic_xor", instr_format_rab },
+    { "atomic_xchg", instr_format_rab },
+    { "atomic_wait", instr_format_rab },
+    { "atomic_notify", instr_format_rab },
+    { "atomic_fence", instr_format_none },
+
+    { "addi", instr_format_rai },
+    { "br_lt", instr_format_cmp_br },
+    { "br_lt_s", instr_format_cmp_br },
+    { "br_le", instr_format_cmp_br },
+    { "br_le_s", instr_format_cmp_br },
+    { "br_eq", instr_format_cmp_br },
+    { "br_ge", instr_format_cmp_br },
+    { "br_ge_s", instr_format_cmp_br },
+    { "br_gt", instr_format_cmp_br },
+    { "br_gt_s", instr_format_cmp_br },
+    { "br_ne", instr_format_cmp_br },
+    { "return_call", instr_format_call },
+    { "return_calli", instr_format_calli },
+    { "atomic_load", instr_format_load },
+    { "atomic_store", instr_format_store },
+};
+
+//
+// Writes the type and name of an instruction, like "i32.add".
+void ovm_disassemble_opcode(u32 full_instr, bh_buffer *instr_text) {
+    ovm_instr_t instr = { .full_instr = full_instr };
+    u32 opcode = OVM_INSTR_INSTR(instr);
+    if (opcode >= OVMI_VSPLAT && opcode < OVMI_ATOMIC_ADD) {
+        switch (OVM_INSTR_TYPE(instr)) {
+            case OVM_TYPE_I8: bh_buffer_write_string(instr_text, "i8x16."); break;
+            case OVM_TYPE_I16: bh_buffer_write_string(instr_text, "i16x8."); break;
+            case OVM_TYPE_I32: bh_buffer_write_string(instr_text, "i32x4."); break;
+            case OVM_TYPE_I64: bh_buffer_write_string(instr_text, "i64x2."); break;
+            case OVM_TYPE_F32: bh_buffer_write_string(instr_text, "f32x4."); break;
+            case OVM_TYPE_F64: bh_buffer_write_string(instr_text, "f64x2."); break;
+            case OVM_TYPE_V128: bh_buffer_write_string(instr_text, "v128."); break;
+        }
+
+    } else switch (OVM_INSTR_TYPE(instr)) {
         case OVM_TYPE_I8: bh_buffer_write_string(instr_text, "i8."); break;
         case OVM_TYPE_I16: bh_buffer_write_string(instr_text, "i16."); break;
         case OVM_TYPE_I32: bh_buffer_write_string(instr_text, "i32."); break;
@@ -144,15 +243,23 @@ void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_te
         case OVM_TYPE_V128: bh_buffer_write_string(instr_text, "v128."); break;
     }
 
-    instr_format_t *format = &instr_formats[OVM_INSTR_INSTR(*instr)];
+    bh_buffer_write_string(instr_text, instr_formats[opcode].instr);
+}
+
+void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_text) {
+    static char buf[256];
 
-    bh_buffer_write_string(instr_text, format->instr);
+    ovm_instr_t *instr = &program->code[instr_addr];
+    ovm_disassemble_opcode(instr->full_instr, instr_text);
+
+    instr_format_t *format = &instr_formats[OVM_INSTR_INSTR(*instr)];
 
     u32 formatted = 0;
     switch (format->kind) {
         case instr_format_rab: formatted = snprintf(buf, 255, "%%%d, %%%d, %%%d", instr->r, instr->a, instr->b); break;
         case instr_format_ra:  formatted = snprintf(buf, 255, "%%%d, %%%d", instr->r, instr->a); break;
         case instr_format_a:   formatted = snprintf(buf, 255, "%%%d", instr->a); break;
+        case instr_format_rai: formatted = snprintf(buf, 255, "%%%d, %%%d, %d", instr->r, instr->a, instr->b); break;
 
         case instr_format_imm:
             switch (OVM_INSTR_TYPE(*instr)) {
@@ -162,6 +269,7 @@ void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_te
                 case OVM_TYPE_I64:  formatted = snprintf(buf, 255, "%%%d, %ld", instr->r, instr->l); break;
                 case OVM_TYPE_F32:  formatted = snprintf(buf, 255, "%%%d, %f", instr->r, instr->f); break;
                 case OVM_TYPE_F64:  formatted = snprintf(buf, 255, "%%%d, %lf", instr->r, instr->d); break;
+                case OVM_TYPE_V128: formatted = snprintf(buf, 255, "%%%d, __global_arr_%d", instr->r, instr->a); break;
             }
             break;
 
@@ -170,10 +278,13 @@ void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_te
 
         case instr_format_idx_arr: formatted = snprintf(buf, 255, "%%%d, __global_arr_%d[%%%d]", instr->r, instr->a, instr->b); break;
 
+        case instr_format_lane: formatted = snprintf(buf, 255, "%%%d, %%%d[%d]", instr->r, instr->a, instr->b); break;
+
         case instr_format_br:       formatted = snprintf(buf, 255, "%d", instr_addr + instr->a + 1); break;
         case instr_format_br_cond:  formatted = snprintf(buf, 255, "%d, %%%d", instr_addr + instr->a + 1, instr->b); break;
         case instr_format_bri:      formatted = snprintf(buf, 255, "ip + %%%d", instr->a); break;
         case instr_format_bri_cond: formatted = snprintf(buf, 255, "ip + %%%d, %%%d", instr->a, instr->b); break;
+        case instr_format_cmp_br:   formatted = snprintf(buf, 255, "%d, %%%d, %%%d", instr_addr + instr->a + 1, instr->r, instr->b); break;
 
         case instr_format_call:
             if (instr->r >= 0) {
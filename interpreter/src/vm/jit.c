@@ -0,0 +1,797 @@
+//
+// Baseline JIT for x86-64
+//
+// Hot functions are translated to native code with one template per instruction.
+// Value numbers are not cached in machine registers; every template loads its
+// operands from the frame's value array and stores its result back, which is what
+// lets the interpreter and native code trade a frame at any instruction.
+//
+// Registers used by native code:
+//     rbx - values of the current frame
+//     r12 - base of linear memory
+//     r13 - the ovm_state_t
+//
+// Instructions without a template call their interpreter handler, with `code`
+// set up so the handler returns instead of dispatching the next instruction.
+// Calls go through ovm__jit_call, after which rbx is reloaded, since the value
+// array may have moved. Linear memory never moves, so r12 stays valid.
+//
+
+#include "vm.h"
+
+#ifdef OVM_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stddef.h>
+
+#define JIT_CHUNK_SIZE (1 << 20)
+
+typedef struct ovm_jit_chunk_t {
+    u8 *base;
+    i64 size;
+    i64 used;
+} ovm_jit_chunk_t;
+
+struct ovm_jit_t {
+    bh_allocator allocator;
+    pthread_mutex_t mutex;
+    bh_arr(ovm_jit_chunk_t) chunks;
+    i64 page_size;
+};
+
+ovm_jit_t *ovm_jit_new(bh_allocator allocator) {
+    ovm_jit_t *jit = bh_alloc_item(allocator, ovm_jit_t);
+    jit->allocator = allocator;
+    jit->chunks = NULL;
+    jit->page_size = sysconf(_SC_PAGESIZE);
+    bh_arr_new(allocator, jit->chunks, 4);
+    pthread_mutex_init(&jit->mutex, NULL);
+    return jit;
+}
+
+void ovm_jit_delete(ovm_jit_t *jit) {
+    bh_arr_each(ovm_jit_chunk_t, chunk, jit->chunks) {
+        munmap(chunk->base, chunk->size);
+    }
+
+    bh_arr_free(jit->chunks);
+    pthread_mutex_destroy(&jit->mutex);
+    bh_free(jit->allocator, jit);
+}
+
+//
+// Native code is never writable and executable at the same time. Chunks are
+// mapped read-write, and each function gets pages of its own, which are made
+// read-execute once its code is copied in. Pages that are already executable
+// are never written again, as another thread may be running code on them.
+static u8 *jit_alloc_code(ovm_jit_t *jit, i64 size) {
+    size = (size + jit->page_size - 1) & ~(jit->page_size - 1);
+
+    if (bh_arr_length(jit->chunks) > 0) {
+        ovm_jit_chunk_t *chunk = &bh_arr_last(jit->chunks);
+        if (chunk->used + size <= chunk->size) {
+            u8 *result = chunk->base + chunk->used;
+            chunk->used += size;
+            return result;
+        }
+    }
+
+    ovm_jit_chunk_t chunk;
+    chunk.size = bh_max(size, JIT_CHUNK_SIZE);
+    chunk.used = size;
+    chunk.base = mmap(NULL, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk.base == MAP_FAILED) return NULL;
+
+    bh_arr_push(jit->chunks, chunk);
+    return chunk.base;
+}
+
+static bool jit_make_executable(ovm_jit_t *jit, u8 *code, i64 size) {
+    size = (size + jit->page_size - 1) & ~(jit->page_size - 1);
+    return mprotect(code, size, PROT_READ | PROT_EXEC) == 0;
+}
+
+
+//
+// Machine code emission
+//
+
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8  = 8, R9  = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+// Condition codes, as used by jcc and setcc.
+enum {
+    CC_B  = 0x2, CC_AE = 0x3, CC_E  = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A  = 0x7,
+    CC_P  = 0xA, CC_NP = 0xB, CC_L  = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G  = 0xF,
+};
+
+typedef struct jit_patch_t {
+    i32 at;     // Offset of a rel32 operand.
+    i32 target; // Instruction index, or one of the JIT_TARGET_* values.
+} jit_patch_t;
+
+#define JIT_TARGET_EPILOGUE -1
+#define JIT_TARGET_TRAP     -2
+#define JIT_TARGET_OFFSETS  -3
+
+typedef struct jit_builder_t {
+    ovm_program_t *program;
+    ovm_func_t    *func;
+    i32 start, end;
+
+    bh_arr(u8) code;
+    bh_arr(jit_patch_t) patches;
+    u32 *offsets;
+} jit_builder_t;
+
+#define VALUE_DISP(n) ((i32) (n) * (i32) sizeof(ovm_value_t))
+
+static inline void emit8(jit_builder_t *b, u8 x) {
+    bh_arr_push(b->code, x);
+}
+
+static inline void emit32(jit_builder_t *b, u32 x) {
+    fori (i, 0, 4) emit8(b, (x >> (i * 8)) & 0xff);
+}
+
+static inline void emit64(jit_builder_t *b, u64 x) {
+    fori (i, 0, 8) emit8(b, (x >> (i * 8)) & 0xff);
+}
+
+static void emit_rex(jit_builder_t *b, bool wide, i32 reg, i32 index, i32 base) {
+    u8 rex = 0x40 | (wide << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+    if (rex != 0x40) emit8(b, rex);
+}
+
+//
+// Emits `prefix [rex] opcode` with a ModRM operand of [base + disp32].
+// `prefix` is a mandatory prefix like 0x66 or 0xF3, or 0 for none.
+static void emit_mem(jit_builder_t *b, u8 prefix, bool wide, u32 opcode, i32 reg, i32 base, i32 disp) {
+    if (prefix) emit8(b, prefix);
+    emit_rex(b, wide, reg, 0, base);
+    if (opcode > 0xffff) emit8(b, opcode >> 16);
+    if (opcode > 0xff)   emit8(b, (opcode >> 8) & 0xff);
+    emit8(b, opcode & 0xff);
+
+    emit8(b, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emit8(b, 0x24);
+    emit32(b, disp);
+}
+
+//
+// Same as emit_mem, with an operand of [base + index * (1 << scale)].
+static void emit_mem_index(jit_builder_t *b, u8 prefix, bool wide, u32 opcode, i32 reg, i32 base, i32 index, i32 scale) {
+    if (prefix) emit8(b, prefix);
+    emit_rex(b, wide, reg, index, base);
+    if (opcode > 0xffff) emit8(b, opcode >> 16);
+    if (opcode > 0xff)   emit8(b, (opcode >> 8) & 0xff);
+    emit8(b, opcode & 0xff);
+
+    bool needs_disp = (base & 7) == RBP;
+    emit8(b, (needs_disp ? 0x40 : 0x00) | ((reg & 7) << 3) | 0x04);
+    emit8(b, (scale << 6) | ((index & 7) << 3) | (base & 7));
+    if (needs_disp) emit8(b, 0);
+}
+
+//
+// Emits `[rex] opcode` with a register ModRM operand.
+static void emit_reg(jit_builder_t *b, bool wide, u32 opcode, i32 reg, i32 rm) {
+    emit_rex(b, wide, reg, 0, rm);
+    if (opcode > 0xff) emit8(b, (opcode >> 8) & 0xff);
+    emit8(b, opcode & 0xff);
+    emit8(b, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_load_value(jit_builder_t *b, i32 reg, i32 value, bool wide) {
+    emit_mem(b, 0, wide, 0x8B, reg, RBX, VALUE_DISP(value));
+}
+
+static void emit_store_value(jit_builder_t *b, i32 reg, i32 value, bool wide) {
+    emit_mem(b, 0, wide, 0x89, reg, RBX, VALUE_DISP(value));
+}
+
+static void emit_mov_imm64(jit_builder_t *b, i32 reg, u64 imm) {
+    emit_rex(b, true, 0, 0, reg);
+    emit8(b, 0xB8 + (reg & 7));
+    emit64(b, imm);
+}
+
+static void emit_mov_imm32(jit_builder_t *b, i32 reg, u32 imm) {
+    emit_rex(b, false, 0, 0, reg);
+    emit8(b, 0xB8 + (reg & 7));
+    emit32(b, imm);
+}
+
+static void emit_call_absolute(jit_builder_t *b, void *func) {
+    emit_mov_imm64(b, RAX, (u64) func);
+    emit8(b, 0xFF); emit8(b, 0xD0); // call rax
+}
+
+static void emit_jump(jit_builder_t *b, i32 target) {
+    emit8(b, 0xE9);
+    bh_arr_push(b->patches, ((jit_patch_t) { bh_arr_length(b->code), target }));
+    emit32(b, 0);
+}
+
+static void emit_jcc(jit_builder_t *b, i32 cc, i32 target) {
+    emit8(b, 0x0F); emit8(b, 0x80 | cc);
+    bh_arr_push(b->patches, ((jit_patch_t) { bh_arr_length(b->code), target }));
+    emit32(b, 0);
+}
+
+// setcc al; movzx eax, al
+static void emit_setcc_eax(jit_builder_t *b, i32 cc) {
+    emit8(b, 0x0F); emit8(b, 0x90 | cc); emit8(b, 0xC0);
+    emit8(b, 0x0F); emit8(b, 0xB6); emit8(b, 0xC0);
+}
+
+static void emit_reload_frame(jit_builder_t *b) {
+    emit_mem(b, 0, true, 0x8B, RBX, R13, offsetof(ovm_state_t, __frame_values));
+}
+
+static void emit_trap_check(jit_builder_t *b) {
+    // cmp byte [r13 + trapped], 0
+    emit_mem(b, 0, false, 0x80, 7, R13, offsetof(ovm_state_t, trapped));
+    emit8(b, 0);
+    emit_jcc(b, CC_NE, JIT_TARGET_TRAP);
+}
+
+
+//
+// Templates
+//
+
+static bool is_wide(i32 type) {
+    return type == OVM_TYPE_I64 || type == OVM_TYPE_F64;
+}
+
+static bool is_float(i32 type) {
+    return type == OVM_TYPE_F32 || type == OVM_TYPE_F64;
+}
+
+static void emit_slow_path(jit_builder_t *b, ovm_instr_t *instr) {
+    // The handler dispatches the instruction at `code[state->pc++]` when it is done.
+    emit_mem(b, 0, false, 0xC7, 0, R13, offsetof(ovm_state_t, pc));
+    emit32(b, 0);
+
+    emit_mov_imm64(b, RDI, (u64) instr);
+    emit_reg(b, true, 0x89, R13, RSI);
+    emit_reg(b, true, 0x89, RBX, RDX);
+    emit_reg(b, true, 0x89, R12, RCX);
+    emit_mov_imm64(b, R8, (u64) &ovm__jit_exit_instr);
+    emit_call_absolute(b, ovm__jit_instr_handler(instr->full_instr));
+}
+
+//
+// Loads %a and %b into xmm0 and xmm1 and compares them, leaving 0 or 1 in eax.
+static void emit_float_compare(jit_builder_t *b, i32 op, i32 type, i32 a, i32 b_) {
+    u8 prefix = type == OVM_TYPE_F32 ? 0xF3 : 0xF2;
+    emit_mem(b, prefix, false, 0x0F10, 0, RBX, VALUE_DISP(a));
+    emit_mem(b, prefix, false, 0x0F10, 1, RBX, VALUE_DISP(b_));
+
+    // ucomiss / ucomisd. The operands are swapped for less-than, so
+    // every ordered comparison is an "above" test, which is false for NaN.
+    bool swap = op == OVMI_LT || op == OVMI_LT_S || op == OVMI_LE || op == OVMI_LE_S;
+    if (type == OVM_TYPE_F64) emit8(b, 0x66);
+    emit8(b, 0x0F); emit8(b, 0x2E);
+    emit8(b, swap ? 0xC8 : 0xC1);
+
+    switch (op) {
+        case OVMI_LT: case OVMI_LT_S:
+        case OVMI_GT: case OVMI_GT_S: emit_setcc_eax(b, CC_A);  break;
+        case OVMI_LE: case OVMI_LE_S:
+        case OVMI_GE: case OVMI_GE_S: emit_setcc_eax(b, CC_AE); break;
+
+        case OVMI_EQ:
+            // sete al; setnp cl; and al, cl
+            emit8(b, 0x0F); emit8(b, 0x94); emit8(b, 0xC0);
+            emit8(b, 0x0F); emit8(b, 0x9B); emit8(b, 0xC1);
+            emit8(b, 0x20); emit8(b, 0xC8);
+            emit8(b, 0x0F); emit8(b, 0xB6); emit8(b, 0xC0);
+            break;
+
+        case OVMI_NE:
+            // setne al; setp cl; or al, cl
+            emit8(b, 0x0F); emit8(b, 0x95); emit8(b, 0xC0);
+            emit8(b, 0x0F); emit8(b, 0x9A); emit8(b, 0xC1);
+            emit8(b, 0x08); emit8(b, 0xC8);
+            emit8(b, 0x0F); emit8(b, 0xB6); emit8(b, 0xC0);
+            break;
+    }
+}
+
+static i32 integer_condition(i32 op) {
+    switch (op) {
+        case OVMI_LT:   return CC_B;
+        case OVMI_LT_S: return CC_L;
+        case OVMI_LE:   return CC_BE;
+        case OVMI_LE_S: return CC_LE;
+        case OVMI_EQ:   return CC_E;
+        case OVMI_GE:   return CC_AE;
+        case OVMI_GE_S: return CC_GE;
+        case OVMI_GT:   return CC_A;
+        case OVMI_GT_S: return CC_G;
+        case OVMI_NE:   return CC_NE;
+    }
+
+    return CC_E;
+}
+
+//
+// Jumps to the instruction at `next + %a`, through the table of native offsets.
+static void emit_indirect_branch(jit_builder_t *b, i32 a, i32 next) {
+    emit_mem(b, 0, true, 0x63, RAX, RBX, VALUE_DISP(a));          // movsxd rax, %a
+
+    emit8(b, 0x48); emit8(b, 0x8D); emit8(b, 0x0D);                 // lea rcx, [rip + offsets]
+    bh_arr_push(b->patches, ((jit_patch_t) { bh_arr_length(b->code), JIT_TARGET_OFFSETS }));
+    emit32(b, 0);
+
+    emit8(b, 0x48); emit8(b, 0x8D); emit8(b, 0x0C); emit8(b, 0x81); // lea rcx, [rcx + rax*4]
+    emit_mem(b, 0, false, 0x8B, RAX, RCX, (next - b->start) * 4);   // mov eax, [rcx + next]
+
+    emit8(b, 0x48); emit8(b, 0x8D); emit8(b, 0x0D);                 // lea rcx, [rip + function start]
+    emit32(b, (u32) -(bh_arr_length(b->code) + 4));
+
+    emit8(b, 0x48); emit8(b, 0x01); emit8(b, 0xC8);                 // add rax, rcx
+    emit8(b, 0xFF); emit8(b, 0xE0);                                 // jmp rax
+}
+
+static bool emit_instr(jit_builder_t *b, i32 idx) {
+    ovm_instr_t *instr = &b->program->code[idx];
+    i32 op   = OVM_INSTR_INSTR(*instr);
+    i32 type = OVM_INSTR_TYPE(*instr);
+    bool wide = is_wide(type);
+    i32 next = idx + 1;
+
+    //
+    // Atomic accesses are left to the handlers, except for control flow.
+    if (instr->full_instr & OVMI_ATOMIC) {
+        if (!ovm__jit_instr_handler(instr->full_instr)) return false;
+        emit_slow_path(b, instr);
+        return true;
+    }
+
+    switch (op) {
+        case OVMI_NOP: return true;
+
+        case OVMI_ADD: case OVMI_SUB: case OVMI_MUL:
+        case OVMI_AND: case OVMI_OR:  case OVMI_XOR: {
+            if (is_float(type)) {
+                if (op != OVMI_ADD && op != OVMI_SUB && op != OVMI_MUL) return false;
+
+                u8 prefix = type == OVM_TYPE_F32 ? 0xF3 : 0xF2;
+                u32 opcode = op == OVMI_ADD ? 0x0F58 : op == OVMI_SUB ? 0x0F5C : 0x0F59;
+                emit_mem(b, prefix, false, 0x0F10, 0, RBX, VALUE_DISP(instr->a));
+                emit_mem(b, prefix, false, opcode, 0, RBX, VALUE_DISP(instr->b));
+                emit_mem(b, prefix, false, 0x0F11, 0, RBX, VALUE_DISP(instr->r));
+                return true;
+            }
+
+            u32 opcode;
+            switch (op) {
+                case OVMI_ADD: opcode = 0x03; break;
+                case OVMI_SUB: opcode = 0x2B; break;
+                case OVMI_MUL: opcode = 0x0FAF; break;
+                case OVMI_AND: opcode = 0x23; break;
+                case OVMI_OR:  opcode = 0x0B; break;
+                default:       opcode = 0x33; break;
+            }
+
+            emit_load_value(b, RAX, instr->a, wide);
+            emit_mem(b, 0, wide, opcode, RAX, RBX, VALUE_DISP(instr->b));
+            emit_store_value(b, RAX, instr->r, wide);
+            return true;
+        }
+
+        case OVMI_DIV: case OVMI_DIV_S: case OVMI_REM: case OVMI_REM_S: {
+            if (is_float(type)) {
+                u8 prefix = type == OVM_TYPE_F32 ? 0xF3 : 0xF2;
+                emit_mem(b, prefix, false, 0x0F10, 0, RBX, VALUE_DISP(instr->a));
+                emit_mem(b, prefix, false, 0x0F5E, 0, RBX, VALUE_DISP(instr->b));
+                emit_mem(b, prefix, false, 0x0F11, 0, RBX, VALUE_DISP(instr->r));
+                return true;
+            }
+
+            bool is_signed = op == OVMI_DIV_S || op == OVMI_REM_S;
+            emit_load_value(b, RAX, instr->a, wide);
+            if (is_signed) {
+                if (wide) emit8(b, 0x48);
+                emit8(b, 0x99);                          // cdq / cqo
+            } else {
+                emit8(b, 0x31); emit8(b, 0xD2);          // xor edx, edx
+            }
+
+            emit_mem(b, 0, wide, 0xF7, is_signed ? 7 : 6, RBX, VALUE_DISP(instr->b));
+            emit_store_value(b, (op == OVMI_DIV || op == OVMI_DIV_S) ? RAX : RDX, instr->r, wide);
+            return true;
+        }
+
+        case OVMI_SHL: case OVMI_SHR: case OVMI_SAR: case OVMI_ROTL: case OVMI_ROTR: {
+            i32 ext;
+            switch (op) {
+                case OVMI_SHL:  ext = 4; break;
+                case OVMI_SHR:  ext = 5; break;
+                case OVMI_SAR:  ext = 7; break;
+                case OVMI_ROTL: ext = 0; break;
+                default:        ext = 1; break;
+            }
+
+            emit_load_value(b, RAX, instr->a, wide);
+            emit_load_value(b, RCX, instr->b, false);
+            emit_reg(b, wide, 0xD3, ext, RAX);
+            emit_store_value(b, RAX, instr->r, wide);
+            return true;
+        }
+
+        case OVMI_SQRT: {
+            u8 prefix = type == OVM_TYPE_F32 ? 0xF3 : 0xF2;
+            emit_mem(b, prefix, false, 0x0F51, 0, RBX, VALUE_DISP(instr->a));
+            emit_mem(b, prefix, false, 0x0F11, 0, RBX, VALUE_DISP(instr->r));
+            return true;
+        }
+
+        case OVMI_IMM: {
+            switch (type) {
+                case OVM_TYPE_I32: case OVM_TYPE_F32:
+                    emit_mov_imm32(b, RAX, (u32) instr->i);
+                    emit_store_value(b, RAX, instr->r, true);
+                    return true;
+
+                case OVM_TYPE_I64: case OVM_TYPE_F64:
+                    emit_mov_imm64(b, RAX, (u64) instr->l);
+                    emit_store_value(b, RAX, instr->r, true);
+                    return true;
+            }
+            break;
+        }
+
+        case OVMI_MOV: {
+            if (type == OVM_TYPE_V128) break;
+            emit_load_value(b, RAX, instr->a, true);
+            emit_store_value(b, RAX, instr->r, true);
+            return true;
+        }
+
+        case OVMI_ADDI: {
+            emit_load_value(b, RAX, instr->a, wide);
+            emit_rex(b, wide, 0, 0, RAX);
+            emit8(b, 0x05); emit32(b, (u32) instr->b); // add eax, imm32
+            emit_store_value(b, RAX, instr->r, wide);
+            return true;
+        }
+
+        case OVMI_LOAD: {
+            u32 opcode;
+            switch (type) {
+                case OVM_TYPE_I8:  opcode = 0x0FB6; break;
+                case OVM_TYPE_I16: opcode = 0x0FB7; break;
+                case OVM_TYPE_I32: case OVM_TYPE_F32:
+                case OVM_TYPE_I64: case OVM_TYPE_F64: opcode = 0x8B; break;
+                default: opcode = 0; break;
+            }
+            if (!opcode) break;
+
+            emit_load_value(b, RAX, instr->a, false);
+            emit8(b, 0x05); emit32(b, (u32) instr->b);   // add eax, offset
+            emit_mem_index(b, 0, wide, opcode, RCX, R12, RAX, 0);
+            emit_store_value(b, RCX, instr->r, wide);
+            return true;
+        }
+
+        case OVMI_STORE: {
+            u8 prefix = 0;
+            u32 opcode;
+            switch (type) {
+                case OVM_TYPE_I8:  opcode = 0x88; break;
+                case OVM_TYPE_I16: opcode = 0x89; prefix = 0x66; break;
+                case OVM_TYPE_I32: case OVM_TYPE_F32:
+                case OVM_TYPE_I64: case OVM_TYPE_F64: opcode = 0x89; break;
+                default: opcode = 0; break;
+            }
+            if (!opcode) break;
+
+            emit_load_value(b, RAX, instr->r, false);
+            emit8(b, 0x05); emit32(b, (u32) instr->b);   // add eax, offset
+            emit_load_value(b, RCX, instr->a, true);
+            emit_mem_index(b, prefix, wide, opcode, RCX, R12, RAX, 0);
+            return true;
+        }
+
+        case OVMI_REG_GET: {
+            emit_mem(b, 0, true, 0x8B, RAX, R13, offsetof(ovm_state_t, registers));
+            emit_mem(b, 0, true, 0x8B, RAX, RAX, VALUE_DISP(instr->a));
+            emit_store_value(b, RAX, instr->r, true);
+            return true;
+        }
+
+        case OVMI_REG_SET: {
+            emit_mem(b, 0, true, 0x8B, RAX, R13, offsetof(ovm_state_t, registers));
+            emit_load_value(b, RCX, instr->a, true);
+            emit_mem(b, 0, true, 0x89, RCX, RAX, VALUE_DISP(instr->r));
+            return true;
+        }
+
+        case OVMI_LT: case OVMI_LT_S: case OVMI_LE: case OVMI_LE_S: case OVMI_EQ:
+        case OVMI_GE: case OVMI_GE_S: case OVMI_GT: case OVMI_GT_S: case OVMI_NE: {
+            if (is_float(type)) {
+                emit_float_compare(b, op, type, instr->a, instr->b);
+            } else {
+                emit_load_value(b, RAX, instr->a, wide);
+                emit_mem(b, 0, wide, 0x3B, RAX, RBX, VALUE_DISP(instr->b));
+                emit_setcc_eax(b, integer_condition(op));
+            }
+
+            emit_store_value(b, RAX, instr->r, false);
+            return true;
+        }
+
+        case OVMI_PARAM: {
+            emit_mem(b, 0, false, 0x8B, RAX, R13, offsetof(ovm_state_t, param_count));
+            emit_mem(b, 0, true,  0x8B, RCX, R13, offsetof(ovm_state_t, param_buf));
+            emit_load_value(b, RDX, instr->a, true);
+            emit_mem_index(b, 0, true, 0x89, RDX, RCX, RAX, 3);
+            emit_mem(b, 0, false, 0xFF, 0, R13, offsetof(ovm_state_t, param_count)); // inc
+            return true;
+        }
+
+        case OVMI_RETURN: {
+            if (type == OVM_TYPE_V128) return false;
+            emit_load_value(b, RAX, instr->a, true);
+            emit_jump(b, JIT_TARGET_EPILOGUE);
+            return true;
+        }
+
+        case OVMI_CALL: case OVMI_CALLI: {
+            // Like the interpreter, leave the program counter after the call,
+            // so the callee's frame records where it returns to.
+            emit_mem(b, 0, false, 0xC7, 0, R13, offsetof(ovm_state_t, pc));
+            emit32(b, next);
+
+            emit_reg(b, true, 0x89, R13, RDI);
+            if (op == OVMI_CALL) emit_mov_imm32(b, RSI, (u32) instr->a);
+            else                 emit_load_value(b, RSI, instr->a, false);
+            emit_mov_imm32(b, RDX, (u32) instr->r);
+            emit_call_absolute(b, ovm__jit_call);
+
+            emit_reload_frame(b);
+            emit_trap_check(b);
+            return true;
+        }
+
+        case OVMI_RETURN_CALL: case OVMI_RETURN_CALLI: {
+            if (type == OVM_TYPE_V128) return false;
+
+            //
+            // A function tail calling itself moves its parameters into place
+            // and jumps back to its start, as the frame is the same.
+            if (op == OVMI_RETURN_CALL && instr->a == b->func->id) {
+                i32 param_count = b->func->param_count;
+
+                emit_mem(b, 0, false, 0x8B, RAX, R13, offsetof(ovm_state_t, param_count));
+                emit8(b, 0x2D); emit32(b, (u32) param_count);                  // sub eax, imm32
+                emit_mem(b, 0, false, 0x89, RAX, R13, offsetof(ovm_state_t, param_count));
+                emit_mem(b, 0, true,  0x8B, RCX, R13, offsetof(ovm_state_t, param_buf));
+                emit_mem_index(b, 0, true, 0x8D, RCX, RCX, RAX, 3);             // lea rcx, [rcx + rax * 8]
+
+                fori (i, 0, param_count) {
+                    emit_mem(b, 0, true, 0x8B, RDX, RCX, VALUE_DISP(i));
+                    emit_store_value(b, RDX, i, true);
+                }
+
+                emit_jump(b, b->start);
+                return true;
+            }
+
+            //
+            // Any other tail call is a call followed by a return. Native frames
+            // are limited in depth, so the stack still stops growing once they
+            // run out and the rest of the calls are interpreted.
+            emit_mem(b, 0, false, 0xC7, 0, R13, offsetof(ovm_state_t, pc));
+            emit32(b, next);
+
+            emit_reg(b, true, 0x89, R13, RDI);
+            if (op == OVMI_RETURN_CALL) emit_mov_imm32(b, RSI, (u32) instr->a);
+            else                        emit_load_value(b, RSI, instr->a, false);
+            emit_mov_imm32(b, RDX, (u32) instr->r);
+            emit_call_absolute(b, ovm__jit_call);
+
+            emit_reload_frame(b);
+            emit_trap_check(b);
+
+            if (instr->r >= 0) emit_load_value(b, RAX, instr->r, true);
+            emit_jump(b, JIT_TARGET_EPILOGUE);
+            return true;
+        }
+
+        case OVMI_BR: {
+            emit_jump(b, next + instr->a);
+            return true;
+        }
+
+        case OVMI_BR_Z: case OVMI_BR_NZ: {
+            emit_mem(b, 0, false, 0x83, 7, RBX, VALUE_DISP(instr->b)); // cmp dword %b, 0
+            emit8(b, 0);
+            emit_jcc(b, op == OVMI_BR_Z ? CC_E : CC_NE, next + instr->a);
+            return true;
+        }
+
+        case OVMI_BRI: case OVMI_BRI_Z: case OVMI_BRI_NZ: {
+            i32 skip_at = -1;
+            if (op != OVMI_BRI) {
+                emit_mem(b, 0, false, 0x83, 7, RBX, VALUE_DISP(instr->b));
+                emit8(b, 0);
+                emit8(b, 0x0F); emit8(b, 0x80 | (op == OVMI_BRI_Z ? CC_NE : CC_E));
+                skip_at = bh_arr_length(b->code);
+                emit32(b, 0);
+            }
+
+            emit_indirect_branch(b, instr->a, next);
+
+            if (skip_at >= 0) {
+                i32 rel = bh_arr_length(b->code) - (skip_at + 4);
+                memcpy(&b->code[skip_at], &rel, 4);
+            }
+            return true;
+        }
+
+        case OVMI_BR_LT: case OVMI_BR_LT_S: case OVMI_BR_LE: case OVMI_BR_LE_S: case OVMI_BR_EQ:
+        case OVMI_BR_GE: case OVMI_BR_GE_S: case OVMI_BR_GT: case OVMI_BR_GT_S: case OVMI_BR_NE: {
+            i32 cmp_op = op - OVMI_BR_LT + OVMI_LT;
+            if (is_float(type)) {
+                emit_float_compare(b, cmp_op, type, instr->r, instr->b);
+                emit8(b, 0x85); emit8(b, 0xC0);          // test eax, eax
+                emit_jcc(b, CC_NE, next + instr->a);
+            } else {
+                emit_load_value(b, RAX, instr->r, wide);
+                emit_mem(b, 0, wide, 0x3B, RAX, RBX, VALUE_DISP(instr->b));
+                emit_jcc(b, integer_condition(cmp_op), next + instr->a);
+            }
+            return true;
+        }
+
+        case OVMI_MEM_GROW: {
+            emit_slow_path(b, instr);
+            emit_reload_frame(b);
+            return true;
+        }
+    }
+
+    //
+    // Everything else is run by its handler, which may trap.
+    if (!ovm__jit_instr_handler(instr->full_instr)) return false;
+    emit_slow_path(b, instr);
+    emit_trap_check(b);
+    return true;
+}
+
+static bool is_branch(i32 op) {
+    return op == OVMI_BR || op == OVMI_BR_Z || op == OVMI_BR_NZ
+        || (op >= OVMI_BR_LT && op <= OVMI_BR_NE);
+}
+
+static bool jit_translate(jit_builder_t *b) {
+    //
+    // Prologue
+    emit8(b, 0x53);                         // push rbx
+    emit8(b, 0x41); emit8(b, 0x54);         // push r12
+    emit8(b, 0x41); emit8(b, 0x55);         // push r13
+    emit_reg(b, true, 0x89, RDI, R13);      // mov r13, rdi
+    emit_reg(b, true, 0x89, RSI, RBX);      // mov rbx, rsi
+    emit_reg(b, true, 0x89, RDX, R12);      // mov r12, rdx
+    emit8(b, 0x48); emit8(b, 0x85); emit8(b, 0xC9); // test rcx, rcx
+    emit8(b, 0x74); emit8(b, 0x02);         // jz body
+    emit8(b, 0xFF); emit8(b, 0xE1);         // jmp rcx
+
+    fori (i, b->start, b->end) {
+        b->offsets[i - b->start] = bh_arr_length(b->code);
+
+        ovm_instr_t *instr = &b->program->code[i];
+        i32 op = OVM_INSTR_INSTR(*instr);
+        if (is_branch(op) && !(instr->full_instr & OVMI_ATOMIC)) {
+            i32 target = i + 1 + instr->a;
+            if (target < b->start || target >= b->end) return false;
+        }
+
+        if (!emit_instr(b, i)) return false;
+    }
+
+    //
+    // Falling off the end cannot happen, as every function ends in a return.
+    i32 trap = bh_arr_length(b->code);
+    emit8(b, 0x31); emit8(b, 0xC0);         // xor eax, eax
+
+    i32 epilogue = bh_arr_length(b->code);
+    emit8(b, 0x41); emit8(b, 0x5D);         // pop r13
+    emit8(b, 0x41); emit8(b, 0x5C);         // pop r12
+    emit8(b, 0x5B);                         // pop rbx
+    emit8(b, 0xC3);                         // ret
+
+    while (bh_arr_length(b->code) % 4 != 0) emit8(b, 0xCC);
+    i32 offsets = bh_arr_length(b->code);
+
+    bh_arr_each(jit_patch_t, patch, b->patches) {
+        i32 target;
+        switch (patch->target) {
+            case JIT_TARGET_EPILOGUE: target = epilogue; break;
+            case JIT_TARGET_TRAP:     target = trap;     break;
+            case JIT_TARGET_OFFSETS:  target = offsets;  break;
+            default:                  target = b->offsets[patch->target - b->start]; break;
+        }
+
+        i32 rel = target - (patch->at + 4);
+        memcpy(&b->code[patch->at], &rel, 4);
+    }
+
+    return true;
+}
+
+//
+// Functions are laid out one after another, so a function ends
+// where the next one starts.
+static i32 jit_func_end(ovm_program_t *program, ovm_func_t *func) {
+    i32 end = bh_arr_length(program->code);
+    bh_arr_each(ovm_func_t, other, program->funcs) {
+        if (other->kind != OVM_FUNC_INTERNAL) continue;
+        if (other->start_instr > func->start_instr && other->start_instr < end) {
+            end = other->start_instr;
+        }
+    }
+
+    return end;
+}
+
+bool ovm_jit_compile(ovm_program_t *program, ovm_func_t *func) {
+    ovm_jit_t *jit = program->jit;
+    if (!jit) return false;
+
+    pthread_mutex_lock(&jit->mutex);
+    if (func->native || func->jit_failed) {
+        pthread_mutex_unlock(&jit->mutex);
+        return func->native != NULL;
+    }
+
+    jit_builder_t b = {0};
+    b.program = program;
+    b.func    = func;
+    b.start   = func->start_instr;
+    b.end     = jit_func_end(program, func);
+    bh_arr_new(bh_heap_allocator(), b.code, 1024);
+    bh_arr_new(bh_heap_allocator(), b.patches, 64);
+    b.offsets = bh_alloc_array(bh_heap_allocator(), u32, b.end - b.start);
+
+    bool success = b.end > b.start && jit_translate(&b);
+    if (success) {
+        i32 code_size = bh_arr_length(b.code);
+        i32 table_size = (b.end - b.start) * sizeof(u32);
+
+        //
+        // Only once the code and its offsets are executable is the function
+        // published, so other threads never see a partly written entry.
+        u8 *native = jit_alloc_code(jit, code_size + table_size);
+        if (native) {
+            memcpy(native, b.code, code_size);
+            memcpy(native + code_size, b.offsets, table_size);
+        }
+
+        if (native && jit_make_executable(jit, native, code_size + table_size)) {
+            func->native_offsets = (u32 *) (native + code_size);
+            __atomic_store_n(&func->native, (ovm_native_func_t) native, __ATOMIC_RELEASE);
+        } else {
+            success = false;
+        }
+    }
+
+    if (!success) __atomic_store_n(&func->jit_failed, true, __ATOMIC_RELAXED);
+
+    bh_arr_free(b.code);
+    bh_arr_free(b.patches);
+    bh_free(bh_heap_allocator(), b.offsets);
+
+    pthread_mutex_unlock(&jit->mutex);
+    return success;
+}
+
+#endif
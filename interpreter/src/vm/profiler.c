@@ -0,0 +1,300 @@
+#include "vm.h"
+#include "stb_ds.h"
+
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define PROFILER_MAX_DEPTH   128
+#define PROFILER_SLOT_COUNT  1024
+#define PROFILER_DRAIN_MS    20
+
+enum profiler_slot_status_t {
+    profiler_slot_empty,
+    profiler_slot_writing,
+    profiler_slot_ready,
+};
+
+typedef struct profiler_frame_t {
+    i32 func_id;
+    i32 instr;
+} profiler_frame_t;
+
+//
+// One sample, written by the signal handler and read by the drain thread.
+// Frames go from the outermost call to the innermost.
+typedef struct profiler_slot_t {
+    u32 status;
+    u32 depth;
+    bool truncated;
+    ovm_program_t *program;
+    profiler_frame_t frames[PROFILER_MAX_DEPTH];
+} profiler_slot_t;
+
+struct ovm_profiler_t {
+    char *output_path;
+    debug_info_t *info;
+
+    profiler_slot_t *slots;
+    u32 next_slot;
+    u64 sample_count;
+    u64 dropped_count;
+
+    bool running;
+    pthread_t drain_thread;
+    pthread_mutex_t drain_mutex;
+
+    bh_buffer stack_buffer;
+    Table(u64) stacks;
+};
+
+//
+// Only one profiler can own the timer at a time.
+static ovm_profiler_t *active_profiler = NULL;
+
+static void profiler_signal_handler(int signo, siginfo_t *info, void *context) {
+    ovm_profiler_t *profiler = active_profiler;
+    ovm_state_t *state = ovm_state_current();
+    if (!profiler || !state) return;
+
+    i32 frame_count = state->stack_frame_count;
+    if (frame_count == 0) return;
+
+    u32 slot_idx = __atomic_fetch_add(&profiler->next_slot, 1, __ATOMIC_RELAXED) % PROFILER_SLOT_COUNT;
+    profiler_slot_t *slot = &profiler->slots[slot_idx];
+
+    u32 expected = profiler_slot_empty;
+    if (!__atomic_compare_exchange_n(&slot->status, &expected, profiler_slot_writing, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&profiler->dropped_count, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    i32 first_frame = bh_max(0, frame_count - PROFILER_MAX_DEPTH);
+    fori (i, first_frame, frame_count) {
+        ovm_stack_frame_t *frame = &state->stack_frames[i];
+
+        //
+        // The program counter has already moved past the instruction being
+        // executed, and return addresses point just after the call. Native
+        // code does not keep the program counter up to date, so the innermost
+        // frame gets no location if it is running natively.
+        i32 instr;
+        if (i < frame_count - 1) {
+            instr = state->stack_frames[i + 1].return_address;
+        } else if (state->native_depth > 0 && frame->func->native) {
+            instr = 0;
+        } else {
+            instr = state->pc;
+        }
+
+        profiler_frame_t *out = &slot->frames[i - first_frame];
+        out->func_id = frame->func->id;
+        out->instr   = instr - 1;
+    }
+
+    slot->depth     = frame_count - first_frame;
+    slot->truncated = first_frame > 0;
+    slot->program   = state->program;
+
+    __atomic_store_n(&slot->status, profiler_slot_ready, __ATOMIC_RELEASE);
+}
+
+static void profiler_append_frame(ovm_profiler_t *profiler, ovm_program_t *program, profiler_frame_t frame) {
+    bh_buffer *buf = &profiler->stack_buffer;
+
+    debug_func_info_t func_info;
+    if (debug_info_lookup_func(profiler->info, frame.func_id, &func_info) && func_info.name) {
+        bh_buffer_append(buf, func_info.name, strlen(func_info.name));
+    } else if (frame.func_id < bh_arr_length(program->funcs)) {
+        char *name = program->funcs[frame.func_id].name;
+        bh_buffer_append(buf, name, strlen(name));
+    } else {
+        bh_buffer_append(buf, "[unknown]", 9);
+    }
+
+    if (frame.instr < 0) return;
+
+    //
+    // Not every instruction has a location, so look a little further
+    // ahead, like the debugger does.
+    debug_loc_info_t loc;
+    bool found = false;
+    fori (i, 0, 8) {
+        if (debug_info_lookup_location(profiler->info, frame.instr + i, &loc)) {
+            found = true;
+            break;
+        }
+    }
+
+    debug_file_info_t file_info;
+    if (!found || !debug_info_lookup_file(profiler->info, loc.file_id, &file_info)) return;
+
+    // Only the file name is used, to keep the frames short.
+    char *file_name = strrchr(file_info.name, '/');
+    file_name = file_name ? file_name + 1 : file_info.name;
+
+    char location[256];
+    i32 length = snprintf(location, sizeof(location), " (%s:%d)", file_name, loc.line);
+    bh_buffer_append(buf, location, bh_min(length, (i32) sizeof(location) - 1));
+}
+
+//
+// Folds every finished sample into the table of stacks.
+static void profiler_drain(ovm_profiler_t *profiler) {
+    pthread_mutex_lock(&profiler->drain_mutex);
+
+    fori (i, 0, PROFILER_SLOT_COUNT) {
+        profiler_slot_t *slot = &profiler->slots[i];
+        if (__atomic_load_n(&slot->status, __ATOMIC_ACQUIRE) != profiler_slot_ready) continue;
+
+        bh_buffer_clear(&profiler->stack_buffer);
+        if (slot->truncated) {
+            bh_buffer_append(&profiler->stack_buffer, "[truncated];", 12);
+        }
+
+        fori (f, 0, (i32) slot->depth) {
+            if (f > 0) bh_buffer_write_byte(&profiler->stack_buffer, ';');
+            profiler_append_frame(profiler, slot->program, slot->frames[f]);
+        }
+
+        bh_buffer_write_byte(&profiler->stack_buffer, '\0');
+
+        __atomic_store_n(&slot->status, profiler_slot_empty, __ATOMIC_RELEASE);
+
+        char *stack = (char *) profiler->stack_buffer.data;
+        u64 count = shget(profiler->stacks, stack);
+        shput(profiler->stacks, stack, count + 1);
+        profiler->sample_count += 1;
+    }
+
+    pthread_mutex_unlock(&profiler->drain_mutex);
+}
+
+static void *profiler_drain_thread(void *data) {
+    ovm_profiler_t *profiler = data;
+
+    struct timespec interval;
+    interval.tv_sec  = 0;
+    interval.tv_nsec = PROFILER_DRAIN_MS * 1000000;
+
+    while (__atomic_load_n(&profiler->running, __ATOMIC_ACQUIRE)) {
+        nanosleep(&interval, NULL);
+        profiler_drain(profiler);
+    }
+
+    return NULL;
+}
+
+static void profiler_write_output(ovm_profiler_t *profiler) {
+    FILE *out = fopen(profiler->output_path, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open '%s' to write the profile.\n", profiler->output_path);
+        return;
+    }
+
+    fori (i, 0, shlen(profiler->stacks)) {
+        fprintf(out, "%s %llu\n", profiler->stacks[i].key, (unsigned long long) profiler->stacks[i].value);
+    }
+
+    fclose(out);
+
+    if (profiler->dropped_count > 0) {
+        fprintf(stderr, "Profiler dropped %llu of %llu samples.\n",
+            (unsigned long long) profiler->dropped_count,
+            (unsigned long long) (profiler->sample_count + profiler->dropped_count));
+    }
+}
+
+static void profiler_stop_at_exit() {
+    if (active_profiler) ovm_profiler_stop(active_profiler);
+}
+
+ovm_profiler_t *ovm_profiler_new(char *output_path) {
+    ovm_profiler_t *profiler = bh_alloc_item(bh_heap_allocator(), ovm_profiler_t);
+    memset(profiler, 0, sizeof(*profiler));
+
+    profiler->output_path = output_path;
+
+    // The signal handler cannot allocate, so every slot is made up front.
+    profiler->slots = mmap(NULL, sizeof(profiler_slot_t) * PROFILER_SLOT_COUNT,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (profiler->slots == MAP_FAILED) {
+        bh_free(bh_heap_allocator(), profiler);
+        return NULL;
+    }
+
+    pthread_mutex_init(&profiler->drain_mutex, NULL);
+    bh_buffer_init(&profiler->stack_buffer, bh_heap_allocator(), 1024);
+    sh_new_strdup(profiler->stacks);
+
+    return profiler;
+}
+
+void ovm_profiler_set_debug_info(ovm_profiler_t *profiler, debug_info_t *info) {
+    profiler->info = info;
+}
+
+bool ovm_profiler_start(ovm_profiler_t *profiler) {
+    if (active_profiler) return false;
+
+    active_profiler = profiler;
+    profiler->running = true;
+
+    if (pthread_create(&profiler->drain_thread, NULL, profiler_drain_thread, profiler)) {
+        profiler->running = false;
+        active_profiler = NULL;
+        return false;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = profiler_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec  = 0;
+    timer.it_interval.tv_usec = 1000000 / OVM_PROFILER_HZ;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    //
+    // Programs often end by calling exit directly, which never deletes
+    // the engine, so the profile is also written at exit.
+    static bool registered_at_exit = false;
+    if (!registered_at_exit) {
+        atexit(profiler_stop_at_exit);
+        registered_at_exit = true;
+    }
+
+    return true;
+}
+
+void ovm_profiler_stop(ovm_profiler_t *profiler) {
+    if (active_profiler != profiler) return;
+
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+
+    __atomic_store_n(&profiler->running, false, __ATOMIC_RELEASE);
+    pthread_join(profiler->drain_thread, NULL);
+
+    profiler_drain(profiler);
+    profiler_write_output(profiler);
+
+    active_profiler = NULL;
+}
+
+void ovm_profiler_delete(ovm_profiler_t *profiler) {
+    ovm_profiler_stop(profiler);
+
+    shfree(profiler->stacks);
+    bh_buffer_free(&profiler->stack_buffer);
+    pthread_mutex_destroy(&profiler->drain_mutex);
+    munmap(profiler->slots, sizeof(profiler_slot_t) * PROFILER_SLOT_COUNT);
+    bh_free(bh_heap_allocator(), profiler);
+}
@@ -52,7 +52,11 @@ bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, ch
         bh_file_read(&file, &size, sizeof(i32));
 
         assert(engine);
-        assert(engine->memory);
+        if (!ovm_engine_memory_ensure_capacity(engine, (i64) offset + size)) {
+            fprintf(stderr, "Data section of '%s' does not fit in memory.\n", filename);
+            return false;
+        }
+
         bh_file_read(&file, ((u8 *) engine->memory) + offset, size);
     }
 
@@ -104,6 +108,190 @@ bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, ch
     return true;
 }
 
+//
+// Program images
+//
+// Arrays are written as a u32 count followed by their elements, exactly as they
+// are laid out in memory. The table of line offsets for the debug files goes last,
+// with its count after it, because the files only exist once the custom sections
+// of the module have been parsed, long after the rest of the image is loaded.
+//
+
+static void image_write_array(bh_buffer *out, void *data, u32 count, u32 elem_size) {
+    bh_buffer_write_u32(out, count);
+    bh_buffer_append(out, data, count * elem_size);
+}
+
+#define IMAGE_WRITE_ARRAY(out, arr) image_write_array((out), (arr), bh_arr_length(arr), sizeof(*(arr)))
+
+void ovm_program_write_image(ovm_program_t *program, debug_info_t *debug, bh_buffer *out) {
+    bh_buffer_write_u32(out, program->register_count);
+    IMAGE_WRITE_ARRAY(out, program->code);
+    IMAGE_WRITE_ARRAY(out, program->static_integers);
+    IMAGE_WRITE_ARRAY(out, program->static_data);
+
+    bh_buffer_write_u32(out, bh_arr_length(program->funcs));
+    bh_arr_each(ovm_func_t, func, program->funcs) {
+        bh_buffer_write_u32(out, func->kind);
+        bh_buffer_write_u32(out, func->param_count);
+        bh_buffer_write_u32(out, func->value_number_count);
+        bh_buffer_write_u32(out, func->kind == OVM_FUNC_INTERNAL ? func->start_instr : func->external_func_idx);
+        image_write_array(out, func->name, strlen(func->name), 1);
+    }
+
+    bool has_debug_info = debug && debug->has_debug_info;
+    bh_buffer_write_u32(out, has_debug_info);
+    if (has_debug_info) {
+        IMAGE_WRITE_ARRAY(out, debug->line_info);
+        IMAGE_WRITE_ARRAY(out, debug->instruction_reducer);
+        IMAGE_WRITE_ARRAY(out, debug->line_to_instruction);
+
+        bh_buffer_write_u32(out, bh_arr_length(debug->symbol_scopes));
+        bh_arr_each(debug_sym_scope_t, scope, debug->symbol_scopes) {
+            bh_buffer_write_u32(out, scope->parent);
+            IMAGE_WRITE_ARRAY(out, scope->symbols);
+        }
+    }
+
+    u32 file_count = has_debug_info ? bh_arr_length(debug->files) : 0;
+    fori (i, 0, (i32) file_count) {
+        bh_buffer_write_u32(out, debug->files[i].line_buffer_offset);
+    }
+    bh_buffer_write_u32(out, file_count);
+}
+
+typedef struct image_reader_t {
+    u8  *data;
+    u32  size;
+    u32  offset;
+    bool failed;
+} image_reader_t;
+
+static void *image_read_bytes(image_reader_t *reader, u64 size) {
+    if (reader->failed || reader->offset + size > reader->size) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    void *result = reader->data + reader->offset;
+    reader->offset += size;
+    return result;
+}
+
+static u32 image_read_u32(image_reader_t *reader) {
+    u32 result = 0;
+    void *bytes = image_read_bytes(reader, sizeof(u32));
+    if (bytes) memcpy(&result, bytes, sizeof(u32));
+    return result;
+}
+
+#define IMAGE_READ_ARRAY(reader, arr) { \
+    u32 count = image_read_u32(reader); \
+    void *elems = image_read_bytes((reader), (u64) count * sizeof(*(arr))); \
+    if (elems) { \
+        i32 start = bh_arr_length(arr); \
+        bh_arr_insert_end((arr), count); \
+        memcpy(&(arr)[start], elems, count * sizeof(*(arr))); \
+    } \
+}
+
+//
+// Loads an image into an empty program. If the image turns out to be malformed,
+// the program and debug info are left empty and false is returned.
+bool ovm_program_read_image(ovm_program_t *program, debug_info_t *debug, u8 *data, u32 size) {
+    assert(bh_arr_length(program->code) == 0 && bh_arr_length(program->funcs) == 0);
+
+    image_reader_t reader = { data, size, 0, false };
+
+    program->register_count = image_read_u32(&reader);
+    IMAGE_READ_ARRAY(&reader, program->code);
+    IMAGE_READ_ARRAY(&reader, program->static_integers);
+    IMAGE_READ_ARRAY(&reader, program->static_data);
+
+    u32 func_count = image_read_u32(&reader);
+    fori (i, 0, (i32) func_count) {
+        if (reader.failed) break;
+
+        ovm_func_kind_t kind  = image_read_u32(&reader);
+        i32 param_count        = image_read_u32(&reader);
+        i32 value_number_count = image_read_u32(&reader);
+        i32 start_or_external  = image_read_u32(&reader);
+
+        u32 name_len = image_read_u32(&reader);
+        char *name_data = image_read_bytes(&reader, name_len);
+        if (!name_data) break;
+
+        char *name = bh_alloc_array(program->store->arena_allocator, char, name_len + 1);
+        memcpy(name, name_data, name_len);
+        name[name_len] = '\0';
+
+        if (kind == OVM_FUNC_INTERNAL) {
+            ovm_program_register_func(program, name, start_or_external, param_count, value_number_count);
+        } else {
+            ovm_program_register_external_func(program, name, param_count, start_or_external);
+        }
+    }
+
+    if (image_read_u32(&reader) && debug) {
+        IMAGE_READ_ARRAY(&reader, debug->line_info);
+        IMAGE_READ_ARRAY(&reader, debug->instruction_reducer);
+        IMAGE_READ_ARRAY(&reader, debug->line_to_instruction);
+
+        u32 scope_count = image_read_u32(&reader);
+        fori (i, 0, (i32) scope_count) {
+            if (reader.failed) break;
+
+            debug_sym_scope_t scope;
+            scope.parent = image_read_u32(&reader);
+            scope.symbols = NULL;
+            bh_arr_new(debug->alloc, scope.symbols, 4);
+            IMAGE_READ_ARRAY(&reader, scope.symbols);
+
+            bh_arr_push(debug->symbol_scopes, scope);
+        }
+    }
+
+    if (!reader.failed) return true;
+
+    bh_arr_clear(program->code);
+    bh_arr_clear(program->funcs);
+    bh_arr_clear(program->static_integers);
+    bh_arr_clear(program->static_data);
+    program->register_count = 0;
+
+    if (debug) {
+        bh_arr_clear(debug->line_info);
+        bh_arr_clear(debug->instruction_reducer);
+        bh_arr_clear(debug->line_to_instruction);
+        bh_arr_each(debug_sym_scope_t, scope, debug->symbol_scopes) {
+            bh_arr_free(scope->symbols);
+        }
+        bh_arr_clear(debug->symbol_scopes);
+    }
+
+    return false;
+}
+
+//
+// Restores the line offsets of the debug files. This has to wait until
+// the files have been imported from the custom sections.
+void ovm_program_read_image_files(debug_info_t *debug, u8 *data, u32 size) {
+    if (size < sizeof(u32)) return;
+
+    u32 file_count;
+    memcpy(&file_count, data + size - sizeof(u32), sizeof(u32));
+    if (file_count != (u32) bh_arr_length(debug->files)) return;
+    if ((u64) file_count * sizeof(i32) + sizeof(u32) > size) return;
+
+    u8 *offsets = data + size - sizeof(u32) - file_count * sizeof(i32);
+    fori (i, 0, (i32) file_count) {
+        memcpy(&debug->files[i].line_buffer_offset, offsets + i * sizeof(i32), sizeof(i32));
+    }
+}
+
+#undef IMAGE_WRITE_ARRAY
+#undef IMAGE_READ_ARRAY
+
 void ovm_state_link_external_funcs(ovm_program_t *program, ovm_state_t *state, ovm_linkable_func_t *funcs) {
     bh_arr_each(ovm_func_t, f, program->funcs) {
         if (f->kind == OVM_FUNC_INTERNAL) continue;
@@ -4,6 +4,7 @@
 
 #include <sys/mman.h>
 #include <signal.h>
+#include <setjmp.h>
 #if defined(__arm64__)
     #include <arm_neon.h>
 #elif defined(__x86_64__)
@@ -22,6 +23,13 @@
 
 #include <math.h> // REMOVE THIS!!!  only needed for sqrt
 #include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#if defined(_BH_LINUX)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
 
 #ifdef OVM_DEBUG
 #define ovm_assert(c) assert((c))
@@ -31,12 +39,16 @@
 
 
 static inline void ovm_print_val(ovm_value_t val) {
+#ifdef OVM_TAGGED_VALUES
     switch (val.type) {
         case OVM_TYPE_I32: printf("i32[%d]", val.i32); break;
         case OVM_TYPE_I64: printf("i64[%ld]", val.i64); break;
         case OVM_TYPE_F32: printf("f32[%f]", val.f32); break;
         case OVM_TYPE_F64: printf("f64[%lf]", val.f64); break;
     }
+#else
+    printf("[%016lx]", val.u64);
+#endif
 }
 
 
@@ -75,10 +87,18 @@ ovm_program_t *ovm_program_new(ovm_store_t *store) {
     bh_arr_new(store->heap_allocator, program->static_integers, 128);
     bh_arr_new(store->heap_allocator, program->static_data, 128);
 
+#ifdef OVM_JIT
+    program->jit = ovm_jit_new(store->heap_allocator);
+#else
+    program->jit = NULL;
+#endif
+
     return program;
 }
 
 void ovm_program_delete(ovm_program_t *program) {
+    if (program->jit) ovm_jit_delete(program->jit);
+
     bh_arr_free(program->funcs);
     bh_arr_free(program->code);
     bh_arr_free(program->static_integers);
@@ -110,7 +130,7 @@ void ovm_program_modify_static_int(ovm_program_t *program, int arr, int idx, int
 }
 
 int ovm_program_register_func(ovm_program_t *program, char *name, i32 instr, i32 param_count, i32 value_number_count) {
-    ovm_func_t func;
+    ovm_func_t func = {0};
     func.kind = OVM_FUNC_INTERNAL;
     func.id = bh_arr_length(program->funcs);
     func.name = name;
@@ -123,7 +143,7 @@ int ovm_program_register_func(ovm_program_t *program, char *name, i32 instr, i32
 }
 
 int ovm_program_register_external_func(ovm_program_t *program, char *name, i32 param_count, i32 external_func_idx) {
-    ovm_func_t func;
+    ovm_func_t func = {0};
     func.kind = OVM_FUNC_EXTERNAL;
     func.id = bh_arr_length(program->funcs);
     func.name = name;
@@ -136,7 +156,7 @@ int ovm_program_register_external_func(ovm_program_t *program, char *name, i32 p
 }
 
 void ovm_program_begin_func(ovm_program_t *program, char *name, i32 param_count, i32 value_number_count) {
-    ovm_func_t func;
+    ovm_func_t func = {0};
     func.id = bh_arr_length(program->funcs);
     func.name = name;
     func.start_instr = bh_arr_length(program->code);
@@ -153,6 +173,75 @@ void ovm_program_add_instructions(ovm_program_t *program, i32 instr_count, ovm_i
 }
 
 
+//
+// Memory faults
+//
+
+//
+// The state running on this thread, if any. The profiler and the memory
+// fault handler read this from signal handlers, so it must not need a call
+// into the dynamic linker.
+static __thread ovm_state_t *ovm__current_state __attribute__((tls_model("initial-exec"))) = NULL;
+
+//
+// Where ovm_func_call on this thread resumes if the code it runs touches the
+// unmapped part of linear memory.
+static __thread sigjmp_buf *ovm__trap_point __attribute__((tls_model("initial-exec"))) = NULL;
+
+static pthread_once_t ovm__memory_fault_handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction ovm__previous_segv_action;
+static struct sigaction ovm__previous_bus_action;
+
+//
+// Loads and stores are not bounds checked; an address past memory_size lands
+// in the inaccessible rest of the reservation or in the guard region after it.
+// A fault there is turned into a trap of the state running on this thread.
+// Any other fault is passed on to the handler that was installed before.
+static void ovm__memory_fault_handler(int signo, siginfo_t *info, void *context) {
+    ovm_state_t *state = ovm__current_state;
+    if (state && ovm__trap_point) {
+        u8 *addr   = info->si_addr;
+        u8 *memory = state->engine->memory;
+
+        if (memory && addr >= memory && addr < memory + state->engine->memory_reserved * 2) {
+            siglongjmp(*ovm__trap_point, 1);
+        }
+    }
+
+    struct sigaction *previous = signo == SIGBUS ? &ovm__previous_bus_action : &ovm__previous_segv_action;
+    if (previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(signo, info, context);
+        return;
+    }
+
+    if (previous->sa_handler == SIG_IGN) return;
+    if (previous->sa_handler != SIG_DFL) {
+        previous->sa_handler(signo);
+        return;
+    }
+
+    //
+    // Returning re-runs the faulting instruction, which now gets the
+    // default action.
+    signal(signo, SIG_DFL);
+}
+
+static void ovm__install_memory_fault_handler() {
+    struct sigaction sa;
+    sa.sa_sigaction = ovm__memory_fault_handler;
+    sigemptyset(&sa.sa_mask);
+
+    //
+    // The handler jumps out instead of returning, so the signal must not
+    // stay blocked; trap points are set with sigsetjmp(.., 0) to keep
+    // ovm_func_call from saving the signal mask on every call.
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+
+    sigaction(SIGSEGV, &sa, &ovm__previous_segv_action);
+    sigaction(SIGBUS,  &sa, &ovm__previous_bus_action);
+}
+
+
 //
 // Engine
 ovm_engine_t *ovm_engine_new(ovm_store_t *store) {
@@ -160,19 +249,35 @@ ovm_engine_t *ovm_engine_new(ovm_store_t *store) {
 
     engine->store = store;
     engine->memory_size = 0;
+    engine->memory_reserved = 0;
     engine->memory = NULL;
     engine->debug = NULL;
+    engine->profiler = NULL;
+    engine->counters = NULL;
+#ifdef OVM_JIT
+    engine->jit_threshold = OVM_JIT_DEFAULT_THRESHOLD;
+#else
+    engine->jit_threshold = 0;
+#endif
     pthread_mutex_init(&engine->atomic_mutex, NULL);
+    pthread_cond_init(&engine->atomic_cond, NULL);
+
+    pthread_once(&ovm__memory_fault_handler_once, ovm__install_memory_fault_handler);
 
     //
-    // HACK: This should not be necessary, but because moving the memory around
-    // causes issues with other standard libraries (like STBTT and STBI), it is
-    // better to allocate a large amount here and avoid needing to reallocate.
-    // A solution should be possible, because other runtimes like Wasmer support
-    // this.
-    i64 attempt_to_allocate = 1ull << 32;
-    while (!ovm_engine_memory_ensure_capacity(engine, attempt_to_allocate)) {
-        attempt_to_allocate /= 2;
+    // Only address space is reserved here, so the full 4GiB is asked for.
+    // If that is not available, less is reserved and the memory cannot
+    // grow as far.
+    i64 reserve_size = OVM_MEMORY_MAX_SIZE;
+    while (reserve_size >= 65536) {
+        void *reserved = mmap(NULL, reserve_size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserved != MAP_FAILED) {
+            engine->memory = reserved;
+            engine->memory_reserved = reserve_size;
+            break;
+        }
+
+        reserve_size /= 2;
     }
 
     return engine;
@@ -182,9 +287,11 @@ void ovm_engine_delete(ovm_engine_t *engine) {
     ovm_store_t *store = engine->store;
 
     if (engine->memory) {
-        munmap(engine->memory, engine->memory_size);
+        munmap(engine->memory, engine->memory_reserved * 2);
     }
 
+    pthread_cond_destroy(&engine->atomic_cond);
+    pthread_mutex_destroy(&engine->atomic_mutex);
     bh_free(store->heap_allocator, engine);
 }
 
@@ -211,37 +318,23 @@ void ovm_engine_enable_debug(ovm_engine_t *engine, debug_state_t *debug) {
     // sigaction(SIGINT, &sa, NULL);   Don't overload Ctrl+C
 }
 
+//
+// Makes the memory at least minimum_size bytes long. The pages are only
+// made accessible here; the kernel backs them once they are touched.
 bool ovm_engine_memory_ensure_capacity(ovm_engine_t *engine, i64 minimum_size) {
     if (engine->memory_size >= minimum_size) return true;
+    if (minimum_size > engine->memory_reserved) return false;
 
-    void *new_addr;
-
-    if (engine->memory == NULL) {
-        new_addr = mmap(NULL, minimum_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    } else {
-        #ifdef _BH_DARWIN // Darwin doesn't support mremap so we need to map and copy it manually
-            new_addr = mmap(engine->memory, minimum_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-            if (new_addr == MAP_FAILED) return false;
-
-            memcpy(new_addr, engine->memory, engine->memory_size);
-            munmap(engine->memory, engine->memory_size);
-        #elif defined(_BH_LINUX)
-            new_addr = mremap(engine->memory, engine->memory_size, minimum_size, MREMAP_MAYMOVE);
-        #else
-            #error "Unhandled platform."
-        #endif
-    }
-
-    if (new_addr == MAP_FAILED) {
-        // Something went wrong...
-        // At this point the program should probably horifically crash.
+    i64 page_size = getpagesize();
+    i64 start = engine->memory_size - engine->memory_size % page_size;
+    i64 end   = minimum_size;
+    bh_align(end, page_size);
 
+    if (mprotect((u8 *) engine->memory + start, end - start, PROT_READ | PROT_WRITE)) {
         return false;
     }
 
     engine->memory_size = minimum_size;
-    engine->memory = new_addr;
-
     return true;
 }
 
@@ -249,15 +342,126 @@ void ovm_engine_memory_copy(ovm_engine_t *engine, i64 target, void *data, i64 si
     ovm_assert(engine);
     ovm_assert(engine->memory);
     ovm_assert(data);
-    ovm_assert(size + target < engine->memory_size);
+    ovm_assert(size + target <= engine->memory_size);
     memcpy(((u8 *) engine->memory) + target, data, size);
 }
 
+//
+// Implements memory.atomic.wait32/64. Returns 0 when woken, 1 when the value
+// in memory did not match `expected`, and 2 when `timeout` (in nanoseconds,
+// negative for none) elapsed. Waiting on a 64-bit value compares all 64 bits,
+// but sleeps on the futex for the low 32 bits, which is where notify wakes.
+//
+// The address must be inside linear memory and aligned to the size of the
+// value; the instructions trap before calling this otherwise.
+i32 ovm_engine_atomic_wait(ovm_engine_t *engine, u32 addr, i64 expected, i64 timeout, bool wide) {
+    ovm_assert((i64) addr + (wide ? 8 : 4) <= engine->memory_size && addr % (wide ? 8 : 4) == 0);
+    void *ptr = ((u8 *) engine->memory) + addr;
+
+#if defined(_BH_LINUX)
+    if (wide) {
+        if (__atomic_load_n((i64 *) ptr, __ATOMIC_SEQ_CST) != expected) return 1;
+    }
+
+    struct timespec ts, *tsp = NULL;
+    if (timeout >= 0) {
+        ts.tv_sec  = timeout / 1000000000;
+        ts.tv_nsec = timeout % 1000000000;
+        tsp = &ts;
+    }
+
+    if (syscall(SYS_futex, ptr, FUTEX_WAIT_PRIVATE, (u32) expected, tsp, NULL, 0) == 0) return 0;
+
+    switch (errno) {
+        case EAGAIN:    return 1;
+        case ETIMEDOUT: return 2;
+        default:        return 0; // EINTR is treated as a spurious wake up.
+    }
+
+#else
+    pthread_mutex_lock(&engine->atomic_mutex);
+
+    i64 current = wide ? __atomic_load_n((i64 *) ptr, __ATOMIC_SEQ_CST)
+                       : __atomic_load_n((i32 *) ptr, __ATOMIC_SEQ_CST);
+    if (current != (wide ? expected : (i32) expected)) {
+        pthread_mutex_unlock(&engine->atomic_mutex);
+        return 1;
+    }
+
+    i32 result = 0;
+    if (timeout < 0) {
+        pthread_cond_wait(&engine->atomic_cond, &engine->atomic_mutex);
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += timeout / 1000000000 + (ts.tv_nsec + timeout % 1000000000) / 1000000000;
+        ts.tv_nsec  = (ts.tv_nsec + timeout % 1000000000) % 1000000000;
+
+        if (pthread_cond_timedwait(&engine->atomic_cond, &engine->atomic_mutex, &ts) == ETIMEDOUT) {
+            result = 2;
+        }
+    }
+
+    pthread_mutex_unlock(&engine->atomic_mutex);
+    return result;
+#endif
+}
+
+//
+// Implements memory.atomic.notify. Returns the number of woken threads. Without
+// futexes every waiter is woken, and the number of woken threads is unknown,
+// so 0 is returned.
+i32 ovm_engine_atomic_notify(ovm_engine_t *engine, u32 addr, i32 count) {
+    ovm_assert((i64) addr + 4 <= engine->memory_size && addr % 4 == 0);
+    void *ptr = ((u8 *) engine->memory) + addr;
+
+#if defined(_BH_LINUX)
+    i32 res = syscall(SYS_futex, ptr, FUTEX_WAKE_PRIVATE, count < 0 ? INT_MAX : count, NULL, NULL, 0);
+    return res < 0 ? 0 : res;
+
+#else
+    pthread_mutex_lock(&engine->atomic_mutex);
+    pthread_cond_broadcast(&engine->atomic_cond);
+    pthread_mutex_unlock(&engine->atomic_mutex);
+    return 0;
+#endif
+}
+
 
 
 //
 // State
 //
+
+ovm_state_t *ovm_state_current() {
+    return ovm__current_state;
+}
+
+//
+// The value stack and the frame stack are mapped together, each followed by a
+// guard page. Pages are only backed once a call reaches them.
+static void ovm__state_map_stacks(ovm_state_t *state) {
+    u64 page_size   = getpagesize();
+    u64 values_size = OVM_VALUE_STACK_SIZE * sizeof(ovm_value_t);
+    u64 frames_size = OVM_FRAME_STACK_SIZE * sizeof(ovm_stack_frame_t);
+    bh_align(values_size, page_size);
+    bh_align(frames_size, page_size);
+
+    state->stacks_mapping_size = values_size + page_size + frames_size + page_size;
+    state->stacks_mapping = mmap(NULL, state->stacks_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(state->stacks_mapping != MAP_FAILED);
+
+    u8 *base = state->stacks_mapping;
+    mprotect(base + values_size, page_size, PROT_NONE);
+    mprotect(base + values_size + page_size + frames_size, page_size, PROT_NONE);
+
+    state->numbered_values = (ovm_value_t *) base;
+    state->numbered_value_count = 0;
+    state->stack_frames = (ovm_stack_frame_t *) (base + values_size + page_size);
+    state->stack_frame_count = 0;
+    state->__frame_values = state->numbered_values;
+}
+
 // This takes in a program because it needs to know how many registers to allocate.
 // Should there be another mechanism for this? or is this the most concise way?
 ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program) {
@@ -270,17 +474,24 @@ ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program) {
     state->pc = 0;
     state->value_number_offset = 0;
 
-    state->numbered_values = NULL;
-    state->stack_frames = NULL;
+    ovm__state_map_stacks(state);
+
     state->registers = NULL;
-    bh_arr_new(store->heap_allocator, state->numbered_values, 128);
-    bh_arr_new(store->heap_allocator, state->stack_frames, 32);
     bh_arr_new(store->heap_allocator, state->registers, program->register_count);
     bh_arr_insert_end(state->registers, program->register_count);
 
     state->param_buf = bh_alloc_array(store->arena_allocator, ovm_value_t, OVM_MAX_PARAM_COUNT);
     state->param_count = 0;
 
+    state->trapped = false;
+    state->trap_message = NULL;
+    state->native_depth = 0;
+
+    state->counters = NULL;
+    if (engine->counters && engine->counters->program == program) {
+        state->counters = engine->counters;
+    }
+
     state->external_funcs = NULL;
     bh_arr_new(store->heap_allocator, state->external_funcs, 8);
 
@@ -295,8 +506,7 @@ ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program) {
 void ovm_state_delete(ovm_state_t *state) {
     ovm_store_t *store = state->store;
 
-    bh_arr_free(state->numbered_values);
-    bh_arr_free(state->stack_frames);
+    munmap(state->stacks_mapping, state->stacks_mapping_size);
     bh_arr_free(state->registers);
     bh_arr_free(state->external_funcs);
 }
@@ -324,42 +534,82 @@ void ovm_state_register_set(ovm_state_t *state, i32 idx, ovm_value_t val) {
 //
 // Function calling
 
-static void ovm__func_setup_stack_frame(ovm_state_t *state, ovm_func_t *func, i32 result_number) {
-    //
-    // Push a stack frame
-    ovm_stack_frame_t frame;
-    frame.func = func;
-    frame.value_number_count = func->value_number_count;
-    frame.value_number_base  = bh_arr_length(state->numbered_values);
-    frame.return_address = state->pc;
-    frame.return_number_value = result_number;
-    bh_arr_push(state->stack_frames, frame);
-
-    //
-    // Move the base pointer to the value numbers.
-    state->value_number_offset = frame.value_number_base;
+//
+// If the frame does not fit on the stacks, nothing is pushed, the state
+// traps and false is returned.
+static bool ovm__func_setup_stack_frame(ovm_state_t *state, ovm_func_t *func, i32 result_number) {
+    i32 frame_count = state->stack_frame_count;
+    i32 value_base  = state->numbered_value_count;
+
+    if (frame_count >= OVM_FRAME_STACK_SIZE
+        || func->value_number_count > OVM_VALUE_STACK_SIZE - value_base) {
+        state->trapped = true;
+        state->trap_message = "Stack overflow";
+        return false;
+    }
 
     //
-    // Setup value numbers
-    bh_arr_insert_end(state->numbered_values, func->value_number_count);
-
-    state->__frame_values = &state->numbered_values[state->value_number_offset];
+    // The frame is written before the count is bumped, so a sample taken by
+    // the profiler at any point in here sees a consistent stack.
+    ovm_stack_frame_t *frame = &state->stack_frames[frame_count];
+    frame->func = func;
+    frame->value_number_count = func->value_number_count;
+    frame->value_number_base  = value_base;
+    frame->return_address = state->pc;
+    frame->return_number_value = result_number;
+
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    state->stack_frame_count = frame_count + 1;
+
+    state->value_number_offset = value_base;
+    state->numbered_value_count = value_base + func->value_number_count;
+    state->__frame_values = &state->numbered_values[value_base];
 
     //
     // Modify debug state so step over works
     if (state->debug) {
         state->debug->extra_frames_since_last_pause++;
     }
+
+    if (state->counters) {
+        __atomic_fetch_add(&state->counters->call_counts[func->id], 1, __ATOMIC_RELAXED);
+    }
+
+    return true;
+}
+
+//
+// Reuses the frame on top of the stack for a tail call. The return address
+// and result of the frame are kept, so the callee returns to where the
+// function it replaces would have.
+static bool ovm__func_replace_stack_frame(ovm_state_t *state, ovm_func_t *func) {
+    ovm_stack_frame_t *frame = &state->stack_frames[state->stack_frame_count - 1];
+
+    if (func->value_number_count > OVM_VALUE_STACK_SIZE - frame->value_number_base) {
+        state->trapped = true;
+        state->trap_message = "Stack overflow";
+        return false;
+    }
+
+    frame->func = func;
+    frame->value_number_count = func->value_number_count;
+    state->numbered_value_count = frame->value_number_base + func->value_number_count;
+
+    if (state->counters) {
+        __atomic_fetch_add(&state->counters->call_counts[func->id], 1, __ATOMIC_RELAXED);
+    }
+
+    return true;
 }
 
 static ovm_stack_frame_t ovm__func_teardown_stack_frame(ovm_state_t *state) {
-    ovm_stack_frame_t frame = bh_arr_pop(state->stack_frames);
-    bh_arr_fastdeleten(state->numbered_values, frame.value_number_count);
+    ovm_stack_frame_t frame = state->stack_frames[--state->stack_frame_count];
+    state->numbered_value_count = frame.value_number_base;
 
-    if (bh_arr_length(state->stack_frames) == 0) {
+    if (state->stack_frame_count == 0) {
         state->value_number_offset = 0;
     } else {
-        state->value_number_offset = bh_arr_last(state->stack_frames).value_number_base;
+        state->value_number_offset = state->stack_frames[state->stack_frame_count - 1].value_number_base;
     }
 
     state->__frame_values = &state->numbered_values[state->value_number_offset];
@@ -374,42 +624,154 @@ static ovm_stack_frame_t ovm__func_teardown_stack_frame(ovm_state_t *state) {
     return frame;
 }
 
+//
+// JIT entry
+//
+// Calls and taken backward branches count towards a function getting hot. Once it
+// is compiled, calls enter its native code from the start, and a backward branch in
+// an interpreted frame of the function moves that frame into native code.
+#ifdef OVM_JIT
+
+static inline bool ovm__jit_can_enter(ovm_state_t *state) {
+    return !state->debug && state->native_depth < OVM_JIT_MAX_NATIVE_DEPTH;
+}
+
+static inline bool ovm__jit_is_hot(ovm_state_t *state, ovm_func_t *func) {
+    if (__atomic_load_n(&func->jit_failed, __ATOMIC_RELAXED)) return false;
+    if (state->debug || state->engine->jit_threshold <= 0) return false;
+
+    u32 count = __atomic_load_n(&func->call_count, __ATOMIC_RELAXED)
+              + __atomic_load_n(&func->back_edge_count, __ATOMIC_RELAXED);
+    if (count < (u32) state->engine->jit_threshold) return false;
+
+    return ovm_jit_compile(state->program, func);
+}
+
+static inline bool ovm__jit_should_call(ovm_state_t *state, ovm_func_t *func) {
+    if (__atomic_load_n(&func->native, __ATOMIC_ACQUIRE)) return ovm__jit_can_enter(state);
+
+    __atomic_fetch_add(&func->call_count, 1, __ATOMIC_RELAXED);
+    return ovm__jit_is_hot(state, func) && ovm__jit_can_enter(state);
+}
+
+static inline bool ovm__jit_should_resume(ovm_state_t *state) {
+    ovm_func_t *func = state->stack_frames[state->stack_frame_count - 1].func;
+    if (__atomic_load_n(&func->native, __ATOMIC_ACQUIRE)) return ovm__jit_can_enter(state);
+
+    __atomic_fetch_add(&func->back_edge_count, 1, __ATOMIC_RELAXED);
+    return ovm__jit_is_hot(state, func) && ovm__jit_can_enter(state);
+}
+
+//
+// Runs the native code of the function in the top frame, either from
+// its start or from the instruction at state->pc, until it returns.
+// Native code does not keep state->pc up to date, so it is put back
+// for the interpreter afterwards.
+static ovm_value_t ovm__jit_enter(ovm_state_t *state, bool resume) {
+    ovm_func_t *func = state->stack_frames[state->stack_frame_count - 1].func;
+    i32 pc = state->pc;
+
+    void *resume_at = NULL;
+    if (resume) {
+        resume_at = (u8 *) func->native + func->native_offsets[pc - func->start_instr];
+    }
+
+    state->native_depth += 1;
+    ovm_value_t result;
+    result.u64 = func->native(state, state->__frame_values, state->engine->memory, resume_at);
+    state->native_depth -= 1;
+    state->pc = pc;
+
+    return result;
+}
+
+#else
+
+static inline bool ovm__jit_should_call(ovm_state_t *state, ovm_func_t *func) { return false; }
+static inline bool ovm__jit_should_resume(ovm_state_t *state) { return false; }
+static inline ovm_value_t ovm__jit_enter(ovm_state_t *state, bool resume) { return (ovm_value_t) {0}; }
+
+#endif
+
 ovm_value_t ovm_func_call(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program, i32 func_idx, i32 param_count, ovm_value_t *params) {
     ovm_func_t *func = &program->funcs[func_idx];
     ovm_assert(func->value_number_count >= func->param_count);
 
+    i32 call_depth   = state->call_depth;
+    i32 native_depth = state->native_depth;
+
     state->call_depth += 1;
+    state->trapped = false;
+    state->trap_message = NULL;
+
+    ovm_state_t *previous_state = ovm__current_state;
+    sigjmp_buf  *previous_trap_point = ovm__trap_point;
+
+    //
+    // An out of bounds access jumps back here from the fault handler. The
+    // frames are left on the stack, like they are for every other trap.
+    sigjmp_buf trap_point;
+    if (sigsetjmp(trap_point, 0)) {
+        state->call_depth   = call_depth;
+        state->native_depth = native_depth;
+        state->trapped = true;
+        state->trap_message = "Out of bounds memory access";
+
+        ovm__trap_point = previous_trap_point;
+        ovm__current_state = previous_state;
+        return (ovm_value_t) {0};
+    }
+
+    ovm__current_state = state;
+    ovm__trap_point = &trap_point;
+
+    ovm_value_t result = {0};
 
     switch (func->kind) {
         case OVM_FUNC_INTERNAL: {
-            ovm__func_setup_stack_frame(state, func, 0);
+            if (!ovm__func_setup_stack_frame(state, func, 0)) {
+                state->call_depth -= 1;
+                break;
+            }
 
             fori (i, 0, param_count) {
                 state->numbered_values[i + state->value_number_offset] = params[i];
             }
 
-            state->pc = func->start_instr;
-            ovm_value_t result = ovm_run_code(engine, state, program);
+            if (ovm__jit_should_call(state, func)) {
+                result = ovm__jit_enter(state, false);
+                if (!state->trapped) ovm__func_teardown_stack_frame(state);
+
+            } else {
+                state->pc = func->start_instr;
+                result = ovm_run_code(engine, state, program);
+            }
 
             state->call_depth -= 1;
-            return result;
+            break;
         }
 
         case OVM_FUNC_EXTERNAL: {
-            ovm__func_setup_stack_frame(state, func, 0);
+            if (!ovm__func_setup_stack_frame(state, func, 0)) {
+                state->call_depth -= 1;
+                break;
+            }
 
-            ovm_value_t result = {0};
             ovm_external_func_t external_func = state->external_funcs[func->external_func_idx];
             external_func.native_func(external_func.userdata, params, &result);
 
             ovm__func_teardown_stack_frame(state);
 
             state->call_depth -= 1;
-            return result;
+            break;
         }
 
-        default: return (ovm_value_t) {};
+        default: break;
     }
+
+    ovm__trap_point = previous_trap_point;
+    ovm__current_state = previous_state;
+    return result;
 }
 
 static inline double __ovm_abs(double f) {
@@ -454,23 +816,44 @@ static inline double __ovm_copysign(a, b) double a, b; {
     return -a;
 }
 
+static void __ovm_debug_wait(ovm_state_t *state) {
+    assert(write(state->debug->state_change_write_fd, "1", 1));
+    sem_wait(&state->debug->wait_semaphore);
+}
+
 static void __ovm_trigger_exception(ovm_state_t *state) {
     if (state->debug) {
         state->debug->state = debug_state_pausing;
         state->debug->pause_reason = debug_pause_exception;
 
-        assert(write(state->debug->state_change_write_fd, "1", 1));
-        sem_wait(&state->debug->wait_semaphore);
+        __ovm_debug_wait(state);
     }
 }
 
-static void __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
-    if (!state->debug) return;
+//
+// A thread only needs the hooked dispatch table while it is stepping, which
+// includes being asked to pause.
+static inline bool ovm__debug_is_stepping(debug_thread_state_t *thread) {
+    return thread->run_count >= 0 || thread->pause_at_next_line;
+}
+
+static inline bool ovm__debug_should_interrupt(ovm_state_t *state) {
+    return hit_signaled_exception || ovm__debug_is_stepping(state->debug);
+}
+
+static inline bool ovm__debug_is_line_start(debug_state_t *debug, u32 instr) {
+    return (debug->line_starts[instr >> 6] >> (instr & 63)) & 1;
+}
+
+//
+// Returns true if the thread waited for the debugger.
+static bool __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
+    if (!state->debug) return false;
 
     if (hit_signaled_exception) {
         __ovm_trigger_exception(state);
         hit_signaled_exception = 0;
-        return;
+        return true;
     }
 
     if (state->debug->run_count == 0) {
@@ -486,79 +869,212 @@ static void __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
         goto should_wait;
     }
 
-    if (state->debug->pause_at_next_line) {
-        if (state->debug->pause_within == -1 || state->debug->pause_within == bh_arr_last(state->stack_frames).func->id) {
-
-            debug_loc_info_t l1, l2;
-            debug_info_lookup_location(engine->debug->info, state->pc - 1, &l1);
-            debug_info_lookup_location(engine->debug->info, state->pc,     &l2);
-
-            if (l1.file_id != l2.file_id || l1.line != l2.line) {
-                state->debug->pause_at_next_line = false;
-                state->debug->pause_reason = debug_pause_step;
-                state->debug->state = debug_state_pausing;
-                goto should_wait;
-            }
-        }
-    }
-
-    ovm_assert(engine->debug);
-    bh_arr_each(debug_breakpoint_t, bp, engine->debug->breakpoints) {
-        if (bp->instr == (u32) state->pc) {
-            state->debug->state = debug_state_hit_breakpoint;
-            state->debug->last_breakpoint_hit = bp->id;
+    if (state->debug->pause_at_next_line && ovm__debug_is_line_start(engine->debug, state->pc)) {
+        if (state->debug->pause_within == -1 || state->debug->pause_within == state->stack_frames[state->stack_frame_count - 1].func->id) {
+            state->debug->pause_at_next_line = false;
+            state->debug->pause_reason = debug_pause_step;
+            state->debug->state = debug_state_pausing;
             goto should_wait;
         }
     }
 
-    goto shouldnt_wait;
+    if (state->debug->run_count > 0) state->debug->run_count--;
+    return false;
 
     should_wait:
-    assert(write(state->debug->state_change_write_fd, "1", 1));
-    sem_wait(&state->debug->wait_semaphore);
+    __ovm_debug_wait(state);
     state->debug->state = debug_state_running;
 
-    shouldnt_wait:
     if (state->debug->run_count > 0) state->debug->run_count--;
+    return true;
 }
 
+//
+// These are shared by every dispatch table, so they are defined after them.
+static ovm_value_t ovm__debug_enter(ovm_instr_t *instr, ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_instr_t *code);
+static ovm_value_t ovm__debug_breakpoint(ovm_instr_t *instr, ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_instr_t *code);
+
 #define OVMI_FUNC_NAME(n) ovmi_exec_##n
 #define OVMI_DISPATCH_NAME ovmi_dispatch
 #define OVMI_DEBUG_HOOK ((void)0)
+#define OVMI_SAFEPOINT_HOOK ((void)0)
+#define OVMI_COUNT_HOOK ((void)0)
 #define OVMI_EXCEPTION_HOOK ((void)0)
 #define OVMI_DIVIDE_CHECK_HOOK(_) ((void)0)
 #include "./vm_instrs.h"
 
+//
+// Used by threads that have a debugger attached, but are not stepping.
+#define OVMI_FUNC_NAME(n) ovmi_exec_attached_##n
+#define OVMI_DISPATCH_NAME ovmi_attached_dispatch
+#define OVMI_DEBUG_HOOK ((void)0)
+#define OVMI_SAFEPOINT_HOOK if (ovm__debug_should_interrupt(state)) return ovm__debug_enter(instr, state, values, memory, code)
+#define OVMI_COUNT_HOOK ((void)0)
+#define OVMI_EXCEPTION_HOOK __ovm_trigger_exception(state)
+#define OVMI_DIVIDE_CHECK_HOOK(ctype) if (VAL(instr->b).ctype == 0) __ovm_trigger_exception(state)
+#include "./vm_instrs.h"
+
 #define OVMI_FUNC_NAME(n) ovmi_exec_debug_##n
 #define OVMI_DISPATCH_NAME ovmi_debug_dispatch
-#define OVMI_DEBUG_HOOK __ovm_debug_hook(state->engine, state)
+#define OVMI_DEBUG_HOOK return ovm__debug_enter(instr, state, values, memory, code)
+#define OVMI_SAFEPOINT_HOOK ((void)0)
+#define OVMI_COUNT_HOOK ((void)0)
 #define OVMI_EXCEPTION_HOOK __ovm_trigger_exception(state)
 #define OVMI_DIVIDE_CHECK_HOOK(ctype) if (VAL(instr->b).ctype == 0) __ovm_trigger_exception(state)
 #include "./vm_instrs.h"
 
+//
+// Several threads can run the same program, so the counters are bumped
+// atomically. Relaxed ordering is enough, since they are only read once
+// everything has stopped.
+#define OVMI_FUNC_NAME(n) ovmi_exec_count_##n
+#define OVMI_DISPATCH_NAME ovmi_count_dispatch
+#define OVMI_DEBUG_HOOK ((void)0)
+#define OVMI_SAFEPOINT_HOOK ((void)0)
+#define OVMI_COUNT_HOOK __atomic_fetch_add(&state->counters->instr_counts[state->pc - 1], 1, __ATOMIC_RELAXED)
+#define OVMI_EXCEPTION_HOOK ((void)0)
+#define OVMI_DIVIDE_CHECK_HOOK(_) ((void)0)
+#include "./vm_instrs.h"
+
+//
+// Runs the debug hook before the instruction at state->pc, and then carries
+// on with whichever dispatch table the thread needs now.
+static ovm_value_t ovm__debug_enter(ovm_instr_t *instr, ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_instr_t *code) {
+    bool waited = __ovm_debug_hook(state->engine, state);
+
+    instr = &code[state->pc++];
+
+    //
+    // The thread already stopped here, so it should not stop again
+    // for a breakpoint on this instruction.
+    if (waited && (instr->full_instr & OVM_INSTR_MASK) == OVM_BREAKPOINT_INSTR) {
+        instr = &state->engine->debug->original_code[state->pc - 1];
+    }
+
+    ovmi_instr_exec_t *exec_table = ovm__debug_is_stepping(state->debug) ? ovmi_debug_dispatch : ovmi_attached_dispatch;
+    return exec_table[instr->full_instr & OVM_INSTR_MASK](instr, state, values, memory, code);
+}
+
+static ovm_value_t ovm__debug_breakpoint(ovm_instr_t *instr, ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_instr_t *code) {
+    debug_state_t *debug = state->engine->debug;
+    ovm_assert(debug && state->debug);
+
+    //
+    // The breakpoint may have been cleared since this instruction was read,
+    // in which case the original instruction simply runs.
+    i32 instr_idx = state->pc - 1;
+    bh_arr_each(debug_breakpoint_t, bp, debug->breakpoints) {
+        if (bp->instr != (u32) instr_idx) continue;
+
+        state->debug->state = debug_state_hit_breakpoint;
+        state->debug->last_breakpoint_hit = bp->id;
+
+        // While paused, the program counter points at the breakpoint itself.
+        state->pc = instr_idx;
+        __ovm_debug_wait(state);
+        state->pc = instr_idx + 1;
+
+        state->debug->state = debug_state_running;
+        if (state->debug->run_count > 0) state->debug->run_count--;
+        break;
+    }
+
+    instr = &debug->original_code[instr_idx];
+
+    ovmi_instr_exec_t *exec_table = ovm__debug_is_stepping(state->debug) ? ovmi_debug_dispatch : ovmi_attached_dispatch;
+    return exec_table[instr->full_instr & OVM_INSTR_MASK](instr, state, values, memory, code);
+}
+
 ovm_value_t ovm_run_code(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program) {
     ovm_assert(engine);
     ovm_assert(state);
     ovm_assert(program);
 
-    ovmi_instr_exec_t *exec_table = ovmi_dispatch;
-    if (state->debug) {
-        exec_table = ovmi_debug_dispatch;
-    }
-
     ovm_instr_t *code = program->code;
     u8 *memory = engine->memory;
     ovm_value_t *values = state->__frame_values;
-    ovm_instr_t *instr = &code[state->pc];
+
+    if (state->debug) {
+        return ovm__debug_enter(NULL, state, values, memory, code);
+    }
+
+    ovmi_instr_exec_t *exec_table = ovmi_dispatch;
+    if (state->counters) {
+        exec_table = ovmi_count_dispatch;
+    }
+
+    //
+    // Like NEXT_OP, step state->pc past the first instruction, since
+    // handlers expect it to point at the one after them.
+    ovm_instr_t *instr = &code[state->pc++];
+
+    if (exec_table == ovmi_count_dispatch) {
+        __atomic_fetch_add(&state->counters->instr_counts[state->pc - 1], 1, __ATOMIC_RELAXED);
+    }
 
     return exec_table[instr->full_instr & 0x7ff](instr, state, values, memory, code);
 }
 
+#ifdef OVM_JIT
+
+//
+// Performs a call for native code. Internal callees run natively if they
+// can, and are otherwise interpreted until they return.
+void ovm__jit_call(ovm_state_t *state, i32 func_idx, i32 result_number) {
+    ovm_func_t *func = &state->program->funcs[func_idx];
+    i32 extra_params = state->param_count - func->param_count;
+    ovm_assert(extra_params >= 0);
+
+    if (!ovm__func_setup_stack_frame(state, func, result_number)) return;
+
+    state->param_count -= func->param_count;
+
+    ovm_value_t result;
+    if (func->kind == OVM_FUNC_INTERNAL) {
+        memcpy(state->__frame_values, &state->param_buf[extra_params], func->param_count * sizeof(ovm_value_t));
+
+        if (!ovm__jit_should_call(state, func)) {
+            //
+            // A negative return address makes the return instruction
+            // store the result and come back here.
+            state->stack_frames[state->stack_frame_count - 1].return_address = -1;
+            state->pc = func->start_instr;
+            ovm_run_code(state->engine, state, state->program);
+            return;
+        }
+
+        result = ovm__jit_enter(state, false);
+        if (state->trapped) return;
+
+    } else {
+        ovm_external_func_t external_func = state->external_funcs[func->external_func_idx];
+        external_func.native_func(external_func.userdata, &state->param_buf[extra_params], &state->__tmp_value);
+        result = state->__tmp_value;
+    }
+
+    ovm__func_teardown_stack_frame(state);
+
+    if (result_number >= 0) {
+        state->__frame_values[result_number] = result;
+    }
+}
+
+//
+// Native code runs instructions without a template by calling their handler
+// with `code` pointing at this instruction, which returns straight back.
+ovm_instr_t ovm__jit_exit_instr = { .full_instr = OVM_TYPED_INSTR(OVMI_NATIVE_EXIT, OVM_TYPE_NONE) };
+
+void *ovm__jit_instr_handler(u32 full_instr) {
+    return (void *) ovmi_dispatch[full_instr & OVM_INSTR_MASK];
+}
+
+#endif
+
 
 void ovm_print_stack_trace(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program) {
     int i = 0;
-    bh_arr_rev_each(ovm_stack_frame_t, frame, state->stack_frames) {
-        ovm_func_t *func = frame->func;
+    for (i32 f = state->stack_frame_count - 1; f >= 0; f--) {
+        ovm_func_t *func = state->stack_frames[f].func;
         printf("[%03d] %s\n", i++, func->name);
     }
 }
@@ -15,6 +15,10 @@
 // When this hook is present, the compiler MUST emit many `push` and `pop` instructions to preserve
 // the needed registers because it cannot know what will happen in the function. This more than
 // doubles the instruction count of all operations and slows down the runner by at least 20 percent.
+// So the hooked table is only used while a thread is stepping. Otherwise a thread with a debugger
+// attached runs on the attached table, and only stops at the breakpoints written into the code,
+// at an exception, or at a safepoint (a call or a backward branch) once the debugger asks it to.
+// Threads without a debugger run on the normal table, where all of the hooks compile to nothing.
 //
 
 
@@ -27,6 +31,7 @@
 #define NEXT_OP \
     OVMI_DEBUG_HOOK; \
     instr = &code[state->pc++]; \
+    OVMI_COUNT_HOOK; \
     return OVMI_DISPATCH_NAME[instr->full_instr & OVM_INSTR_MASK](instr, state, values, memory, code);
 
 #define VAL(loc) values[loc]
@@ -44,6 +49,14 @@ OVMI_INSTR_EXEC(nop) {
     NEXT_OP;
 }
 
+OVMI_INSTR_EXEC(native_exit) {
+    return ((ovm_value_t) {0});
+}
+
+OVMI_INSTR_EXEC(breakpoint) {
+    return ovm__debug_breakpoint(instr, state, values, memory, code);
+}
+
 
 //
 // Binary Operations
@@ -77,7 +90,7 @@ OVMI_INSTR_EXEC(nop) {
 #define OVM_OP(t, op, ctype) \
     ovm_assert(VAL(instr->a).type == t && VAL(instr->b).type == t); \
     VAL(instr->r).ctype = VAL(instr->a).ctype op VAL(instr->b).ctype; \
-    VAL(instr->r).type = t;
+    OVM_SET_TYPE(VAL(instr->r), t);
 
 OVM_OP_EXEC(add, +)
 OVM_OP_EXEC(sub, -)
@@ -96,7 +109,7 @@ OVM_OP_INTEGER_EXEC(sar, >>)
     ovm_assert(VAL(instr->a).type == t && VAL(instr->b).type == t); \
     OVMI_DIVIDE_CHECK_HOOK(ctype); \
     VAL(instr->r).ctype = VAL(instr->a).ctype op VAL(instr->b).ctype; \
-    VAL(instr->r).type = t;
+    OVM_SET_TYPE(VAL(instr->r), t);
 
 OVM_OP_EXEC(div_s, /)
 OVM_OP_UNSIGNED_EXEC(div, /)
@@ -108,7 +121,7 @@ OVM_OP_INTEGER_EXEC(rem_s, %)
 #define OVM_OP(t, func, ctype) \
     ovm_assert(VAL(instr->a).type == t && VAL(instr->b).type == t); \
     VAL(instr->r).ctype = func( VAL(instr->a).ctype, VAL(instr->b).ctype ); \
-    VAL(instr->r).type = t;
+    OVM_SET_TYPE(VAL(instr->r), t);
 
 #ifndef ROTATION_FUNCTIONS
 #define ROTATION_FUNCTIONS
@@ -153,7 +166,7 @@ OVM_OP_FLOAT_EXEC(copysign, __ovm_copysign)
 
 #define OVM_OP(t, op, ctype) \
     ovm_assert(VAL(instr->a).type == t); \
-    VAL(instr->r).type = t; \
+    OVM_SET_TYPE(VAL(instr->r), t); \
     VAL(instr->r).ctype = (ctype) op (VAL(instr->a).ctype);
 
 OVMI_INSTR_EXEC(clz_i32) { OVM_OP(OVM_TYPE_I32, __ovm_clz, u32);   NEXT_OP; }
@@ -176,7 +189,7 @@ OVM_OP_FLOAT_EXEC(sqrt,    sqrt)
 
 #define OVM_OP(t, op, ctype) \
     ovm_assert(VAL(instr->a).type == t && VAL(instr->b).type == t); \
-    VAL(instr->r).type = OVM_TYPE_I32; \
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32); \
     VAL(instr->r).i32 = ((VAL(instr->a).ctype op VAL(instr->b).ctype)) ? 1 : 0;
 
 OVM_OP_EXEC(eq, ==)
@@ -199,7 +212,7 @@ OVM_OP_EXEC(ge_s, >=)
 //
 
 #define OVM_IMM(t, dtype, stype) \
-    VAL(instr->r).type = t; \
+    OVM_SET_TYPE(VAL(instr->r), t); \
     VAL(instr->r).u64 = 0; \
     VAL(instr->r).dtype = instr->stype;
 
@@ -222,7 +235,7 @@ OVMI_INSTR_EXEC(mov) {
         u32 dest = VAL(instr->a).u32 + (u32) instr->b; \
         if (dest == 0) OVMI_EXCEPTION_HOOK; \
         VAL(instr->r).stype = * (stype *) &memory[dest]; \
-        VAL(instr->r).type = type_; \
+        OVM_SET_TYPE(VAL(instr->r), type_); \
         NEXT_OP; \
     }
 
@@ -267,9 +280,9 @@ OVMI_INSTR_EXEC(copy) {
 }
 
 OVMI_INSTR_EXEC(fill) {
-    i32 dest  = VAL(instr->r).i32;
+    u32 dest  = VAL(instr->r).u32;
     u8  byte  = VAL(instr->a).u8;
-    i32 count = VAL(instr->b).i32;
+    u32 count = VAL(instr->b).u32;
 
     if (!dest) OVMI_EXCEPTION_HOOK;
 
@@ -294,13 +307,12 @@ OVMI_INSTR_EXEC(idx_arr) {
     ovm_static_integer_array_t data_elem = state->program->static_data[instr->a];
     if (VAL(instr->b).u32 >= (u32) data_elem.len) {
         OVMI_EXCEPTION_HOOK;
-        ovm_value_t bad_val;
-        bad_val.type = OVM_TYPE_ERR;
-        return bad_val;
+        state->trapped = true;
+        return ((ovm_value_t) {0});
     }
 
     VAL(instr->r).i32 = state->program->static_integers[data_elem.start_idx + VAL(instr->b).u32];
-    VAL(instr->r).type = OVM_TYPE_I32;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
 
     NEXT_OP;
 }
@@ -318,27 +330,38 @@ OVMI_INSTR_EXEC(param) {
     NEXT_OP;
 }
 
-OVMI_INSTR_EXEC(return) {
-    ovm_value_t val = VAL(instr->a);
-    ovm_stack_frame_t frame = ovm__func_teardown_stack_frame(state);
-    state->pc = frame.return_address;
-    values = state->__frame_values;
-
-    if (bh_arr_length(state->stack_frames) == 0) {
-        return val;
-    }
-
-    ovm_func_t *new_func = bh_arr_last(state->stack_frames).func;
-    if (new_func->kind == OVM_FUNC_EXTERNAL) {
-        return val;
+//
+// Pops the current frame and hands val to the caller. This leaves the interpreter
+// if the caller is the host, or native code, which is marked by a negative
+// return address.
+#define OVMI_RETURN_FROM_FRAME(val) \
+    ovm_stack_frame_t frame = ovm__func_teardown_stack_frame(state); \
+    state->pc = frame.return_address; \
+    values = state->__frame_values; \
+ \
+    if (state->stack_frame_count == 0) { \
+        return val; \
+    } \
+ \
+    ovm_func_t *new_func = state->stack_frames[state->stack_frame_count - 1].func; \
+    if (new_func->kind == OVM_FUNC_EXTERNAL) { \
+        return val; \
+    } \
+ \
+    if (frame.return_number_value >= 0) { \
+        VAL(frame.return_number_value) = val; \
+    } \
+ \
+    if (frame.return_address < 0) { \
+        return val; \
     }
 
-    if (frame.return_number_value >= 0) {
-        VAL(frame.return_number_value) = val;
-    }
+OVMI_INSTR_EXEC(return) {
+    ovm_value_t val = VAL(instr->a);
+    OVMI_RETURN_FROM_FRAME(val);
 
 #ifdef OVM_VERBOSE
-    printf("Returning from %s to %s: ", frame.func->name, bh_arr_last(state->stack_frames).func->name);
+    printf("Returning from %s to %s: ", frame.func->name, state->stack_frames[state->stack_frame_count - 1].func->name);
     ovm_print_val(val);
     printf("\n\n");
 #endif
@@ -352,23 +375,37 @@ OVMI_INSTR_EXEC(return) {
     ovm_func_t *func = &state->program->funcs[fidx]; \
     i32 extra_params = state->param_count - func->param_count; \
     ovm_assert(extra_params >= 0); \
-    ovm__func_setup_stack_frame(state, func, instr->r); \
+    if (!ovm__func_setup_stack_frame(state, func, instr->r)) { \
+        OVMI_EXCEPTION_HOOK; \
+        return ((ovm_value_t) {0}); \
+    } \
     state->param_count -= func->param_count; \
     if (func->kind == OVM_FUNC_INTERNAL) { \
         values = state->__frame_values; \
         memcpy(&VAL(0), &state->param_buf[extra_params], func->param_count * sizeof(ovm_value_t)); \
-        state->pc = func->start_instr; \
+        if (ovm__jit_should_call(state, func)) { \
+            ovm_value_t result = ovm__jit_enter(state, false); \
+            if (state->trapped) return result; \
+\
+            ovm__func_teardown_stack_frame(state); \
+            values = state->__frame_values; \
+            if (instr->r >= 0) { \
+                VAL(instr->r) = result; \
+            } \
+        } else { \
+            state->pc = func->start_instr; \
+        } \
     } else { \
         ovm_external_func_t external_func = state->external_funcs[func->external_func_idx]; \
         external_func.native_func(external_func.userdata, &state->param_buf[extra_params], &state->__tmp_value); \
-        memory = state->engine->memory; \
 \
         ovm__func_teardown_stack_frame(state); \
 \
         if (instr->r >= 0) { \
             VAL(instr->r) = state->__tmp_value; \
         } \
-    }
+    } \
+    OVMI_SAFEPOINT_HOOK;
 
 
 OVMI_INSTR_EXEC(call) {
@@ -383,18 +420,115 @@ OVMI_INSTR_EXEC(calli) {
 
 #undef OVM_CALL_CODE
 
+//
+// A tail call replaces the frame of the current function with the callee's,
+// so a chain of tail calls runs without growing either stack. Calls into
+// native code return their result straight away.
+#define OVM_TAIL_CALL_CODE(func_idx) \
+    i32 fidx = func_idx; \
+    ovm_func_t *func = &state->program->funcs[fidx]; \
+    i32 extra_params = state->param_count - func->param_count; \
+    ovm_assert(extra_params >= 0); \
+    if (!ovm__func_replace_stack_frame(state, func)) { \
+        OVMI_EXCEPTION_HOOK; \
+        return ((ovm_value_t) {0}); \
+    } \
+    state->param_count -= func->param_count; \
+    if (func->kind == OVM_FUNC_INTERNAL) { \
+        values = state->__frame_values; \
+        memcpy(&VAL(0), &state->param_buf[extra_params], func->param_count * sizeof(ovm_value_t)); \
+        if (ovm__jit_should_call(state, func)) { \
+            ovm_value_t result = ovm__jit_enter(state, false); \
+            if (state->trapped) return result; \
+\
+            OVMI_RETURN_FROM_FRAME(result); \
+        } else { \
+            state->pc = func->start_instr; \
+        } \
+    } else { \
+        ovm_external_func_t external_func = state->external_funcs[func->external_func_idx]; \
+        external_func.native_func(external_func.userdata, &state->param_buf[extra_params], &state->__tmp_value); \
+\
+        ovm_value_t result = state->__tmp_value; \
+        OVMI_RETURN_FROM_FRAME(result); \
+    } \
+    OVMI_SAFEPOINT_HOOK;
+
+OVMI_INSTR_EXEC(return_call) {
+    OVM_TAIL_CALL_CODE(instr->a);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(return_calli) {
+    OVM_TAIL_CALL_CODE(VAL(instr->a).i32);
+    NEXT_OP;
+}
+
+#undef OVM_TAIL_CALL_CODE
+
 
 
 //
 // Branching Instructions
 //
 
-OVMI_INSTR_EXEC(br)     { state->pc += instr->a; NEXT_OP; }
-OVMI_INSTR_EXEC(bri)    { state->pc += VAL(instr->a).i32; NEXT_OP; }
-OVMI_INSTR_EXEC(br_nz)  { if (VAL(instr->b).i32 != 0) state->pc += instr->a; NEXT_OP; }
-OVMI_INSTR_EXEC(bri_nz) { if (VAL(instr->b).i32 != 0) state->pc += VAL(instr->a).i32; NEXT_OP; }
-OVMI_INSTR_EXEC(br_z)   { if (VAL(instr->b).i32 == 0) state->pc += instr->a; NEXT_OP; }
-OVMI_INSTR_EXEC(bri_z)  { if (VAL(instr->b).i32 == 0) state->pc += VAL(instr->a).i32; NEXT_OP; }
+//
+// A taken backward branch counts towards the function getting hot, and once
+// it has native code, the rest of the call runs natively.
+#define OVMI_BRANCH(offset) { \
+    i32 delta = (offset); \
+    state->pc += delta; \
+    if (delta < 0 && ovm__jit_should_resume(state)) { \
+        ovm_value_t val = ovm__jit_enter(state, true); \
+        if (state->trapped) return val; \
+\
+        OVMI_RETURN_FROM_FRAME(val); \
+    } \
+    if (delta < 0) OVMI_SAFEPOINT_HOOK; \
+}
+
+OVMI_INSTR_EXEC(br)     { OVMI_BRANCH(instr->a); NEXT_OP; }
+OVMI_INSTR_EXEC(bri)    { OVMI_BRANCH(VAL(instr->a).i32); NEXT_OP; }
+OVMI_INSTR_EXEC(br_nz)  { if (VAL(instr->b).i32 != 0) OVMI_BRANCH(instr->a); NEXT_OP; }
+OVMI_INSTR_EXEC(bri_nz) { if (VAL(instr->b).i32 != 0) OVMI_BRANCH(VAL(instr->a).i32); NEXT_OP; }
+OVMI_INSTR_EXEC(br_z)   { if (VAL(instr->b).i32 == 0) OVMI_BRANCH(instr->a); NEXT_OP; }
+OVMI_INSTR_EXEC(bri_z)  { if (VAL(instr->b).i32 == 0) OVMI_BRANCH(VAL(instr->a).i32); NEXT_OP; }
+
+//
+// Compare and branch, formed from a comparison followed by br_z or br_nz.
+// The left operand lives in %r, because %a holds the branch offset.
+//
+
+#define OVM_OP(t, op, ctype) \
+    ovm_assert(VAL(instr->r).type == t && VAL(instr->b).type == t); \
+    if (VAL(instr->r).ctype op VAL(instr->b).ctype) OVMI_BRANCH(instr->a);
+
+OVM_OP_EXEC(br_eq, ==)
+OVM_OP_EXEC(br_ne, !=)
+OVM_OP_UNSIGNED_EXEC(br_lt, <)
+OVM_OP_UNSIGNED_EXEC(br_le, <=)
+OVM_OP_UNSIGNED_EXEC(br_gt, >)
+OVM_OP_UNSIGNED_EXEC(br_ge, >=)
+OVM_OP_EXEC(br_lt_s, <)
+OVM_OP_EXEC(br_le_s, <=)
+OVM_OP_EXEC(br_gt_s, >)
+OVM_OP_EXEC(br_ge_s, >=)
+
+#undef OVM_OP
+
+OVMI_INSTR_EXEC(addi_i32) {
+    ovm_assert(VAL(instr->a).type == OVM_TYPE_I32);
+    VAL(instr->r).u32 = VAL(instr->a).u32 + (u32) instr->b;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(addi_i64) {
+    ovm_assert(VAL(instr->a).type == OVM_TYPE_I64);
+    VAL(instr->r).u64 = VAL(instr->a).u64 + (u64) (i64) instr->b;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I64);
+    NEXT_OP;
+}
 
 
 //
@@ -404,7 +538,7 @@ OVMI_INSTR_EXEC(bri_z)  { if (VAL(instr->b).i32 == 0) state->pc += VAL(instr->a)
 #define OVM_CVT(n1, n2, stype, dtype, otype, ctype) \
     OVMI_INSTR_EXEC(cvt_##n1##_##n2) { \
         state->__tmp_value.dtype = (ctype) VAL(instr->a).stype; \
-        state->__tmp_value.type = otype; \
+        OVM_SET_TYPE(state->__tmp_value, otype); \
         VAL(instr->r) = state->__tmp_value; \
         NEXT_OP; \
     }
@@ -465,7 +599,7 @@ OVM_CVT(f64_s, f32, f64, f32, OVM_TYPE_F32, f32);
     OVMI_INSTR_EXEC(transmute_##n1##_##n2) { \
         ovm_value_t tmp_val; \
         tmp_val.dtype = *(ctype *) &VAL(instr->a).stype; \
-        tmp_val.type = otype; \
+        OVM_SET_TYPE(tmp_val, otype); \
         VAL(instr->r) = tmp_val; \
         NEXT_OP; \
     }
@@ -479,31 +613,143 @@ OVM_CVT(f64, i64, f64, u64, OVM_TYPE_I64, u64);
 
 
 //
-// Compare exchange
+// Atomics
+//
+// These operate directly on linear memory with the compiler's atomic builtins,
+// so threads never contend on a lock. WebAssembly atomics are sequentially
+// consistent. Narrow operations zero-extend the old value into %r.
+//
+
 //
+// Every atomic access has to be aligned to its size, and has to be inside of
+// linear memory, or it traps. Unlike a plain load or store, the address is
+// always checked, since a misaligned atomic faults on some hosts, and the
+// pages past the end of memory are not mapped.
+#define OVM_ATOMIC_CHECK_ADDRESS(addr, size) \
+    if ((u64) (addr) + (size) > (u64) state->engine->memory_size || ((addr) & ((size) - 1)) != 0) { \
+        OVMI_EXCEPTION_HOOK; \
+        state->trapped = true; \
+        return ((ovm_value_t) {0}); \
+    }
 
-#define CMPXCHG(otype, ctype) \
+#define CMPXCHG(otype, ctype, stype) \
     OVMI_INSTR_EXEC(cmpxchg_##ctype) { \
-        pthread_mutex_lock(&state->engine->atomic_mutex); \
         if (VAL(instr->r).u32 == 0) OVMI_EXCEPTION_HOOK; \
-        ctype *addr = (ctype *) &memory[VAL(instr->r).u32]; \
+        OVM_ATOMIC_CHECK_ADDRESS(VAL(instr->r).u32, sizeof(stype)); \
+        stype *addr = (stype *) &memory[VAL(instr->r).u32]; \
+        stype expected = VAL(instr->a).stype; \
+ \
+        __atomic_compare_exchange_n(addr, &expected, VAL(instr->b).stype, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
  \
         VAL(instr->r).u64 = 0; \
-        VAL(instr->r).type = otype; \
-        VAL(instr->r).ctype = *addr; \
+        OVM_SET_TYPE(VAL(instr->r), otype); \
+        VAL(instr->r).stype = expected; \
+        NEXT_OP; \
+    }
+
+CMPXCHG(OVM_TYPE_I8,  i8,  u8)
+CMPXCHG(OVM_TYPE_I16, i16, u16)
+CMPXCHG(OVM_TYPE_I32, i32, u32)
+CMPXCHG(OVM_TYPE_I64, i64, u64)
+
+#undef CMPXCHG
+
+#define OVM_ATOMIC_RMW(name, func, otype, ctype, stype) \
+    OVMI_INSTR_EXEC(name##_##ctype) { \
+        if (VAL(instr->a).u32 == 0) OVMI_EXCEPTION_HOOK; \
+        OVM_ATOMIC_CHECK_ADDRESS(VAL(instr->a).u32, sizeof(stype)); \
+        stype old = func((stype *) &memory[VAL(instr->a).u32], VAL(instr->b).stype, __ATOMIC_SEQ_CST); \
  \
-        if (*addr == VAL(instr->a).ctype) { \
-            *addr = VAL(instr->b).ctype ; \
-        } \
+        VAL(instr->r).u64 = 0; \
+        OVM_SET_TYPE(VAL(instr->r), otype); \
+        VAL(instr->r).stype = old; \
+        NEXT_OP; \
+    }
+
+#define OVM_ATOMIC_RMW_ALL(name, func) \
+    OVM_ATOMIC_RMW(name, func, OVM_TYPE_I8,  i8,  u8) \
+    OVM_ATOMIC_RMW(name, func, OVM_TYPE_I16, i16, u16) \
+    OVM_ATOMIC_RMW(name, func, OVM_TYPE_I32, i32, u32) \
+    OVM_ATOMIC_RMW(name, func, OVM_TYPE_I64, i64, u64)
+
+OVM_ATOMIC_RMW_ALL(atomic_add,  __atomic_fetch_add)
+OVM_ATOMIC_RMW_ALL(atomic_sub,  __atomic_fetch_sub)
+OVM_ATOMIC_RMW_ALL(atomic_and,  __atomic_fetch_and)
+OVM_ATOMIC_RMW_ALL(atomic_or,   __atomic_fetch_or)
+OVM_ATOMIC_RMW_ALL(atomic_xor,  __atomic_fetch_xor)
+OVM_ATOMIC_RMW_ALL(atomic_xchg, __atomic_exchange_n)
+
+#undef OVM_ATOMIC_RMW_ALL
+#undef OVM_ATOMIC_RMW
+
+#define OVM_ATOMIC_LOAD(otype, ctype, stype) \
+    OVMI_INSTR_EXEC(atomic_load_##ctype) { \
+        u32 addr = VAL(instr->a).u32 + (u32) instr->b; \
+        if (addr == 0) OVMI_EXCEPTION_HOOK; \
+        OVM_ATOMIC_CHECK_ADDRESS(addr, sizeof(stype)); \
+        stype value = __atomic_load_n((stype *) &memory[addr], __ATOMIC_SEQ_CST); \
  \
-        pthread_mutex_unlock(&state->engine->atomic_mutex); \
+        VAL(instr->r).u64 = 0; \
+        OVM_SET_TYPE(VAL(instr->r), otype); \
+        VAL(instr->r).stype = value; \
+        NEXT_OP; \
+    }
+
+#define OVM_ATOMIC_STORE(otype, ctype, stype) \
+    OVMI_INSTR_EXEC(atomic_store_##ctype) { \
+        u32 addr = VAL(instr->r).u32 + (u32) instr->b; \
+        if (addr == 0) OVMI_EXCEPTION_HOOK; \
+        OVM_ATOMIC_CHECK_ADDRESS(addr, sizeof(stype)); \
+        __atomic_store_n((stype *) &memory[addr], VAL(instr->a).stype, __ATOMIC_SEQ_CST); \
         NEXT_OP; \
     }
 
-CMPXCHG(OVM_TYPE_I32, i32)
-CMPXCHG(OVM_TYPE_I64, i64)
+OVM_ATOMIC_LOAD(OVM_TYPE_I8,  i8,  u8)
+OVM_ATOMIC_LOAD(OVM_TYPE_I16, i16, u16)
+OVM_ATOMIC_LOAD(OVM_TYPE_I32, i32, u32)
+OVM_ATOMIC_LOAD(OVM_TYPE_I64, i64, u64)
+OVM_ATOMIC_STORE(OVM_TYPE_I8,  i8,  u8)
+OVM_ATOMIC_STORE(OVM_TYPE_I16, i16, u16)
+OVM_ATOMIC_STORE(OVM_TYPE_I32, i32, u32)
+OVM_ATOMIC_STORE(OVM_TYPE_I64, i64, u64)
 
-#undef CMPXCHG
+#undef OVM_ATOMIC_STORE
+#undef OVM_ATOMIC_LOAD
+
+#define OVM_ATOMIC_WAIT(otype, ctype, wide) \
+    OVMI_INSTR_EXEC(atomic_wait_##ctype) { \
+        if (VAL(instr->r).u32 == 0) OVMI_EXCEPTION_HOOK; \
+        OVM_ATOMIC_CHECK_ADDRESS(VAL(instr->r).u32, sizeof(ctype)); \
+        i32 res = ovm_engine_atomic_wait(state->engine, VAL(instr->r).u32, VAL(instr->a).ctype, VAL(instr->b).i64, wide); \
+ \
+        VAL(instr->r).u64 = 0; \
+        OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32); \
+        VAL(instr->r).i32 = res; \
+        NEXT_OP; \
+    }
+
+OVM_ATOMIC_WAIT(OVM_TYPE_I32, i32, false)
+OVM_ATOMIC_WAIT(OVM_TYPE_I64, i64, true)
+
+#undef OVM_ATOMIC_WAIT
+
+OVMI_INSTR_EXEC(atomic_notify) {
+    if (VAL(instr->a).u32 == 0) OVMI_EXCEPTION_HOOK;
+    OVM_ATOMIC_CHECK_ADDRESS(VAL(instr->a).u32, 4);
+    i32 res = ovm_engine_atomic_notify(state->engine, VAL(instr->a).u32, VAL(instr->b).i32);
+
+    VAL(instr->r).u64 = 0;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
+    VAL(instr->r).i32 = res;
+    NEXT_OP;
+}
+
+#undef OVM_ATOMIC_CHECK_ADDRESS
+
+OVMI_INSTR_EXEC(atomic_fence) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    NEXT_OP;
+}
 
 
 //
@@ -512,27 +758,595 @@ CMPXCHG(OVM_TYPE_I64, i64)
 
 OVMI_INSTR_EXEC(mem_size) {
     VAL(instr->r).u32 = (u32) (state->engine->memory_size / 65536);
-    VAL(instr->r).type = OVM_TYPE_I32;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
     NEXT_OP;
 }
 
 OVMI_INSTR_EXEC(mem_grow) {
     ovm_assert(VAL(instr->a).type == OVM_TYPE_I32);
-    VAL(instr->r).type = OVM_TYPE_I32;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
     VAL(instr->r).u32 = (u32) (state->engine->memory_size / 65536);
 
     if (!ovm_engine_memory_ensure_capacity(state->engine,
-            state->engine->memory_size + VAL(instr->a).u32 * 65536)) {
+            state->engine->memory_size + (i64) VAL(instr->a).u32 * 65536)) {
         VAL(instr->r).i32 = -1;
     }
 
-    memory = state->engine->memory;
     NEXT_OP;
 }
 
 
+//
+// SIMD
+//
+// A v128 value is split across two value numbers, so every instruction
+// below reassembles its operands into an ovm_v128_t, does the work using
+// GCC/Clang vector extensions (which lower to SSE2 / NEON), and splits the
+// result back out. Operations that have no portable vector form use the
+// intrinsics for the target architecture.
+//
+
+#ifndef SIMD_FUNCTIONS
+#define SIMD_FUNCTIONS
+
+typedef i8  ovm_i8x16_t __attribute__((vector_size(16)));
+typedef u8  ovm_u8x16_t __attribute__((vector_size(16)));
+typedef i16 ovm_i16x8_t __attribute__((vector_size(16)));
+typedef u16 ovm_u16x8_t __attribute__((vector_size(16)));
+typedef i32 ovm_i32x4_t __attribute__((vector_size(16)));
+typedef u32 ovm_u32x4_t __attribute__((vector_size(16)));
+typedef i64 ovm_i64x2_t __attribute__((vector_size(16)));
+typedef u64 ovm_u64x2_t __attribute__((vector_size(16)));
+typedef f32 ovm_f32x4_t __attribute__((vector_size(16)));
+typedef f64 ovm_f64x2_t __attribute__((vector_size(16)));
+
+typedef union ovm_v128_t {
+    ovm_i8x16_t i8;
+    ovm_u8x16_t u8;
+    ovm_i16x8_t i16;
+    ovm_u16x8_t u16;
+    ovm_i32x4_t i32;
+    ovm_u32x4_t u32;
+    ovm_i64x2_t i64;
+    ovm_u64x2_t u64;
+    ovm_f32x4_t f32;
+    ovm_f64x2_t f64;
+    u64 halves[2];
+} ovm_v128_t;
+
+static inline ovm_v128_t ovm_v128_get(ovm_value_t *values, i32 loc) {
+    ovm_v128_t v;
+    v.halves[0] = values[loc].u64;
+    v.halves[1] = values[loc + 1].u64;
+    return v;
+}
+
+static inline void ovm_v128_set(ovm_value_t *values, i32 loc, ovm_v128_t v) {
+    values[loc].u64 = v.halves[0];
+    OVM_SET_TYPE(values[loc], OVM_TYPE_V128);
+    values[loc + 1].u64 = v.halves[1];
+    OVM_SET_TYPE(values[loc + 1], OVM_TYPE_V128);
+}
+
+#if defined(__x86_64__)
+    #define SIMD_INTRINSIC(name, field, x86_func, arm_func, arm_type) \
+        static inline ovm_v128_t name(ovm_v128_t a, ovm_v128_t b) { \
+            ovm_v128_t r; \
+            r.i64 = (ovm_i64x2_t) x86_func((__m128i) a.field, (__m128i) b.field); \
+            return r; \
+        }
+#elif defined(__arm64__)
+    #define SIMD_INTRINSIC(name, field, x86_func, arm_func, arm_type) \
+        static inline ovm_v128_t name(ovm_v128_t a, ovm_v128_t b) { \
+            ovm_v128_t r; \
+            r.field = (__typeof__(r.field)) arm_func((arm_type) a.field, (arm_type) b.field); \
+            return r; \
+        }
+#endif
+
+SIMD_INTRINSIC(ovm_v128_add_sat_i8,    u8,  _mm_adds_epu8,  vqaddq_u8,  uint8x16_t)
+SIMD_INTRINSIC(ovm_v128_add_sat_s_i8,  i8,  _mm_adds_epi8,  vqaddq_s8,  int8x16_t)
+SIMD_INTRINSIC(ovm_v128_sub_sat_i8,    u8,  _mm_subs_epu8,  vqsubq_u8,  uint8x16_t)
+SIMD_INTRINSIC(ovm_v128_sub_sat_s_i8,  i8,  _mm_subs_epi8,  vqsubq_s8,  int8x16_t)
+SIMD_INTRINSIC(ovm_v128_add_sat_i16,   u16, _mm_adds_epu16, vqaddq_u16, uint16x8_t)
+SIMD_INTRINSIC(ovm_v128_add_sat_s_i16, i16, _mm_adds_epi16, vqaddq_s16, int16x8_t)
+SIMD_INTRINSIC(ovm_v128_sub_sat_i16,   u16, _mm_subs_epu16, vqsubq_u16, uint16x8_t)
+SIMD_INTRINSIC(ovm_v128_sub_sat_s_i16, i16, _mm_subs_epi16, vqsubq_s16, int16x8_t)
+SIMD_INTRINSIC(ovm_v128_avgr_i8,       u8,  _mm_avg_epu8,   vrhaddq_u8,  uint8x16_t)
+SIMD_INTRINSIC(ovm_v128_avgr_i16,      u16, _mm_avg_epu16,  vrhaddq_u16, uint16x8_t)
+
+#undef SIMD_INTRINSIC
+
+static inline ovm_v128_t ovm_v128_narrow_s_i8(ovm_v128_t a, ovm_v128_t b) {
+    ovm_v128_t r;
+#if defined(__x86_64__)
+    r.i64 = (ovm_i64x2_t) _mm_packs_epi16((__m128i) a.i16, (__m128i) b.i16);
+#elif defined(__arm64__)
+    r.i8 = (ovm_i8x16_t) vcombine_s8(vqmovn_s16((int16x8_t) a.i16), vqmovn_s16((int16x8_t) b.i16));
+#endif
+    return r;
+}
+
+static inline ovm_v128_t ovm_v128_narrow_i8(ovm_v128_t a, ovm_v128_t b) {
+    ovm_v128_t r;
+#if defined(__x86_64__)
+    r.i64 = (ovm_i64x2_t) _mm_packus_epi16((__m128i) a.i16, (__m128i) b.i16);
+#elif defined(__arm64__)
+    r.u8 = (ovm_u8x16_t) vcombine_u8(vqmovun_s16((int16x8_t) a.i16), vqmovun_s16((int16x8_t) b.i16));
+#endif
+    return r;
+}
+
+static inline ovm_v128_t ovm_v128_narrow_s_i16(ovm_v128_t a, ovm_v128_t b) {
+    ovm_v128_t r;
+#if defined(__x86_64__)
+    r.i64 = (ovm_i64x2_t) _mm_packs_epi32((__m128i) a.i32, (__m128i) b.i32);
+#elif defined(__arm64__)
+    r.i16 = (ovm_i16x8_t) vcombine_s16(vqmovn_s32((int32x4_t) a.i32), vqmovn_s32((int32x4_t) b.i32));
+#endif
+    return r;
+}
+
+static inline ovm_v128_t ovm_v128_narrow_i16(ovm_v128_t a, ovm_v128_t b) {
+    ovm_v128_t r;
+#if defined(__arm64__)
+    r.u16 = (ovm_u16x8_t) vcombine_u16(vqmovun_s32((int32x4_t) a.i32), vqmovun_s32((int32x4_t) b.i32));
+#else
+    // packus_epi32 needs SSE4.1, which is not part of the x86-64 baseline.
+    fori (i, 0, 8) {
+        i32 x = i < 4 ? a.i32[i] : b.i32[i - 4];
+        r.u16[i] = (u16) bh_clamp(x, 0, 65535);
+    }
+#endif
+    return r;
+}
+
+static inline ovm_v128_t ovm_v128_swizzle(ovm_v128_t a, ovm_v128_t s) {
+    ovm_v128_t r;
+#if defined(__arm64__)
+    r.u8 = (ovm_u8x16_t) vqtbl1q_u8((uint8x16_t) a.u8, (uint8x16_t) s.u8);
+#else
+    // pshufb needs SSSE3, which is not part of the x86-64 baseline.
+    fori (i, 0, 16) {
+        r.u8[i] = s.u8[i] < 16 ? a.u8[s.u8[i]] : 0;
+    }
+#endif
+    return r;
+}
+
+// Under -Ofast a lane-wise sqrt loop gets vectorized into an rsqrt estimate,
+// which is not exact; the sqrt instructions are.
+static inline ovm_v128_t ovm_v128_sqrt_f32(ovm_v128_t a) {
+    ovm_v128_t r;
+#if defined(__x86_64__)
+    r.f32 = (ovm_f32x4_t) _mm_sqrt_ps((__m128) a.f32);
+#elif defined(__arm64__)
+    r.f32 = (ovm_f32x4_t) vsqrtq_f32((float32x4_t) a.f32);
+#endif
+    return r;
+}
+
+static inline ovm_v128_t ovm_v128_sqrt_f64(ovm_v128_t a) {
+    ovm_v128_t r;
+#if defined(__x86_64__)
+    r.f64 = (ovm_f64x2_t) _mm_sqrt_pd((__m128d) a.f64);
+#elif defined(__arm64__)
+    r.f64 = (ovm_f64x2_t) vsqrtq_f64((float64x2_t) a.f64);
+#endif
+    return r;
+}
+
+static inline i32 ovm_v128_bitmask_i8(ovm_v128_t a) {
+#if defined(__x86_64__)
+    return _mm_movemask_epi8((__m128i) a.i8);
+#else
+    i32 mask = 0;
+    fori (i, 0, 16) mask |= (a.i8[i] < 0) << i;
+    return mask;
+#endif
+}
+
+#endif
+
+#define VGET(loc)    ovm_v128_get(values, (loc))
+#define VSET(loc, v) ovm_v128_set(values, (loc), (v))
+
+#define OVM_VOP(name, shape, field, expr) \
+    OVMI_INSTR_EXEC(name##_##shape) { \
+        ovm_v128_t a = VGET(instr->a), b = VGET(instr->b), r; \
+        r.field = expr; \
+        VSET(instr->r, r); \
+        NEXT_OP; \
+    }
+
+#define OVM_VUNOP(name, shape, field, expr) \
+    OVMI_INSTR_EXEC(name##_##shape) { \
+        ovm_v128_t a = VGET(instr->a), r; \
+        r.field = expr; \
+        VSET(instr->r, r); \
+        NEXT_OP; \
+    }
+
+#define OVM_VOP_CALL(name, shape, func) \
+    OVMI_INSTR_EXEC(name##_##shape) { \
+        VSET(instr->r, func(VGET(instr->a), VGET(instr->b))); \
+        NEXT_OP; \
+    }
+
+#define OVM_VOP_EXEC(name, op) \
+    OVM_VOP(name, i8,  u8,  a.u8  op b.u8) \
+    OVM_VOP(name, i16, u16, a.u16 op b.u16) \
+    OVM_VOP(name, i32, u32, a.u32 op b.u32) \
+    OVM_VOP(name, i64, u64, a.u64 op b.u64) \
+    OVM_VOP(name, f32, f32, a.f32 op b.f32) \
+    OVM_VOP(name, f64, f64, a.f64 op b.f64)
+
+OVM_VOP_EXEC(vadd, +)
+OVM_VOP_EXEC(vsub, -)
+
+OVM_VOP(vmul, i16, u16, a.u16 * b.u16)
+OVM_VOP(vmul, i32, u32, a.u32 * b.u32)
+OVM_VOP(vmul, i64, u64, a.u64 * b.u64)
+OVM_VOP(vmul, f32, f32, a.f32 * b.f32)
+OVM_VOP(vmul, f64, f64, a.f64 * b.f64)
+OVM_VOP(vdiv, f32, f32, a.f32 / b.f32)
+OVM_VOP(vdiv, f64, f64, a.f64 / b.f64)
+
+OVM_VOP(vand,    v128, u64, a.u64 & b.u64)
+OVM_VOP(vandnot, v128, u64, a.u64 & ~b.u64)
+OVM_VOP(vor,     v128, u64, a.u64 | b.u64)
+OVM_VOP(vxor,    v128, u64, a.u64 ^ b.u64)
+OVM_VUNOP(vnot,  v128, u64, ~a.u64)
+
+OVM_VOP_CALL(vadd_sat,   i8,  ovm_v128_add_sat_i8)
+OVM_VOP_CALL(vadd_sat_s, i8,  ovm_v128_add_sat_s_i8)
+OVM_VOP_CALL(vsub_sat,   i8,  ovm_v128_sub_sat_i8)
+OVM_VOP_CALL(vsub_sat_s, i8,  ovm_v128_sub_sat_s_i8)
+OVM_VOP_CALL(vadd_sat,   i16, ovm_v128_add_sat_i16)
+OVM_VOP_CALL(vadd_sat_s, i16, ovm_v128_add_sat_s_i16)
+OVM_VOP_CALL(vsub_sat,   i16, ovm_v128_sub_sat_i16)
+OVM_VOP_CALL(vsub_sat_s, i16, ovm_v128_sub_sat_s_i16)
+OVM_VOP_CALL(vavgr,      i8,  ovm_v128_avgr_i8)
+OVM_VOP_CALL(vavgr,      i16, ovm_v128_avgr_i16)
+OVM_VOP_CALL(vnarrow,    i8,  ovm_v128_narrow_i8)
+OVM_VOP_CALL(vnarrow_s,  i8,  ovm_v128_narrow_s_i8)
+OVM_VOP_CALL(vnarrow,    i16, ovm_v128_narrow_i16)
+OVM_VOP_CALL(vnarrow_s,  i16, ovm_v128_narrow_s_i16)
+OVM_VOP_CALL(vswizzle,   v128, ovm_v128_swizzle)
+
+#undef OVM_VOP_EXEC
+
+
+//
+// Comparisons produce all ones in the lanes that are true.
+#define OVM_VCMP_EXEC(name, op) \
+    OVM_VOP(name, i8,  i8,  (ovm_i8x16_t) (a.u8  op b.u8)) \
+    OVM_VOP(name, i16, i16, (ovm_i16x8_t) (a.u16 op b.u16)) \
+    OVM_VOP(name, i32, i32, (ovm_i32x4_t) (a.u32 op b.u32)) \
+    OVM_VOP(name, i64, i64, (ovm_i64x2_t) (a.u64 op b.u64)) \
+    OVM_VOP(name, f32, i32, (ovm_i32x4_t) (a.f32 op b.f32)) \
+    OVM_VOP(name, f64, i64, (ovm_i64x2_t) (a.f64 op b.f64))
+
+#define OVM_VCMP_SIGNED_EXEC(name, op) \
+    OVM_VOP(name, i8,  i8,  (ovm_i8x16_t) (a.i8  op b.i8)) \
+    OVM_VOP(name, i16, i16, (ovm_i16x8_t) (a.i16 op b.i16)) \
+    OVM_VOP(name, i32, i32, (ovm_i32x4_t) (a.i32 op b.i32)) \
+    OVM_VOP(name, i64, i64, (ovm_i64x2_t) (a.i64 op b.i64))
+
+OVM_VCMP_EXEC(veq, ==)
+OVM_VCMP_EXEC(vne, !=)
+OVM_VCMP_EXEC(vlt, <)
+OVM_VCMP_EXEC(vle, <=)
+OVM_VCMP_EXEC(vgt, >)
+OVM_VCMP_EXEC(vge, >=)
+OVM_VCMP_SIGNED_EXEC(vlt_s, <)
+OVM_VCMP_SIGNED_EXEC(vle_s, <=)
+OVM_VCMP_SIGNED_EXEC(vgt_s, >)
+OVM_VCMP_SIGNED_EXEC(vge_s, >=)
+
+#undef OVM_VCMP_EXEC
+#undef OVM_VCMP_SIGNED_EXEC
+
+
+//
+// Min and max select between the lanes using the mask from a comparison,
+// so there is no branching per lane.
+#define OVM_VSELECT(name, shape, cmp_field, bits_field, bits_type, op) \
+    OVM_VOP(name, shape, bits_field, \
+        ((a.bits_field & (bits_type) (a.cmp_field op b.cmp_field)) | (b.bits_field & ~(bits_type) (a.cmp_field op b.cmp_field))))
+
+OVM_VSELECT(vmin,   i8,  u8,  u8,  ovm_u8x16_t, <)
+OVM_VSELECT(vmin,   i16, u16, u16, ovm_u16x8_t, <)
+OVM_VSELECT(vmin,   i32, u32, u32, ovm_u32x4_t, <)
+OVM_VSELECT(vmin,   f32, f32, u32, ovm_u32x4_t, <)
+OVM_VSELECT(vmin,   f64, f64, u64, ovm_u64x2_t, <)
+OVM_VSELECT(vmin_s, i8,  i8,  u8,  ovm_u8x16_t, <)
+OVM_VSELECT(vmin_s, i16, i16, u16, ovm_u16x8_t, <)
+OVM_VSELECT(vmin_s, i32, i32, u32, ovm_u32x4_t, <)
+OVM_VSELECT(vmax,   i8,  u8,  u8,  ovm_u8x16_t, >)
+OVM_VSELECT(vmax,   i16, u16, u16, ovm_u16x8_t, >)
+OVM_VSELECT(vmax,   i32, u32, u32, ovm_u32x4_t, >)
+OVM_VSELECT(vmax,   f32, f32, u32, ovm_u32x4_t, >)
+OVM_VSELECT(vmax,   f64, f64, u64, ovm_u64x2_t, >)
+OVM_VSELECT(vmax_s, i8,  i8,  u8,  ovm_u8x16_t, >)
+OVM_VSELECT(vmax_s, i16, i16, u16, ovm_u16x8_t, >)
+OVM_VSELECT(vmax_s, i32, i32, u32, ovm_u32x4_t, >)
+
+#undef OVM_VSELECT
+
+
+//
+// Shifts take the shift amount as a scalar, modulo the lane width.
+#define OVM_VSHIFT(name, shape, field, ctype, op) \
+    OVMI_INSTR_EXEC(name##_##shape) { \
+        ovm_v128_t a = VGET(instr->a), r; \
+        r.field = a.field op (ctype) (VAL(instr->b).u32 & (sizeof(ctype) * 8 - 1)); \
+        VSET(instr->r, r); \
+        NEXT_OP; \
+    }
+
+OVM_VSHIFT(vshl, i8,  u8,  u8,  <<)
+OVM_VSHIFT(vshl, i16, u16, u16, <<)
+OVM_VSHIFT(vshl, i32, u32, u32, <<)
+OVM_VSHIFT(vshl, i64, u64, u64, <<)
+OVM_VSHIFT(vshr, i8,  u8,  u8,  >>)
+OVM_VSHIFT(vshr, i16, u16, u16, >>)
+OVM_VSHIFT(vshr, i32, u32, u32, >>)
+OVM_VSHIFT(vshr, i64, u64, u64, >>)
+OVM_VSHIFT(vsar, i8,  i8,  i8,  >>)
+OVM_VSHIFT(vsar, i16, i16, i16, >>)
+OVM_VSHIFT(vsar, i32, i32, i32, >>)
+OVM_VSHIFT(vsar, i64, i64, i64, >>)
+
+#undef OVM_VSHIFT
+
+
+OVM_VUNOP(vneg, i8,  u8,  -a.u8)
+OVM_VUNOP(vneg, i16, u16, -a.u16)
+OVM_VUNOP(vneg, i32, u32, -a.u32)
+OVM_VUNOP(vneg, i64, u64, -a.u64)
+OVM_VUNOP(vneg, f32, f32, -a.f32)
+OVM_VUNOP(vneg, f64, f64, -a.f64)
+
+// |x| == (x ^ (x >> bits-1)) - (x >> bits-1)
+OVM_VUNOP(vabs, i8,  u8,  (a.u8  ^ (ovm_u8x16_t) (a.i8  >> 7))  - (ovm_u8x16_t) (a.i8  >> 7))
+OVM_VUNOP(vabs, i16, u16, (a.u16 ^ (ovm_u16x8_t) (a.i16 >> 15)) - (ovm_u16x8_t) (a.i16 >> 15))
+OVM_VUNOP(vabs, i32, u32, (a.u32 ^ (ovm_u32x4_t) (a.i32 >> 31)) - (ovm_u32x4_t) (a.i32 >> 31))
+OVM_VUNOP(vabs, f32, u32, a.u32 & 0x7fffffffu)
+OVM_VUNOP(vabs, f64, u64, a.u64 & 0x7fffffffffffffffull)
+
+OVM_VUNOP(vsqrt, f32, f32, ovm_v128_sqrt_f32(a).f32)
+OVM_VUNOP(vsqrt, f64, f64, ovm_v128_sqrt_f64(a).f64)
+
+#undef OVM_VUNOP
+#undef OVM_VOP
+#undef OVM_VOP_CALL
+
+
+#define OVM_VLANES(name, shape, lanes, body) \
+    OVMI_INSTR_EXEC(name##_##shape) { \
+        ovm_v128_t a = VGET(instr->a), r; \
+        fori (i, 0, lanes) { body; } \
+        VSET(instr->r, r); \
+        NEXT_OP; \
+    }
+
+OVM_VLANES(vwiden_low,    i16, 8, r.i16[i] = a.u8[i])
+OVM_VLANES(vwiden_low_s,  i16, 8, r.i16[i] = a.i8[i])
+OVM_VLANES(vwiden_high,   i16, 8, r.i16[i] = a.u8[i + 8])
+OVM_VLANES(vwiden_high_s, i16, 8, r.i16[i] = a.i8[i + 8])
+OVM_VLANES(vwiden_low,    i32, 4, r.i32[i] = a.u16[i])
+OVM_VLANES(vwiden_low_s,  i32, 4, r.i32[i] = a.i16[i])
+OVM_VLANES(vwiden_high,   i32, 4, r.i32[i] = a.u16[i + 4])
+OVM_VLANES(vwiden_high_s, i32, 4, r.i32[i] = a.i16[i + 4])
+
+OVM_VLANES(vconvert,   f32, 4, r.f32[i] = (f32) a.u32[i])
+OVM_VLANES(vconvert_s, f32, 4, r.f32[i] = (f32) a.i32[i])
+
+OVM_VLANES(vtrunc_sat, i32, 4,
+    f32 x = a.f32[i];
+    r.u32[i] = !(x > -1.0f) ? 0 : x >= 4294967296.0f ? 0xffffffff : (u32) x)
+
+OVM_VLANES(vtrunc_sat_s, i32, 4,
+    f32 x = a.f32[i];
+    r.i32[i] = x != x ? 0 : x <= -2147483648.0f ? (i32) 0x80000000 : x >= 2147483648.0f ? 0x7fffffff : (i32) x)
+
+#undef OVM_VLANES
+
+
+#define OVM_VSPLAT(shape, field, lanes) \
+    OVMI_INSTR_EXEC(vsplat_##shape) { \
+        ovm_v128_t r; \
+        fori (i, 0, lanes) r.field[i] = VAL(instr->a).field; \
+        VSET(instr->r, r); \
+        NEXT_OP; \
+    }
+
+OVM_VSPLAT(i8,  i8,  16)
+OVM_VSPLAT(i16, i16, 8)
+OVM_VSPLAT(i32, i32, 4)
+OVM_VSPLAT(i64, i64, 2)
+OVM_VSPLAT(f32, f32, 4)
+OVM_VSPLAT(f64, f64, 2)
+
+#undef OVM_VSPLAT
+
+#define OVM_VEXTRACT(name, shape, field, dtype, otype) \
+    OVMI_INSTR_EXEC(name##_##shape) { \
+        ovm_v128_t a = VGET(instr->a); \
+        VAL(instr->r).u64 = 0; \
+        VAL(instr->r).dtype = a.field[instr->b]; \
+        OVM_SET_TYPE(VAL(instr->r), otype); \
+        NEXT_OP; \
+    }
+
+OVM_VEXTRACT(vextract,   i8,  u8,  u32, OVM_TYPE_I32)
+OVM_VEXTRACT(vextract,   i16, u16, u32, OVM_TYPE_I32)
+OVM_VEXTRACT(vextract,   i32, u32, u32, OVM_TYPE_I32)
+OVM_VEXTRACT(vextract,   i64, u64, u64, OVM_TYPE_I64)
+OVM_VEXTRACT(vextract,   f32, f32, f32, OVM_TYPE_F32)
+OVM_VEXTRACT(vextract,   f64, f64, f64, OVM_TYPE_F64)
+OVM_VEXTRACT(vextract_s, i8,  i8,  i32, OVM_TYPE_I32)
+OVM_VEXTRACT(vextract_s, i16, i16, i32, OVM_TYPE_I32)
+
+#undef OVM_VEXTRACT
+
+#define OVM_VREPLACE(shape, field) \
+    OVMI_INSTR_EXEC(vreplace_##shape) { \
+        ovm_v128_t r = VGET(instr->r); \
+        r.field[instr->b] = VAL(instr->a).field; \
+        VSET(instr->r, r); \
+        NEXT_OP; \
+    }
+
+OVM_VREPLACE(i8,  i8)
+OVM_VREPLACE(i16, i16)
+OVM_VREPLACE(i32, i32)
+OVM_VREPLACE(i64, i64)
+OVM_VREPLACE(f32, f32)
+OVM_VREPLACE(f64, f64)
+
+#undef OVM_VREPLACE
+
+#define OVM_VALL_TRUE(shape, field, vtype) \
+    OVMI_INSTR_EXEC(vall_true_##shape) { \
+        ovm_v128_t a = VGET(instr->a), zeros; \
+        zeros.field = (vtype) (a.field == 0); \
+        VAL(instr->r).u64 = 0; \
+        VAL(instr->r).i32 = (zeros.halves[0] | zeros.halves[1]) == 0; \
+        OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32); \
+        NEXT_OP; \
+    }
+
+OVM_VALL_TRUE(i8,  i8,  ovm_i8x16_t)
+OVM_VALL_TRUE(i16, i16, ovm_i16x8_t)
+OVM_VALL_TRUE(i32, i32, ovm_i32x4_t)
+OVM_VALL_TRUE(i64, i64, ovm_i64x2_t)
+
+#undef OVM_VALL_TRUE
+
+OVMI_INSTR_EXEC(vany_true_v128) {
+    ovm_v128_t a = VGET(instr->a);
+    VAL(instr->r).u64 = 0;
+    VAL(instr->r).i32 = (a.halves[0] | a.halves[1]) != 0;
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
+    NEXT_OP;
+}
+
+#define OVM_VBITMASK(shape, field, lanes) \
+    OVMI_INSTR_EXEC(vbitmask_##shape) { \
+        ovm_v128_t a = VGET(instr->a); \
+        i32 mask = 0; \
+        fori (i, 0, lanes) mask |= (a.field[i] < 0) << i; \
+        VAL(instr->r).u64 = 0; \
+        VAL(instr->r).i32 = mask; \
+        OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32); \
+        NEXT_OP; \
+    }
+
+OVM_VBITMASK(i16, i16, 8)
+OVM_VBITMASK(i32, i32, 4)
+OVM_VBITMASK(i64, i64, 2)
+
+#undef OVM_VBITMASK
+
+OVMI_INSTR_EXEC(vbitmask_i8) {
+    VAL(instr->r).u64 = 0;
+    VAL(instr->r).i32 = ovm_v128_bitmask_i8(VGET(instr->a));
+    OVM_SET_TYPE(VAL(instr->r), OVM_TYPE_I32);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(vshuffle_v128) {
+    ovm_v128_t lanes = VGET(instr->r), a = VGET(instr->a), b = VGET(instr->b), r;
+    fori (i, 0, 16) {
+        u8 lane = lanes.u8[i];
+        r.u8[i] = lane < 16 ? a.u8[lane] : b.u8[lane & 15];
+    }
+
+    VSET(instr->r, r);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(vbitselect_v128) {
+    ovm_v128_t mask = VGET(instr->r), a = VGET(instr->a), b = VGET(instr->b), r;
+    r.u64 = (a.u64 & mask.u64) | (b.u64 & ~mask.u64);
+
+    VSET(instr->r, r);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(imm_v128) {
+    ovm_static_integer_array_t data_elem = state->program->static_data[instr->a];
+
+    ovm_v128_t r;
+    memcpy(&r, &state->program->static_integers[data_elem.start_idx], sizeof(r));
+    VSET(instr->r, r);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(mov_v128) {
+    VAL(instr->r)     = VAL(instr->a);
+    VAL(instr->r + 1) = VAL(instr->a + 1);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(load_v128) {
+    ovm_assert(VAL(instr->a).type == OVM_TYPE_I32);
+    u32 dest = VAL(instr->a).u32 + (u32) instr->b;
+    if (dest == 0) OVMI_EXCEPTION_HOOK;
+
+    ovm_v128_t r;
+    memcpy(&r, &memory[dest], sizeof(r));
+    VSET(instr->r, r);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(store_v128) {
+    ovm_assert(VAL(instr->r).type == OVM_TYPE_I32);
+    u32 dest = VAL(instr->r).u32 + (u32) instr->b;
+    if (dest == 0) OVMI_EXCEPTION_HOOK;
+
+    ovm_v128_t a = VGET(instr->a);
+    memcpy(&memory[dest], &a, sizeof(a));
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(return_v128) {
+    ovm_value_t low  = VAL(instr->a);
+    ovm_value_t high = VAL(instr->a + 1);
+    ovm_stack_frame_t frame = ovm__func_teardown_stack_frame(state);
+    state->pc = frame.return_address;
+    values = state->__frame_values;
+
+    if (state->stack_frame_count == 0) {
+        return low;
+    }
+
+    ovm_func_t *new_func = state->stack_frames[state->stack_frame_count - 1].func;
+    if (new_func->kind == OVM_FUNC_EXTERNAL) {
+        return low;
+    }
+
+    if (frame.return_number_value >= 0) {
+        VAL(frame.return_number_value)     = low;
+        VAL(frame.return_number_value + 1) = high;
+    }
+
+    if (frame.return_address < 0) {
+        return low;
+    }
+
+    NEXT_OP;
+}
+
+#undef VGET
+#undef VSET
+
+
 OVMI_INSTR_EXEC(illegal) {
     OVMI_EXCEPTION_HOOK;
+    state->trapped = true;
     return ((ovm_value_t) {0});
 }
 
@@ -543,11 +1357,14 @@ OVMI_INSTR_EXEC(illegal) {
 #define D(n) OVMI_FUNC_NAME(n)
 
 #define IROW_UNTYPED(name) D(name), NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-#define IROW_TYPED(name)   NULL, D(name##_i8), D(name##_i16), D(name##_i32), D(name##_i64), D(name##_f32), D(name##_f64), NULL,
+#define IROW_TYPED(name)   NULL, D(name##_i8), D(name##_i16), D(name##_i32), D(name##_i64), D(name##_f32), D(name##_f64), D(name##_v128),
 #define IROW_PARTIAL(name) NULL, NULL, NULL, D(name##_i32), D(name##_i64), D(name##_f32), D(name##_f64), NULL,
 #define IROW_INT(name)     NULL, NULL, NULL, D(name##_i32), D(name##_i64), NULL, NULL, NULL,
 #define IROW_FLOAT(name)   NULL, NULL, NULL, NULL, NULL, D(name##_f32), D(name##_f64), NULL,
 #define IROW_SAME(name)    D(name),D(name),D(name),D(name),D(name),D(name),D(name),NULL,
+#define IROW_LANES(name)   NULL, D(name##_i8), D(name##_i16), D(name##_i32), D(name##_i64), D(name##_f32), D(name##_f64), NULL,
+#define IROW_INT_LANES(name) NULL, D(name##_i8), D(name##_i16), D(name##_i32), D(name##_i64), NULL, NULL, NULL,
+#define IROW_V128(name)    NULL, NULL, NULL, NULL, NULL, NULL, NULL, D(name##_v128),
 
 static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     IROW_UNTYPED(nop) // 0x00
@@ -564,10 +1381,10 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     IROW_INT(shl)
     IROW_INT(shr)
     IROW_INT(sar)
+    IROW_UNTYPED(native_exit)
     IROW_SAME(illegal)
-    IROW_SAME(illegal)
-    IROW_PARTIAL(imm) // 0x10
-    IROW_UNTYPED(mov)
+    NULL, NULL, NULL, D(imm_i32), D(imm_i64), D(imm_f32), D(imm_f64), D(imm_v128), // 0x10
+    D(mov), NULL, NULL, NULL, NULL, NULL, NULL, D(mov_v128),
     IROW_TYPED(load)
     IROW_TYPED(store)
     IROW_UNTYPED(copy)
@@ -586,7 +1403,7 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     IROW_PARTIAL(gt_s)
     IROW_PARTIAL(ne)
     IROW_UNTYPED(param)
-    IROW_UNTYPED(return)
+    D(return), NULL, NULL, NULL, NULL, NULL, NULL, D(return_v128),
     IROW_UNTYPED(call)
     IROW_UNTYPED(calli)
     IROW_UNTYPED(br)
@@ -626,10 +1443,88 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     NULL, NULL, NULL, NULL, D(transmute_i64_f64), NULL, NULL, NULL,
     NULL, NULL, NULL, NULL, NULL, D(transmute_f32_i32), NULL, NULL,
     NULL, NULL, NULL, NULL, NULL, NULL, D(transmute_f64_i64), NULL,
-    IROW_INT(cmpxchg)
-    IROW_SAME(illegal)
+    IROW_INT_LANES(cmpxchg)
+    D(illegal), D(breakpoint), D(breakpoint), D(breakpoint), D(breakpoint), D(breakpoint), D(breakpoint), NULL,
     IROW_UNTYPED(mem_size)
     IROW_UNTYPED(mem_grow)
+    IROW_LANES(vsplat) // 0x50
+    IROW_LANES(vextract)
+    NULL, D(vextract_s_i8), D(vextract_s_i16), NULL, NULL, NULL, NULL, NULL,
+    IROW_LANES(vreplace)
+    IROW_V128(vshuffle)
+    IROW_V128(vswizzle)
+    IROW_V128(vbitselect)
+    IROW_V128(vnot)
+    IROW_V128(vand)
+    IROW_V128(vandnot)
+    IROW_V128(vor)
+    IROW_V128(vxor)
+    IROW_LANES(veq)
+    IROW_LANES(vne)
+    IROW_LANES(vlt)
+    IROW_INT_LANES(vlt_s)
+    IROW_LANES(vle) // 0x60
+    IROW_INT_LANES(vle_s)
+    IROW_LANES(vgt)
+    IROW_INT_LANES(vgt_s)
+    IROW_LANES(vge)
+    IROW_INT_LANES(vge_s)
+    NULL, D(vabs_i8), D(vabs_i16), D(vabs_i32), NULL, D(vabs_f32), D(vabs_f64), NULL,
+    IROW_LANES(vneg)
+    IROW_V128(vany_true)
+    IROW_INT_LANES(vall_true)
+    IROW_INT_LANES(vbitmask)
+    NULL, D(vnarrow_i8), D(vnarrow_i16), NULL, NULL, NULL, NULL, NULL,
+    NULL, D(vnarrow_s_i8), D(vnarrow_s_i16), NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, D(vwiden_low_i16), D(vwiden_low_i32), NULL, NULL, NULL, NULL,
+    NULL, NULL, D(vwiden_low_s_i16), D(vwiden_low_s_i32), NULL, NULL, NULL, NULL,
+    NULL, NULL, D(vwiden_high_i16), D(vwiden_high_i32), NULL, NULL, NULL, NULL,
+    NULL, NULL, D(vwiden_high_s_i16), D(vwiden_high_s_i32), NULL, NULL, NULL, NULL, // 0x70
+    IROW_INT_LANES(vshl)
+    IROW_INT_LANES(vshr)
+    IROW_INT_LANES(vsar)
+    IROW_LANES(vadd)
+    NULL, D(vadd_sat_i8), D(vadd_sat_i16), NULL, NULL, NULL, NULL, NULL,
+    NULL, D(vadd_sat_s_i8), D(vadd_sat_s_i16), NULL, NULL, NULL, NULL, NULL,
+    IROW_LANES(vsub)
+    NULL, D(vsub_sat_i8), D(vsub_sat_i16), NULL, NULL, NULL, NULL, NULL,
+    NULL, D(vsub_sat_s_i8), D(vsub_sat_s_i16), NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, D(vmul_i16), D(vmul_i32), D(vmul_i64), D(vmul_f32), D(vmul_f64), NULL,
+    IROW_FLOAT(vdiv)
+    NULL, D(vmin_i8), D(vmin_i16), D(vmin_i32), NULL, D(vmin_f32), D(vmin_f64), NULL,
+    NULL, D(vmin_s_i8), D(vmin_s_i16), D(vmin_s_i32), NULL, NULL, NULL, NULL,
+    NULL, D(vmax_i8), D(vmax_i16), D(vmax_i32), NULL, D(vmax_f32), D(vmax_f64), NULL,
+    NULL, D(vmax_s_i8), D(vmax_s_i16), D(vmax_s_i32), NULL, NULL, NULL, NULL,
+    NULL, D(vavgr_i8), D(vavgr_i16), NULL, NULL, NULL, NULL, NULL, // 0x80
+    IROW_FLOAT(vsqrt)
+    NULL, NULL, NULL, D(vtrunc_sat_i32), NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, D(vtrunc_sat_s_i32), NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL, D(vconvert_f32), NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL, D(vconvert_s_f32), NULL, NULL,
+    IROW_INT_LANES(atomic_add)
+    IROW_INT_LANES(atomic_sub)
+    IROW_INT_LANES(atomic_and)
+    IROW_INT_LANES(atomic_or)
+    IROW_INT_LANES(atomic_xor)
+    IROW_INT_LANES(atomic_xchg)
+    IROW_INT(atomic_wait)
+    IROW_UNTYPED(atomic_notify)
+    IROW_UNTYPED(atomic_fence)
+    IROW_INT(addi)
+    IROW_PARTIAL(br_lt) // 0x90
+    IROW_PARTIAL(br_lt_s)
+    IROW_PARTIAL(br_le)
+    IROW_PARTIAL(br_le_s)
+    IROW_PARTIAL(br_eq)
+    IROW_PARTIAL(br_ge)
+    IROW_PARTIAL(br_ge_s)
+    IROW_PARTIAL(br_gt)
+    IROW_PARTIAL(br_gt_s)
+    IROW_PARTIAL(br_ne)
+    D(return_call), NULL, NULL, NULL, NULL, NULL, NULL, D(return_call),
+    D(return_calli), NULL, NULL, NULL, NULL, NULL, NULL, D(return_calli),
+    IROW_INT_LANES(atomic_load)
+    IROW_INT_LANES(atomic_store)
 };
 
 #undef D
@@ -639,7 +1534,12 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
 #undef IROW_INT
 #undef IROW_FLOAT
 #undef IROW_SAME
+#undef IROW_LANES
+#undef IROW_INT_LANES
+#undef IROW_V128
 
+#undef OVMI_BRANCH
+#undef OVMI_RETURN_FROM_FRAME
 #undef OVM_OP_EXEC
 #undef OVM_OP_UNSIGNED_EXEC
 #undef OVM_OP_INTEGER_EXEC
@@ -653,6 +1553,8 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
 #undef OVMI_FUNC_NAME
 #undef OVMI_DISPATCH_NAME
 #undef OVMI_DEBUG_HOOK
+#undef OVMI_SAFEPOINT_HOOK
+#undef OVMI_COUNT_HOOK
 #undef OVMI_EXCEPTION_HOOK
 #undef OVMI_DIVIDE_CHECK_HOOK
 
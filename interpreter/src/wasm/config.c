@@ -5,6 +5,50 @@ wasm_config_t *wasm_config_new() {
     wasm_config_t *config = malloc(sizeof(*config));
     config->debug_enabled = false;
     config->listen_path   = "/tmp/ovm-debug.0000";
+    config->jit_threshold = OVM_JIT_DEFAULT_THRESHOLD;
+    config->profile_path  = NULL;
+
+    // OVM_COUNTS=<file> writes a report of how often each function,
+    // opcode and basic block was executed. This turns off the JIT.
+    config->counts_path = getenv("OVM_COUNTS");
+
+    // OVM_FRAMES=<file> writes the frame size, in value slots, of every
+    // function once the program is built.
+    config->frames_path = getenv("OVM_FRAMES");
+
+    // OVM_DEBUG_SOCKET=<path> is where the debugger listens with --debug.
+    char *listen_path = getenv("OVM_DEBUG_SOCKET");
+    if (listen_path && *listen_path) config->listen_path = listen_path;
+
+    // OVM_JIT_THRESHOLD=0 runs everything in the interpreter.
+    char *jit_threshold = getenv("OVM_JIT_THRESHOLD");
+    if (jit_threshold) config->jit_threshold = atoi(jit_threshold);
+
+    // Built programs are cached under $XDG_CACHE_HOME/onyx/ovm, or
+    // ~/.cache/onyx/ovm. OVM_CACHE_DIR=<dir> puts the cache somewhere else,
+    // which is useful for tests, and OVM_CACHE=0 turns it off.
+    // OVM_CACHE_SIZE=<MiB> sets how large the cache can get.
+    config->cache_dir = NULL;
+    config->cache_max_size = OVM_CACHE_DEFAULT_MAX_SIZE;
+
+    char *cache_enabled = getenv("OVM_CACHE");
+    if (!cache_enabled || strcmp(cache_enabled, "0")) {
+        char *cache_dir = getenv("OVM_CACHE_DIR");
+        char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+        char *home = getenv("HOME");
+
+        if (cache_dir && *cache_dir) {
+            config->cache_dir = bh_aprintf(bh_heap_allocator(), "%s", cache_dir);
+        } else if (xdg_cache_home && *xdg_cache_home) {
+            config->cache_dir = bh_aprintf(bh_heap_allocator(), "%s/onyx/ovm", xdg_cache_home);
+        } else if (home && *home) {
+            config->cache_dir = bh_aprintf(bh_heap_allocator(), "%s/.cache/onyx/ovm", home);
+        }
+    }
+
+    char *cache_size = getenv("OVM_CACHE_SIZE");
+    if (cache_size && *cache_size) config->cache_max_size = (i64) atoi(cache_size) << 20;
+
     return config;
 }
 
@@ -20,3 +64,26 @@ void wasm_config_set_listen_path(wasm_config_t *config, char *listen_path) {
     config->listen_path = listen_path;
 }
 
+void wasm_config_set_jit_threshold(wasm_config_t *config, i32 threshold) {
+    config->jit_threshold = threshold;
+}
+
+void wasm_config_set_cache_dir(wasm_config_t *config, char *cache_dir) {
+    config->cache_dir = cache_dir;
+}
+
+void wasm_config_set_cache_max_size(wasm_config_t *config, i64 max_size) {
+    config->cache_max_size = max_size;
+}
+
+void wasm_config_set_profile_path(wasm_config_t *config, char *profile_path) {
+    config->profile_path = profile_path;
+}
+
+void wasm_config_set_counts_path(wasm_config_t *config, char *counts_path) {
+    config->counts_path = counts_path;
+}
+
+void wasm_config_set_frames_path(wasm_config_t *config, char *frames_path) {
+    config->frames_path = frames_path;
+}
@@ -17,6 +17,10 @@ wasm_engine_t *wasm_engine_new_with_config(wasm_config_t *config) {
     ovm_engine_t *ovm_engine = ovm_engine_new(store);
     engine->engine = ovm_engine;
 
+    if (config) {
+        ovm_engine->jit_threshold = config->jit_threshold;
+    }
+
     if (config && config->debug_enabled) {
         // This should maybe be moved elsewhere?
         debug_state_t *debug  = bh_alloc_item(store->heap_allocator, debug_state_t);
@@ -28,6 +32,22 @@ wasm_engine_t *wasm_engine_new_with_config(wasm_config_t *config) {
         debug_host_start(engine->engine->debug);
     }
 
+    if (config && config->profile_path) {
+        ovm_profiler_t *profiler = ovm_profiler_new(config->profile_path);
+        if (profiler && ovm_profiler_start(profiler)) {
+            ovm_engine->profiler = profiler;
+        } else {
+            fprintf(stderr, "Failed to start the profiler.\n");
+            if (profiler) ovm_profiler_delete(profiler);
+        }
+    }
+
+    if (config && config->counts_path && *config->counts_path) {
+        // Native code does not go through the dispatch table, so nothing would be counted.
+        ovm_engine->jit_threshold = 0;
+        ovm_engine->counters = ovm_counters_new(config->counts_path);
+    }
+
     return engine;
 }
 
@@ -36,6 +56,14 @@ void wasm_engine_delete(wasm_engine_t *engine) {
         debug_host_stop(engine->engine->debug);
     }
 
+    if (engine->engine->profiler) {
+        ovm_profiler_delete(engine->engine->profiler);
+    }
+
+    if (engine->engine->counters) {
+        ovm_counters_delete(engine->engine->counters);
+    }
+
     ovm_store_t *store = engine->store;
     ovm_engine_delete(engine->engine);
     bh_free(store->heap_allocator, engine);
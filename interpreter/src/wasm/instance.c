@@ -4,8 +4,6 @@
 #include "vm.h"
 #include <alloca.h>
 
-static_assert(sizeof(ovm_value_t) == sizeof(wasm_val_t), "Size of ovm_value_t should match size of wasm_val_t");
-
 typedef struct wasm_ovm_binding wasm_ovm_binding;
 struct wasm_ovm_binding {
     int func_idx;
@@ -14,6 +12,7 @@ struct wasm_ovm_binding {
     ovm_program_t *program;
 
     wasm_instance_t *instance;
+    const wasm_functype_t *type;
 };
 
 typedef struct ovm_wasm_binding ovm_wasm_binding;
@@ -22,80 +21,61 @@ struct ovm_wasm_binding {
     int result_count;
     wasm_func_t *func;
     wasm_val_vec_t param_buffer;
+#ifdef OVM_TAGGED_VALUES
+    wasm_raw_val_t *raw_param_buffer;
+#endif
 };
 
 #define WASM_TO_OVM(w, o) { \
     (o).u64 = 0;\
     switch ((w).kind) { \
         case WASM_I32: \
-            (o).type = OVM_TYPE_I32; \
+            OVM_SET_TYPE(o, OVM_TYPE_I32); \
             (o).i32  = (w).of.i32; \
             break; \
  \
         case WASM_I64: \
-            (o).type = OVM_TYPE_I64; \
+            OVM_SET_TYPE(o, OVM_TYPE_I64); \
             (o).i64  = (w).of.i64; \
             break; \
  \
         case WASM_F32: \
-            (o).type = OVM_TYPE_F32; \
+            OVM_SET_TYPE(o, OVM_TYPE_F32); \
             (o).f32  = (w).of.f32; \
             break; \
  \
         case WASM_F64: \
-            (o).type = OVM_TYPE_F64; \
+            OVM_SET_TYPE(o, OVM_TYPE_F64); \
             (o).f64  = (w).of.f64; \
             break; \
  \
         default: assert(("invalid wasm value type for conversion", 0)); \
     } }
 
-#define OVM_TO_WASM(o, w) { \
+//
+// OVM values do not carry their type, so the kind of the
+// wasm value comes from the signature of the function.
+#define OVM_TO_WASM(o, k, w) { \
     (w).of.i64 = 0;\
-    switch ((o).type) { \
-        case OVM_TYPE_NONE: \
-            (w).kind = WASM_I32; \
-            (w).of.i32 = 0; \
-            break; \
- \
-        case OVM_TYPE_I8: \
-            (w).kind = WASM_I32; \
-            (w).of.i32 = (i32) (o).i8; \
-            break; \
- \
-        case OVM_TYPE_I16: \
-            (w).kind = WASM_I32; \
-            (w).of.i32 = (i32) (o).i16; \
-            break; \
- \
-        case OVM_TYPE_I32: \
-            (w).kind = WASM_I32; \
-            (w).of.i32 = (i32) (o).i32; \
+    (w).kind = (k); \
+    switch (k) { \
+        case WASM_I32: \
+            (w).of.i32 = (o).i32; \
             break; \
  \
-        case OVM_TYPE_I64: \
-            (w).kind = WASM_I64; \
+        case WASM_I64: \
             (w).of.i64 = (o).i64; \
             break; \
  \
-        case OVM_TYPE_F32: \
-            (w).kind = WASM_F32; \
+        case WASM_F32: \
             (w).of.f32 = (o).f32; \
             break; \
  \
-        case OVM_TYPE_F64: \
-            (w).kind = WASM_F64; \
+        case WASM_F64: \
             (w).of.f64 = (o).f64; \
             break; \
  \
-        case OVM_TYPE_ERR: \
-            (w).kind = WASM_I32; \
-            (w).of.i32 = 0; \
-            break; \
- \
-        default: \
-            printf("INVALID: %d\n", (o).type); \
-            assert(("invalid ovm value type for conversion", 0)); \
+        default: assert(("invalid ovm value type for conversion", 0)); \
     } }
 
 static wasm_trap_t *wasm_to_ovm_func_call_binding(void *vbinding, const wasm_val_vec_t *args, wasm_val_vec_t *res) {
@@ -109,16 +89,25 @@ static wasm_trap_t *wasm_to_ovm_func_call_binding(void *vbinding, const wasm_val
     ovm_value_t ovm_res = ovm_func_call(binding->engine, binding->state, binding->program, binding->func_idx, args->size, vals);
 
     // Check for error (trap).
-    if (ovm_res.type == OVM_TYPE_ERR) {
+    if (binding->state->trapped) {
+        const char *message = binding->state->trap_message ? binding->state->trap_message : "Hit error";
+
         wasm_byte_vec_t msg;
-        wasm_byte_vec_new(&msg, 9, "Hit error");
+        wasm_byte_vec_new(&msg, strlen(message), message);
         wasm_trap_t *trap = wasm_trap_new(binding->instance->store, (void *) &msg);
         return trap;
     }
 
     if (!res || res->size == 0) return NULL;
 
-    OVM_TO_WASM(ovm_res, res->data[0]);
+    const wasm_valtype_vec_t *result_types = &binding->type->type.func.results;
+    if (result_types->size == 0) {
+        res->data[0].kind = WASM_I32;
+        res->data[0].of.i64 = 0;
+        return NULL;
+    }
+
+    OVM_TO_WASM(ovm_res, result_types->data[0]->kind, res->data[0]);
 
     return NULL;
 }
@@ -126,8 +115,9 @@ static wasm_trap_t *wasm_to_ovm_func_call_binding(void *vbinding, const wasm_val
 static void ovm_to_wasm_func_call_binding(void *env, ovm_value_t* params, ovm_value_t *res) {
     ovm_wasm_binding *binding = (ovm_wasm_binding *) env;
 
+    const wasm_valtype_vec_t *param_types = &binding->func->inner.type->func.params;
     fori (i, 0, binding->param_count) {
-        OVM_TO_WASM(params[i], binding->param_buffer.data[i]);
+        OVM_TO_WASM(params[i], param_types->data[i]->kind, binding->param_buffer.data[i]);
     }
 
     wasm_val_t return_value;
@@ -144,14 +134,40 @@ static void ovm_to_wasm_func_call_binding(void *env, ovm_value_t* params, ovm_va
     }
 }
 
+//
+// Raw callbacks are given the parameters as they are. Tagged values are bigger
+// than the raw values, so they have to be copied first.
+static void ovm_to_raw_func_call_binding(void *env, ovm_value_t* params, ovm_value_t *res) {
+    ovm_wasm_binding *binding = (ovm_wasm_binding *) env;
+
+    wasm_raw_val_vec_t raw_params;
+    raw_params.size = binding->param_count;
+
+#ifdef OVM_TAGGED_VALUES
+    fori (i, 0, binding->param_count) {
+        binding->raw_param_buffer[i].i64 = params[i].i64;
+    }
+    raw_params.data = binding->raw_param_buffer;
+#else
+    raw_params.data = (wasm_raw_val_t *) params;
+#endif
+
+    wasm_val_t return_value;
+    wasm_val_vec_t wasm_results;
+    wasm_results.data = &return_value;
+    wasm_results.size = binding->result_count;
+
+    wasm_trap_t *trap = binding->func->inner.func.raw_func_ptr(&raw_params, &wasm_results);
+    assert(!trap);
+
+    if (binding->result_count > 0) {
+        WASM_TO_OVM(return_value, *res);
+    }
+}
+
 static void wasm_memory_init(void *env, ovm_value_t* params, ovm_value_t *res) {
     wasm_instance_t *instr = (wasm_instance_t *) env;
 
-    assert(params[0].type == OVM_TYPE_I32);
-    assert(params[1].type == OVM_TYPE_I32);
-    assert(params[2].type == OVM_TYPE_I32);
-    assert(params[3].type == OVM_TYPE_I32);
-
     ovm_engine_memory_copy(instr->store->engine->engine, params[0].i32, instr->module->data_entries[params[3].i32].data, params[2].i32);
 }
 
@@ -187,7 +203,14 @@ static void prepare_instance(wasm_instance_t *instance, const wasm_extern_vec_t
                 binding->param_buffer.data = bh_alloc(ovm_store->arena_allocator, sizeof(wasm_val_t) * binding->param_count);
                 binding->param_buffer.size = binding->param_count; 
 
-                ovm_state_register_external_func(ovm_state, importtype->external_func_idx, ovm_to_wasm_func_call_binding, binding);
+                if (func->inner.func.raw_func_ptr) {
+#ifdef OVM_TAGGED_VALUES
+                    binding->raw_param_buffer = bh_alloc(ovm_store->arena_allocator, sizeof(wasm_raw_val_t) * binding->param_count);
+#endif
+                    ovm_state_register_external_func(ovm_state, importtype->external_func_idx, ovm_to_raw_func_call_binding, binding);
+                } else {
+                    ovm_state_register_external_func(ovm_state, importtype->external_func_idx, ovm_to_wasm_func_call_binding, binding);
+                }
                 break;
             }
 
@@ -237,6 +260,7 @@ static void prepare_instance(wasm_instance_t *instance, const wasm_extern_vec_t
         binding->program  = ovm_program;
         binding->state    = ovm_state;
         binding->instance = instance;
+        binding->type     = instance->module->functypes.data[i];
         
         wasm_func_t *func = wasm_func_new_with_env(instance->store, instance->module->functypes.data[i], 
             wasm_to_ovm_func_call_binding, binding, NULL);
@@ -283,6 +307,12 @@ static void prepare_instance(wasm_instance_t *instance, const wasm_extern_vec_t
     }
 
 
+    //
+    // The memory starts at its minimum size, which the data segments need.
+    assert(bh_arr_length(instance->memories) == 1);
+    i64 memory_size = (i64) instance->memories[0]->inner.type->memory.limits.min * MEMORY_PAGE_SIZE;
+    ovm_engine_memory_ensure_capacity(ovm_engine, memory_size);
+
     //
     // Initialize all non-passive data segments
     fori (i, 0, (int) instance->module->data_count) {
@@ -348,10 +378,6 @@ wasm_instance_t *wasm_instance_new(wasm_store_t *store, const wasm_module_t *mod
 
     prepare_instance(instance, imports);
 
-    assert(bh_arr_length(instance->memories) == 1);
-    u32 memory_size = (instance->memories[0]->inner.type->memory.limits.min) * MEMORY_PAGE_SIZE;
-    ovm_engine_memory_ensure_capacity(store->engine->engine, memory_size);
-
     if (trap) *trap = NULL;
 
     return instance;
@@ -20,6 +20,13 @@ byte_t *wasm_memory_data(wasm_memory_t *memory) {
     return memory->inner.memory.engine->memory;
 }
 
+//
+// The engine updates this pointer when the memory moves, so it can be held onto.
+byte_t **wasm_memory_data_ref(wasm_memory_t *memory) {
+    assert(memory && memory->inner.memory.engine);
+    return (byte_t **) &memory->inner.memory.engine->memory;
+}
+
 size_t wasm_memory_data_size(const wasm_memory_t *memory) {
     assert(memory && memory->inner.memory.engine);
     return memory->inner.memory.engine->memory_size;
@@ -4,8 +4,275 @@
 #include "vm_codebuilder.h"
 #include "stb_ds.h"
 
+#include <pthread.h>
+#include <unistd.h>
+
 #include "./module_parsing.h"
 
+//
+// Program cache
+//
+// Building the OVM program is the bulk of the startup cost for a large
+// binary, so the result is stored on disk, keyed by a hash of the binary.
+// The types, imports, exports and data of the module are still parsed
+// from the binary every time; only the code section is replaced by the
+// cached image. The least recently used images are removed once the cache
+// grows past its size limit.
+//
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#define OVM_CACHE_AVAILABLE 1
+
+typedef struct program_cache_header_t {
+    char magic[4];
+    u32  image_version;
+    char build_stamp[32];
+    u32  instr_size;
+    u32  binary_size;
+    u64  binary_hash;
+    i32  func_table_arr_idx;
+} program_cache_header_t;
+
+typedef struct program_cache_t {
+    char *path;
+    u64   binary_hash;
+
+    u8  *mapping;
+    u64  mapping_size;
+} program_cache_t;
+
+static void program_cache_fill_header(program_cache_header_t *header, const wasm_byte_vec_t *binary, u64 hash) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, "OVMC", 4);
+    header->image_version = OVM_PROGRAM_IMAGE_VERSION;
+    strncpy(header->build_stamp, __DATE__ " " __TIME__, sizeof(header->build_stamp) - 1);
+    header->instr_size  = sizeof(ovm_instr_t);
+    header->binary_size = binary->size;
+    header->binary_hash = hash;
+}
+
+static u64 program_cache_hash(const wasm_byte_vec_t *binary) {
+    // FNV-1a
+    u64 hash = 0xcbf29ce484222325ull;
+    fori (i, 0, (i64) binary->size) {
+        hash ^= (u8) binary->data[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+//
+// The binary is only hashed here; the hash is kept for checking and
+// writing the image.
+static bool program_cache_open(program_cache_t *cache, wasm_engine_t *engine, const wasm_byte_vec_t *binary) {
+    memset(cache, 0, sizeof(*cache));
+    if (!engine->config || !engine->config->cache_dir) return false;
+
+    // The debugger wants to see the module being built.
+    if (engine->engine->debug) return false;
+
+    cache->binary_hash = program_cache_hash(binary);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.ovm", (unsigned long long) cache->binary_hash);
+
+    cache->path = bh_aprintf(bh_heap_allocator(), "%s/%s", engine->config->cache_dir, name);
+    return true;
+}
+
+//
+// Maps the cached image for this binary, if there is a valid one.
+// A hit updates the modification time of the image, which is what
+// eviction goes by.
+static bool program_cache_load(program_cache_t *cache, const wasm_byte_vec_t *binary, program_cache_header_t *out_header) {
+    int fd = open(cache->path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (u64) st.st_size <= sizeof(program_cache_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    program_cache_header_t expected;
+    program_cache_fill_header(&expected, binary, cache->binary_hash);
+
+    program_cache_header_t *header = mapping;
+    expected.func_table_arr_idx = header->func_table_arr_idx;
+
+    if (memcmp(header, &expected, sizeof(expected))) {
+        munmap(mapping, st.st_size);
+        close(fd);
+        return false;
+    }
+
+    futimens(fd, NULL);
+    close(fd);
+
+    *out_header = *header;
+    cache->mapping = mapping;
+    cache->mapping_size = st.st_size;
+    return true;
+}
+
+static void program_cache_close(program_cache_t *cache) {
+    if (cache->mapping) munmap(cache->mapping, cache->mapping_size);
+    if (cache->path)    bh_free(bh_heap_allocator(), cache->path);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void program_cache_make_dirs(char *dir) {
+    char path[512];
+    if (strlen(dir) >= sizeof(path)) return;
+    strcpy(path, dir);
+
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+
+    mkdir(path, 0755);
+}
+
+typedef struct program_cache_entry_t {
+    char *path;
+    i64   size;
+    i64   last_used; // In nanoseconds
+} program_cache_entry_t;
+
+static int program_cache_entry_compare(const void *a, const void *b) {
+    const program_cache_entry_t *ea = a, *eb = b;
+    if (ea->last_used != eb->last_used) return ea->last_used < eb->last_used ? -1 : 1;
+    return 0;
+}
+
+//
+// Removes the least recently used images until the cache fits in its size
+// limit. The image that was just written is never removed. Temporary files
+// left behind by runs that died while writing are removed after an hour.
+static void program_cache_evict(char *cache_dir, i64 max_size, char *keep_path) {
+    DIR *dir = opendir(cache_dir);
+    if (!dir) return;
+
+    bh_arr(program_cache_entry_t) entries = NULL;
+    bh_arr_new(bh_heap_allocator(), entries, 64);
+
+    i64 total_size = 0;
+    i64 now = (i64) time(NULL);
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        i32 name_length = strlen(ent->d_name);
+        bool is_image = name_length > 4 && !strcmp(ent->d_name + name_length - 4, ".ovm");
+        bool is_tmp   = name_length > 4 && !strcmp(ent->d_name + name_length - 4, ".tmp");
+        if (!is_image && !is_tmp) continue;
+
+        char *path = bh_aprintf(bh_heap_allocator(), "%s/%s", cache_dir, ent->d_name);
+
+        struct stat st;
+        if (stat(path, &st) < 0) {
+            bh_free(bh_heap_allocator(), path);
+            continue;
+        }
+
+        if (is_tmp) {
+            if (now - (i64) st.st_mtime > 60 * 60) unlink(path);
+            bh_free(bh_heap_allocator(), path);
+            continue;
+        }
+
+        program_cache_entry_t entry;
+        entry.path = path;
+        entry.size = st.st_size;
+#if defined(_BH_DARWIN)
+        entry.last_used = (i64) st.st_mtimespec.tv_sec * 1000000000ll + st.st_mtimespec.tv_nsec;
+#else
+        entry.last_used = (i64) st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+#endif
+        bh_arr_push(entries, entry);
+
+        total_size += entry.size;
+    }
+
+    closedir(dir);
+
+    if (total_size > max_size) {
+        qsort(entries, bh_arr_length(entries), sizeof(program_cache_entry_t), program_cache_entry_compare);
+
+        bh_arr_each(program_cache_entry_t, entry, entries) {
+            if (total_size <= max_size) break;
+            if (!strcmp(entry->path, keep_path)) continue;
+
+            if (unlink(entry->path) == 0) total_size -= entry->size;
+        }
+    }
+
+    bh_arr_each(program_cache_entry_t, entry, entries) bh_free(bh_heap_allocator(), entry->path);
+    bh_arr_free(entries);
+}
+
+//
+// Writes to a temporary file and renames it into place, so concurrent
+// runs never see a partially written image.
+static void program_cache_store(program_cache_t *cache, wasm_engine_t *engine, wasm_module_t *module, build_context *ctx) {
+    program_cache_make_dirs(engine->config->cache_dir);
+
+    program_cache_header_t header;
+    program_cache_fill_header(&header, &ctx->binary, cache->binary_hash);
+    header.func_table_arr_idx = ctx->func_table_arr_idx;
+
+    bh_buffer out;
+    bh_buffer_init(&out, bh_heap_allocator(), 1 << 16);
+    bh_buffer_append(&out, &header, sizeof(header));
+    ovm_program_write_image(module->program, &module->debug_info, &out);
+
+    char *tmp_path = bh_aprintf(bh_heap_allocator(), "%s.%d.tmp", cache->path, (i32) getpid());
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        bool ok = true;
+        u8 *data = out.data;
+        u32 remaining = out.length;
+        while (remaining > 0) {
+            ssize_t written = write(fd, data, remaining);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) { ok = false; break; }
+
+            data += written;
+            remaining -= written;
+        }
+        close(fd);
+
+        if (!ok || rename(tmp_path, cache->path) < 0) {
+            unlink(tmp_path);
+        } else {
+            program_cache_evict(engine->config->cache_dir, engine->config->cache_max_size, cache->path);
+        }
+    }
+
+    bh_free(bh_heap_allocator(), tmp_path);
+    bh_buffer_free(&out);
+}
+
+#endif
+
 static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
     wasm_engine_t *engine = module->store->engine;
     module->program = ovm_program_new(engine->store);
@@ -17,10 +284,26 @@ static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
     ctx.program = module->program;
     ctx.store   = engine->store;
     ctx.next_external_func_idx = 0;
+    ctx.program_from_image = false;
 
     debug_info_builder_init(&ctx.debug_builder, &module->debug_info);
     sh_new_arena(module->custom_sections);
 
+#ifdef OVM_CACHE_AVAILABLE
+    program_cache_t cache;
+    bool use_cache = program_cache_open(&cache, engine, binary);
+
+    program_cache_header_t header;
+    if (use_cache && program_cache_load(&cache, binary, &header)) {
+        // The image is copied out of the mapping, because the program's
+        // arrays are grown and patched after loading.
+        ctx.program_from_image = ovm_program_read_image(module->program, &module->debug_info,
+            cache.mapping + sizeof(header), cache.mapping_size - sizeof(header));
+
+        ctx.func_table_arr_idx = header.func_table_arr_idx;
+    }
+#endif
+
     while (ctx.offset < binary->size) {
         parse_section(&ctx);
     }
@@ -29,6 +312,18 @@ static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
     // But Onyx does not do this, so I don't care at the moment.
     module->program->register_count = module->globaltypes.size;
 
+#ifdef OVM_CACHE_AVAILABLE
+    if (ctx.program_from_image) {
+        ovm_program_read_image_files(&module->debug_info,
+            cache.mapping + sizeof(header), cache.mapping_size - sizeof(header));
+
+    } else if (use_cache) {
+        program_cache_store(&cache, engine, module, &ctx);
+    }
+
+    if (use_cache) program_cache_close(&cache);
+#endif
+
     #if 0
         printf("Program instruction count: %d\n", bh_arr_length(module->program->code));
     #endif
@@ -37,6 +332,32 @@ static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
 }
 
 
+//
+// Writes "<frame size> <name>" for every function that runs in the OVM, where
+// the frame size is the number of value slots the builder gave it.
+static void module_write_frame_sizes(wasm_module_t *module, char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Unable to open '%s' to write frame sizes.\n", path);
+        return;
+    }
+
+    bh_arr_each(ovm_func_t, func, module->program->funcs) {
+        if (func->kind != OVM_FUNC_INTERNAL) continue;
+
+        debug_func_info_t func_info;
+        char *name = func->name;
+        if (debug_info_lookup_func(&module->debug_info, func->id, &func_info) && func_info.name) {
+            name = func_info.name;
+        }
+
+        fprintf(out, "%d %s\n", func->value_number_count, name ? name : "<unnamed>");
+    }
+
+    fclose(out);
+}
+
+
 #define WASM_MODULE_INDEX(k1, k2) \
     wasm_##k1##type_t *wasm_module_index_##k1##type(wasm_module_t *module, int index) { \
         fori (i, 0, (int) module->imports.size) { \
@@ -80,11 +401,36 @@ wasm_module_t *wasm_module_new(wasm_store_t *store, const wasm_byte_vec_t *binar
         store->engine->engine->debug->info = &module->debug_info;
     }
 
+    if (store->engine->engine->profiler) {
+        ovm_profiler_set_debug_info(store->engine->engine->profiler, &module->debug_info);
+    }
+
     bool success = module_build(module, binary); 
+
+    if (success && store->engine->engine->debug) {
+        debug_host_set_program(store->engine->engine->debug, module->program);
+    }
+
+    if (success && store->engine->engine->counters) {
+        ovm_counters_set_program(store->engine->engine->counters, module->program, &module->debug_info);
+    }
+
+    wasm_config_t *config = store->engine->config;
+    if (success && config && config->frames_path && *config->frames_path) {
+        module_write_frame_sizes(module, config->frames_path);
+    }
+
     return module;
 }
 
 void wasm_module_delete(wasm_module_t *module) {
+    // The profile refers to the functions of the program, so finish it first.
+    ovm_profiler_t *profiler = module->store->engine->engine->profiler;
+    if (profiler) ovm_profiler_stop(profiler);
+
+    ovm_counters_t *counters = module->store->engine->engine->counters;
+    if (counters && counters->program == module->program) ovm_counters_write_report(counters);
+
     ovm_program_delete(module->program);
 }
 
@@ -20,6 +20,11 @@ struct build_context {
 
     int func_table_arr_idx;
     int next_external_func_idx;
+
+    // Set when the program was loaded from a cached image. The sections
+    // are still parsed for the module's types, but nothing is added to
+    // the program, and the code section is skipped entirely.
+    bool program_from_image;
     
     debug_info_builder_t debug_builder;
 
@@ -52,13 +57,33 @@ static inline wasm_valkind_t parse_valtype(build_context *ctx) {
         case 0x7e: return WASM_I64;
         case 0x7d: return WASM_F32;
         case 0x7c: return WASM_F64;
-        case 0x7b: assert(("SIMD values are not currently supported", 0));
+        case 0x7b: return WASM_V128;
         case 0x70: return WASM_FUNCREF;
         case 0x6F: return WASM_ANYREF;
         default:   assert(("Invalid valtype.", 0));
     }
 }
 
+//
+// The code builder only needs to know whether a value is a v128 or not,
+// as v128s occupy two value numbers and everything else occupies one.
+static inline ovm_valtype_t valkind_to_ovm_type(wasm_valkind_t kind) {
+    switch (kind) {
+        case WASM_I32:  return OVM_TYPE_I32;
+        case WASM_I64:  return OVM_TYPE_I64;
+        case WASM_F32:  return OVM_TYPE_F32;
+        case WASM_F64:  return OVM_TYPE_F64;
+        case WASM_V128: return OVM_TYPE_V128;
+        default:        return OVM_TYPE_NONE;
+    }
+}
+
+static inline ovm_valtype_t functype_return_type(wasm_functype_t *functype) {
+    if (functype->type.func.results.size == 0) return OVM_TYPE_NONE;
+
+    return valkind_to_ovm_type(functype->type.func.results.data[0]->kind);
+}
+
 static void parse_custom_section(build_context *ctx) {
     unsigned int section_size = uleb128_to_uint(ctx->binary.data, &ctx->offset);
     unsigned int end_of_section = ctx->offset + section_size;
@@ -209,6 +234,7 @@ static void parse_import_section(build_context *ctx) {
             int external_func_idx = ctx->next_external_func_idx++;
             import->external_func_idx = external_func_idx;
 
+            if (ctx->program_from_image) continue;
             ovm_program_register_external_func(ctx->program, external_func_name, import_type->func.params.size, external_func_idx);
         }
     }
@@ -351,7 +377,9 @@ static void parse_elem_section(build_context *ctx) {
         ctx->module->elem_entries[i] = uleb128_to_uint(ctx->binary.data, &ctx->offset);
     }
 
-    ctx->func_table_arr_idx = ovm_program_register_static_ints(ctx->program, entry_count, ctx->module->elem_entries);
+    if (!ctx->program_from_image) {
+        ctx->func_table_arr_idx = ovm_program_register_static_ints(ctx->program, entry_count, ctx->module->elem_entries);
+    }
 
     assert(ctx->module->tabletypes.size == 1);
     ctx->module->tabletypes.data[0]->type.table.static_arr = ctx->func_table_arr_idx;
@@ -426,7 +454,7 @@ static void parse_fc_instruction(build_context *ctx) {
             assert(CONSUME_BYTE(ctx) == 0x00);
 
             ovm_code_builder_add_imm(&ctx->builder, OVM_TYPE_I32, &dataidx);
-            ovm_code_builder_add_call(&ctx->builder, ctx->module->memory_init_idx, 4, false);
+            ovm_code_builder_add_call(&ctx->builder, ctx->module->memory_init_idx, 4, OVM_TYPE_NONE);
             break;
         }
 
@@ -449,6 +477,236 @@ static void parse_fc_instruction(build_context *ctx) {
     }
 }
 
+static void parse_fd_instruction(build_context *ctx) {
+    int instr_num = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+
+    switch (instr_num) {
+        case 0: {
+            int alignment = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            int offset    = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            ovm_code_builder_add_load(&ctx->builder, OVM_TYPE_V128, offset);
+            break;
+        }
+
+        case 11: {
+            int alignment = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            int offset    = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            ovm_code_builder_add_store(&ctx->builder, OVM_TYPE_V128, offset);
+            break;
+        }
+
+        case 12: {
+            ovm_code_builder_add_v128_imm(&ctx->builder, &ctx->binary.data[ctx->offset]);
+            ctx->offset += 16;
+            break;
+        }
+
+        case 13: {
+            ovm_code_builder_add_v128_shuffle(&ctx->builder, &ctx->binary.data[ctx->offset]);
+            ctx->offset += 16;
+            break;
+        }
+
+#define LANE_CASE(num, kind, instr, type) \
+        case num : { \
+            int lane = CONSUME_BYTE(ctx); \
+            ovm_code_builder_add_v128_##kind##_lane(&ctx->builder, OVM_TYPED_INSTR(instr, type), lane); \
+            break; \
+        }
+
+        LANE_CASE(21, extract, OVMI_VEXTRACT_S, OVM_TYPE_I8)
+        LANE_CASE(22, extract, OVMI_VEXTRACT,   OVM_TYPE_I8)
+        LANE_CASE(23, replace, OVMI_VREPLACE,   OVM_TYPE_I8)
+        LANE_CASE(24, extract, OVMI_VEXTRACT_S, OVM_TYPE_I16)
+        LANE_CASE(25, extract, OVMI_VEXTRACT,   OVM_TYPE_I16)
+        LANE_CASE(26, replace, OVMI_VREPLACE,   OVM_TYPE_I16)
+        LANE_CASE(27, extract, OVMI_VEXTRACT,   OVM_TYPE_I32)
+        LANE_CASE(28, replace, OVMI_VREPLACE,   OVM_TYPE_I32)
+        LANE_CASE(29, extract, OVMI_VEXTRACT,   OVM_TYPE_I64)
+        LANE_CASE(30, replace, OVMI_VREPLACE,   OVM_TYPE_I64)
+        LANE_CASE(31, extract, OVMI_VEXTRACT,   OVM_TYPE_F32)
+        LANE_CASE(32, replace, OVMI_VREPLACE,   OVM_TYPE_F32)
+        LANE_CASE(33, extract, OVMI_VEXTRACT,   OVM_TYPE_F64)
+        LANE_CASE(34, replace, OVMI_VREPLACE,   OVM_TYPE_F64)
+
+#undef LANE_CASE
+
+#define VBINOP(instr, type) ovm_code_builder_add_v128_binop(&ctx->builder, OVM_TYPED_INSTR(instr, type))
+#define VUNOP(instr, type)  ovm_code_builder_add_v128_unop (&ctx->builder, OVM_TYPED_INSTR(instr, type))
+#define VTEST(instr, type)  ovm_code_builder_add_unop      (&ctx->builder, OVM_TYPED_INSTR(instr, type))
+
+        case 14: VBINOP(OVMI_VSWIZZLE, OVM_TYPE_V128); break;
+        case 15: VUNOP(OVMI_VSPLAT, OVM_TYPE_I8);  break;
+        case 16: VUNOP(OVMI_VSPLAT, OVM_TYPE_I16); break;
+        case 17: VUNOP(OVMI_VSPLAT, OVM_TYPE_I32); break;
+        case 18: VUNOP(OVMI_VSPLAT, OVM_TYPE_I64); break;
+        case 19: VUNOP(OVMI_VSPLAT, OVM_TYPE_F32); break;
+        case 20: VUNOP(OVMI_VSPLAT, OVM_TYPE_F64); break;
+
+        case 35: VBINOP(OVMI_VEQ,   OVM_TYPE_I8); break;
+        case 36: VBINOP(OVMI_VNE,   OVM_TYPE_I8); break;
+        case 37: VBINOP(OVMI_VLT_S, OVM_TYPE_I8); break;
+        case 38: VBINOP(OVMI_VLT,   OVM_TYPE_I8); break;
+        case 39: VBINOP(OVMI_VGT_S, OVM_TYPE_I8); break;
+        case 40: VBINOP(OVMI_VGT,   OVM_TYPE_I8); break;
+        case 41: VBINOP(OVMI_VLE_S, OVM_TYPE_I8); break;
+        case 42: VBINOP(OVMI_VLE,   OVM_TYPE_I8); break;
+        case 43: VBINOP(OVMI_VGE_S, OVM_TYPE_I8); break;
+        case 44: VBINOP(OVMI_VGE,   OVM_TYPE_I8); break;
+
+        case 45: VBINOP(OVMI_VEQ,   OVM_TYPE_I16); break;
+        case 46: VBINOP(OVMI_VNE,   OVM_TYPE_I16); break;
+        case 47: VBINOP(OVMI_VLT_S, OVM_TYPE_I16); break;
+        case 48: VBINOP(OVMI_VLT,   OVM_TYPE_I16); break;
+        case 49: VBINOP(OVMI_VGT_S, OVM_TYPE_I16); break;
+        case 50: VBINOP(OVMI_VGT,   OVM_TYPE_I16); break;
+        case 51: VBINOP(OVMI_VLE_S, OVM_TYPE_I16); break;
+        case 52: VBINOP(OVMI_VLE,   OVM_TYPE_I16); break;
+        case 53: VBINOP(OVMI_VGE_S, OVM_TYPE_I16); break;
+        case 54: VBINOP(OVMI_VGE,   OVM_TYPE_I16); break;
+
+        case 55: VBINOP(OVMI_VEQ,   OVM_TYPE_I32); break;
+        case 56: VBINOP(OVMI_VNE,   OVM_TYPE_I32); break;
+        case 57: VBINOP(OVMI_VLT_S, OVM_TYPE_I32); break;
+        case 58: VBINOP(OVMI_VLT,   OVM_TYPE_I32); break;
+        case 59: VBINOP(OVMI_VGT_S, OVM_TYPE_I32); break;
+        case 60: VBINOP(OVMI_VGT,   OVM_TYPE_I32); break;
+        case 61: VBINOP(OVMI_VLE_S, OVM_TYPE_I32); break;
+        case 62: VBINOP(OVMI_VLE,   OVM_TYPE_I32); break;
+        case 63: VBINOP(OVMI_VGE_S, OVM_TYPE_I32); break;
+        case 64: VBINOP(OVMI_VGE,   OVM_TYPE_I32); break;
+
+        case 65: VBINOP(OVMI_VEQ, OVM_TYPE_F32); break;
+        case 66: VBINOP(OVMI_VNE, OVM_TYPE_F32); break;
+        case 67: VBINOP(OVMI_VLT, OVM_TYPE_F32); break;
+        case 68: VBINOP(OVMI_VGT, OVM_TYPE_F32); break;
+        case 69: VBINOP(OVMI_VLE, OVM_TYPE_F32); break;
+        case 70: VBINOP(OVMI_VGE, OVM_TYPE_F32); break;
+
+        case 71: VBINOP(OVMI_VEQ, OVM_TYPE_F64); break;
+        case 72: VBINOP(OVMI_VNE, OVM_TYPE_F64); break;
+        case 73: VBINOP(OVMI_VLT, OVM_TYPE_F64); break;
+        case 74: VBINOP(OVMI_VGT, OVM_TYPE_F64); break;
+        case 75: VBINOP(OVMI_VLE, OVM_TYPE_F64); break;
+        case 76: VBINOP(OVMI_VGE, OVM_TYPE_F64); break;
+
+        case 77: VUNOP(OVMI_VNOT,     OVM_TYPE_V128); break;
+        case 78: VBINOP(OVMI_VAND,    OVM_TYPE_V128); break;
+        case 79: VBINOP(OVMI_VANDNOT, OVM_TYPE_V128); break;
+        case 80: VBINOP(OVMI_VOR,     OVM_TYPE_V128); break;
+        case 81: VBINOP(OVMI_VXOR,    OVM_TYPE_V128); break;
+        case 82: ovm_code_builder_add_v128_bitselect(&ctx->builder); break;
+
+        case 96:  VUNOP(OVMI_VABS,       OVM_TYPE_I8); break;
+        case 97:  VUNOP(OVMI_VNEG,       OVM_TYPE_I8); break;
+        case 98:  VTEST(OVMI_VANY_TRUE,  OVM_TYPE_V128); break;
+        case 99:  VTEST(OVMI_VALL_TRUE,  OVM_TYPE_I8); break;
+        case 100: VTEST(OVMI_VBITMASK,   OVM_TYPE_I8); break;
+        case 101: VBINOP(OVMI_VNARROW_S, OVM_TYPE_I8); break;
+        case 102: VBINOP(OVMI_VNARROW,   OVM_TYPE_I8); break;
+        case 107: VBINOP(OVMI_VSHL,      OVM_TYPE_I8); break;
+        case 108: VBINOP(OVMI_VSAR,      OVM_TYPE_I8); break;
+        case 109: VBINOP(OVMI_VSHR,      OVM_TYPE_I8); break;
+        case 110: VBINOP(OVMI_VADD,      OVM_TYPE_I8); break;
+        case 111: VBINOP(OVMI_VADD_SAT_S, OVM_TYPE_I8); break;
+        case 112: VBINOP(OVMI_VADD_SAT,  OVM_TYPE_I8); break;
+        case 113: VBINOP(OVMI_VSUB,      OVM_TYPE_I8); break;
+        case 114: VBINOP(OVMI_VSUB_SAT_S, OVM_TYPE_I8); break;
+        case 115: VBINOP(OVMI_VSUB_SAT,  OVM_TYPE_I8); break;
+        case 118: VBINOP(OVMI_VMIN_S,    OVM_TYPE_I8); break;
+        case 119: VBINOP(OVMI_VMIN,      OVM_TYPE_I8); break;
+        case 120: VBINOP(OVMI_VMAX_S,    OVM_TYPE_I8); break;
+        case 121: VBINOP(OVMI_VMAX,      OVM_TYPE_I8); break;
+        case 123: VBINOP(OVMI_VAVGR,     OVM_TYPE_I8); break;
+
+        case 128: VUNOP(OVMI_VABS,           OVM_TYPE_I16); break;
+        case 129: VUNOP(OVMI_VNEG,           OVM_TYPE_I16); break;
+        case 130: VTEST(OVMI_VANY_TRUE,      OVM_TYPE_V128); break;
+        case 131: VTEST(OVMI_VALL_TRUE,      OVM_TYPE_I16); break;
+        case 132: VTEST(OVMI_VBITMASK,       OVM_TYPE_I16); break;
+        case 133: VBINOP(OVMI_VNARROW_S,     OVM_TYPE_I16); break;
+        case 134: VBINOP(OVMI_VNARROW,       OVM_TYPE_I16); break;
+        case 135: VUNOP(OVMI_VWIDEN_LOW_S,   OVM_TYPE_I16); break;
+        case 136: VUNOP(OVMI_VWIDEN_HIGH_S,  OVM_TYPE_I16); break;
+        case 137: VUNOP(OVMI_VWIDEN_LOW,     OVM_TYPE_I16); break;
+        case 138: VUNOP(OVMI_VWIDEN_HIGH,    OVM_TYPE_I16); break;
+        case 139: VBINOP(OVMI_VSHL,          OVM_TYPE_I16); break;
+        case 140: VBINOP(OVMI_VSAR,          OVM_TYPE_I16); break;
+        case 141: VBINOP(OVMI_VSHR,          OVM_TYPE_I16); break;
+        case 142: VBINOP(OVMI_VADD,          OVM_TYPE_I16); break;
+        case 143: VBINOP(OVMI_VADD_SAT_S,    OVM_TYPE_I16); break;
+        case 144: VBINOP(OVMI_VADD_SAT,      OVM_TYPE_I16); break;
+        case 145: VBINOP(OVMI_VSUB,          OVM_TYPE_I16); break;
+        case 146: VBINOP(OVMI_VSUB_SAT_S,    OVM_TYPE_I16); break;
+        case 147: VBINOP(OVMI_VSUB_SAT,      OVM_TYPE_I16); break;
+        case 149: VBINOP(OVMI_VMUL,          OVM_TYPE_I16); break;
+        case 150: VBINOP(OVMI_VMIN_S,        OVM_TYPE_I16); break;
+        case 151: VBINOP(OVMI_VMIN,          OVM_TYPE_I16); break;
+        case 152: VBINOP(OVMI_VMAX_S,        OVM_TYPE_I16); break;
+        case 153: VBINOP(OVMI_VMAX,          OVM_TYPE_I16); break;
+        case 155: VBINOP(OVMI_VAVGR,         OVM_TYPE_I16); break;
+
+        case 160: VUNOP(OVMI_VABS,           OVM_TYPE_I32); break;
+        case 161: VUNOP(OVMI_VNEG,           OVM_TYPE_I32); break;
+        case 162: VTEST(OVMI_VANY_TRUE,      OVM_TYPE_V128); break;
+        case 163: VTEST(OVMI_VALL_TRUE,      OVM_TYPE_I32); break;
+        case 164: VTEST(OVMI_VBITMASK,       OVM_TYPE_I32); break;
+        case 167: VUNOP(OVMI_VWIDEN_LOW_S,   OVM_TYPE_I32); break;
+        case 168: VUNOP(OVMI_VWIDEN_HIGH_S,  OVM_TYPE_I32); break;
+        case 169: VUNOP(OVMI_VWIDEN_LOW,     OVM_TYPE_I32); break;
+        case 170: VUNOP(OVMI_VWIDEN_HIGH,    OVM_TYPE_I32); break;
+        case 171: VBINOP(OVMI_VSHL,          OVM_TYPE_I32); break;
+        case 172: VBINOP(OVMI_VSAR,          OVM_TYPE_I32); break;
+        case 173: VBINOP(OVMI_VSHR,          OVM_TYPE_I32); break;
+        case 174: VBINOP(OVMI_VADD,          OVM_TYPE_I32); break;
+        case 177: VBINOP(OVMI_VSUB,          OVM_TYPE_I32); break;
+        case 181: VBINOP(OVMI_VMUL,          OVM_TYPE_I32); break;
+        case 182: VBINOP(OVMI_VMIN_S,        OVM_TYPE_I32); break;
+        case 183: VBINOP(OVMI_VMIN,          OVM_TYPE_I32); break;
+        case 184: VBINOP(OVMI_VMAX_S,        OVM_TYPE_I32); break;
+        case 185: VBINOP(OVMI_VMAX,          OVM_TYPE_I32); break;
+
+        case 193: VUNOP(OVMI_VNEG,  OVM_TYPE_I64); break;
+        case 203: VBINOP(OVMI_VSHL, OVM_TYPE_I64); break;
+        case 204: VBINOP(OVMI_VSAR, OVM_TYPE_I64); break;
+        case 205: VBINOP(OVMI_VSHR, OVM_TYPE_I64); break;
+        case 206: VBINOP(OVMI_VADD, OVM_TYPE_I64); break;
+        case 209: VBINOP(OVMI_VSUB, OVM_TYPE_I64); break;
+        case 213: VBINOP(OVMI_VMUL, OVM_TYPE_I64); break;
+
+        case 224: VUNOP(OVMI_VABS,  OVM_TYPE_F32); break;
+        case 225: VUNOP(OVMI_VNEG,  OVM_TYPE_F32); break;
+        case 227: VUNOP(OVMI_VSQRT, OVM_TYPE_F32); break;
+        case 228: VBINOP(OVMI_VADD, OVM_TYPE_F32); break;
+        case 229: VBINOP(OVMI_VSUB, OVM_TYPE_F32); break;
+        case 230: VBINOP(OVMI_VMUL, OVM_TYPE_F32); break;
+        case 231: VBINOP(OVMI_VDIV, OVM_TYPE_F32); break;
+        case 232: VBINOP(OVMI_VMIN, OVM_TYPE_F32); break;
+        case 233: VBINOP(OVMI_VMAX, OVM_TYPE_F32); break;
+
+        case 236: VUNOP(OVMI_VABS,  OVM_TYPE_F64); break;
+        case 237: VUNOP(OVMI_VNEG,  OVM_TYPE_F64); break;
+        case 239: VUNOP(OVMI_VSQRT, OVM_TYPE_F64); break;
+        case 240: VBINOP(OVMI_VADD, OVM_TYPE_F64); break;
+        case 241: VBINOP(OVMI_VSUB, OVM_TYPE_F64); break;
+        case 242: VBINOP(OVMI_VMUL, OVM_TYPE_F64); break;
+        case 243: VBINOP(OVMI_VDIV, OVM_TYPE_F64); break;
+        case 244: VBINOP(OVMI_VMIN, OVM_TYPE_F64); break;
+        case 245: VBINOP(OVMI_VMAX, OVM_TYPE_F64); break;
+
+        case 248: VUNOP(OVMI_VTRUNC_SAT_S, OVM_TYPE_I32); break;
+        case 249: VUNOP(OVMI_VTRUNC_SAT,   OVM_TYPE_I32); break;
+        case 250: VUNOP(OVMI_VCONVERT_S,   OVM_TYPE_F32); break;
+        case 251: VUNOP(OVMI_VCONVERT,     OVM_TYPE_F32); break;
+
+#undef VBINOP
+#undef VUNOP
+#undef VTEST
+
+        default: assert(("UNHANDLED SIMD INSTRUCTION", 0));
+    }
+}
+
 static void parse_fe_instruction(build_context *ctx) {
     int instr_num = uleb128_to_uint(ctx->binary.data, &ctx->offset);
 
@@ -508,6 +766,54 @@ static void parse_fe_instruction(build_context *ctx) {
 
 #undef CMPXCHG_CASE
 
+#define RMW_CASE(num, instr, type) \
+        case num : { \
+            int alignment = uleb128_to_uint(ctx->binary.data, &ctx->offset); \
+            int offset    = uleb128_to_uint(ctx->binary.data, &ctx->offset); \
+            ovm_code_builder_add_atomic_rmw(&ctx->builder, instr, type, offset); \
+            break; \
+        }
+
+#define RMW_CASES(base, instr) \
+        RMW_CASE(base + 0, instr, OVM_TYPE_I32) \
+        RMW_CASE(base + 1, instr, OVM_TYPE_I64) \
+        RMW_CASE(base + 2, instr, OVM_TYPE_I8) \
+        RMW_CASE(base + 3, instr, OVM_TYPE_I16) \
+        RMW_CASE(base + 4, instr, OVM_TYPE_I8) \
+        RMW_CASE(base + 5, instr, OVM_TYPE_I16) \
+        RMW_CASE(base + 6, instr, OVM_TYPE_I32)
+
+        RMW_CASE(0x00, OVMI_ATOMIC_NOTIFY, OVM_TYPE_NONE)
+
+        RMW_CASES(0x1E, OVMI_ATOMIC_ADD)
+        RMW_CASES(0x25, OVMI_ATOMIC_SUB)
+        RMW_CASES(0x2C, OVMI_ATOMIC_AND)
+        RMW_CASES(0x33, OVMI_ATOMIC_OR)
+        RMW_CASES(0x3A, OVMI_ATOMIC_XOR)
+        RMW_CASES(0x41, OVMI_ATOMIC_XCHG)
+
+#undef RMW_CASES
+#undef RMW_CASE
+
+#define WAIT_CASE(num, type) \
+        case num : { \
+            int alignment = uleb128_to_uint(ctx->binary.data, &ctx->offset); \
+            int offset    = uleb128_to_uint(ctx->binary.data, &ctx->offset); \
+            ovm_code_builder_add_atomic_wait(&ctx->builder, type, offset); \
+            break; \
+        }
+
+        WAIT_CASE(0x01, OVM_TYPE_I32)
+        WAIT_CASE(0x02, OVM_TYPE_I64)
+
+#undef WAIT_CASE
+
+        case 0x03: {
+            CONSUME_BYTE(ctx);
+            ovm_code_builder_add_atomic_fence(&ctx->builder);
+            break;
+        }
+
         default: assert(("UNHANDLED ATOMIC INSTRUCTION... SORRY :/", 0));
     }
 }
@@ -610,7 +916,7 @@ static void parse_instruction(build_context *ctx) {
             wasm_functype_t *functype = wasm_module_index_functype(ctx->module, func_idx);
             int param_count = functype->type.func.params.size;
 
-            ovm_code_builder_add_call(&ctx->builder, func_idx, param_count, functype->type.func.results.size != 0);
+            ovm_code_builder_add_call(&ctx->builder, func_idx, param_count, functype_return_type(functype));
             break;
         }
 
@@ -621,7 +927,28 @@ static void parse_instruction(build_context *ctx) {
 
             wasm_functype_t *functype = ctx->module->type_section.data[type_idx];
             int param_count = functype->type.func.params.size;
-            ovm_code_builder_add_indirect_call(&ctx->builder, param_count, functype->type.func.results.size != 0);
+            ovm_code_builder_add_indirect_call(&ctx->builder, param_count, functype_return_type(functype));
+            break;
+        }
+
+        case 0x12: {
+            int func_idx = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+
+            wasm_functype_t *functype = wasm_module_index_functype(ctx->module, func_idx);
+            int param_count = functype->type.func.params.size;
+
+            ovm_code_builder_add_tail_call(&ctx->builder, func_idx, param_count, functype_return_type(functype));
+            break;
+        }
+
+        case 0x13: {
+            int type_idx = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            int table_idx = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            assert(table_idx == 0);
+
+            wasm_functype_t *functype = ctx->module->type_section.data[type_idx];
+            int param_count = functype->type.func.params.size;
+            ovm_code_builder_add_indirect_tail_call(&ctx->builder, param_count, functype_return_type(functype));
             break;
         }
 
@@ -899,6 +1226,7 @@ static void parse_instruction(build_context *ctx) {
         case 0xC4: ovm_code_builder_add_unop (&ctx->builder, OVM_TYPED_INSTR(OVMI_CVT_I32_S, OVM_TYPE_I64)); break;
 
         case 0xFC: parse_fc_instruction(ctx); break;
+        case 0xFD: parse_fd_instruction(ctx); break;
         case 0xFE: parse_fe_instruction(ctx); break;
 
         default: assert(("UNHANDLED INSTRUCTION", 0));
@@ -911,48 +1239,263 @@ static void parse_expression(build_context *ctx) {
     }
 }
 
+typedef struct translated_func_t {
+    i32 start_instr;
+    i32 param_count;
+    i32 value_number_count;
+} translated_func_t;
+
+//
+// Translates the body of one function, starting at its local declarations.
+static translated_func_t translate_function(build_context *ctx, int code_idx, i32 func_idx, bh_arr(i32) *static_data_relocs) {
+    unsigned int local_sections_count = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+
+    wasm_functype_t *functype = ctx->module->functypes.data[code_idx];
+    i32 param_count  = functype->type.func.params.size;
+    i32 result_count = functype->type.func.results.size;
+
+    bh_arr(ovm_valtype_t) local_types = NULL;
+    bh_arr_new(bh_heap_allocator(), local_types, param_count);
+    fori (j, 0, param_count) {
+        bh_arr_push(local_types, valkind_to_ovm_type(functype->type.func.params.data[j]->kind));
+    }
+
+    unsigned int total_locals = 0;
+    fori (j, 0, (int) local_sections_count) {
+        unsigned int local_count = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+        wasm_valkind_t valtype = parse_valtype(ctx);
+
+        fori (k, 0, (int) local_count) {
+            bh_arr_push(local_types, valkind_to_ovm_type(valtype));
+        }
+
+        total_locals += local_count;
+    }
+
+    // Set up a lot of stuff...
+
+    debug_info_builder_begin_func(&ctx->debug_builder, func_idx);
+
+    ctx->builder = ovm_code_builder_new(ctx->program, &ctx->debug_builder, param_count, result_count, total_locals, local_types);
+    ctx->builder.func_table_arr_idx = ctx->func_table_arr_idx;
+    ctx->builder.static_data_relocs = static_data_relocs;
+
+    ovm_code_builder_push_label_target(&ctx->builder, label_kind_func);
+    parse_expression(ctx);
+    ovm_code_builder_add_return(&ctx->builder);
+    ovm_code_builder_form_superinstructions(&ctx->builder);
+
+    translated_func_t result;
+    result.start_instr        = ctx->builder.start_instr;
+    result.param_count        = ctx->builder.param_count;
+    result.value_number_count = ctx->builder.highest_value_number + 1;
+
+    ovm_code_builder_free(&ctx->builder);
+    bh_arr_free(local_types);
+    debug_info_builder_end_func(&ctx->debug_builder);
+
+    return result;
+}
+
+//
+// Parallel translation
+//
+// Function bodies only depend on the sections before the code section, so
+// they can be translated independently. The code section is split into
+// chunks of consecutive functions. Each chunk is translated by one of the
+// workers into a private program, and the chunks are appended to the real
+// program in order, so the result is identical to translating serially.
+//
+// Debug info is built from a single stream of ops that follows the
+// instructions in program order, so modules with debug info are still
+// translated serially.
+//
+
+#define CODE_CHUNK_SIZE          64
+#define CODE_SECTION_MAX_THREADS 16
+
+typedef struct code_chunk_t {
+    i32 first_code_idx;
+    i32 code_count;
+
+    // Only the code and static data of this program are used.
+    ovm_program_t program;
+    bh_arr(i32) static_data_relocs;
+
+    translated_func_t *funcs;
+} code_chunk_t;
+
+typedef struct code_section_job_t {
+    build_context *ctx;
+    unsigned int  *body_offsets;
+    i32            first_func_idx;
+
+    code_chunk_t  *chunks;
+    i32            chunk_count;
+    i32            next_chunk;
+} code_section_job_t;
+
+static void *code_section_worker(void *data) {
+    code_section_job_t *job = data;
+
+    while (1) {
+        i32 chunk_idx = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk_idx >= job->chunk_count) break;
+
+        code_chunk_t *chunk = &job->chunks[chunk_idx];
+
+        build_context ctx = *job->ctx;
+        ctx.program = &chunk->program;
+        debug_info_builder_init(&ctx.debug_builder, NULL);
+
+        fori (i, 0, chunk->code_count) {
+            i32 code_idx = chunk->first_code_idx + i;
+            ctx.offset = job->body_offsets[code_idx];
+
+            chunk->funcs[i] = translate_function(&ctx, code_idx, job->first_func_idx + code_idx, &chunk->static_data_relocs);
+        }
+    }
+
+    return NULL;
+}
+
+static void merge_code_chunk(build_context *ctx, code_chunk_t *chunk, i32 first_func_idx) {
+    ovm_program_t *program = ctx->program;
+
+    i32 code_base = bh_arr_length(program->code);
+    i32 data_base = bh_arr_length(program->static_data);
+    i32 ints_base = bh_arr_length(program->static_integers);
+
+    i32 code_count = bh_arr_length(chunk->program.code);
+    bh_arr_insert_end(program->code, code_count);
+    memcpy(&program->code[code_base], chunk->program.code, code_count * sizeof(ovm_instr_t));
+
+    bh_arr_each(i32, reloc, chunk->static_data_relocs) {
+        program->code[code_base + *reloc].a += data_base;
+    }
+
+    i32 ints_count = bh_arr_length(chunk->program.static_integers);
+    bh_arr_insert_end(program->static_integers, ints_count);
+    memcpy(&program->static_integers[ints_base], chunk->program.static_integers, ints_count * sizeof(i32));
+
+    bh_arr_each(ovm_static_integer_array_t, entry, chunk->program.static_data) {
+        ovm_static_integer_array_t relocated = *entry;
+        relocated.start_idx += ints_base;
+        bh_arr_push(program->static_data, relocated);
+    }
+
+    fori (i, 0, chunk->code_count) {
+        i32 func_idx = first_func_idx + chunk->first_code_idx + i;
+        translated_func_t *func = &chunk->funcs[i];
+
+        char *func_name = bh_aprintf(bh_heap_allocator(), "wasm_loaded_%d", func_idx);
+        ovm_program_register_func(program, func_name, code_base + func->start_instr, func->param_count, func->value_number_count);
+    }
+}
+
+static i32 code_section_thread_count(i32 chunk_count) {
+    i32 thread_count = (i32) sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = bh_min(thread_count, CODE_SECTION_MAX_THREADS);
+    thread_count = bh_min(thread_count, chunk_count);
+    return bh_max(thread_count, 1);
+}
+
+static void translate_code_section_parallel(build_context *ctx, unsigned int *body_offsets, i32 code_count) {
+    code_section_job_t job;
+    job.ctx = ctx;
+    job.body_offsets = body_offsets;
+    job.first_func_idx = bh_arr_length(ctx->program->funcs);
+    job.chunk_count = (code_count + CODE_CHUNK_SIZE - 1) / CODE_CHUNK_SIZE;
+    job.next_chunk = 0;
+    job.chunks = bh_alloc_array(bh_heap_allocator(), code_chunk_t, job.chunk_count);
+
+    fori (i, 0, job.chunk_count) {
+        code_chunk_t *chunk = &job.chunks[i];
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->first_code_idx = i * CODE_CHUNK_SIZE;
+        chunk->code_count = bh_min(CODE_CHUNK_SIZE, code_count - chunk->first_code_idx);
+        chunk->funcs = bh_alloc_array(bh_heap_allocator(), translated_func_t, chunk->code_count);
+
+        chunk->program.store = ctx->store;
+        bh_arr_new(bh_heap_allocator(), chunk->program.code, 1024);
+        bh_arr_new(bh_heap_allocator(), chunk->program.static_integers, 16);
+        bh_arr_new(bh_heap_allocator(), chunk->program.static_data, 16);
+        bh_arr_new(bh_heap_allocator(), chunk->static_data_relocs, 16);
+    }
+
+    //
+    // The calling thread works through the chunks as well, so if no
+    // threads can be started, everything is still translated.
+    i32 thread_count = code_section_thread_count(job.chunk_count);
+    pthread_t threads[CODE_SECTION_MAX_THREADS];
+    i32 started = 0;
+    fori (i, 1, thread_count) {
+        if (pthread_create(&threads[started], NULL, code_section_worker, &job)) break;
+        started++;
+    }
+
+    code_section_worker(&job);
+
+    fori (i, 0, started) {
+        pthread_join(threads[i], NULL);
+    }
+
+    fori (i, 0, job.chunk_count) {
+        code_chunk_t *chunk = &job.chunks[i];
+        merge_code_chunk(ctx, chunk, job.first_func_idx);
+
+        bh_arr_free(chunk->program.code);
+        bh_arr_free(chunk->program.static_integers);
+        bh_arr_free(chunk->program.static_data);
+        bh_arr_free(chunk->static_data_relocs);
+        bh_free(bh_heap_allocator(), chunk->funcs);
+    }
+
+    bh_free(bh_heap_allocator(), job.chunks);
+}
+
 static void parse_code_section(build_context *ctx) {
     unsigned int section_size = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+    unsigned int section_start = ctx->offset;
     unsigned int code_count = uleb128_to_uint(ctx->binary.data, &ctx->offset);
     assert(ctx->module->functypes.size == code_count);
 
     ctx->module->memory_init_external_idx = ctx->next_external_func_idx++;
+
+    if (ctx->program_from_image) {
+        // The image already has every function, with memory.init last.
+        ctx->module->memory_init_idx = bh_arr_length(ctx->program->funcs) - 1;
+        ctx->offset = section_start + section_size;
+        return;
+    }
     
     // HACK HACK HACK THIS IS SUCH A BAD WAY OF DOING THIS
     ctx->module->memory_init_idx = bh_arr_length(ctx->program->funcs) + code_count;
 
-    fori (i, 0, (int) code_count) {
-        unsigned int code_size = uleb128_to_uint(ctx->binary.data, &ctx->offset);
-        unsigned int local_sections_count = uleb128_to_uint(ctx->binary.data, &ctx->offset);
-
-        unsigned int total_locals = 0;
-        fori (j, 0, (int) local_sections_count) {
-            unsigned int local_count = uleb128_to_uint(ctx->binary.data, &ctx->offset);
-            wasm_valkind_t valtype = parse_valtype(ctx);
+    bool parallel = ctx->debug_builder.data == NULL && code_count > CODE_CHUNK_SIZE;
 
-            total_locals += local_count;
+    if (parallel) {
+        // Find where every function body starts, so they can be handed out.
+        unsigned int *body_offsets = bh_alloc_array(bh_heap_allocator(), unsigned int, code_count);
+        fori (i, 0, (int) code_count) {
+            unsigned int code_size = uleb128_to_uint(ctx->binary.data, &ctx->offset);
+            body_offsets[i] = ctx->offset;
+            ctx->offset += code_size;
         }
 
-        // Set up a lot of stuff...
-
-        i32 func_idx = bh_arr_length(ctx->program->funcs);
-        i32 param_count  = ctx->module->functypes.data[i]->type.func.params.size;
-        i32 result_count = ctx->module->functypes.data[i]->type.func.results.size;
-
-        debug_info_builder_begin_func(&ctx->debug_builder, func_idx);
+        translate_code_section_parallel(ctx, body_offsets, code_count);
+        bh_free(bh_heap_allocator(), body_offsets);
 
-        ctx->builder = ovm_code_builder_new(ctx->program, &ctx->debug_builder, param_count, result_count, total_locals);
-        ctx->builder.func_table_arr_idx = ctx->func_table_arr_idx;
-
-        ovm_code_builder_push_label_target(&ctx->builder, label_kind_func);
-        parse_expression(ctx);
-        ovm_code_builder_add_return(&ctx->builder);
+    } else {
+        fori (i, 0, (int) code_count) {
+            unsigned int code_size = uleb128_to_uint(ctx->binary.data, &ctx->offset);
 
-        char *func_name = bh_aprintf(bh_heap_allocator(), "wasm_loaded_%d", func_idx);
-        ovm_program_register_func(ctx->program, func_name, ctx->builder.start_instr, ctx->builder.param_count, ctx->builder.highest_value_number + 1);
+            i32 func_idx = bh_arr_length(ctx->program->funcs);
+            translated_func_t func = translate_function(ctx, i, func_idx, NULL);
 
-        ovm_code_builder_free(&ctx->builder);
-        debug_info_builder_end_func(&ctx->debug_builder);
+            char *func_name = bh_aprintf(bh_heap_allocator(), "wasm_loaded_%d", func_idx);
+            ovm_program_register_func(ctx->program, func_name, func.start_instr, func.param_count, func.value_number_count);
+        }
     }
 
     ovm_program_register_external_func(ctx->program, "__internal_wasm_memory_init", 4, ctx->module->memory_init_external_idx);
@@ -23,10 +23,15 @@
     #include <termios.h>
     #include <sys/ioctl.h>
     #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/uio.h>
 #endif
 
 #if defined(_BH_LINUX)
     #include <linux/futex.h>
+    #include <sys/epoll.h>
+    #include <sys/sendfile.h>
+    #include <linux/io_uring.h>
 #endif
 
 #if defined(_BH_DARWIN)
@@ -42,6 +47,7 @@
 #include "src/ort_os.h"
 #include "src/ort_cptr.h"
 #include "src/ort_tty.h"
+#include "src/ort_uring.h"
 
 #if defined(_BH_LINUX) || defined(_BH_DARWIN)
 #include "src/ort_net_linux.h"
@@ -66,6 +72,11 @@ ONYX_LIBRARY {
     ONYX_FUNC(__file_size)
     ONYX_FUNC(__file_get_standard)
     ONYX_FUNC(__file_rename)
+    ONYX_FUNC(__file_read_vectored)
+    ONYX_FUNC(__file_write_vectored)
+    ONYX_FUNC(__file_map)
+    ONYX_FUNC(__file_unmap)
+    ONYX_FUNC(__file_sync_mapped)
     ONYX_FUNC(__poll)
 
     ONYX_FUNC(__dir_open)
@@ -120,6 +131,20 @@ ONYX_LIBRARY {
     ONYX_FUNC(__net_sendto_host)
     ONYX_FUNC(__net_recv)
     ONYX_FUNC(__net_recvfrom)
+    ONYX_FUNC(__net_send_vectored)
+    ONYX_FUNC(__net_recv_vectored)
+    ONYX_FUNC(__net_send_file)
+    ONYX_FUNC(__poller_create)
+    ONYX_FUNC(__poller_close)
+    ONYX_FUNC(__poller_ctl)
+    ONYX_FUNC(__poller_wait)
+
+    ONYX_FUNC(__uring_create)
+    ONYX_FUNC(__uring_destroy)
+    ONYX_FUNC(__uring_register_buffers)
+    ONYX_FUNC(__uring_queue)
+    ONYX_FUNC(__uring_submit)
+    ONYX_FUNC(__uring_reap)
 
     ONYX_FUNC(__cptr_make)
     ONYX_FUNC(__cptr_read)
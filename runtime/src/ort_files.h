@@ -216,3 +216,203 @@ ONYX_DEF(__file_rename, (WASM_I32, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
 #endif
 }
 
+//
+// Vectored I/O
+//
+// These take a slice of slices, which is an array of { data: u32, count: u32 },
+// and read or write all of them with one call. At most ONYX_IOV_MAX buffers are
+// used at once, so fewer bytes than asked for can be read or written.
+//
+
+#define ONYX_IOV_MAX 1024
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+static int onyx_iovecs_from_slices(struct iovec *iovs, u32 slices_addr, u32 slice_count) {
+    u32 *slices = ONYX_PTR(slices_addr);
+    int count = bh_min(slice_count, ONYX_IOV_MAX);
+
+    fori (i, 0, count) {
+        iovs[i].iov_base = ONYX_PTR(slices[2 * i]);
+        iovs[i].iov_len  = slices[2 * i + 1];
+    }
+
+    return count;
+}
+#endif
+
+// (fd: FileData, buffers: [] [] u8, bytes_read: &u64) -> io.Error
+ONYX_DEF(__file_read_vectored, (WASM_I64, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    i64 fd = params->data[0].of.i64;
+    u64 *bytes_read = ONYX_PTR(params->data[3].of.i32);
+    *bytes_read = 0;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    struct iovec iovs[ONYX_IOV_MAX];
+    int count = onyx_iovecs_from_slices(iovs, params->data[1].of.i32, params->data[2].of.i32);
+
+    ssize_t result = readv(fd, iovs, count);
+    if (result < 0) {
+        results->data[0] = WASM_I32_VAL(2);
+        return NULL;
+    }
+
+    *bytes_read = result;
+#endif
+
+#ifdef _BH_WINDOWS
+    bh_file file = { (bh_file_descriptor) fd };
+    u32 *slices = ONYX_PTR(params->data[1].of.i32);
+
+    fori (i, 0, (i32) params->data[2].of.i32) {
+        isize read = 0;
+        if (!bh_file_read_at(&file, bh_file_tell(&file), ONYX_PTR(slices[2 * i]), slices[2 * i + 1], &read)) break;
+
+        bh_file_seek_to(&file, bh_file_tell(&file) + read);
+        *bytes_read += read;
+        if (read < slices[2 * i + 1]) break;
+    }
+#endif
+
+    results->data[0] = WASM_I32_VAL(0);
+    return NULL;
+}
+
+// (fd: FileData, buffers: [] [] u8, bytes_wrote: &u64) -> io.Error
+ONYX_DEF(__file_write_vectored, (WASM_I64, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    i64 fd = params->data[0].of.i64;
+    u64 *bytes_wrote = ONYX_PTR(params->data[3].of.i32);
+    *bytes_wrote = 0;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    struct iovec iovs[ONYX_IOV_MAX];
+    int count = onyx_iovecs_from_slices(iovs, params->data[1].of.i32, params->data[2].of.i32);
+
+    ssize_t result = writev(fd, iovs, count);
+    if (result < 0) {
+        results->data[0] = WASM_I32_VAL(2);
+        return NULL;
+    }
+
+    *bytes_wrote = result;
+#endif
+
+#ifdef _BH_WINDOWS
+    bh_file file = { (bh_file_descriptor) fd };
+    u32 *slices = ONYX_PTR(params->data[1].of.i32);
+
+    fori (i, 0, (i32) params->data[2].of.i32) {
+        isize wrote = 0;
+        if (!bh_file_write_at(&file, bh_file_tell(&file), ONYX_PTR(slices[2 * i]), slices[2 * i + 1], &wrote)) break;
+
+        bh_file_seek_to(&file, bh_file_tell(&file) + wrote);
+        *bytes_wrote += wrote;
+        if (wrote < slices[2 * i + 1]) break;
+    }
+#endif
+
+    results->data[0] = WASM_I32_VAL(0);
+    return NULL;
+}
+
+//
+// Mapping files into linear memory
+//
+// A file is mapped over a range of linear memory that the program has already
+// allocated, so the memory has to be one mapping that never moves. That is only
+// known to be true with OVM, which sets wasm_memory_data_ref. The range and the
+// offset into the file have to be aligned to the page size.
+//
+
+// :EnumDependent  These have to match os.Map_Mode.
+#define ONYX_MAP_READ     1
+#define ONYX_MAP_WRITE    2
+#define ONYX_MAP_PRIVATE  3
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+static bool onyx_memory_range_is_mappable(u32 addr, u32 length) {
+    if (!runtime->wasm_memory_data_ref) return false;
+
+    u64 page_size = sysconf(_SC_PAGESIZE);
+    if (addr == 0 || addr % page_size != 0 || length == 0 || length % page_size != 0) return false;
+
+    return (u64) addr + length <= runtime->wasm_memory_data_size(runtime->wasm_memory);
+}
+#endif
+
+// (path: str, addr: rawptr, length: u32, offset: i64, mode: Map_Mode) -> bool
+ONYX_DEF(__file_map, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I64, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(0);
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    char *path_ptr = ONYX_PTR(params->data[0].of.i32);
+    int   path_len = params->data[1].of.i32;
+
+    char path[512] = {0};
+    path_len = bh_min(path_len, 511);
+    strncpy(path, path_ptr, path_len);
+    path[path_len] = 0;
+
+    u32 addr   = params->data[2].of.i32;
+    u32 length = params->data[3].of.i32;
+    i64 offset = params->data[4].of.i64;
+
+    if (!onyx_memory_range_is_mappable(addr, length)) return NULL;
+    if (offset < 0 || offset % sysconf(_SC_PAGESIZE) != 0) return NULL;
+
+    int open_flags, prot, map_flags;
+    switch (params->data[5].of.i32) {
+        case ONYX_MAP_READ:    open_flags = O_RDONLY; prot = PROT_READ;              map_flags = MAP_SHARED;  break;
+        case ONYX_MAP_WRITE:   open_flags = O_RDWR;   prot = PROT_READ | PROT_WRITE; map_flags = MAP_SHARED;  break;
+        case ONYX_MAP_PRIVATE: open_flags = O_RDONLY; prot = PROT_READ | PROT_WRITE; map_flags = MAP_PRIVATE; break;
+        default: return NULL;
+    }
+
+    int fd = open(path, open_flags | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    // The mapping keeps its own reference to the file.
+    void *result = mmap(ONYX_PTR(addr), length, prot, map_flags | MAP_FIXED, fd, offset);
+    close(fd);
+
+    results->data[0] = WASM_I32_VAL(result != MAP_FAILED);
+#endif
+
+    return NULL;
+}
+
+// (addr: rawptr, length: u32) -> bool
+//
+// Puts zeroed, writable memory back over a mapped range, which is what was
+// there before the file was mapped.
+ONYX_DEF(__file_unmap, (WASM_I32, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(0);
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    u32 addr   = params->data[0].of.i32;
+    u32 length = params->data[1].of.i32;
+    if (!onyx_memory_range_is_mappable(addr, length)) return NULL;
+
+    void *result = mmap(ONYX_PTR(addr), length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+    results->data[0] = WASM_I32_VAL(result != MAP_FAILED);
+#endif
+
+    return NULL;
+}
+
+// (addr: rawptr, length: u32) -> bool
+ONYX_DEF(__file_sync_mapped, (WASM_I32, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(0);
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    u32 addr   = params->data[0].of.i32;
+    u32 length = params->data[1].of.i32;
+    if (!onyx_memory_range_is_mappable(addr, length)) return NULL;
+
+    results->data[0] = WASM_I32_VAL(msync(ONYX_PTR(addr), length, MS_SYNC) == 0);
+#endif
+
+    return NULL;
+}
+
@@ -412,3 +412,178 @@ ONYX_DEF(__net_recvfrom, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32), (WA
 
     return NULL;
 }
+
+// (socket, buffers: [] [] u8) -> i32
+// Like __net_send, but gathers the data from every buffer into one send.
+ONYX_DEF(__net_send_vectored, (WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    struct iovec iovs[ONYX_IOV_MAX];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = onyx_iovecs_from_slices(iovs, params->data[1].of.i32, params->data[2].of.i32);
+
+    int sent = sendmsg(params->data[0].of.i32, &msg, MSG_NOSIGNAL);
+    results->data[0] = WASM_I32_VAL(sent);
+
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            results->data[0] = WASM_I32_VAL(-2);
+        }
+    }
+
+    return NULL;
+}
+
+// (socket, buffers: [] [] u8) -> i32
+// Like __net_recv, but scatters what was received across the buffers, in order.
+ONYX_DEF(__net_recv_vectored, (WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    struct iovec iovs[ONYX_IOV_MAX];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = onyx_iovecs_from_slices(iovs, params->data[1].of.i32, params->data[2].of.i32);
+
+    int received = recvmsg(params->data[0].of.i32, &msg, MSG_NOSIGNAL);
+    results->data[0] = WASM_I32_VAL(received);
+
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            results->data[0] = WASM_I32_VAL(-2);
+        }
+    }
+
+    return NULL;
+}
+
+// (socket, file: FileData, offset: i64, count: u32) -> i32
+// Sends up to `count` bytes of the file, starting at `offset`, without them
+// passing through linear memory. The position of the file is not used or
+// changed. Returns how many bytes were sent, which is 0 at the end of the
+// file, -2 if a non-blocking socket was full, or -1 on any other error.
+ONYX_DEF(__net_send_file, (WASM_I32, WASM_I64, WASM_I64, WASM_I32), (WASM_I32)) {
+    int socket = params->data[0].of.i32;
+    int fd     = params->data[1].of.i64;
+    off_t offset = params->data[2].of.i64;
+    u32 count  = params->data[3].of.i32;
+
+    #if defined(_BH_LINUX)
+    ssize_t sent = sendfile(socket, fd, &offset, count);
+
+    #elif defined(_BH_DARWIN)
+    // Darwin reports how much was sent even when the send stops early.
+    off_t len = count;
+    ssize_t sent = sendfile(fd, socket, offset, &len, NULL, 0);
+    if (len > 0) sent = len;
+    #endif
+
+    results->data[0] = WASM_I32_VAL(sent);
+
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            results->data[0] = WASM_I32_VAL(-2);
+        }
+    }
+
+    return NULL;
+}
+
+//
+// Pollers
+//
+// A poller is a persistent set of sockets that can be waited on. Unlike __poll,
+// the set is kept by the kernel, so waiting costs nothing per idle socket. Only
+// Linux has one (epoll); everywhere else __poller_create fails and the caller
+// falls back to __poll.
+//
+// Each event written out by __poller_wait is 16 bytes:
+//     struct { data: u64; events: u32; _: u32; }
+//
+
+// :EnumDependent  These have to match Socket_Poller_Events.
+#define ONYX_POLLER_READABLE 0x01
+#define ONYX_POLLER_WRITABLE 0x02
+#define ONYX_POLLER_CLOSED   0x04
+
+ONYX_DEF(__poller_create, (), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    results->data[0] = WASM_I32_VAL(epoll_create1(EPOLL_CLOEXEC));
+    #else
+    results->data[0] = WASM_I32_VAL(-1);
+    #endif
+
+    return NULL;
+}
+
+ONYX_DEF(__poller_close, (WASM_I32), ()) {
+    close(params->data[0].of.i32);
+    return NULL;
+}
+
+// (poller, op, socket, interest, data: u64) -> bool
+// op is 1 to add the socket, 2 to change its interest or data, and 3 to remove it.
+ONYX_DEF(__poller_ctl, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I64), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    int op;
+    switch (params->data[1].of.i32) {
+        case 1: op = EPOLL_CTL_ADD; break;
+        case 2: op = EPOLL_CTL_MOD; break;
+        case 3: op = EPOLL_CTL_DEL; break;
+        default:
+            results->data[0] = WASM_I32_VAL(0);
+            return NULL;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if (params->data[3].of.i32 & ONYX_POLLER_READABLE) event.events |= EPOLLIN;
+    if (params->data[3].of.i32 & ONYX_POLLER_WRITABLE) event.events |= EPOLLOUT;
+    event.data.u64 = params->data[4].of.i64;
+
+    int res = epoll_ctl(params->data[0].of.i32, op, params->data[2].of.i32, &event);
+    results->data[0] = WASM_I32_VAL(res == 0);
+    #else
+    results->data[0] = WASM_I32_VAL(0);
+    #endif
+
+    return NULL;
+}
+
+// (poller, events: [] Socket_Poller_Event, timeout) -> i32
+// Returns how many events were written, or -1 if the wait failed.
+ONYX_DEF(__poller_wait, (WASM_I32, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    int max_events = bh_min(params->data[2].of.i32, 1024);
+    if (max_events <= 0) {
+        results->data[0] = WASM_I32_VAL(0);
+        return NULL;
+    }
+
+    struct epoll_event *events = alloca(max_events * sizeof(struct epoll_event));
+
+    int count = epoll_wait(params->data[0].of.i32, events, max_events, params->data[3].of.i32);
+    if (count < 0) {
+        // Being interrupted by a signal is not an error, there just were no events.
+        results->data[0] = WASM_I32_VAL(errno == EINTR ? 0 : -1);
+        return NULL;
+    }
+
+    u8 *out = ONYX_PTR(params->data[1].of.i32);
+    for (int i = 0; i < count; i++) {
+        u32 flags = 0;
+        if (events[i].events & EPOLLIN)  flags |= ONYX_POLLER_READABLE;
+        if (events[i].events & EPOLLOUT) flags |= ONYX_POLLER_WRITABLE;
+        if (events[i].events & (EPOLLHUP | EPOLLERR)) flags |= ONYX_POLLER_CLOSED;
+
+        *(u64 *) (out + 16 * i)     = events[i].data.u64;
+        *(u32 *) (out + 16 * i + 8) = flags;
+    }
+
+    results->data[0] = WASM_I32_VAL(count);
+    #else
+    results->data[0] = WASM_I32_VAL(-1);
+    #endif
+
+    return NULL;
+}
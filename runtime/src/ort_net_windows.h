@@ -87,3 +87,37 @@ ONYX_DEF(__net_recv, (WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
 ONYX_DEF(__net_recvfrom, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
     return NULL;
 }
+
+ONYX_DEF(__net_send_vectored, (WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(-1);
+    return NULL;
+}
+
+ONYX_DEF(__net_recv_vectored, (WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(-1);
+    return NULL;
+}
+
+ONYX_DEF(__net_send_file, (WASM_I32, WASM_I64, WASM_I64, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(-1);
+    return NULL;
+}
+
+ONYX_DEF(__poller_create, (), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(-1);
+    return NULL;
+}
+
+ONYX_DEF(__poller_close, (WASM_I32), ()) {
+    return NULL;
+}
+
+ONYX_DEF(__poller_ctl, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I64), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(0);
+    return NULL;
+}
+
+ONYX_DEF(__poller_wait, (WASM_I32, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
+    results->data[0] = WASM_I32_VAL(-1);
+    return NULL;
+}
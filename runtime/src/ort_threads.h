@@ -2,6 +2,20 @@
 //
 // THREADS
 //
+// Creating a wasm instance is expensive. For OVM it means a new state, new bindings
+// for every function and rerunning the data segment initialization, so threads are
+// not torn down when they finish. Instead, each OS thread keeps its instance and parks
+// itself in a pool, waiting for the next call to __spawn_thread to hand it more work.
+// This works because _thread_start sets up everything a thread needs from scratch,
+// and _thread_exit_deferred leaves nothing behind in the instance.
+//
+// _thread_exit_deferred does not mark the thread as exited. Otherwise, a thread joining
+// it could return and let the program exit while this thread is still running the end
+// of _thread_exit, tearing down the instance under it. Instead, the address of the
+// `alive` flag of the thread is returned, and it is cleared here once the call is done.
+//
+#define THREAD_POOL_MAX_IDLE 32
+
 typedef struct OnyxThread {
     i32 id;
     i32 tls_base;
@@ -11,17 +25,92 @@ typedef struct OnyxThread {
     i32 dataptr;
     wasm_instance_t* instance;
 
+    // Both of these are protected by the thread pool lock.
+    b32 running;
+    b32 killed;
+
     #if defined(_BH_LINUX) || defined(_BH_DARWIN)
         pthread_t thread;
+        pthread_cond_t wake;
     #endif
 
     #ifdef _BH_WINDOWS
         HANDLE thread_handle;
         i32    thread_id;
+        CONDITION_VARIABLE wake;
     #endif
 } OnyxThread;
 
-static bh_arr(OnyxThread) threads = NULL;
+// Every thread that is still alive, whether it is running or parked.
+static bh_arr(OnyxThread *) threads = NULL;
+
+// The threads that are parked, waiting for work.
+static bh_arr(OnyxThread *) idle_threads = NULL;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+static pthread_mutex_t thread_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void thread_pool_lock()   { pthread_mutex_lock(&thread_pool_mutex); }
+static void thread_pool_unlock() { pthread_mutex_unlock(&thread_pool_mutex); }
+static void thread_pool_wait(OnyxThread *thread) { pthread_cond_wait(&thread->wake, &thread_pool_mutex); }
+static void thread_pool_wake(OnyxThread *thread) { pthread_cond_signal(&thread->wake); }
+#endif
+
+#ifdef _BH_WINDOWS
+static SRWLOCK thread_pool_mutex = SRWLOCK_INIT;
+
+static void thread_pool_lock()   { AcquireSRWLockExclusive(&thread_pool_mutex); }
+static void thread_pool_unlock() { ReleaseSRWLockExclusive(&thread_pool_mutex); }
+static void thread_pool_wait(OnyxThread *thread) { SleepConditionVariableSRW(&thread->wake, &thread_pool_mutex, INFINITE, 0); }
+static void thread_pool_wake(OnyxThread *thread) { WakeConditionVariable(&thread->wake); }
+#endif
+
+static void thread_pool_remove(bh_arr(OnyxThread *) *arr, OnyxThread *thread) {
+    fori (i, 0, bh_arr_length(*arr)) {
+        if ((*arr)[i] == thread) {
+            bh_arr_fastdelete(*arr, i);
+            return;
+        }
+    }
+}
+
+//
+// Returns a thread that has finished its work to the pool. Returns false if the
+// thread should exit instead, either because it was killed while finishing up or
+// because there are already enough parked threads. Must hold the lock.
+static b32 thread_pool_release(OnyxThread *thread, b32 reusable) {
+    thread->running = 0;
+
+    if (thread->killed) return 0;
+
+    if (!reusable || bh_arr_length(idle_threads) >= THREAD_POOL_MAX_IDLE) {
+        thread_pool_remove(&threads, thread);
+        return 0;
+    }
+
+    bh_arr_push(idle_threads, thread);
+    return 1;
+}
+
+//
+// Clears the `alive` flag of a thread and wakes anyone joining it.
+static void thread_mark_exited(i32 alive_ptr) {
+    if (alive_ptr == 0) return;
+
+    u8 *alive = (u8 *) ONYX_MEMORY_BASE + (u32) alive_ptr;
+    __atomic_store_n(alive, 0, __ATOMIC_SEQ_CST);
+
+    // Joining threads wait on the aligned word holding the flag.
+    void *word = (void *) ((uintptr_t) alive & ~(uintptr_t) 3);
+
+    #if defined(_BH_LINUX)
+        syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+    #endif
+
+    #ifdef _BH_WINDOWS
+        WakeByAddressAll(word);
+    #endif
+}
 
 #if defined(_BH_LINUX) || defined(_BH_DARWIN)
 static void *onyx_run_thread(void *data) {
@@ -34,54 +123,130 @@ static i32 onyx_run_thread(void *data) {
     wasm_extern_t* start_extern = runtime->wasm_extern_lookup_by_name(runtime->wasm_module, thread->instance, "_thread_start");
     wasm_func_t*   start_func   = runtime->wasm_extern_as_func(start_extern);
 
-    wasm_extern_t* exit_extern = runtime->wasm_extern_lookup_by_name(runtime->wasm_module, thread->instance, "_thread_exit");
+    // Programs built against an older core library only have _thread_exit.
+    b32 exit_deferred = 1;
+    wasm_extern_t* exit_extern = runtime->wasm_extern_lookup_by_name(runtime->wasm_module, thread->instance, "_thread_exit_deferred");
+    if (exit_extern == NULL) {
+        exit_deferred = 0;
+        exit_extern = runtime->wasm_extern_lookup_by_name(runtime->wasm_module, thread->instance, "_thread_exit");
+    }
+
     wasm_func_t*   exit_func   = runtime->wasm_extern_as_func(exit_extern);
 
-    wasm_trap_t* trap=NULL;
-
-    // NOTE: This is cached in a local variable because there is a tiny chance that if a lot of threads are created
-    // then the backing array for the thread handles will move and thread* we have well not be valid. I'm betting on this
-    // not happening before now in the function; however, it *could* happen before we call thread_exit. This would be bad
-    // because of the normal reasons why accessing memory that you don't own any more is bad.
-    i32 thread_id = thread->id;
-
-    { // Call the _thread_start procedure
-        wasm_val_t args[7]    = {
-            WASM_I32_VAL(thread_id),
-            WASM_I32_VAL(thread->tls_base),
-            WASM_I32_VAL(thread->stack_base),
-            WASM_I32_VAL(thread->funcidx),
-            WASM_I32_VAL(thread->closureptr),
-            WASM_I32_VAL(0),
-            WASM_I32_VAL(thread->dataptr)
-        };
-        wasm_val_vec_t results = { 0, 0 };
-        wasm_val_vec_t args_array = WASM_ARRAY_VEC(args);
-
-        trap = runtime->wasm_func_call(start_func, &args_array, &results);
-        if (trap != NULL) {
-            bh_printf("THREAD: %d\n", thread_id);
-            runtime->onyx_print_trap(trap);
+    b32 reusable;
+    do {
+        wasm_trap_t* trap=NULL;
+        i32 thread_id = thread->id;
+
+        { // Call the _thread_start procedure
+            wasm_val_t args[7]    = {
+                WASM_I32_VAL(thread_id),
+                WASM_I32_VAL(thread->tls_base),
+                WASM_I32_VAL(thread->stack_base),
+                WASM_I32_VAL(thread->funcidx),
+                WASM_I32_VAL(thread->closureptr),
+                WASM_I32_VAL(0),
+                WASM_I32_VAL(thread->dataptr)
+            };
+            wasm_val_vec_t results = { 0, 0 };
+            wasm_val_vec_t args_array = WASM_ARRAY_VEC(args);
+
+            trap = runtime->wasm_func_call(start_func, &args_array, &results);
+            if (trap != NULL) {
+                bh_printf("THREAD: %d\n", thread_id);
+                runtime->onyx_print_trap(trap);
+            }
         }
-    }
 
-    { // Call the _thread_exit procedure
-        wasm_val_t args[]    = { WASM_I32_VAL(thread_id) };
-        wasm_val_vec_t results = { 0, 0 };
-        wasm_val_vec_t args_array = WASM_ARRAY_VEC(args);
+        // An instance that trapped could be left in any state, so it is not reused.
+        reusable = trap == NULL;
 
-        trap = runtime->wasm_func_call(exit_func, &args_array, &results);
-    }
+        i32 alive_ptr = 0;
+
+        { // Call the _thread_exit procedure
+            wasm_val_t args[]    = { WASM_I32_VAL(thread_id) };
+            wasm_val_t result[]  = { WASM_I32_VAL(0) };
+            wasm_val_vec_t results = { exit_deferred ? 1 : 0, result };
+            wasm_val_vec_t args_array = WASM_ARRAY_VEC(args);
+
+            trap = runtime->wasm_func_call(exit_func, &args_array, &results);
+            reusable = reusable && exit_deferred && trap == NULL;
+
+            if (exit_deferred && trap == NULL) alive_ptr = result[0].of.i32;
+        }
+
+        //
+        // __kill_thread only cancels threads that are running. Cancelling is turned off
+        // while the thread is parked, so a kill that lands as the thread finishes is seen
+        // through the killed flag, instead of cancelling whatever the thread runs next.
+        #if defined(_BH_LINUX) || defined(_BH_DARWIN)
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        #endif
+
+        thread_pool_lock();
+        reusable = thread_pool_release(thread, reusable);
+        thread_pool_unlock();
+
+        // Once the thread is marked as exited, the program may exit, so the instance
+        // of a thread that is not going back to the pool is deleted first.
+        if (!reusable) {
+            runtime->wasm_instance_delete(thread->instance);
+        }
+
+        thread_mark_exited(alive_ptr);
+
+        if (reusable) {
+            thread_pool_lock();
+            while (!thread->running) {
+                thread_pool_wait(thread);
+            }
+            thread_pool_unlock();
+
+            #if defined(_BH_LINUX) || defined(_BH_DARWIN)
+                pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            #endif
+        }
+    } while (reusable);
+
+    #if defined(_BH_LINUX) || defined(_BH_DARWIN)
+        pthread_cond_destroy(&thread->wake);
+    #endif
 
-    runtime->wasm_instance_delete(thread->instance);
+    #ifdef _BH_WINDOWS
+        CloseHandle(thread->thread_handle);
+    #endif
 
+    bh_free(bh_heap_allocator(), thread);
     return 0;
 }
 
 ONYX_DEF(__spawn_thread, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32), (WASM_I32)) {
-    if (threads == NULL) bh_arr_new(bh_heap_allocator(), threads, 128);
-    bh_arr_insert_end(threads, 1);
-    OnyxThread *thread = &bh_arr_last(threads);
+    thread_pool_lock();
+
+    if (threads == NULL) {
+        bh_arr_new(bh_heap_allocator(), threads, 16);
+        bh_arr_new(bh_heap_allocator(), idle_threads, 16);
+    }
+
+    OnyxThread *thread = NULL;
+    b32 reused = bh_arr_length(idle_threads) > 0;
+    if (reused) {
+        thread = bh_arr_pop(idle_threads);
+
+    } else {
+        // The instance is made without holding the lock, so finishing threads can still park.
+        thread_pool_unlock();
+
+        thread = bh_alloc_item(bh_heap_allocator(), OnyxThread);
+        memset(thread, 0, sizeof(*thread));
+
+        wasm_trap_t* traps = NULL;
+        thread->instance = runtime->wasm_instance_new(runtime->wasm_store, runtime->wasm_module, &runtime->wasm_imports, &traps);
+        assert(thread->instance);
+
+        thread_pool_lock();
+        bh_arr_push(threads, thread);
+    }
 
     thread->id         = params->data[0].of.i32;
     thread->tls_base   = params->data[1].of.i32;
@@ -89,20 +254,30 @@ ONYX_DEF(__spawn_thread, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM
     thread->funcidx    = params->data[3].of.i32;
     thread->closureptr = params->data[4].of.i32;
     thread->dataptr    = params->data[6].of.i32;
+    thread->running    = 1;
 
-    wasm_trap_t* traps = NULL;
-    thread->instance = runtime->wasm_instance_new(runtime->wasm_store, runtime->wasm_module, &runtime->wasm_imports, &traps);
-    assert(thread->instance);
+    if (reused) {
+        thread_pool_wake(thread);
+        thread_pool_unlock();
+
+        results->data[0] = WASM_I32_VAL(1);
+        return NULL;
+    }
 
     #if defined(_BH_LINUX) || defined(_BH_DARWIN)
+        pthread_cond_init(&thread->wake, NULL);
         pthread_create(&thread->thread, NULL, onyx_run_thread, thread);
+        pthread_detach(thread->thread);
     #endif
 
     #ifdef _BH_WINDOWS
+        InitializeConditionVariable(&thread->wake);
         // thread->thread_handle = CreateThread(NULL, 0, onyx_run_thread, thread, 0, &thread->thread_id);
         thread->thread_handle = (HANDLE) _beginthreadex(NULL, 0, onyx_run_thread, thread, 0, &thread->thread_id);
     #endif
 
+    thread_pool_unlock();
+
     results->data[0] = WASM_I32_VAL(1);
     return NULL;
 }
@@ -110,9 +285,13 @@ ONYX_DEF(__spawn_thread, (WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM_I32, WASM
 ONYX_DEF(__kill_thread, (WASM_I32), (WASM_I32)) {
     i32 thread_id = params->data[0].of.i32;
 
-    i32 i = 0;
-    bh_arr_each(OnyxThread, thread, threads) {
-        if (thread->id == thread_id) {
+    thread_pool_lock();
+
+    bh_arr_each(OnyxThread *, it, threads) {
+        OnyxThread *thread = *it;
+        if (thread->id == thread_id && thread->running && !thread->killed) {
+            thread->killed = 1;
+
             #if defined(_BH_LINUX) || defined(_BH_DARWIN)
             // This leads to some weirdness and bugs...
             //
@@ -125,15 +304,16 @@ ONYX_DEF(__kill_thread, (WASM_I32), (WASM_I32)) {
             CloseHandle(thread->thread_handle);
             #endif
 
-            bh_arr_deleten(threads, i, 1);
+            thread_pool_remove(&threads, thread);
+            thread_pool_unlock();
+
             results->data[0] = WASM_I32_VAL(1);
             return NULL;
         }
-
-        i++;
     }
 
+    thread_pool_unlock();
+
     results->data[0] = WASM_I32_VAL(0);
     return NULL;
 }
-
@@ -0,0 +1,360 @@
+
+//
+// Asynchronous I/O
+//
+// A ring is an io_uring instance. Operations are queued into its submission
+// queue in batches, submitted with one call, and their results are normally
+// read out of the completion queue without a system call.
+//
+// Buffers are pointers into linear memory that the kernel reads and writes
+// after the call that queued them has returned. This is only sound because
+// linear memory is never moved once it has been reserved, and the buffers have
+// to stay alive until their operation completes.
+//
+// Only Linux has io_uring; everywhere else __uring_create fails.
+//
+// Each operation given to __uring_queue is 40 bytes:
+//     struct { kind: u32; fd: i32; buffer: [] u8; offset: i64; user_data: u64; fixed_buffer: i32; flags: u32; }
+//
+// Each completion written out by __uring_reap is 16 bytes:
+//     struct { user_data: u64; result: i32; flags: u32; }
+//
+
+#if defined(_BH_LINUX)
+
+typedef struct onyx_uring_t {
+    int fd;
+
+    u8   *sq_ring;
+    u64   sq_ring_size;
+    u32  *sq_head;
+    u32  *sq_tail;
+    u32  *sq_flags;
+    u32   sq_mask;
+    u32  *sq_array;
+    struct io_uring_sqe *sqes;
+    u64   sqes_size;
+
+    // Entries are written past the shared tail, and only become visible to
+    // the kernel when they are submitted.
+    u32   sq_pending_tail;
+
+    u8   *cq_ring;
+    u64   cq_ring_size;
+    u32  *cq_head;
+    u32  *cq_tail;
+    u32   cq_mask;
+    struct io_uring_cqe *cqes;
+
+    bool has_buffers;
+} onyx_uring_t;
+
+static void onyx_uring_free(onyx_uring_t *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED)       munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED
+        && ring->cq_ring != ring->sq_ring)            munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+
+    free(ring);
+}
+
+#endif
+
+// (entries: i32) -> u64
+ONYX_DEF(__uring_create, (WASM_I32), (WASM_I64)) {
+    #if defined(_BH_LINUX)
+    onyx_uring_t *ring = calloc(1, sizeof(*ring));
+
+    struct io_uring_params ring_params;
+    memset(&ring_params, 0, sizeof(ring_params));
+
+    ring->fd = syscall(__NR_io_uring_setup, bh_max(params->data[0].of.i32, 1), &ring_params);
+    if (ring->fd < 0) goto failed;
+
+    ring->sq_ring_size = ring_params.sq_off.array + ring_params.sq_entries * sizeof(u32);
+    ring->cq_ring_size = ring_params.cq_off.cqes + ring_params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels map both rings with one mapping.
+    bool single_mmap = (ring_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        ring->sq_ring_size = bh_max(ring->sq_ring_size, ring->cq_ring_size);
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto failed;
+
+    if (single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) goto failed;
+    }
+
+    ring->sqes_size = ring_params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto failed;
+
+    ring->sq_head  = (u32 *) (ring->sq_ring + ring_params.sq_off.head);
+    ring->sq_tail  = (u32 *) (ring->sq_ring + ring_params.sq_off.tail);
+    ring->sq_flags = (u32 *) (ring->sq_ring + ring_params.sq_off.flags);
+    ring->sq_mask  = *(u32 *) (ring->sq_ring + ring_params.sq_off.ring_mask);
+    ring->sq_array = (u32 *) (ring->sq_ring + ring_params.sq_off.array);
+    ring->sq_pending_tail = *ring->sq_tail;
+
+    ring->cq_head  = (u32 *) (ring->cq_ring + ring_params.cq_off.head);
+    ring->cq_tail  = (u32 *) (ring->cq_ring + ring_params.cq_off.tail);
+    ring->cq_mask  = *(u32 *) (ring->cq_ring + ring_params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *) (ring->cq_ring + ring_params.cq_off.cqes);
+
+    results->data[0] = WASM_I64_VAL((u64) ring);
+    return NULL;
+
+  failed:
+    onyx_uring_free(ring);
+    #endif
+
+    results->data[0] = WASM_I64_VAL(0);
+    return NULL;
+}
+
+ONYX_DEF(__uring_destroy, (WASM_I64), ()) {
+    #if defined(_BH_LINUX)
+    onyx_uring_free((onyx_uring_t *) params->data[0].of.i64);
+    #endif
+
+    return NULL;
+}
+
+// (ring: u64, buffers: [] [] u8) -> bool
+//
+// Registers the buffers that operations can refer to by index. The kernel pins
+// their pages, so they have to be in memory that has already been committed.
+// Registering again replaces the buffers from before.
+ONYX_DEF(__uring_register_buffers, (WASM_I64, WASM_I32, WASM_I32), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    onyx_uring_t *ring = (onyx_uring_t *) params->data[0].of.i64;
+    int count = params->data[2].of.i32;
+
+    if (ring->has_buffers) {
+        syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        ring->has_buffers = false;
+    }
+
+    if (count <= 0) {
+        results->data[0] = WASM_I32_VAL(1);
+        return NULL;
+    }
+
+    struct iovec *iovecs = alloca(count * sizeof(struct iovec));
+    u32 *slices = ONYX_PTR(params->data[1].of.i32);
+    for (int i = 0; i < count; i++) {
+        iovecs[i].iov_base = ONYX_PTR(slices[2 * i]);
+        iovecs[i].iov_len  = slices[2 * i + 1];
+    }
+
+    int res = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, count);
+    ring->has_buffers = res == 0;
+    results->data[0] = WASM_I32_VAL(res == 0);
+    #else
+    results->data[0] = WASM_I32_VAL(0);
+    #endif
+
+    return NULL;
+}
+
+// :EnumDependent  These have to match io.Async_Op_Kind.
+#define ONYX_ASYNC_OP_NOP     0
+#define ONYX_ASYNC_OP_READ    1
+#define ONYX_ASYNC_OP_WRITE   2
+#define ONYX_ASYNC_OP_ACCEPT  3
+#define ONYX_ASYNC_OP_RECV    4
+#define ONYX_ASYNC_OP_SEND    5
+#define ONYX_ASYNC_OP_OPEN    6
+#define ONYX_ASYNC_OP_CLOSE   7
+
+// (ring: u64, ops: [] Async_Op) -> i32
+//
+// Queues as many of the operations as there is room for, and returns how many
+// were queued. Nothing is given to the kernel until __uring_submit.
+ONYX_DEF(__uring_queue, (WASM_I64, WASM_I32, WASM_I32), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    onyx_uring_t *ring = (onyx_uring_t *) params->data[0].of.i64;
+    u8 *ops  = ONYX_PTR(params->data[1].of.i32);
+    int count = params->data[2].of.i32;
+
+    u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    u32 capacity = ring->sq_mask + 1;
+
+    int queued = 0;
+    while (queued < count && ring->sq_pending_tail - head < capacity) {
+        u8 *op = ops + 40 * queued;
+        u32 kind         = *(u32 *) (op + 0);
+        i32 fd           = *(i32 *) (op + 4);
+        u32 buf          = *(u32 *) (op + 8);
+        u32 len          = *(u32 *) (op + 12);
+        i64 offset       = *(i64 *) (op + 16);
+        u64 user_data    = *(u64 *) (op + 24);
+        i32 fixed_buffer = *(i32 *) (op + 32);
+        u32 flags        = *(u32 *) (op + 36);
+
+        u32 index = ring->sq_pending_tail & ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+
+        sqe->fd        = fd;
+        sqe->user_data = user_data;
+
+        switch (kind) {
+            case ONYX_ASYNC_OP_NOP:
+                sqe->opcode = IORING_OP_NOP;
+                break;
+
+            case ONYX_ASYNC_OP_READ:
+            case ONYX_ASYNC_OP_WRITE:
+                sqe->addr = (u64) ONYX_PTR(buf);
+                sqe->len  = len;
+                sqe->off  = (u64) offset;
+
+                if (fixed_buffer >= 0) {
+                    sqe->opcode    = kind == ONYX_ASYNC_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                    sqe->buf_index = fixed_buffer;
+                } else {
+                    sqe->opcode    = kind == ONYX_ASYNC_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+                }
+                break;
+
+            case ONYX_ASYNC_OP_ACCEPT:
+                // The address of the peer is not reported.
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->accept_flags = SOCK_CLOEXEC;
+                break;
+
+            case ONYX_ASYNC_OP_RECV:
+            case ONYX_ASYNC_OP_SEND:
+                sqe->opcode   = kind == ONYX_ASYNC_OP_RECV ? IORING_OP_RECV : IORING_OP_SEND;
+                sqe->addr     = (u64) ONYX_PTR(buf);
+                sqe->len      = len;
+                sqe->msg_flags = MSG_NOSIGNAL;
+                break;
+
+            case ONYX_ASYNC_OP_OPEN: {
+                // The path has to end with a zero.
+                // :EnumDependent  The flags are an os.OpenMode.
+                int open_flags = O_CLOEXEC;
+                switch (flags) {
+                    case 1: open_flags |= O_RDONLY; break;
+                    case 2: open_flags |= O_WRONLY | O_CREAT | O_TRUNC; break;
+                    case 3: open_flags |= O_WRONLY | O_CREAT | O_APPEND; break;
+                }
+
+                sqe->opcode     = IORING_OP_OPENAT;
+                sqe->fd         = fd < 0 ? AT_FDCWD : fd;
+                sqe->addr       = (u64) ONYX_PTR(buf);
+                sqe->len        = 0644;
+                sqe->open_flags = open_flags;
+                break;
+            }
+
+            case ONYX_ASYNC_OP_CLOSE:
+                sqe->opcode = IORING_OP_CLOSE;
+                break;
+
+            default:
+                // Unknown operations do nothing, and complete straight away.
+                sqe->opcode = IORING_OP_NOP;
+                break;
+        }
+
+        ring->sq_array[index] = index;
+        ring->sq_pending_tail += 1;
+        queued += 1;
+    }
+
+    results->data[0] = WASM_I32_VAL(queued);
+    #else
+    results->data[0] = WASM_I32_VAL(0);
+    #endif
+
+    return NULL;
+}
+
+// (ring: u64, wait_for: i32) -> i32
+//
+// Gives every queued operation to the kernel, and then waits until at least
+// `wait_for` operations have completed. Returns how many operations were
+// submitted, or a negative errno.
+ONYX_DEF(__uring_submit, (WASM_I64, WASM_I32), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    onyx_uring_t *ring = (onyx_uring_t *) params->data[0].of.i64;
+    u32 wait_for = bh_max(params->data[1].of.i32, 0);
+
+    u32 to_submit = ring->sq_pending_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sq_pending_tail, __ATOMIC_RELEASE);
+
+    if (to_submit == 0 && wait_for == 0) {
+        results->data[0] = WASM_I32_VAL(0);
+        return NULL;
+    }
+
+    u32 flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    int res;
+    do {
+        res = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_for, flags, NULL, 0);
+    } while (res < 0 && errno == EINTR && to_submit == 0);
+
+    results->data[0] = WASM_I32_VAL(res < 0 ? -errno : res);
+    #else
+    results->data[0] = WASM_I32_VAL(-1);
+    #endif
+
+    return NULL;
+}
+
+// (ring: u64, out: [] Async_Completion) -> i32
+//
+// Takes completions off the ring without waiting, and returns how many were
+// written to `out`.
+ONYX_DEF(__uring_reap, (WASM_I64, WASM_I32, WASM_I32), (WASM_I32)) {
+    #if defined(_BH_LINUX)
+    onyx_uring_t *ring = (onyx_uring_t *) params->data[0].of.i64;
+    u8 *out = ONYX_PTR(params->data[1].of.i32);
+    int max_count = params->data[2].of.i32;
+
+    int count = 0;
+    while (count < max_count) {
+        u32 head = *ring->cq_head;
+        u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail && count < max_count) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+
+            *(u64 *) (out + 16 * count)      = cqe->user_data;
+            *(i32 *) (out + 16 * count + 8)  = cqe->res;
+            *(u32 *) (out + 16 * count + 12) = cqe->flags;
+
+            head  += 1;
+            count += 1;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        //
+        // Completions that did not fit in the completion queue are held by the
+        // kernel until it is asked for events, which moves them into the queue.
+        if (!(__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) break;
+        syscall(__NR_io_uring_enter, ring->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+
+    results->data[0] = WASM_I32_VAL(count);
+    #else
+    results->data[0] = WASM_I32_VAL(0);
+    #endif
+
+    return NULL;
+}
@@ -44,6 +44,19 @@ typedef struct OnyxRuntime {
     void (*wasm_instance_delete)(wasm_instance_t *instance);
 
     wasm_store_t *wasm_store;
+
+    size_t (*wasm_memory_data_size)(const wasm_memory_t *wasm_memory);
+
+    //
+    // New fields go below this point, and every new field bumps ONYX_LIBRARY_ABI_VERSION.
+    // A library built against a newer header than the runtime would read past the end
+    // of this struct, so the runtime refuses to load it.
+    //
+
+    // This is only set when using the OVMwasm runtime. It points at the base address
+    // of the memory, which stays current when the memory moves, so ONYX_PTR does not
+    // need to call wasm_memory_data every time.
+    char **wasm_memory_data_ref;
 } OnyxRuntime;
 
 OnyxRuntime* runtime;
@@ -62,13 +75,53 @@ typedef struct WasmFuncDefinition {
     WasmValkindBuffer *results;
 } WasmFuncDefinition;
 
+//
+// Raw calls
+//
+// The body of every ONYX_DEF takes its parameters as untagged 8-byte values,
+// which is how OVM stores them. OVM calls the body directly, without building a
+// wasm_val_t for every parameter first. Other runtimes call the `func` of the
+// definition, which copies the parameters out of the wasm_val_t's.
+//
+// Libraries built with raw calls say so with the ONYX_RAW_CALLS_NAME_GEN symbol,
+// so the runtime knows that their definitions are OnyxRawFuncDefinitions. The value
+// of the symbol is the ONYX_LIBRARY_ABI_VERSION of the header the library was built
+// against; the runtime rejects libraries whose version does not match its own.
+// Libraries without the symbol predate raw calls and only use the original fields
+// of OnyxRuntime, so they are still loaded.
+//
+typedef struct OnyxRawVal {
+    union {
+        int32_t i32;
+        int64_t i64;
+        float32_t f32;
+        float64_t f64;
+    } of;
+} OnyxRawVal;
+
+typedef struct OnyxRawValVec {
+    size_t size;
+    OnyxRawVal *data;
+} OnyxRawValVec;
+
+typedef wasm_trap_t* (*OnyxRawFuncCallback)(const OnyxRawValVec* params, wasm_val_vec_t* results);
+
+typedef struct OnyxRawFuncDefinition {
+    WasmFuncDefinition base;
+    OnyxRawFuncCallback raw_func;
+} OnyxRawFuncDefinition;
+
+#define ONYX_LIBRARY_ABI_VERSION 2
+
 #define STRINGIFY1(a) #a
 #define STRINGIFY2(a) STRINGIFY1(a)
 #define CONCAT2(a, b) a ## _ ## b
 #define CONCAT3(a, b, c) a ## _ ## b ## _ ## c
 #define ONYX_MODULE_NAME_GEN(m) CONCAT2(__onyx_library, m)
 #define ONYX_LINK_NAME_GEN(m) CONCAT2(onyx_library, m)
+#define ONYX_RAW_CALLS_NAME_GEN(m) CONCAT2(onyx_library_raw_calls, m)
 #define ONYX_FUNC_NAME(m, n) CONCAT3(__onyx_internal, m, n)
+#define ONYX_RAW_FUNC_NAME(m, n) CONCAT3(__onyx_internal_raw, m, n)
 #define ONYX_DEF_NAME(m, n) CONCAT3(__onyx_internal_def, m, n)
 #define ONYX_PARAM_NAME(m, n) CONCAT3(__onyx_internal_param_buffer, m, n)
 #define ONYX_RESULT_NAME(m, n) CONCAT3(__onyx_internal_result_buffer, m, n)
@@ -78,20 +131,27 @@ typedef struct WasmFuncDefinition {
 #define _VALS(...) { NUM_VALS(__VA_ARGS__) - 1, __VA_ARGS__ }
 
 #define ONYX_DEF(name, params_types, result_types) \
-    static wasm_trap_t* ONYX_FUNC_NAME(ONYX_LIBRARY_NAME, name)(const wasm_val_vec_t* params, wasm_val_vec_t* results); \
+    static wasm_trap_t* ONYX_RAW_FUNC_NAME(ONYX_LIBRARY_NAME, name)(const OnyxRawValVec* params, wasm_val_vec_t* results); \
+    static wasm_trap_t* ONYX_FUNC_NAME(ONYX_LIBRARY_NAME, name)(const wasm_val_vec_t* params, wasm_val_vec_t* results) { \
+        OnyxRawVal raw_params[NUM_VALS params_types]; \
+        for (size_t i = 0; i < params->size; i++) raw_params[i].of.i64 = params->data[i].of.i64; \
+        OnyxRawValVec raw_params_vec = { params->size, raw_params }; \
+        return ONYX_RAW_FUNC_NAME(ONYX_LIBRARY_NAME, name)(&raw_params_vec, results); \
+    } \
     static struct WasmValkindBuffer  ONYX_PARAM_NAME(ONYX_LIBRARY_NAME, name) = _VALS params_types; \
     static struct WasmValkindBuffer  ONYX_RESULT_NAME(ONYX_LIBRARY_NAME, name) = _VALS result_types; \
-    static struct WasmFuncDefinition ONYX_DEF_NAME(ONYX_LIBRARY_NAME, name) = { STRINGIFY2(ONYX_LIBRARY_NAME), #name, ONYX_FUNC_NAME(ONYX_LIBRARY_NAME, name), & ONYX_PARAM_NAME(ONYX_LIBRARY_NAME, name), & ONYX_RESULT_NAME(ONYX_LIBRARY_NAME, name) }; \
+    static struct OnyxRawFuncDefinition ONYX_DEF_NAME(ONYX_LIBRARY_NAME, name) = { { STRINGIFY2(ONYX_LIBRARY_NAME), #name, ONYX_FUNC_NAME(ONYX_LIBRARY_NAME, name), & ONYX_PARAM_NAME(ONYX_LIBRARY_NAME, name), & ONYX_RESULT_NAME(ONYX_LIBRARY_NAME, name) }, ONYX_RAW_FUNC_NAME(ONYX_LIBRARY_NAME, name) }; \
     \
-    static wasm_trap_t* ONYX_FUNC_NAME(ONYX_LIBRARY_NAME, name)(const wasm_val_vec_t* params, wasm_val_vec_t* results)
+    static wasm_trap_t* ONYX_RAW_FUNC_NAME(ONYX_LIBRARY_NAME, name)(const OnyxRawValVec* params, wasm_val_vec_t* results)
 
-#define ONYX_FUNC(name) & ONYX_DEF_NAME(ONYX_LIBRARY_NAME, name),
+#define ONYX_FUNC(name) & ONYX_DEF_NAME(ONYX_LIBRARY_NAME, name).base,
 #define ONYX_LIBRARY \
     extern struct WasmFuncDefinition *ONYX_MODULE_NAME_GEN(ONYX_LIBRARY_NAME)[]; \
     ONYX_EXPORT WasmFuncDefinition** ONYX_LINK_NAME_GEN(ONYX_LIBRARY_NAME)(OnyxRuntime* in_runtime) { \
         runtime = in_runtime; \
         return ONYX_MODULE_NAME_GEN(ONYX_LIBRARY_NAME); \
     } \
+    ONYX_EXPORT int ONYX_RAW_CALLS_NAME_GEN(ONYX_LIBRARY_NAME) = ONYX_LIBRARY_ABI_VERSION; \
     struct WasmFuncDefinition *ONYX_MODULE_NAME_GEN(ONYX_LIBRARY_NAME)[] =
 
 #define WASM_PTR WASM_I32
@@ -111,8 +171,9 @@ typedef struct WasmFuncDefinition {
 #define PTR WASM_PTR
 #endif
 
-#define ONYX_PTR(p) ((void*) (p != 0 ? (runtime->wasm_memory_data(runtime->wasm_memory) + p) : NULL))
-#define ONYX_UNPTR(p) ((int) (p != NULL ? ((char *) p - runtime->wasm_memory_data(runtime->wasm_memory)) : 0))
+#define ONYX_MEMORY_BASE (runtime->wasm_memory_data_ref ? *runtime->wasm_memory_data_ref : runtime->wasm_memory_data(runtime->wasm_memory))
+#define ONYX_PTR(p) ((void*) (p != 0 ? (ONYX_MEMORY_BASE + p) : NULL))
+#define ONYX_UNPTR(p) ((int) (p != NULL ? ((char *) p - ONYX_MEMORY_BASE) : 0))
 
 
 //